@@ -0,0 +1,448 @@
+/**
+ * @file
+ * @brief Load generator of the NNG server, keeps N requests outstanding
+ *        with a mix of request types at a target rate and reports the
+ *        throughput and the latency percentiles of each type as JSON
+ * @ccmod{MBIM_X_MMG}
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "databuf.h"
+#include "modem.h"
+#include "nng_client.h"
+#include "nng_server.h"
+#include "sim.h"
+#include "trace.h"
+
+#define LOAD_URL "ipc:///tmp/mbim_nng_bench.socket"
+#define LOAD_CONTEXTS 16
+#define LOAD_DURATION_S 5
+#define LOAD_WORKERS 8
+#define LOAD_DELAY_MS 1
+#define LOAD_MIX "signal:4,register:2,pin_status:1,full_status:1"
+
+static const char *g_type_names[MBIM_UNKOWN] = {
+    [MBIM_PIN_STATUS] = "pin_status",
+    [MBIM_PIN_ENTER] = "pin_enter",
+    [MBIM_SUBSCRIBER] = "subscriber",
+    [MBIM_REGISTER] = "register",
+    [MBIM_ATTACH] = "attach",
+    [MBIM_CONNECT] = "connect",
+    [MBIM_IP] = "ip",
+    [MBIM_STATUS] = "status",
+    [MBIM_DEVICE_CAPS] = "device_caps",
+    [MBIM_PACKET_SERVICE] = "packet_service",
+    [MBIM_SIGNAL] = "signal",
+    [MBIM_FULL_STATUS] = "full_status",
+    [MBIM_DICTIONARY] = "dictionary",
+};
+
+// Latencies of one request type measured by one context
+typedef struct load_samples
+{
+    uint32_t *us;
+    size_t nb;
+    size_t max;
+    size_t errors;
+} Load_samples;
+
+typedef struct load_context
+{
+    pthread_t thread;
+    Req_client *client;
+    int index;
+    uint64_t start_us;
+    uint64_t end_us;
+    double interval_us;          // Between two requests of the context, 0 without target rate
+    uint32_t seed;
+    Load_samples samples[MBIM_UNKOWN];
+} Load_context;
+
+static unsigned int g_weights[MBIM_UNKOWN];
+static unsigned int g_total_weight;
+static int g_nb_contexts;
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void sleep_until_us(uint64_t deadline)
+{
+    uint64_t now = now_us();
+    struct timespec ts;
+
+    if (deadline <= now)
+        return;
+
+    ts.tv_sec = (deadline - now) / 1000000;
+    ts.tv_nsec = ((deadline - now) % 1000000) * 1000;
+    nanosleep(&ts, NULL);
+}
+
+/**
+ * Parse the request mix, a list of name:weight, for example "signal:4,register:1".
+ *
+ * @return True on success, otherwise false
+ */
+static bool parse_mix(const char *mix)
+{
+    char name[32];
+    unsigned int weight;
+    int len;
+    int i;
+
+    memset(g_weights, 0, sizeof(g_weights));
+    g_total_weight = 0;
+
+    while (*mix)
+    {
+        if (sscanf(mix, "%31[^:]:%u%n", name, &weight, &len) != 2)
+            return false;
+
+        for (i = 0; i < MBIM_UNKOWN; i++)
+        {
+            if (strcmp(name, g_type_names[i]) == 0)
+                break;
+        }
+
+        if (i == MBIM_UNKOWN)
+        {
+            printf("Unknown request type %s\n", name);
+            return false;
+        }
+
+        g_weights[i] += weight;
+        g_total_weight += weight;
+
+        mix += len;
+        if (*mix == ',')
+            mix++;
+    }
+
+    return g_total_weight > 0;
+}
+
+/**
+ * Pick a request type of the mix.
+ */
+static Mbim_req_type pick_type(Load_context *context)
+{
+    unsigned int pick;
+    int i;
+
+    // xorshift32
+    context->seed ^= context->seed << 13;
+    context->seed ^= context->seed >> 17;
+    context->seed ^= context->seed << 5;
+
+    pick = context->seed % g_total_weight;
+    for (i = 0; i < MBIM_UNKOWN - 1; i++)
+    {
+        if (pick < g_weights[i])
+            break;
+        pick -= g_weights[i];
+    }
+
+    return i;
+}
+
+static void add_sample(Load_samples *samples, uint64_t latency_us)
+{
+    uint32_t *us;
+
+    if (samples->nb == samples->max)
+    {
+        us = realloc(samples->us, (samples->max * 2 + 1024) * sizeof(*us));
+        if (!us)
+            return;
+
+        samples->us = us;
+        samples->max = samples->max * 2 + 1024;
+    }
+
+    samples->us[samples->nb++] = latency_us > UINT32_MAX ? UINT32_MAX : latency_us;
+}
+
+/**
+ * One outstanding request at a time on its own context of the shared
+ * socket. With a target rate, the latency is measured from the time the
+ * request was due, so a slow server is not hidden by late sends.
+ */
+static void *load_thread(void *arg)
+{
+    Load_context *context = arg;
+    uint64_t due = context->start_us + context->interval_us * context->index / g_nb_contexts;
+    uint64_t sent;
+    unsigned int status;
+    Mbim_req_type type;
+    Databuf request;
+    Databuf response;
+    Req_call *call;
+    int ret;
+
+    while ((sent = now_us()) < context->end_us)
+    {
+        if (context->interval_us > 0)
+        {
+            sleep_until_us(due);
+            sent = due;
+            due += context->interval_us;
+        }
+
+        type = pick_type(context);
+
+        databuf_init_msg(&request);
+        mb_add_request(&request, type);
+        call = req_client_call(context->client, &request, NNG_DURATION_DEFAULT);
+        databuf_free(&request);
+
+        if (!call)
+        {
+            context->samples[type].errors++;
+            continue;
+        }
+
+        memset(&response, 0, sizeof(response));
+        status = MBIM_ERROR;
+        ret = req_call_wait(call, &response);
+        if (ret == 0)
+            mb_get_response(&response, &status);
+
+        if (status != MBIM_OK)
+            context->samples[type].errors++;
+        else
+            add_sample(&context->samples[type], now_us() - sent);
+
+        databuf_free(&response);
+    }
+
+    return NULL;
+}
+
+static int compare_us(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *) a;
+    uint32_t y = *(const uint32_t *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+// Nearest rank of a sorted set
+static uint32_t percentile(const Load_samples *samples, double p)
+{
+    size_t rank;
+
+    if (!samples->nb)
+        return 0;
+
+    rank = (size_t) (p * samples->nb + 0.999999);
+    if (rank < 1)
+        rank = 1;
+
+    return samples->us[rank - 1];
+}
+
+/**
+ * Merge the samples of the contexts and print the report.
+ */
+static void report(Load_context *contexts, double elapsed_s, double rate)
+{
+    Load_samples all[MBIM_UNKOWN] = {0};
+    size_t requests = 0;
+    size_t errors = 0;
+    bool first = true;
+    int i;
+    int t;
+
+    for (t = 0; t < MBIM_UNKOWN; t++)
+    {
+        for (i = 0; i < g_nb_contexts; i++)
+        {
+            Load_samples *samples = &contexts[i].samples[t];
+            size_t j;
+
+            for (j = 0; j < samples->nb; j++)
+                add_sample(&all[t], samples->us[j]);
+            all[t].errors += samples->errors;
+        }
+
+        if (all[t].nb)
+            qsort(all[t].us, all[t].nb, sizeof(*all[t].us), compare_us);
+        requests += all[t].nb + all[t].errors;
+        errors += all[t].errors;
+    }
+
+    printf("{\"duration_s\": %.3f, \"contexts\": %d, \"target_rate\": %.1f, \"requests\": %zu, "
+           "\"errors\": %zu, \"throughput\": %.1f, \"types\": {",
+           elapsed_s, g_nb_contexts, rate, requests, errors, (requests - errors) / elapsed_s);
+
+    for (t = 0; t < MBIM_UNKOWN; t++)
+    {
+        if (!g_weights[t])
+            continue;
+
+        printf("%s\n  \"%s\": {\"count\": %zu, \"errors\": %zu, \"p50_us\": %u, \"p90_us\": %u, "
+               "\"p99_us\": %u, \"p999_us\": %u, \"max_us\": %u}",
+               first ? "" : ",", g_type_names[t], all[t].nb, all[t].errors, percentile(&all[t], 0.5),
+               percentile(&all[t], 0.9), percentile(&all[t], 0.99), percentile(&all[t], 0.999),
+               percentile(&all[t], 1.0));
+        first = false;
+        free(all[t].us);
+    }
+
+    printf("\n}}\n");
+}
+
+static void usage(const char *name)
+{
+    printf("Usage: %s [-u url] [-c contexts] [-r rate] [-d seconds] [-m mix] [-l delay_ms] [-s config] [-t trace]\n"
+           "          [-T scale] [-w workers]\n"
+           "  -u  Server to load, an in-process server on the simulated modem without\n"
+           "  -c  Requests outstanding together (%d)\n"
+           "  -r  Target requests per second, 0 sends as fast as possible (0)\n"
+           "  -d  Duration in seconds (%d)\n"
+           "  -m  Request mix, name:weight,... (%s)\n"
+           "  -l  Latency of the simulated modem in ms (%d)\n"
+           "  -s  Configuration of the simulated modem, see sim_configure_line()\n"
+           "  -t  Trace of mbim_nng record replayed instead of the simulated modem\n"
+           "  -T  Factor of the trace timing, 0 answers at once (1)\n"
+           "  -w  Workers of the in-process server (%d)\n",
+           name, LOAD_CONTEXTS, LOAD_DURATION_S, LOAD_MIX, LOAD_DELAY_MS, LOAD_WORKERS);
+}
+
+int main(int argc, char *argv[])
+{
+    Rep_server server = {0};
+    Load_context *contexts;
+    Req_client *client;
+    const char *url = NULL;
+    const char *mix = LOAD_MIX;
+    const char *config = NULL;
+    const char *trace = NULL;
+    double scale = 1;
+    char line[64];
+    double rate = 0;
+    int duration = LOAD_DURATION_S;
+    int delay = LOAD_DELAY_MS;
+    int workers = LOAD_WORKERS;
+    uint64_t start;
+    uint64_t end;
+    int opt;
+    int i;
+
+    g_nb_contexts = LOAD_CONTEXTS;
+
+    while ((opt = getopt(argc, argv, "u:c:r:d:m:l:s:t:T:w:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'u': url = optarg; break;
+        case 'c': g_nb_contexts = atoi(optarg); break;
+        case 'r': rate = atof(optarg); break;
+        case 'd': duration = atoi(optarg); break;
+        case 'm': mix = optarg; break;
+        case 'l': delay = atoi(optarg); break;
+        case 's': config = optarg; break;
+        case 't': trace = optarg; break;
+        case 'T': scale = atof(optarg); break;
+        case 'w': workers = atoi(optarg); break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (g_nb_contexts <= 0 || duration <= 0 || rate < 0 || !parse_mix(mix))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (!url)
+    {
+        url = LOAD_URL;
+
+        if (trace)
+        {
+            if (!trace_replay(trace, scale))
+                return 1;
+
+            modem_set_backend(MB_PROT_MBIM, &replay_backend);
+            modem_set_backend(MB_PROT_QMI, &replay_backend);
+        }
+        else
+        {
+            // The configuration file may override the latency of -l
+            snprintf(line, sizeof(line), "latency default fixed %d", delay);
+            if (!sim_configure_line(line) || (config && !sim_configure(config)))
+                return 1;
+
+            modem_set_backend(MB_PROT_MBIM, &sim_backend);
+            modem_set_backend(MB_PROT_QMI, &sim_backend);
+        }
+
+        if (!databuf_pool_init() || !cache_init() || !modem_start())
+            return 1;
+
+        if (!rep_server_open(&server.sock, url) || !rep_server_start(&server, workers))
+        {
+            modem_stop();
+            return 1;
+        }
+    }
+
+    client = req_client_open(url, false);
+    contexts = calloc(g_nb_contexts, sizeof(*contexts));
+    if (!client || !contexts)
+        return 1;
+
+    start = now_us();
+    end = start + (uint64_t) duration * 1000000;
+    for (i = 0; i < g_nb_contexts; i++)
+    {
+        contexts[i].client = client;
+        contexts[i].index = i;
+        contexts[i].start_us = start;
+        contexts[i].end_us = end;
+        contexts[i].interval_us = rate > 0 ? g_nb_contexts * 1e6 / rate : 0;
+        contexts[i].seed = 2463534242u + i;
+        pthread_create(&contexts[i].thread, NULL, load_thread, &contexts[i]);
+    }
+
+    for (i = 0; i < g_nb_contexts; i++)
+        pthread_join(contexts[i].thread, NULL);
+
+    report(contexts, (now_us() - start) / 1e6, rate);
+
+    req_client_close(client);
+
+    if (server.workers)
+    {
+        modem_cancel();
+        rep_server_stop(&server);
+        modem_stop();
+        trace_stop();
+        cache_free();
+        databuf_pool_free();
+    }
+
+    for (i = 0; i < g_nb_contexts; i++)
+    {
+        for (int t = 0; t < MBIM_UNKOWN; t++)
+            free(contexts[i].samples[t].us);
+    }
+    free(contexts);
+
+    return 0;
+}
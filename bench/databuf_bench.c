@@ -0,0 +1,279 @@
+/**
+ * @file
+ * @brief Databuf micro-benchmarks, decode with a linear scan against the index
+ *        and the iterator, and misses of the buffer pool
+ * @ccmod{MBIM_X_MMG}
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "databuf.h"
+#include "mbim_enum.h"
+
+#define BENCH_ITERATIONS 2000
+
+static const unsigned int g_caps_strings[] = {
+    MB_DEV_TYPE, MB_DEV_CELL_CLASS, MB_DEV_VOICE_CLASS, MB_DEV_SIM_CLASS, MB_DEV_DATA_CLASS, MB_DEV_SMS_CAPS,
+    MB_DEV_CTRL_CAPS, MB_DEV_CUST_DATA_CLASS, MB_DEV_ID, MB_DEV_FMW_INFO, MB_DEV_HW_INFO,
+};
+
+static double now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/**
+ * Build a MBIM_DEVICE_CAPS like section followed by nb_addr IPv6 addresses
+ */
+static void build_section(Databuf *section, int nb_addr)
+{
+    char addr[64];
+    size_t i;
+    int n;
+
+    databuf_init(section);
+    databuf_add_string(section, MB_DEVICE, "/dev/cdc-wdm0");
+    for (i = 0; i < sizeof(g_caps_strings) / sizeof(g_caps_strings[0]); i++)
+        databuf_add_string(section, g_caps_strings[i], "value");
+    databuf_add_uint(section, MB_DEV_MAX_SESSION, 8);
+
+    databuf_add_uint(section, MB_IPV6_NB, nb_addr);
+    for (n = 0; n < nb_addr; n++)
+    {
+        snprintf(addr, sizeof(addr), "2001:db8::%x/64", (unsigned int) n);
+        databuf_add_string(section, MB_IPV6_ADDR, addr);
+    }
+
+    databuf_add_uint(section, MB_REQUEST, MBIM_DEVICE_CAPS);
+    databuf_add_uint(section, MB_RESPONSE, MBIM_OK);
+}
+
+/**
+ * Build a batch response of nb_sections sections
+ */
+static void build_response(Databuf *resp, int nb_sections, int nb_addr)
+{
+    Databuf section = {0};
+    int i;
+
+    databuf_init(resp);
+    build_section(&section, nb_addr);
+    for (i = 0; i < nb_sections; i++)
+        databuf_add_databuf(resp, MB_BATCH_RESPONSE, &section);
+    databuf_add_uint(resp, MB_RESPONSE, MBIM_OK);
+    databuf_free(&section);
+}
+
+/**
+ * Read every field of every section, the way a client decodes a response
+ *
+ * @return Number of fields read
+ */
+static unsigned int decode(Databuf *resp, bool indexed)
+{
+    Databuf section = {0};
+    unsigned char *prev = NULL;
+    unsigned char *addr;
+    unsigned int value;
+    unsigned int count = 0;
+    size_t i;
+
+    if (indexed)
+        databuf_index(resp);
+
+    databuf_get_uint(resp, MB_RESPONSE, &value);
+    while ((prev = (unsigned char *) databuf_get_next_databuf(resp, MB_BATCH_RESPONSE, &section, prev)) != NULL)
+    {
+        if (indexed)
+            databuf_index(&section);
+
+        count += databuf_get_uint(&section, MB_RESPONSE, &value) != NULL;
+        count += databuf_get_uint(&section, MB_REQUEST, &value) != NULL;
+        count += databuf_get_uint(&section, MB_DEV_MAX_SESSION, &value) != NULL;
+        for (i = 0; i < sizeof(g_caps_strings) / sizeof(g_caps_strings[0]); i++)
+            count += databuf_get_string(&section, g_caps_strings[i]) != NULL;
+
+        addr = NULL;
+        while ((addr = (unsigned char *) databuf_get_next_string(&section, MB_IPV6_ADDR, addr)) != NULL)
+            count++;
+
+        databuf_unindex(&section);
+    }
+
+    databuf_unindex(resp);
+
+    return count;
+}
+
+/**
+ * Read every field of every section in a single pass with the iterator
+ *
+ * @return Number of fields read
+ */
+static unsigned int decode_iter(Databuf *resp)
+{
+    Databuf_iter iter;
+    Databuf_iter field;
+    Databuf section = {0};
+    unsigned int value;
+    unsigned int count = 0;
+
+    databuf_iter_init(&iter, resp);
+    while (databuf_iter_next(&iter))
+    {
+        if (iter.var != MB_BATCH_RESPONSE || !databuf_iter_databuf(&iter, &section))
+            continue;
+
+        databuf_iter_init(&field, &section);
+        while (databuf_iter_next(&field))
+        {
+            switch (field.var)
+            {
+            case MB_DEVICE:
+            case MB_IPV6_NB:
+                break;
+
+            case MB_RESPONSE:
+            case MB_REQUEST:
+            case MB_DEV_MAX_SESSION:
+                count += databuf_iter_uint(&field, &value);
+                break;
+
+            default:
+                count += databuf_iter_string(&field) != NULL;
+                break;
+            }
+        }
+    }
+
+    return count;
+}
+
+static double bench(Databuf *resp, bool indexed, unsigned int *count)
+{
+    double start = now_us();
+    int i;
+
+    for (i = 0; i < BENCH_ITERATIONS; i++)
+        *count = decode(resp, indexed);
+
+    return (now_us() - start) / BENCH_ITERATIONS;
+}
+
+static double bench_iter(Databuf *resp, unsigned int *count)
+{
+    double start = now_us();
+    int i;
+
+    for (i = 0; i < BENCH_ITERATIONS; i++)
+        *count = decode_iter(resp);
+
+    return (now_us() - start) / BENCH_ITERATIONS;
+}
+
+/**
+ * Build and release batch responses of every shape with the buffer pool, the
+ * pool must not miss once warm. Only the pooled data buffers are counted, not
+ * the nng messages nor the other allocations of the server.
+ *
+ * @return True if the steady state does not miss the pool
+ */
+static bool bench_pool(const int (*shapes)[2], size_t nb_shapes)
+{
+    size_t warm;
+    double start;
+    size_t i;
+    int n;
+
+    if (!databuf_pool_init())
+        return false;
+
+    for (i = 0; i < nb_shapes; i++)
+    {
+        Databuf resp = {0};
+
+        build_response(&resp, shapes[i][0], shapes[i][1]);
+        databuf_free(&resp);
+    }
+    warm = databuf_pool_misses();
+
+    start = now_us();
+    for (n = 0; n < BENCH_ITERATIONS; n++)
+    {
+        for (i = 0; i < nb_shapes; i++)
+        {
+            Databuf resp = {0};
+
+            build_response(&resp, shapes[i][0], shapes[i][1]);
+            databuf_free(&resp);
+        }
+    }
+
+    printf("\npool : %zu misses to warm up, %zu over %d iterations, %.2f us per iteration\n", warm,
+           databuf_pool_misses() - warm, BENCH_ITERATIONS, (now_us() - start) / BENCH_ITERATIONS);
+
+    n = databuf_pool_misses() == warm;
+    databuf_pool_free();
+
+    return n;
+}
+
+int main(void)
+{
+    static const int shapes[][2] = {{1, 0}, {1, 64}, {8, 0}, {8, 16}, {32, 16}, {64, 64}};
+    size_t i;
+
+    printf("%8s %8s %10s %10s %12s %12s %12s %8s\n", "sections", "addrs", "bytes", "compact", "linear us", "indexed us",
+           "iter us", "speedup");
+
+    for (i = 0; i < sizeof(shapes) / sizeof(shapes[0]); i++)
+    {
+        Databuf resp = {0};
+        unsigned int linear_count;
+        unsigned int indexed_count;
+        unsigned int iter_count;
+        Databuf compact = {0};
+        size_t compact_len;
+        double linear;
+        double indexed;
+        double iter;
+
+        build_response(&resp, shapes[i][0], shapes[i][1]);
+
+        linear = bench(&resp, false, &linear_count);
+        indexed = bench(&resp, true, &indexed_count);
+        iter = bench_iter(&resp, &iter_count);
+        if (linear_count != indexed_count || linear_count != iter_count)
+        {
+            printf("Error : decoded %u fields with the index and %u with the iterator, expected %u\n", indexed_count,
+                   iter_count, linear_count);
+            databuf_free(&resp);
+            return 1;
+        }
+
+        // Size of the same response on a connection that negotiated the compact encoding
+        databuf_init(&compact);
+        databuf_merge(&compact, &resp, NULL, 0);
+        compact_len = databuf_compact(&compact) ? compact.len : 0;
+        databuf_free(&compact);
+
+        // Speedup of the fastest decode against the linear scan
+        printf("%8d %8d %10zu %10zu %12.2f %12.2f %12.2f %7.1fx\n", shapes[i][0], shapes[i][1], resp.len, compact_len, linear,
+               indexed, iter, linear / (indexed < iter ? indexed : iter));
+        databuf_free(&resp);
+    }
+
+    if (!bench_pool(shapes, sizeof(shapes) / sizeof(shapes[0])))
+    {
+        printf("Error : the buffer pool misses in the steady state\n");
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,461 @@
+/**
+ * @file
+ * @brief Wire-level modem emulator, a pty speaking MBIM control messages
+ *        and QMUX that MBIM_NNG_DEVICE can point to, to run the server on
+ *        the real libmbim and libqmi code paths without any device
+ * @ccmod{MBIM_X_MMG}
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "modem_emu.h"
+
+#define EMU_PATH "/tmp/cdc-wdm-emu"
+#define EMU_RX_SIZE 65536
+
+// Reply waiting for its delay
+typedef struct emu_reply
+{
+    uint64_t due_us;
+    Emu_buf msg;
+    struct emu_reply *next;
+} Emu_reply;
+
+typedef struct emu_command
+{
+    const char *name;
+    int delay_ms; // -1 for the default delay
+} Emu_command;
+
+Emu_state g_emu = {
+    .registered = true,
+    .attached = true,
+    .rssi = 20,
+    .rssi_dbm = -73,
+};
+bool g_emu_verbose;
+
+static Emu_command g_commands[] = {
+    {"open", -1},           {"device_caps", -1},    {"subscriber", -1},           {"pin", -1},
+    {"register", -1},       {"packet_service", -1}, {"connect", -1},              {"ip", -1},
+    {"atds_signal", -1},    {"ctl", -1},            {"card_status", -1},          {"verify_pin", -1},
+    {"serving_system", -1}, {"signal_info", -1},    {"register_indications", -1}, {"start_network", -1},
+    {"current_settings", -1}, {"packet_status", -1}, {"indication", -1},          {"unsupported", -1},
+};
+static unsigned int g_default_delay;
+static Emu_reply *g_replies;
+static int g_master = -1;
+static volatile sig_atomic_t g_stop;
+
+void emu_buf_bytes(Emu_buf *buf, const void *value, size_t len)
+{
+    unsigned char *data;
+
+    if (!len)
+        return;
+
+    if (buf->len + len > buf->size)
+    {
+        data = realloc(buf->data, buf->len + len + 256);
+        if (!data)
+        {
+            printf("Emulator : Out of memory\n");
+            exit(1);
+        }
+
+        buf->data = data;
+        buf->size = buf->len + len + 256;
+    }
+
+    memcpy(buf->data + buf->len, value, len);
+    buf->len += len;
+}
+
+void emu_buf_u8(Emu_buf *buf, uint8_t value)
+{
+    emu_buf_bytes(buf, &value, 1);
+}
+
+void emu_buf_u16(Emu_buf *buf, uint16_t value)
+{
+    unsigned char bytes[2] = {value, value >> 8};
+
+    emu_buf_bytes(buf, bytes, sizeof(bytes));
+}
+
+void emu_buf_u32(Emu_buf *buf, uint32_t value)
+{
+    emu_buf_u16(buf, value);
+    emu_buf_u16(buf, value >> 16);
+}
+
+void emu_buf_u64(Emu_buf *buf, uint64_t value)
+{
+    emu_buf_u32(buf, value);
+    emu_buf_u32(buf, value >> 32);
+}
+
+void emu_buf_set_u16(Emu_buf *buf, size_t offset, uint16_t value)
+{
+    buf->data[offset] = value;
+    buf->data[offset + 1] = value >> 8;
+}
+
+void emu_buf_set_u32(Emu_buf *buf, size_t offset, uint32_t value)
+{
+    emu_buf_set_u16(buf, offset, value);
+    emu_buf_set_u16(buf, offset + 2, value >> 16);
+}
+
+void emu_buf_free(Emu_buf *buf)
+{
+    free(buf->data);
+    buf->data = NULL;
+    buf->len = 0;
+    buf->size = 0;
+}
+
+uint16_t emu_get_u16(const unsigned char *data)
+{
+    return data[0] | data[1] << 8;
+}
+
+uint32_t emu_get_u32(const unsigned char *data)
+{
+    return emu_get_u16(data) | (uint32_t) emu_get_u16(data + 2) << 16;
+}
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * Delay of a command, as configured.
+ *
+ * @param command Command name
+ *
+ * @return Delay in ms
+ */
+unsigned int emu_delay(const char *command)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(g_commands) / sizeof(g_commands[0]); i++)
+    {
+        if (strcmp(g_commands[i].name, command) == 0)
+            return g_commands[i].delay_ms >= 0 ? (unsigned int) g_commands[i].delay_ms : g_default_delay;
+    }
+
+    return g_default_delay;
+}
+
+/**
+ * Queue a message to the host, sent once its delay elapsed. The replies of
+ * the same due time keep their order.
+ *
+ * @param msg      Message, owned by the queue afterwards
+ * @param delay_ms Delay in ms
+ */
+void emu_send(Emu_buf *msg, unsigned int delay_ms)
+{
+    Emu_reply **prev = &g_replies;
+    Emu_reply *reply;
+
+    reply = calloc(1, sizeof(*reply));
+    if (!reply)
+    {
+        emu_buf_free(msg);
+        return;
+    }
+
+    reply->due_us = now_us() + (uint64_t) delay_ms * 1000;
+    reply->msg = *msg;
+    memset(msg, 0, sizeof(*msg));
+
+    while (*prev && (*prev)->due_us <= reply->due_us)
+        prev = &(*prev)->next;
+
+    reply->next = *prev;
+    *prev = reply;
+}
+
+/**
+ * Write the replies that are due to the pty.
+ *
+ * @return Time in ms until the next reply, -1 without any
+ */
+static int emu_flush(void)
+{
+    Emu_reply *reply;
+    uint64_t now = now_us();
+    size_t done;
+    ssize_t ret;
+
+    while ((reply = g_replies) != NULL && reply->due_us <= now)
+    {
+        g_replies = reply->next;
+
+        for (done = 0; done < reply->msg.len; done += ret)
+        {
+            ret = write(g_master, reply->msg.data + done, reply->msg.len - done);
+            if (ret < 0 && errno == EINTR)
+                ret = 0;
+            else if (ret < 0)
+            {
+                // Nobody reads the device, the host will start over with an open
+                printf("Emulator : Dropping a reply: %s\n", strerror(errno));
+                break;
+            }
+        }
+
+        emu_buf_free(&reply->msg);
+        free(reply);
+    }
+
+    if (!g_replies)
+        return -1;
+
+    return (int) ((g_replies->due_us - now + 999) / 1000);
+}
+
+/**
+ * Apply one configuration line, "delay <command|default> <ms>".
+ *
+ * @return True on success, otherwise false
+ */
+static bool emu_configure_line(const char *line)
+{
+    char name[32];
+    unsigned int ms;
+    size_t i;
+
+    while (*line == ' ' || *line == '\t')
+        line++;
+
+    if (*line == '\0' || *line == '\n' || *line == '#')
+        return true;
+
+    if (sscanf(line, "delay %31s %u", name, &ms) == 2)
+    {
+        if (strcmp(name, "default") == 0)
+        {
+            g_default_delay = ms;
+            return true;
+        }
+
+        for (i = 0; i < sizeof(g_commands) / sizeof(g_commands[0]); i++)
+        {
+            if (strcmp(g_commands[i].name, name) == 0)
+            {
+                g_commands[i].delay_ms = ms;
+                return true;
+            }
+        }
+    }
+
+    printf("Emulator : Invalid configuration line: %.*s\n", (int) strcspn(line, "\r\n"), line);
+
+    return false;
+}
+
+static bool emu_configure(const char *path)
+{
+    char line[128];
+    bool ok = true;
+    FILE *file;
+
+    file = fopen(path, "r");
+    if (!file)
+    {
+        printf("Emulator : Unable to open %s\n", path);
+        return false;
+    }
+
+    while (fgets(line, sizeof(line), file))
+    {
+        if (!emu_configure_line(line))
+            ok = false;
+    }
+
+    fclose(file);
+
+    return ok;
+}
+
+/**
+ * Open the pty, in raw mode, and link its device to path.
+ *
+ * @return True on success, otherwise false
+ */
+static bool emu_open(const char *path, int *slave)
+{
+    struct termios tio;
+    const char *name;
+
+    g_master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (g_master < 0 || grantpt(g_master) != 0 || unlockpt(g_master) != 0 || !(name = ptsname(g_master)))
+    {
+        printf("Emulator : Unable to open a pty: %s\n", strerror(errno));
+        return false;
+    }
+
+    // Kept open so the host can close and reopen the device
+    *slave = open(name, O_RDWR | O_NOCTTY);
+    if (*slave < 0 || tcgetattr(*slave, &tio) != 0)
+    {
+        printf("Emulator : Unable to open %s: %s\n", name, strerror(errno));
+        return false;
+    }
+
+    cfmakeraw(&tio);
+    tcsetattr(*slave, TCSANOW, &tio);
+    fcntl(g_master, F_SETFL, fcntl(g_master, F_GETFL) | O_NONBLOCK);
+
+    unlink(path);
+    if (symlink(name, path) != 0)
+    {
+        printf("Emulator : Unable to link %s to %s: %s\n", path, name, strerror(errno));
+        return false;
+    }
+
+    printf("Emulator : %s -> %s\n", path, name);
+
+    return true;
+}
+
+/**
+ * Handle the complete messages received, QMUX frames start with 0x01 and a
+ * non zero length, MBIM messages with their 32-bit type.
+ *
+ * @return Bytes consumed
+ */
+static size_t emu_receive(const unsigned char *data, size_t len)
+{
+    size_t used = 0;
+    size_t msg_len;
+    bool qmux;
+
+    while (used < len)
+    {
+        qmux = len - used >= 3 && data[used] == 0x01 && (data[used + 1] || data[used + 2]);
+        msg_len = qmux ? qmi_emu_length(data + used, len - used) : mbim_emu_length(data + used, len - used);
+        if (msg_len == 0)
+            break;
+
+        if (msg_len == (size_t) -1)
+        {
+            printf("Emulator : Dropping %zu bytes of unknown data\n", len - used);
+            return len;
+        }
+
+        if (qmux)
+            qmi_emu_handle(data + used, msg_len);
+        else
+            mbim_emu_handle(data + used, msg_len);
+
+        used += msg_len;
+    }
+
+    return used;
+}
+
+static void signal_handler(int sig)
+{
+    (void) sig;
+    g_stop = 1;
+}
+
+static void usage(const char *name)
+{
+    printf("Usage: %s [-p path] [-d delay_ms] [-c config] [-v]\n"
+           "  -p  Path of the emulated device, for MBIM_NNG_DEVICE (%s)\n"
+           "  -d  Default delay of the replies in ms (0)\n"
+           "  -c  Configuration, lines of \"delay <command|default> <ms>\"\n"
+           "  -v  Print the messages\n",
+           name, EMU_PATH);
+}
+
+int main(int argc, char *argv[])
+{
+    static unsigned char rx[EMU_RX_SIZE];
+    struct sigaction act = {0};
+    struct pollfd pfd;
+    const char *path = EMU_PATH;
+    size_t rx_len = 0;
+    size_t used;
+    ssize_t ret;
+    int slave = -1;
+    int timeout;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "p:d:c:vh")) != -1)
+    {
+        switch (opt)
+        {
+        case 'p': path = optarg; break;
+        case 'd': g_default_delay = atoi(optarg); break;
+        case 'c':
+            if (!emu_configure(optarg))
+                return 1;
+            break;
+        case 'v': g_emu_verbose = true; break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    act.sa_handler = signal_handler;
+    sigaction(SIGINT, &act, NULL);
+    sigaction(SIGTERM, &act, NULL);
+
+    if (!emu_open(path, &slave))
+        return 1;
+
+    pfd.fd = g_master;
+    pfd.events = POLLIN;
+
+    while (!g_stop)
+    {
+        timeout = emu_flush();
+        ret = poll(&pfd, 1, timeout);
+        if (ret < 0 && errno != EINTR)
+            break;
+
+        if (ret <= 0 || !(pfd.revents & POLLIN))
+            continue;
+
+        ret = read(g_master, rx + rx_len, sizeof(rx) - rx_len);
+        if (ret <= 0)
+            continue;
+
+        rx_len += ret;
+        used = emu_receive(rx, rx_len);
+        memmove(rx, rx + used, rx_len - used);
+        rx_len -= used;
+
+        // A message larger than the buffer is not a control message
+        if (rx_len == sizeof(rx))
+            rx_len = 0;
+    }
+
+    unlink(path);
+    close(slave);
+    close(g_master);
+
+    return 0;
+}
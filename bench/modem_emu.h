@@ -0,0 +1,58 @@
+#ifndef MBIM_NNG_MODEM_EMU_H
+#define MBIM_NNG_MODEM_EMU_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Growable little-endian message buffer
+typedef struct emu_buf
+{
+    unsigned char *data;
+    size_t len;
+    size_t size;
+} Emu_buf;
+
+// Emulated modem state, shared by both protocols
+typedef struct emu_state
+{
+    bool pin_locked;
+    bool registered;
+    bool attached;
+    bool connected;
+    uint32_t rssi;        // MBIM 0-31
+    int8_t rssi_dbm;
+    uint32_t session_id;
+} Emu_state;
+
+extern Emu_state g_emu;
+extern bool g_emu_verbose;
+
+void emu_buf_u8(Emu_buf *buf, uint8_t value);
+void emu_buf_u16(Emu_buf *buf, uint16_t value);
+void emu_buf_u32(Emu_buf *buf, uint32_t value);
+void emu_buf_u64(Emu_buf *buf, uint64_t value);
+void emu_buf_bytes(Emu_buf *buf, const void *value, size_t len);
+void emu_buf_set_u16(Emu_buf *buf, size_t offset, uint16_t value);
+void emu_buf_set_u32(Emu_buf *buf, size_t offset, uint32_t value);
+void emu_buf_free(Emu_buf *buf);
+uint16_t emu_get_u16(const unsigned char *data);
+uint32_t emu_get_u32(const unsigned char *data);
+
+unsigned int emu_delay(const char *command);
+void emu_send(Emu_buf *msg, unsigned int delay_ms);
+
+size_t mbim_emu_length(const unsigned char *data, size_t len);
+void mbim_emu_handle(const unsigned char *data, size_t len);
+size_t qmi_emu_length(const unsigned char *data, size_t len);
+void qmi_emu_handle(const unsigned char *data, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // MBIM_NNG_MODEM_EMU_H
@@ -0,0 +1,400 @@
+/**
+ * @file
+ * @brief MBIM control messages of the modem emulator, the basic connect
+ *        CIDs the server uses and the ATDS signal
+ * @ccmod{MBIM_X_MMG}
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "modem_emu.h"
+
+#define MBIM_OPEN_MSG 0x00000001
+#define MBIM_CLOSE_MSG 0x00000002
+#define MBIM_COMMAND_MSG 0x00000003
+#define MBIM_HOST_ERROR_MSG 0x00000004
+#define MBIM_OPEN_DONE 0x80000001
+#define MBIM_CLOSE_DONE 0x80000002
+#define MBIM_COMMAND_DONE 0x80000003
+#define MBIM_INDICATE_STATUS_MSG 0x80000007
+
+#define MBIM_HEADER_SIZE 12
+#define MBIM_COMMAND_HEADER_SIZE 48
+#define MBIM_MAX_MESSAGE 65536
+
+#define MBIM_STATUS_SUCCESS 0
+#define MBIM_STATUS_FAILURE 2
+#define MBIM_STATUS_NO_DEVICE_SUPPORT 9
+
+#define MBIM_CID_DEVICE_CAPS 1
+#define MBIM_CID_SUBSCRIBER_READY_STATUS 2
+#define MBIM_CID_PIN 4
+#define MBIM_CID_REGISTER_STATE 9
+#define MBIM_CID_PACKET_SERVICE 10
+#define MBIM_CID_SIGNAL_STATE 11
+#define MBIM_CID_CONNECT 12
+#define MBIM_CID_IP_CONFIGURATION 15
+#define MBIM_CID_DEVICE_SERVICE_SUBSCRIBE_LIST 19
+#define MBIM_CID_ATDS_SIGNAL 1
+
+#define MBIM_DATA_CLASS_LTE 0x20
+
+static const unsigned char g_uuid_basic_connect[16] = {0xa2, 0x89, 0xcc, 0x33, 0xbc, 0xbb, 0x8b, 0x4f,
+                                                       0xb6, 0xb0, 0x13, 0x3e, 0xc2, 0xaa, 0xe6, 0xdf};
+static const unsigned char g_uuid_atds[16] = {0x59, 0x67, 0xbd, 0xcc, 0x7f, 0xd2, 0x49, 0xa2,
+                                              0x9f, 0x5c, 0xb2, 0xe7, 0x0e, 0x52, 0x7d, 0xb3};
+static const unsigned char g_uuid_internet[16] = {0x7e, 0x5e, 0x2a, 0x7e, 0x4e, 0x6f, 0x72, 0x72,
+                                                  0x73, 0x6b, 0x65, 0x6e, 0x7e, 0x5e, 0x2a, 0x7e};
+
+// Information buffer, the strings follow the fixed fields they are referenced from
+typedef struct mbim_info
+{
+    Emu_buf fixed;
+    Emu_buf data;
+    size_t fixed_size;
+} Mbim_info;
+
+/**
+ * Add an offset/size pair to the fixed fields and the UTF-16LE string,
+ * padded to 4 bytes, to the data.
+ */
+static void info_string(Mbim_info *info, const char *value)
+{
+    size_t len = strlen(value);
+    size_t i;
+
+    emu_buf_u32(&info->fixed, info->fixed_size + info->data.len);
+    emu_buf_u32(&info->fixed, len * 2);
+
+    for (i = 0; i < len; i++)
+        emu_buf_u16(&info->data, (unsigned char) value[i]);
+
+    if (len % 2)
+        emu_buf_u16(&info->data, 0);
+}
+
+static void info_free(Mbim_info *info)
+{
+    emu_buf_free(&info->fixed);
+    emu_buf_free(&info->data);
+}
+
+/**
+ * Send a command done, or an indication when tid is 0.
+ */
+static void mbim_send(uint32_t tid, const unsigned char *uuid, uint32_t cid, uint32_t status, Mbim_info *info,
+                      const char *command)
+{
+    Emu_buf msg = {0};
+    size_t info_len = info ? info->fixed.len + info->data.len : 0;
+
+    emu_buf_u32(&msg, tid ? MBIM_COMMAND_DONE : MBIM_INDICATE_STATUS_MSG);
+    emu_buf_u32(&msg, 0); // Length, set below
+    emu_buf_u32(&msg, tid);
+    emu_buf_u32(&msg, 1); // Total fragments
+    emu_buf_u32(&msg, 0); // Current fragment
+    emu_buf_bytes(&msg, uuid, 16);
+    emu_buf_u32(&msg, cid);
+    if (tid)
+        emu_buf_u32(&msg, status);
+    emu_buf_u32(&msg, info_len);
+
+    if (info)
+    {
+        emu_buf_bytes(&msg, info->fixed.data, info->fixed.len);
+        emu_buf_bytes(&msg, info->data.data, info->data.len);
+        info_free(info);
+    }
+
+    emu_buf_set_u32(&msg, 4, msg.len);
+
+    if (g_emu_verbose)
+        printf("MBIM > %s cid %u %s status %u\n", tid ? "done" : "indication", cid, command, status);
+
+    emu_send(&msg, emu_delay(tid ? command : "indication"));
+}
+
+static void mbim_send_done(uint32_t type, uint32_t tid, uint32_t status)
+{
+    Emu_buf msg = {0};
+
+    emu_buf_u32(&msg, type);
+    emu_buf_u32(&msg, MBIM_HEADER_SIZE + 4);
+    emu_buf_u32(&msg, tid);
+    emu_buf_u32(&msg, status);
+
+    emu_send(&msg, emu_delay("open"));
+}
+
+static void device_caps(Mbim_info *info)
+{
+    info->fixed_size = 64;
+    emu_buf_u32(&info->fixed, 3);                    // Remote device
+    emu_buf_u32(&info->fixed, 1);                    // GSM cellular class
+    emu_buf_u32(&info->fixed, 1);                    // No voice
+    emu_buf_u32(&info->fixed, 2);                    // Physical SIM
+    emu_buf_u32(&info->fixed, MBIM_DATA_CLASS_LTE);
+    emu_buf_u32(&info->fixed, 0);                    // SMS caps
+    emu_buf_u32(&info->fixed, 0);                    // Control caps
+    emu_buf_u32(&info->fixed, 1);                    // Max sessions
+    info_string(info, "");
+    info_string(info, "350000000000001");
+    info_string(info, "EMU.1.0");
+    info_string(info, "modem_emu");
+}
+
+static void subscriber_ready_status(Mbim_info *info)
+{
+    info->fixed_size = 28;
+    emu_buf_u32(&info->fixed, g_emu.pin_locked ? 6 : 1); // Device locked or initialized
+    info_string(info, g_emu.pin_locked ? "" : "001010123456789");
+    info_string(info, "8901001012345678901");
+    emu_buf_u32(&info->fixed, 0); // Ready info
+    emu_buf_u32(&info->fixed, 0); // No telephone numbers
+}
+
+static void pin_state(Mbim_info *info)
+{
+    info->fixed_size = 12;
+    emu_buf_u32(&info->fixed, g_emu.pin_locked ? 2 : 0); // PIN1 or none
+    emu_buf_u32(&info->fixed, g_emu.pin_locked ? 1 : 0); // Locked or unlocked
+    emu_buf_u32(&info->fixed, 3);
+}
+
+static void register_state(Mbim_info *info)
+{
+    info->fixed_size = 48;
+    emu_buf_u32(&info->fixed, 0);                         // Network error
+    emu_buf_u32(&info->fixed, g_emu.registered ? 3 : 1);  // Home or deregistered
+    emu_buf_u32(&info->fixed, 1);                         // Automatic
+    emu_buf_u32(&info->fixed, MBIM_DATA_CLASS_LTE);
+    emu_buf_u32(&info->fixed, 1);                         // GSM cellular class
+    info_string(info, g_emu.registered ? "00101" : "");
+    info_string(info, g_emu.registered ? "Emulator" : "");
+    info_string(info, "");
+    emu_buf_u32(&info->fixed, 0);                         // Registration flags
+}
+
+static void packet_service(Mbim_info *info)
+{
+    info->fixed_size = 28;
+    emu_buf_u32(&info->fixed, 0);                         // Network error
+    emu_buf_u32(&info->fixed, g_emu.attached ? 2 : 4);    // Attached or detached
+    emu_buf_u32(&info->fixed, g_emu.attached ? MBIM_DATA_CLASS_LTE : 0);
+    emu_buf_u64(&info->fixed, g_emu.attached ? 50000000 : 0);
+    emu_buf_u64(&info->fixed, g_emu.attached ? 150000000 : 0);
+}
+
+static void connect_state(Mbim_info *info)
+{
+    info->fixed_size = 36;
+    emu_buf_u32(&info->fixed, g_emu.session_id);
+    emu_buf_u32(&info->fixed, g_emu.connected ? 1 : 3); // Activated or deactivated
+    emu_buf_u32(&info->fixed, 0);                       // No voice call
+    emu_buf_u32(&info->fixed, 1);                       // IPv4
+    emu_buf_bytes(&info->fixed, g_uuid_internet, 16);
+    emu_buf_u32(&info->fixed, 0);                       // Network error
+}
+
+static void ip_configuration(Mbim_info *info)
+{
+    static const unsigned char address[4] = {10, 64, 0, 2};
+    static const unsigned char gateway[4] = {10, 64, 0, 1};
+    static const unsigned char dns[4] = {10, 64, 0, 53};
+
+    info->fixed_size = 60;
+    emu_buf_u32(&info->fixed, g_emu.session_id);
+    emu_buf_u32(&info->fixed, 0x0f);           // IPv4 address, gateway, DNS and MTU
+    emu_buf_u32(&info->fixed, 0);              // No IPv6
+    emu_buf_u32(&info->fixed, 1);              // IPv4 address count and offset
+    emu_buf_u32(&info->fixed, 60);
+    emu_buf_u32(&info->fixed, 0);              // IPv6 address count and offset
+    emu_buf_u32(&info->fixed, 0);
+    emu_buf_u32(&info->fixed, 68);             // IPv4 gateway offset
+    emu_buf_u32(&info->fixed, 0);              // IPv6 gateway offset
+    emu_buf_u32(&info->fixed, 1);              // IPv4 DNS count and offset
+    emu_buf_u32(&info->fixed, 72);
+    emu_buf_u32(&info->fixed, 0);              // IPv6 DNS count and offset
+    emu_buf_u32(&info->fixed, 0);
+    emu_buf_u32(&info->fixed, 1500);           // IPv4 MTU
+    emu_buf_u32(&info->fixed, 0);              // IPv6 MTU
+
+    emu_buf_u32(&info->data, 24);              // Prefix length
+    emu_buf_bytes(&info->data, address, sizeof(address));
+    emu_buf_bytes(&info->data, gateway, sizeof(gateway));
+    emu_buf_bytes(&info->data, dns, sizeof(dns));
+}
+
+static void atds_signal(Mbim_info *info)
+{
+    info->fixed_size = 28;
+    emu_buf_u32(&info->fixed, g_emu.rssi);
+    emu_buf_u32(&info->fixed, 99); // Unknown BER
+    emu_buf_u32(&info->fixed, 255); // No RSCP
+    emu_buf_u32(&info->fixed, 255); // No EcNo
+    emu_buf_u32(&info->fixed, 20);  // RSRQ -10 dB
+    emu_buf_u32(&info->fixed, 45);  // RSRP -96 dBm
+    emu_buf_u32(&info->fixed, 30);  // RSSNR 15 dB
+}
+
+/**
+ * Answer a basic connect command, the set commands change the state and
+ * are followed by the indication of the new state.
+ */
+static void basic_connect(uint32_t tid, uint32_t cid, bool set, const unsigned char *info_buf, size_t info_len)
+{
+    Mbim_info info = {0};
+    Mbim_info notification = {0};
+    void (*state)(Mbim_info *) = NULL;
+    const char *command = "unsupported";
+    uint32_t status = MBIM_STATUS_SUCCESS;
+
+    switch (cid)
+    {
+    case MBIM_CID_DEVICE_CAPS:
+        command = "device_caps";
+        device_caps(&info);
+        break;
+    case MBIM_CID_SUBSCRIBER_READY_STATUS:
+        command = "subscriber";
+        subscriber_ready_status(&info);
+        break;
+    case MBIM_CID_PIN:
+        command = "pin";
+        // Any PIN code unlocks
+        if (set && g_emu.pin_locked)
+        {
+            g_emu.pin_locked = false;
+            state = subscriber_ready_status;
+        }
+        pin_state(&info);
+        break;
+    case MBIM_CID_REGISTER_STATE:
+        command = "register";
+        register_state(&info);
+        break;
+    case MBIM_CID_PACKET_SERVICE:
+        command = "packet_service";
+        if (set && info_len >= 4)
+        {
+            g_emu.attached = emu_get_u32(info_buf) == 0; // Attach or detach action
+            if (!g_emu.attached)
+                g_emu.connected = false;
+            state = packet_service;
+        }
+        packet_service(&info);
+        break;
+    case MBIM_CID_CONNECT:
+        command = "connect";
+        if (info_len >= 4)
+            g_emu.session_id = emu_get_u32(info_buf);
+        if (set && info_len >= 8)
+        {
+            if (emu_get_u32(info_buf + 4) == 1 && !g_emu.attached)
+            {
+                status = MBIM_STATUS_FAILURE;
+                break;
+            }
+
+            g_emu.connected = emu_get_u32(info_buf + 4) == 1; // Activate or deactivate command
+            state = connect_state;
+        }
+        connect_state(&info);
+        break;
+    case MBIM_CID_IP_CONFIGURATION:
+        command = "ip";
+        if (!g_emu.connected)
+            status = MBIM_STATUS_FAILURE;
+        else
+            ip_configuration(&info);
+        break;
+    case MBIM_CID_DEVICE_SERVICE_SUBSCRIBE_LIST:
+        command = "open";
+        // The subscribed list is echoed back
+        emu_buf_bytes(&info.fixed, info_buf, info_len);
+        break;
+    default:
+        status = MBIM_STATUS_NO_DEVICE_SUPPORT;
+        break;
+    }
+
+    mbim_send(tid, g_uuid_basic_connect, cid, status, &info, command);
+
+    if (state)
+    {
+        state(&notification);
+        mbim_send(0, g_uuid_basic_connect, cid, MBIM_STATUS_SUCCESS, &notification, command);
+    }
+}
+
+/**
+ * Length of the MBIM message at the start of data.
+ *
+ * @return Length of the message, 0 if incomplete, -1 if not a host message
+ */
+size_t mbim_emu_length(const unsigned char *data, size_t len)
+{
+    uint32_t type;
+    uint32_t msg_len;
+
+    if (len < 8)
+        return 0;
+
+    type = emu_get_u32(data);
+    msg_len = emu_get_u32(data + 4);
+    if (type < MBIM_OPEN_MSG || type > MBIM_HOST_ERROR_MSG || msg_len < MBIM_HEADER_SIZE || msg_len > MBIM_MAX_MESSAGE)
+        return (size_t) -1;
+
+    return len < msg_len ? 0 : msg_len;
+}
+
+/**
+ * Answer an MBIM message of the host.
+ */
+void mbim_emu_handle(const unsigned char *data, size_t len)
+{
+    uint32_t type = emu_get_u32(data);
+    uint32_t tid = emu_get_u32(data + 8);
+    uint32_t cid;
+    uint32_t info_len;
+    Mbim_info info = {0};
+    bool set;
+
+    switch (type)
+    {
+    case MBIM_OPEN_MSG:
+        if (g_emu_verbose)
+            printf("MBIM < open tid %u\n", tid);
+        mbim_send_done(MBIM_OPEN_DONE, tid, MBIM_STATUS_SUCCESS);
+        return;
+    case MBIM_CLOSE_MSG:
+        if (g_emu_verbose)
+            printf("MBIM < close tid %u\n", tid);
+        mbim_send_done(MBIM_CLOSE_DONE, tid, MBIM_STATUS_SUCCESS);
+        return;
+    case MBIM_COMMAND_MSG: break;
+    default: return;
+    }
+
+    if (len < MBIM_COMMAND_HEADER_SIZE)
+        return;
+
+    cid = emu_get_u32(data + 36);
+    set = emu_get_u32(data + 40) == 1;
+    info_len = emu_get_u32(data + 44);
+    if (info_len > len - MBIM_COMMAND_HEADER_SIZE)
+        info_len = len - MBIM_COMMAND_HEADER_SIZE;
+
+    if (g_emu_verbose)
+        printf("MBIM < %s cid %u tid %u\n", set ? "set" : "query", cid, tid);
+
+    if (memcmp(data + 20, g_uuid_basic_connect, 16) == 0)
+        basic_connect(tid, cid, set, data + MBIM_COMMAND_HEADER_SIZE, info_len);
+    else if (memcmp(data + 20, g_uuid_atds, 16) == 0 && cid == MBIM_CID_ATDS_SIGNAL && !set)
+    {
+        atds_signal(&info);
+        mbim_send(tid, g_uuid_atds, cid, MBIM_STATUS_SUCCESS, &info, "atds_signal");
+    }
+    else
+        mbim_send(tid, data + 20, cid, MBIM_STATUS_NO_DEVICE_SUPPORT, NULL, "unsupported");
+}
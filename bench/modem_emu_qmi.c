@@ -0,0 +1,466 @@
+/**
+ * @file
+ * @brief QMUX of the modem emulator, the CTL messages libqmi and its proxy
+ *        use and the UIM, NAS and WDS messages of the server
+ * @ccmod{MBIM_X_MMG}
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "modem_emu.h"
+
+#define QMUX_HEADER_SIZE 6
+#define QMI_CTL_HEADER_SIZE 6
+#define QMI_SERVICE_HEADER_SIZE 7
+#define QMI_TLV_HEADER_SIZE 3
+
+#define QMI_SERVICE_CTL 0x00
+#define QMI_SERVICE_WDS 0x01
+#define QMI_SERVICE_NAS 0x03
+#define QMI_SERVICE_UIM 0x0b
+#define QMI_CID_BROADCAST 0xff
+
+#define QMI_CTL_FLAG_RESPONSE 0x01
+#define QMI_SERVICE_FLAG_RESPONSE 0x02
+#define QMI_SERVICE_FLAG_INDICATION 0x04
+
+#define QMI_CTL_GET_VERSION_INFO 0x0021
+#define QMI_CTL_ALLOCATE_CID 0x0022
+#define QMI_CTL_RELEASE_CID 0x0023
+#define QMI_CTL_SET_DATA_FORMAT 0x0026
+#define QMI_CTL_SYNC 0x0027
+#define QMI_UIM_VERIFY_PIN 0x0026
+#define QMI_UIM_GET_CARD_STATUS 0x002f
+#define QMI_NAS_REGISTER_INDICATIONS 0x0003
+#define QMI_NAS_GET_SERVING_SYSTEM 0x0024
+#define QMI_NAS_GET_SIGNAL_INFO 0x004f
+#define QMI_WDS_START_NETWORK 0x0020
+#define QMI_WDS_GET_PACKET_SERVICE_STATUS 0x0022
+#define QMI_WDS_GET_CURRENT_SETTINGS 0x002d
+
+#define QMI_ERROR_NONE 0
+#define QMI_ERROR_CALL_FAILED 14
+#define QMI_ERROR_OUT_OF_CALL 15
+#define QMI_ERROR_INVALID_QMI_COMMAND 71
+
+#define EMU_IPV4_ADDRESS 0x0a400002 // 10.64.0.2
+#define EMU_IPV4_GATEWAY 0x0a400001
+#define EMU_IPV4_MASK 0xffffff00
+#define EMU_IPV4_DNS 0x0a400035
+
+// Clients allocated of each service, indications are only sent once a client exists
+static uint8_t g_clients[256];
+
+/**
+ * Start a QMUX message from the service, the lengths are set by qmi_finish().
+ *
+ * @return Offset of the TLVs
+ */
+static size_t qmi_start(Emu_buf *msg, uint8_t service, uint8_t client, uint8_t flags, uint16_t tid, uint16_t id)
+{
+    emu_buf_u8(msg, 0x01);
+    emu_buf_u16(msg, 0);
+    emu_buf_u8(msg, 0x80); // From the service
+    emu_buf_u8(msg, service);
+    emu_buf_u8(msg, client);
+
+    emu_buf_u8(msg, flags);
+    if (service == QMI_SERVICE_CTL)
+        emu_buf_u8(msg, tid);
+    else
+        emu_buf_u16(msg, tid);
+    emu_buf_u16(msg, id);
+    emu_buf_u16(msg, 0);
+
+    return msg->len;
+}
+
+static void qmi_finish(Emu_buf *msg, size_t tlvs)
+{
+    emu_buf_set_u16(msg, 1, msg->len - 1);
+    emu_buf_set_u16(msg, tlvs - 2, msg->len - tlvs);
+}
+
+static size_t tlv_start(Emu_buf *msg, uint8_t type)
+{
+    emu_buf_u8(msg, type);
+    emu_buf_u16(msg, 0);
+
+    return msg->len;
+}
+
+static void tlv_end(Emu_buf *msg, size_t value)
+{
+    emu_buf_set_u16(msg, value - 2, msg->len - value);
+}
+
+static void tlv_u8(Emu_buf *msg, uint8_t type, uint8_t value)
+{
+    size_t tlv = tlv_start(msg, type);
+
+    emu_buf_u8(msg, value);
+    tlv_end(msg, tlv);
+}
+
+static void tlv_u32(Emu_buf *msg, uint8_t type, uint32_t value)
+{
+    size_t tlv = tlv_start(msg, type);
+
+    emu_buf_u32(msg, value);
+    tlv_end(msg, tlv);
+}
+
+static void tlv_result(Emu_buf *msg, uint16_t error)
+{
+    size_t tlv = tlv_start(msg, 0x02);
+
+    emu_buf_u16(msg, error != QMI_ERROR_NONE);
+    emu_buf_u16(msg, error);
+    tlv_end(msg, tlv);
+}
+
+/**
+ * Find a TLV of a request.
+ *
+ * @return Value of the TLV, NULL if missing
+ */
+static const unsigned char *tlv_find(const unsigned char *tlvs, size_t len, uint8_t type, uint16_t *value_len)
+{
+    size_t offset = 0;
+    uint16_t tlv_len;
+
+    while (offset + QMI_TLV_HEADER_SIZE <= len)
+    {
+        tlv_len = emu_get_u16(tlvs + offset + 1);
+        if (offset + QMI_TLV_HEADER_SIZE + tlv_len > len)
+            break;
+
+        if (tlvs[offset] == type)
+        {
+            *value_len = tlv_len;
+            return tlvs + offset + QMI_TLV_HEADER_SIZE;
+        }
+
+        offset += QMI_TLV_HEADER_SIZE + tlv_len;
+    }
+
+    return NULL;
+}
+
+static void serving_system(Emu_buf *msg)
+{
+    static const char description[] = "Emulator";
+    size_t tlv;
+
+    tlv = tlv_start(msg, 0x01);
+    emu_buf_u8(msg, g_emu.registered ? 1 : 0);  // Registered or not registered
+    emu_buf_u8(msg, g_emu.registered ? 1 : 2);  // CS attached or detached
+    emu_buf_u8(msg, g_emu.attached ? 1 : 2);    // PS attached or detached
+    emu_buf_u8(msg, 2);                         // 3GPP
+    emu_buf_u8(msg, 1);
+    emu_buf_u8(msg, 8);                         // LTE
+    tlv_end(msg, tlv);
+
+    tlv_u8(msg, 0x10, 1); // Roaming off
+
+    if (!g_emu.registered)
+        return;
+
+    tlv = tlv_start(msg, 0x12);
+    emu_buf_u16(msg, 1);
+    emu_buf_u16(msg, 1);
+    emu_buf_u8(msg, sizeof(description) - 1);
+    emu_buf_bytes(msg, description, sizeof(description) - 1);
+    tlv_end(msg, tlv);
+}
+
+static void signal_info(Emu_buf *msg)
+{
+    size_t tlv = tlv_start(msg, 0x14);
+
+    emu_buf_u8(msg, (uint8_t) g_emu.rssi_dbm);
+    emu_buf_u8(msg, (uint8_t) -10); // RSRQ dB
+    emu_buf_u16(msg, (uint16_t) -96); // RSRP dBm
+    emu_buf_u16(msg, 150);          // SNR 0.1 dB
+    tlv_end(msg, tlv);
+}
+
+static void card_status(Emu_buf *msg)
+{
+    static const unsigned char aid[16] = {0xa0, 0x00, 0x00, 0x00, 0x87, 0x10, 0x02, 0xff,
+                                          0xff, 0xff, 0xff, 0x89, 0x06, 0x19, 0x00, 0x00};
+    size_t tlv = tlv_start(msg, 0x10);
+
+    emu_buf_u16(msg, 0); // Index of the GW primary application
+    emu_buf_u16(msg, 0xffff);
+    emu_buf_u16(msg, 0xffff);
+    emu_buf_u16(msg, 0xffff);
+    emu_buf_u8(msg, 1);  // Cards
+
+    emu_buf_u8(msg, 1);  // Present
+    emu_buf_u8(msg, 0);  // UPIN not initialized
+    emu_buf_u8(msg, 0);
+    emu_buf_u8(msg, 0);
+    emu_buf_u8(msg, 0);  // No error
+    emu_buf_u8(msg, 1);  // Applications
+
+    emu_buf_u8(msg, 2);                              // USIM
+    emu_buf_u8(msg, g_emu.pin_locked ? 2 : 7);       // PIN1 required or ready
+    emu_buf_u8(msg, 3);                              // Personalization ready
+    emu_buf_u8(msg, 0);
+    emu_buf_u8(msg, 0);
+    emu_buf_u8(msg, 0);
+    emu_buf_u8(msg, sizeof(aid));
+    emu_buf_bytes(msg, aid, sizeof(aid));
+    emu_buf_u8(msg, 0);                              // UPIN does not replace PIN1
+    emu_buf_u8(msg, g_emu.pin_locked ? 1 : 2);       // Enabled, not verified or verified
+    emu_buf_u8(msg, 3);
+    emu_buf_u8(msg, 10);
+    emu_buf_u8(msg, 2);                              // PIN2 enabled, verified
+    emu_buf_u8(msg, 3);
+    emu_buf_u8(msg, 10);
+    tlv_end(msg, tlv);
+}
+
+static void current_settings(Emu_buf *msg)
+{
+    tlv_u32(msg, 0x15, EMU_IPV4_DNS);
+    tlv_u32(msg, 0x1e, EMU_IPV4_ADDRESS);
+    tlv_u32(msg, 0x20, EMU_IPV4_GATEWAY);
+    tlv_u32(msg, 0x21, EMU_IPV4_MASK);
+    tlv_u32(msg, 0x29, 1500);
+    tlv_u8(msg, 0x2b, 4);
+}
+
+static void ctl_handle(uint8_t tid, uint16_t id, const unsigned char *tlvs, size_t len)
+{
+    static const uint8_t services[] = {QMI_SERVICE_CTL, QMI_SERVICE_WDS, QMI_SERVICE_NAS, QMI_SERVICE_UIM};
+    const unsigned char *value;
+    Emu_buf msg = {0};
+    uint16_t value_len;
+    size_t start;
+    size_t tlv;
+    size_t i;
+
+    start = qmi_start(&msg, QMI_SERVICE_CTL, 0, QMI_CTL_FLAG_RESPONSE, tid, id);
+
+    switch (id)
+    {
+    case QMI_CTL_GET_VERSION_INFO:
+        tlv_result(&msg, QMI_ERROR_NONE);
+        tlv = tlv_start(&msg, 0x01);
+        emu_buf_u8(&msg, sizeof(services));
+        for (i = 0; i < sizeof(services); i++)
+        {
+            emu_buf_u8(&msg, services[i]);
+            emu_buf_u16(&msg, 1);  // Major
+            emu_buf_u16(&msg, 50); // Minor
+        }
+        tlv_end(&msg, tlv);
+        break;
+    case QMI_CTL_ALLOCATE_CID:
+        value = tlv_find(tlvs, len, 0x01, &value_len);
+        if (!value || value_len < 1 || g_clients[value[0]] == QMI_CID_BROADCAST - 1)
+        {
+            tlv_result(&msg, QMI_ERROR_INVALID_QMI_COMMAND);
+            break;
+        }
+
+        tlv_result(&msg, QMI_ERROR_NONE);
+        tlv = tlv_start(&msg, 0x01);
+        emu_buf_u8(&msg, value[0]);
+        emu_buf_u8(&msg, ++g_clients[value[0]]);
+        tlv_end(&msg, tlv);
+        break;
+    case QMI_CTL_RELEASE_CID:
+        value = tlv_find(tlvs, len, 0x01, &value_len);
+        if (!value || value_len < 2)
+        {
+            tlv_result(&msg, QMI_ERROR_INVALID_QMI_COMMAND);
+            break;
+        }
+
+        tlv_result(&msg, QMI_ERROR_NONE);
+        tlv = tlv_start(&msg, 0x01);
+        emu_buf_bytes(&msg, value, 2);
+        tlv_end(&msg, tlv);
+        break;
+    case QMI_CTL_SET_DATA_FORMAT:
+    case QMI_CTL_SYNC: tlv_result(&msg, QMI_ERROR_NONE); break;
+    default: tlv_result(&msg, QMI_ERROR_INVALID_QMI_COMMAND); break;
+    }
+
+    qmi_finish(&msg, start);
+
+    if (g_emu_verbose)
+        printf("QMI > ctl 0x%04x tid %u\n", id, tid);
+
+    emu_send(&msg, emu_delay("ctl"));
+}
+
+/**
+ * Send an indication to the clients of the service.
+ */
+static void qmi_indication(uint8_t service, uint16_t id, void (*state)(Emu_buf *))
+{
+    Emu_buf msg = {0};
+    size_t start;
+
+    if (!g_clients[service])
+        return;
+
+    start = qmi_start(&msg, service, QMI_CID_BROADCAST, QMI_SERVICE_FLAG_INDICATION, 0, id);
+    state(&msg);
+    qmi_finish(&msg, start);
+
+    if (g_emu_verbose)
+        printf("QMI > indication service 0x%02x 0x%04x\n", service, id);
+
+    emu_send(&msg, emu_delay("indication"));
+}
+
+static void packet_status_indication(Emu_buf *msg)
+{
+    size_t tlv = tlv_start(msg, 0x01);
+
+    emu_buf_u8(msg, g_emu.connected ? 2 : 1); // Connected or disconnected
+    emu_buf_u8(msg, 0);                       // No reconfiguration
+    tlv_end(msg, tlv);
+}
+
+static void service_handle(uint8_t service, uint8_t client, uint16_t tid, uint16_t id)
+{
+    const char *command = "unsupported";
+    Emu_buf msg = {0};
+    size_t start;
+    size_t tlv;
+    bool connected = false;
+
+    start = qmi_start(&msg, service, client, QMI_SERVICE_FLAG_RESPONSE, tid, id);
+
+    switch (service << 16 | id)
+    {
+    case QMI_SERVICE_UIM << 16 | QMI_UIM_GET_CARD_STATUS:
+        command = "card_status";
+        tlv_result(&msg, QMI_ERROR_NONE);
+        card_status(&msg);
+        break;
+    case QMI_SERVICE_UIM << 16 | QMI_UIM_VERIFY_PIN:
+        command = "verify_pin";
+        // Any PIN code unlocks
+        g_emu.pin_locked = false;
+        tlv_result(&msg, QMI_ERROR_NONE);
+        tlv = tlv_start(&msg, 0x10); // Retries left
+        emu_buf_u8(&msg, 3);
+        emu_buf_u8(&msg, 10);
+        tlv_end(&msg, tlv);
+        break;
+    case QMI_SERVICE_NAS << 16 | QMI_NAS_REGISTER_INDICATIONS:
+        command = "register_indications";
+        tlv_result(&msg, QMI_ERROR_NONE);
+        break;
+    case QMI_SERVICE_NAS << 16 | QMI_NAS_GET_SERVING_SYSTEM:
+        command = "serving_system";
+        tlv_result(&msg, QMI_ERROR_NONE);
+        serving_system(&msg);
+        break;
+    case QMI_SERVICE_NAS << 16 | QMI_NAS_GET_SIGNAL_INFO:
+        command = "signal_info";
+        tlv_result(&msg, QMI_ERROR_NONE);
+        signal_info(&msg);
+        break;
+    case QMI_SERVICE_WDS << 16 | QMI_WDS_START_NETWORK:
+        command = "start_network";
+        if (!g_emu.attached)
+        {
+            tlv_result(&msg, QMI_ERROR_CALL_FAILED);
+            break;
+        }
+
+        connected = !g_emu.connected;
+        g_emu.connected = true;
+        tlv_result(&msg, QMI_ERROR_NONE);
+        tlv_u32(&msg, 0x01, 0x12345678); // Packet data handle
+        break;
+    case QMI_SERVICE_WDS << 16 | QMI_WDS_GET_PACKET_SERVICE_STATUS:
+        command = "packet_status";
+        tlv_result(&msg, QMI_ERROR_NONE);
+        tlv_u8(&msg, 0x01, g_emu.connected ? 2 : 1);
+        break;
+    case QMI_SERVICE_WDS << 16 | QMI_WDS_GET_CURRENT_SETTINGS:
+        command = "current_settings";
+        if (!g_emu.connected)
+        {
+            tlv_result(&msg, QMI_ERROR_OUT_OF_CALL);
+            break;
+        }
+
+        tlv_result(&msg, QMI_ERROR_NONE);
+        current_settings(&msg);
+        break;
+    default: tlv_result(&msg, QMI_ERROR_INVALID_QMI_COMMAND); break;
+    }
+
+    qmi_finish(&msg, start);
+
+    if (g_emu_verbose)
+        printf("QMI > %s service 0x%02x client %u tid %u\n", command, service, client, tid);
+
+    emu_send(&msg, emu_delay(command));
+
+    if (connected)
+        qmi_indication(QMI_SERVICE_WDS, QMI_WDS_GET_PACKET_SERVICE_STATUS, packet_status_indication);
+}
+
+/**
+ * Length of the QMUX frame at the start of data.
+ *
+ * @return Length of the frame, 0 if incomplete, -1 if not a QMUX frame
+ */
+size_t qmi_emu_length(const unsigned char *data, size_t len)
+{
+    size_t frame_len;
+
+    if (len < 3)
+        return 0;
+
+    frame_len = emu_get_u16(data + 1) + 1;
+    if (frame_len < QMUX_HEADER_SIZE + QMI_CTL_HEADER_SIZE)
+        return (size_t) -1;
+
+    return len < frame_len ? 0 : frame_len;
+}
+
+/**
+ * Answer a QMUX frame of the host.
+ */
+void qmi_emu_handle(const unsigned char *data, size_t len)
+{
+    uint8_t service = data[4];
+    uint8_t client = data[5];
+    const unsigned char *sdu = data + QMUX_HEADER_SIZE;
+    size_t sdu_len = len - QMUX_HEADER_SIZE;
+    size_t tlvs_len;
+
+    if (service == QMI_SERVICE_CTL)
+    {
+        tlvs_len = emu_get_u16(sdu + 4);
+        if (tlvs_len > sdu_len - QMI_CTL_HEADER_SIZE)
+            tlvs_len = sdu_len - QMI_CTL_HEADER_SIZE;
+
+        if (g_emu_verbose)
+            printf("QMI < ctl 0x%04x tid %u\n", emu_get_u16(sdu + 2), sdu[1]);
+
+        ctl_handle(sdu[1], emu_get_u16(sdu + 2), sdu + QMI_CTL_HEADER_SIZE, tlvs_len);
+        return;
+    }
+
+    if (sdu_len < QMI_SERVICE_HEADER_SIZE)
+        return;
+
+    if (g_emu_verbose)
+        printf("QMI < service 0x%02x client %u 0x%04x tid %u\n", service, client, emu_get_u16(sdu + 3),
+               emu_get_u16(sdu + 1));
+
+    service_handle(service, client, emu_get_u16(sdu + 1), emu_get_u16(sdu + 3));
+}
@@ -1,3 +1,4 @@
+#include <inttypes.h>
 #include <signal.h>
 #include <stdlib.h>
 #include <stdbool.h>
@@ -7,17 +8,23 @@
 
 #include <nng/nng.h>
 #include <nng/protocol/reqrep0/req.h>
+#include <nng/protocol/pubsub0/sub.h>
 
-#include "mbim_enum.h"
+#include "mbim_schema.h"
+#include "nng_client.h"
 
 #define NNG_IPC_PREFIX "ipc://"
 #define NNG_SOCKET "/tmp/mbim_nng.socket"
+#define NNG_NOTIFY_SOCKET "/tmp/mbim_nng_notify.socket"
 
 #define GET_MOB_INFO_RETRY_TIMEOUT_MS 10000 //10 sec
 
+static bool g_compact; // Negotiate the compact encoding of the responses
+static bool g_negotiated;
+
 static bool check_resp(Databuf *response)
 {
-    int status = -1;
+    unsigned int status = MBIM_ERROR;
     if (!databuf_is_valid(response))
     {
         printf("Error : Response is not valid\n");
@@ -25,7 +32,7 @@ static bool check_resp(Databuf *response)
         return false;
     }
 
-    if (!databuf_get_uint(response, MB_RESPONSE, &status))
+    if (!mb_get_response(response, &status))
     {
         printf("Error : response does not contains the status\n");
         databuf_free(response);
@@ -34,7 +41,7 @@ static bool check_resp(Databuf *response)
 
     if (status != MBIM_OK)
     {
-        printf("Error : Resp status is error : %s\n", databuf_get_string(response, MB_ERROR));
+        printf("Error : Resp status is error : %s\n", mb_get_error(response));
         databuf_free(response);
         return false;
     }
@@ -44,270 +51,213 @@ static bool check_resp(Databuf *response)
 
 static bool get_resp(nng_socket sock, Databuf *request, Databuf *response)
 {
-    unsigned char *buf = NULL;
-    size_t size = 0;
+    nng_msg *msg;
+
+    // Negotiated with the first request, the server keeps it for the connection
+    if (g_compact && !g_negotiated)
+    {
+        mb_add_encoding(request, MB_ENCODING_COMPACT);
+        g_negotiated = true;
+    }
+
+    msg = databuf_take_msg(request);
 
-    int ret = nng_send(sock, request->buf, request->len, 0);
+    // The request is sent without copy, nng frees the message once sent
+    int ret = nng_sendmsg(sock, msg, 0);
     if (ret != 0)
     {
         printf("Failed to send request: %s\n", nng_strerror(ret));
+        nng_msg_free(msg);
         nng_close(sock);
         return false;
     }
 
-    ret = nng_recv(sock, &buf, &size, NNG_FLAG_ALLOC);
+    ret = nng_recvmsg(sock, &msg, 0);
 
     if (ret != 0)
     {
         printf("Failed to receive data: %s\n", nng_strerror(ret));
-        nng_free(buf, size);
         return false;
     }
-    databuf_set_buf(response, buf, size);
+    databuf_set_msg(response, msg);
+    if (!databuf_expand(response))
+    {
+        databuf_free(response);
+        return false;
+    }
 
     return check_resp(response);
 }
 
-void pin_status(Databuf *response)
-{
-    int pin_status = -1;
-    if (!databuf_get_uint(response, MB_PIN_STATUS, &pin_status))
-        printf("Error : no pin status (MB_PIN_STATUS)\n");
-    else
-        printf("Ok : Pin status (%d) : %s\n", pin_status, pin_status == MBIM_PIN_UNLOCK ? "MBIM_PIN_UNLOCK" : "MBIM_PIN_LOCK");
-}
-
-void subscriber(Databuf *response)
+/**
+ * Print the variables of a response by their schema name, nested data
+ * buffers are indented.
+ */
+static void print_vars(Databuf *response, int depth)
 {
-    int telephone_numbers_count = -1;
-    printf("MB_SUB_STATE : %s\n" , databuf_get_string(response, MB_SUB_STATE));
-    printf("MB_SUB_ID : %s\n" , databuf_get_string(response, MB_SUB_ID));
-    printf("MB_SUB_SIM_ICCD : %s\n" , databuf_get_string(response, MB_SUB_SIM_ICCD));
-    printf("MB_SUB_READY_INFO : %s\n" , databuf_get_string(response, MB_SUB_READY_INFO));
-    printf("MB_SUB_TEL_NUM : %s\n" , databuf_get_string(response, MB_SUB_TEL_NUM));
-
-    if (!databuf_get_uint(response, MB_SUB_TEL_NB, &telephone_numbers_count))
-        printf("Error : no telephone_numbers_count (MB_SUB_TEL_NUM)\n");
-    else
-        printf("Ok :telephone_numbers_count : %d\n", telephone_numbers_count);
+    const Mb_schema_var *entry;
+    Databuf_iter iter;
+    Databuf section;
+    unsigned int uint_value;
+    int32_t int_value;
+    uint64_t uint64_value;
+    int64_t int64_value;
+    char *string;
+
+    databuf_iter_init(&iter, response);
+    while (databuf_iter_next(&iter))
+    {
+        entry = mbim_schema_var(iter.var);
+        if (entry)
+            printf("%*s%s : ", depth * 2, "", entry->name);
+        else
+            printf("%*s%04x : ", depth * 2, "", iter.var);
+
+        switch (iter.type)
+        {
+            case DT_UINT:
+                if (databuf_iter_uint(&iter, &uint_value))
+                    printf("%u", uint_value);
+                break;
+
+            case DT_INT:
+                if (databuf_iter_int(&iter, &int_value))
+                    printf("%" PRId32, int_value);
+                break;
+
+            case DT_UINT64:
+                if (databuf_iter_uint64(&iter, &uint64_value))
+                    printf("%" PRIu64, uint64_value);
+                break;
+
+            case DT_INT64:
+                if (databuf_iter_int64(&iter, &int64_value))
+                    printf("%" PRId64, int64_value);
+                break;
+
+            case DT_STRING:
+                string = databuf_iter_string(&iter);
+                printf("%s", string ? string : "(invalid)");
+                break;
+
+            case DT_RAW:
+                printf("\n");
+                if (databuf_iter_databuf(&iter, &section))
+                    print_vars(&section, depth + 1);
+                continue;
+
+            default:
+                printf("%zu bytes", iter.len);
+                break;
+        }
+        printf("\n");
+    }
 }
 
-void mregister(Databuf *response)
+/**
+ * Check a response against the schema of its request and print it.
+ */
+static void print_response(Mbim_req_type mbim_req, Databuf *response)
 {
-    int register_state = -1;
-    printf("MB_REGISTER_NET_ERROR : %s\n" , databuf_get_string(response, MB_REGISTER_NET_ERROR));
-    printf("MB_REGISTER_STATE_STR : %s\n" , databuf_get_string(response, MB_REGISTER_STATE_STR));
-    printf("MB_REGISTER_MODE : %s\n" , databuf_get_string(response, MB_REGISTER_MODE));
-    printf("MB_REGISTER_DATA_CLASS : %s\n" , databuf_get_string(response, MB_REGISTER_DATA_CLASS));
-    printf("MB_REGISTER_CLASS : %s\n" , databuf_get_string(response, MB_REGISTER_CLASS));
-    printf("MB_REGISTER_PROVIDER_ID : %s\n" , databuf_get_string(response, MB_REGISTER_PROVIDER_ID));
-    printf("MB_REGISTER_PROVIDER_NAME : %s\n" , databuf_get_string(response, MB_REGISTER_PROVIDER_NAME));
-    printf("MB_REGISTER_ROAMING : %s\n" , databuf_get_string(response, MB_REGISTER_ROAMING));
-    printf("MB_REGISTER_FLAGS : %s\n" , databuf_get_string(response, MB_REGISTER_FLAGS));
-
-    if (!databuf_get_uint(response, MB_REGISTER_STATE, &register_state))
-        printf("Error : no register_state (MB_REGISTER_STATE)\n");
-    else
-        printf("Ok : register_state : %d\n", register_state);
-}
+    if (!mbim_schema_validate(mbim_req, response))
+        printf("Error : response of request %d does not follow the schema\n", mbim_req);
 
-void packet_service(Databuf *response)
-{
-    int uplink_speed = -1;
-    int downlink_speed = -1;
-
-    printf("MB_ATTACH_NET_ERROR : %s\n" , databuf_get_string(response, MB_ATTACH_NET_ERROR));
-    printf("MB_ATTACH_PCK_SERVICE_STATE : %s\n" , databuf_get_string(response, MB_ATTACH_PCK_SERVICE_STATE));
-    printf("MB_ATTACH_DATA_CLASS : %s\n" , databuf_get_string(response, MB_ATTACH_DATA_CLASS));
-    printf("MB_ATTACH_UP_SPEED_STR : %s\n" , databuf_get_string(response, MB_ATTACH_UP_SPEED_STR));
-    printf("MB_ATTACH_DOWN_SPEED_STR : %s\n" , databuf_get_string(response, MB_ATTACH_DOWN_SPEED_STR));
-
-    if (!databuf_get_uint(response, MB_ATTACH_UP_SPEED, &uplink_speed))
-        printf("Error : no uplink_speed (MB_ATTACH_UP_SPEED)\n");
-    else
-        printf("Ok : uplink_speed : %d\n", uplink_speed);
-
-    if (!databuf_get_uint(response, MB_ATTACH_DOWN_SPEED, &downlink_speed))
-        printf("Error : no downlink_speed (MB_ATTACH_DOWN_SPEED)\n");
-    else
-        printf("Ok : downlink_speed : %d\n", downlink_speed);
+    print_vars(response, 0);
 }
 
-void connected(Databuf *response)
+/**
+ * Requests sent by the client, those changing the modem state are left out.
+ */
+static bool is_query(Mbim_req_type mbim_req)
 {
-    printf("Connected !!!\n");
-}
+    switch (mbim_req)
+    {
+        case MBIM_PIN_STATUS:
+        case MBIM_SUBSCRIBER:
+        case MBIM_REGISTER:
+        case MBIM_IP:
+        case MBIM_STATUS:
+        case MBIM_DEVICE_CAPS:
+        case MBIM_PACKET_SERVICE:
+        case MBIM_SIGNAL:
+        case MBIM_FULL_STATUS:
+        case MBIM_DICTIONARY:
+            return true;
 
-void status(Databuf *response)
-{
-    int activation_state = -1;
-    int session_id = -1;
-
-    printf("MB_STATE_ACTIVATION_STR : %s\n" , databuf_get_string(response, MB_STATE_ACTIVATION_STR));
-    printf("MB_STATE_VOICE_CALL_STATE : %s\n" , databuf_get_string(response, MB_STATE_VOICE_CALL_STATE));
-    printf("MB_STATE_IP_TYPE : %s\n" , databuf_get_string(response, MB_STATE_IP_TYPE));
-    printf("MB_STATE_CONTEXT_TYPE : %s\n" , databuf_get_string(response, MB_STATE_CONTEXT_TYPE));
-    printf("MB_STATE_NETWORK_ERROR : %s\n" , databuf_get_string(response, MB_STATE_NETWORK_ERROR));
-
-    if (!databuf_get_uint(response, MB_STATE_ACTIVATION, &activation_state))
-        printf("Error : no activation_state (MB_STATE_ACTIVATION)\n");
-    else
-        printf("Ok : activation_state : %d\n", activation_state);
-
-    if (!databuf_get_uint(response, MB_STATE_SESSION_ID, &session_id))
-        printf("Error : no session_id (MB_STATE_SESSION_ID)\n");
-    else
-        printf("Ok : session_id : %d\n", session_id);
+        default:
+            return false;
+    }
 }
 
-void ip_state(Databuf *response)
+bool perform_request(nng_socket sock, Mbim_req_type mbim_req)
 {
-    int ipv4_nb = -1;
-    int ipv6_nb = -1;
-    unsigned char *ipv4 = NULL;
-    unsigned char *ipv6 = NULL;
+    Databuf request = {0};
+    Databuf response = {0};
 
-    if (!databuf_get_uint(response, MB_IPV4_NB, &ipv4_nb))
-        printf("Error : no ipv4_nb (MB_IPV4_NB)\n");
-    else
-        printf("Ok : ipv4_nb : %d\n", ipv4_nb);
+    if (!is_query(mbim_req))
+        return true;
 
-    if (!databuf_get_uint(response, MB_IPV6_NB, &ipv6_nb))
-        printf("Error : no ipv6_nb (MB_IPV6_NB)\n");
-    else
-        printf("Ok : ipv6_nb : %d\n", ipv6_nb);
+    databuf_init_msg(&request);
 
-    printf("MB_IPV4_GW : %s\n" , databuf_get_string(response, MB_IPV4_GW));
-    printf("MB_IPV6_GW : %s\n" , databuf_get_string(response, MB_IPV6_GW));
+    mb_add_request(&request, mbim_req);
 
-    for (int i = 0; i < ipv4_nb; i++)
+    if (!get_resp(sock, &request, &response))
     {
-        ipv4 = databuf_get_next_string(response, MB_IPV4_ADDR, ipv4);
-        printf("MB_IPV4_ADDR : %s\n" , ipv4);
+        databuf_free(&request);
+        return false;
     }
 
-    for (int i = 0; i < ipv6_nb; i++)
-    {
-        ipv6 = databuf_get_next_string(response, MB_IPV6_ADDR, ipv6);
-        printf("MB_IPV6_ADDR : %s\n" , ipv6);
-    }
-}
+    print_response(mbim_req, &response);
 
-void device_caps(Databuf *response)
-{
-    int max_sessions = -1;
-    if (!databuf_get_uint(response, MB_DEV_MAX_SESSION, &max_sessions))
-        printf("Error : no max_sessions (MB_DEV_MAX_SESSION)\n");
-    else
-        printf("Ok : max_sessions : %d\n", max_sessions);
-
-    printf("MB_DEV_TYPE : %s\n" , databuf_get_string(response, MB_DEV_TYPE));
-    printf("MB_DEV_CELL_CLASS : %s\n" , databuf_get_string(response, MB_DEV_CELL_CLASS));
-    printf("MB_DEV_VOICE_CLASS : %s\n" , databuf_get_string(response, MB_DEV_VOICE_CLASS));
-    printf("MB_DEV_SIM_CLASS : %s\n" , databuf_get_string(response, MB_DEV_SIM_CLASS));
-    printf("MB_DEV_DATA_CLASS : %s\n" , databuf_get_string(response, MB_DEV_DATA_CLASS));
-    printf("MB_DEV_SMS_CAPS : %s\n" , databuf_get_string(response, MB_DEV_SMS_CAPS));
-    printf("MB_DEV_CTRL_CAPS : %s\n" , databuf_get_string(response, MB_DEV_CTRL_CAPS));
-    printf("MB_DEV_CUST_DATA_CLASS : %s\n" , databuf_get_string(response, MB_DEV_CUST_DATA_CLASS));
-    printf("MB_DEV_ID : %s\n" , databuf_get_string(response, MB_DEV_ID));
-    printf("MB_DEV_FMW_INFO : %s\n" , databuf_get_string(response, MB_DEV_FMW_INFO));
-    printf("MB_DEV_HW_INFO : %s\n" , databuf_get_string(response, MB_DEV_HW_INFO));
-}
+    databuf_free(&request);
+    databuf_free(&response);
 
-void signal_state(Databuf *response)
-{
-    int rssi = -1;
-    int error_rate = -1;
-    int rscp = -1;
-    int ecno = -1;
-    int rsrq = -1;
-    int rsrp = -1;
-    int rssnr = -1;
-
-    if (!databuf_get_uint(response, MB_SIGNAL_RSSI, &rssi))
-        printf("Error : no rssi (MB_SIGNAL_RSSI)\n");
-    else
-        printf("Ok : rssi : %d\n", rssi);
-
-    if (!databuf_get_uint(response, MB_SIGNAL_ERROR_RATE, &error_rate))
-        printf("Error : no error_rate (MB_SIGNAL_ERROR_RATE)\n");
-    else
-        printf("Ok : error_rate : %d\n", error_rate);
-
-    if (!databuf_get_uint(response, MB_SIGNAL_RSCP, &rscp))
-        printf("Error : no rscp (MB_SIGNAL_RSCP)\n");
-    else
-        printf("Ok : rscp : %d\n", rscp);
-
-    if (!databuf_get_uint(response, MB_SIGNAL_ECNO, &ecno))
-        printf("Error : no ecno (MB_SIGNAL_ECNO)\n");
-    else
-        printf("Ok : ecno : %d\n", ecno);
-
-    if (!databuf_get_uint(response, MB_SIGNAL_RSRQ, &rsrq))
-        printf("Error : no rsrq (MB_SIGNAL_RSRQ)\n");
-    else
-        printf("Ok : rsrq : %d\n", rsrq);
-
-    if (!databuf_get_uint(response, MB_SIGNAL_RSRP, &rsrp))
-        printf("Error : no rsrp (MB_SIGNAL_RSRP)\n");
-    else
-        printf("Ok : rsrp : %d\n", rsrp);
-
-    if (!databuf_get_uint(response, MB_SIGNAL_RSSNR, &rssnr))
-        printf("Error : no rssnr (MB_SIGNAL_RSSNR)\n");
-    else
-        printf("Ok : rssnr : %d\n", rssnr);
+    return true;
 }
 
-typedef void (*callback)(Databuf *response);
-
-bool perform_request(nng_socket sock, Mbim_req_type mbim_req)
+bool perform_projected(nng_socket sock)
 {
     Databuf request = {0};
     Databuf response = {0};
-    callback cb = NULL;
+    unsigned int rssi = 0;
+    unsigned int error_rate = 0;
 
-    databuf_init(&request);
-
-    databuf_add_uint(&request, MB_REQUEST, mbim_req);
-    switch (mbim_req)
-    {
-        case MBIM_PIN_STATUS:
-            cb = pin_status;
-            break;
+    databuf_init_msg(&request);
 
-        case MBIM_SUBSCRIBER:
-            cb = subscriber;
-            break;
+    // Only the two values are formatted and sent back
+    mb_add_request(&request, MBIM_SIGNAL);
+    mb_add_field(&request, MB_SIGNAL_RSSI);
+    mb_add_field(&request, MB_SIGNAL_ERROR_RATE);
 
-        case MBIM_REGISTER:
-            cb = mregister;
-            break;
+    if (!get_resp(sock, &request, &response))
+    {
+        databuf_free(&request);
+        return false;
+    }
 
-        case MBIM_IP:
-            cb = ip_state;
-            break;
+    mb_get_signal_rssi(&response, &rssi);
+    mb_get_signal_error_rate(&response, &error_rate);
+    printf("Projected signal : rssi %u, error rate %u\n", rssi, error_rate);
 
-        case MBIM_STATUS:
-            cb = status;
-            break;
+    databuf_free(&request);
+    databuf_free(&response);
 
-        case MBIM_DEVICE_CAPS:
-            cb = device_caps;
-            break;
+    return true;
+}
 
-        case MBIM_PACKET_SERVICE:
-            cb = packet_service;
-            break;
+bool perform_batch(nng_socket sock)
+{
+    Databuf request = {0};
+    Databuf response = {0};
+    Databuf section = {0};
+    unsigned char *prev = NULL;
 
-        case MBIM_SIGNAL:
-            cb = signal_state;
-            break;
+    databuf_init_msg(&request);
 
-        default:
-            databuf_free(&request);
-            return true;
+    for (int i = MBIM_PIN_STATUS; i < MBIM_UNKOWN; i++)
+    {
+        if (is_query(i) && i != MBIM_DICTIONARY)
+            mb_add_request(&request, i);
     }
 
     if (!get_resp(sock, &request, &response))
@@ -316,7 +266,17 @@ bool perform_request(nng_socket sock, Mbim_req_type mbim_req)
         return false;
     }
 
-    cb(&response);
+    while ((prev = (unsigned char *) mb_get_next_batch_response(&response, &section, prev)) != NULL)
+    {
+        unsigned int mbim_req = MBIM_UNKOWN;
+        unsigned int status = MBIM_ERROR;
+
+        mb_get_request(&section, &mbim_req);
+        mb_get_response(&section, &status);
+        printf("Batch request %u : %s\n", mbim_req, status == MBIM_OK ? "MBIM_OK" : mb_get_error(&section));
+        if (status == MBIM_OK)
+            print_response(mbim_req, &section);
+    }
 
     databuf_free(&request);
     databuf_free(&response);
@@ -324,8 +284,122 @@ bool perform_request(nng_socket sock, Mbim_req_type mbim_req)
     return true;
 }
 
+bool perform_pipelined(void)
+{
+    Req_call *calls[MBIM_UNKOWN] = {0};
+    Req_client *client;
+
+    client = req_client_open(NNG_IPC_PREFIX NNG_SOCKET, g_compact);
+    if (!client)
+        return false;
+
+    // All the queries are outstanding together on the connection
+    for (int i = MBIM_PIN_STATUS; i < MBIM_UNKOWN; i++)
+    {
+        Databuf request = {0};
+
+        if (!is_query(i))
+            continue;
+
+        databuf_init_msg(&request);
+        mb_add_request(&request, i);
+        calls[i] = req_client_call(client, &request, GET_MOB_INFO_RETRY_TIMEOUT_MS);
+        databuf_free(&request);
+    }
+
+    for (int i = MBIM_PIN_STATUS; i < MBIM_UNKOWN; i++)
+    {
+        Databuf response = {0};
+        int ret;
+
+        if (!calls[i])
+            continue;
+
+        ret = req_call_wait(calls[i], &response);
+        if (ret != 0)
+        {
+            printf("Pipelined request %d failed: %s\n", i, nng_strerror(ret));
+            continue;
+        }
+
+        printf("Pipelined request %d\n", i);
+        if (check_resp(&response))
+        {
+            print_response(i, &response);
+            databuf_free(&response);
+        }
+    }
+
+    req_client_close(client);
+
+    return true;
+}
+
+int watch(void)
+{
+    const char *topics[] = {MB_TOPIC_SIGNAL, MB_TOPIC_REGISTER, MB_TOPIC_CONNECT, MB_TOPIC_SIM};
+    nng_socket sock;
+    int ret = nng_sub0_open(&sock);
+    if (ret != 0)
+    {
+        printf("Failed to open socket: %s\n", nng_strerror(ret));
+        return 1;
+    }
+
+    for (int i = 0; i < sizeof(topics) / sizeof(topics[0]); i++)
+        nng_socket_set(sock, NNG_OPT_SUB_SUBSCRIBE, topics[i], strlen(topics[i]));
+
+    ret = nng_dial(sock, NNG_IPC_PREFIX NNG_NOTIFY_SOCKET, NULL, NNG_FLAG_NONBLOCK);
+    if (ret != 0)
+    {
+        printf("Failed to dial to socket: %s\n", nng_strerror(ret));
+        nng_close(sock);
+        return 1;
+    }
+
+    while (true)
+    {
+        unsigned char *buf = NULL;
+        size_t size = 0;
+        size_t topic_len;
+        Databuf notification = {0};
+        unsigned int mbim_req = MBIM_UNKOWN;
+
+        ret = nng_recv(sock, &buf, &size, NNG_FLAG_ALLOC);
+        if (ret != 0)
+        {
+            printf("Failed to receive data: %s\n", nng_strerror(ret));
+            break;
+        }
+
+        // The notification is the topic, its NUL and the databuf
+        topic_len = strnlen((char *) buf, size) + 1;
+        notification.buf = buf + topic_len;
+        notification.len = size > topic_len ? size - topic_len : 0;
+        notification.size = notification.len;
+
+        if (databuf_is_valid(&notification))
+        {
+            mb_get_request(&notification, &mbim_req);
+            printf("Notification %s\n", (char *) buf);
+            print_response(mbim_req, &notification);
+        }
+
+        nng_free(buf, size);
+    }
+
+    nng_close(sock);
+
+    return 1;
+}
+
 int main(int argc, char *argv[])
 {
+    if (argc > 1 && strcmp(argv[1], "watch") == 0)
+        return watch();
+
+    g_compact = argc > 1 && strcmp(argv[1], "compact") == 0;
+
     nng_socket sock;
     int ret = nng_req0_open(&sock);
     if (ret != 0)
@@ -357,7 +431,12 @@ int main(int argc, char *argv[])
         perform_request(sock, i);
         sleep(1);
     }
+
+    perform_batch(sock);
+    perform_projected(sock);
     nng_close(sock);
 
+    perform_pipelined();
+
     return 0;
 }
@@ -0,0 +1,375 @@
+/**
+ * @file
+ * @brief Response cache of the read-only requests
+ * @ccmod{MBIM_X_SRV}
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+#include "nng/supplemental/util/platform.h"
+
+/*
+ * The server drives a single device (MBIM_NNG_DEVICE), entries are keyed by
+ * protocol, request type and MB_CODES, and hold the serialized response as
+ * sent. A projected response only holds the MB_FIELD variables, it is kept
+ * with its field set and only serves requests asking for the same fields.
+ * Each key has MBIM_NNG_CACHE_WAYS entries, so the full response and a few
+ * projections are cached side by side, the oldest one is replaced first.
+ *
+ * The generation is bumped by every invalidation, a response is only stored
+ * if none happened since its request was submitted, see cache_put().
+ *
+ * The compact encoding of a response is built by its first hit on a compact
+ * connection and kept beside it, the later hits are sent without conversion.
+ */
+typedef struct cache_entry
+{
+    unsigned char *buf;
+    size_t len;
+    unsigned char *compact; // Compact encoding of buf, NULL until asked
+    size_t compact_len;
+    nng_time expire;
+    bool projected;
+    uint32_t fields[MB_FIELD_WORDS];
+} Cache_entry;
+
+static nng_mtx *g_mtx;
+static unsigned int g_generation;
+static Cache_entry g_entries[MB_PROT_UNKOWN][MBIM_UNKOWN][2][MBIM_NNG_CACHE_WAYS];
+static unsigned int g_ttl[MBIM_UNKOWN] = {
+    [MBIM_PIN_STATUS] = MBIM_NNG_CACHE_TTL_PIN_STATUS,
+    [MBIM_SUBSCRIBER] = MBIM_NNG_CACHE_TTL_SUBSCRIBER,
+    [MBIM_REGISTER] = MBIM_NNG_CACHE_TTL_REGISTER,
+    [MBIM_DEVICE_CAPS] = MBIM_NNG_CACHE_TTL_DEVICE_CAPS,
+    [MBIM_SIGNAL] = MBIM_NNG_CACHE_TTL_SIGNAL,
+    [MBIM_DICTIONARY] = MBIM_NNG_CACHE_TTL_DICTIONARY,
+};
+
+/**
+ * Get the entries of a request, if it can be cached.
+ *
+ * @param proto Request protocol
+ * @param type  Request type
+ * @param codes Enumerations sent as codes
+ *
+ * @return Pointer to the MBIM_NNG_CACHE_WAYS entries, NULL if the request is not cached
+ */
+static Cache_entry *cache_entry(Mbim_protocol proto, Mbim_req_type type, bool codes)
+{
+    if (!g_mtx || proto >= MB_PROT_UNKOWN || type >= MBIM_UNKOWN || !g_ttl[type])
+        return NULL;
+
+    return g_entries[proto][type][codes];
+}
+
+/**
+ * Check if the response of a request only depends on its type and field set.
+ * A dictionary restricted with MB_DICT_VAR is not cached.
+ *
+ * @param request Pointer to the request
+ *
+ * @return True if the response can be cached
+ */
+static bool cache_request_cacheable(const Mbim_request *request)
+{
+    unsigned int var;
+
+    return request->type != MBIM_DICTIONARY || !mb_get_next_dict_var((Databuf *) &request->req, &var, NULL);
+}
+
+/**
+ * Release the response held by an entry, the lock must be held.
+ *
+ * @param entry Pointer to the entry
+ */
+static void cache_entry_clear(Cache_entry *entry)
+{
+    free(entry->buf);
+    free(entry->compact);
+    entry->buf = NULL;
+    entry->len = 0;
+    entry->compact = NULL;
+    entry->compact_len = 0;
+    entry->expire = 0;
+}
+
+/**
+ * Build the compact encoding of the response held by an entry, the lock must
+ * be held. The entry is left without it on failure.
+ *
+ * @param entry Pointer to the entry
+ */
+static void cache_entry_compact(Cache_entry *entry)
+{
+    Databuf resp = {.buf = entry->buf, .size = entry->len, .len = entry->len};
+    Databuf copy = {0};
+
+    if (!databuf_init(&copy))
+        return;
+
+    databuf_merge(&copy, &resp, NULL, 0);
+    if (databuf_compact(&copy))
+    {
+        entry->compact = malloc(copy.len);
+        if (entry->compact)
+        {
+            memcpy(entry->compact, copy.buf, copy.len);
+            entry->compact_len = copy.len;
+        }
+    }
+
+    databuf_free(&copy);
+}
+
+/**
+ * Check if an entry holds the fields of a request, the lock must be held.
+ *
+ * @param entry   Pointer to the entry
+ * @param request Pointer to the request
+ *
+ * @return True if the projections are the same
+ */
+static bool cache_entry_matches(const Cache_entry *entry, const Mbim_request *request)
+{
+    if (entry->projected != request->projected)
+        return false;
+
+    return !entry->projected || memcmp(entry->fields, request->fields, sizeof(entry->fields)) == 0;
+}
+
+/**
+ * Pick the entry to store the response of a request in, the one of the same
+ * fields, else a free or expired one, else the oldest. The lock must be held.
+ *
+ * @param entries Pointer to the entries of the request
+ * @param request Pointer to the request
+ *
+ * @return Pointer to the entry
+ */
+static Cache_entry *cache_entry_victim(Cache_entry *entries, const Mbim_request *request)
+{
+    Cache_entry *victim = &entries[0];
+    nng_time now = nng_clock();
+    int i;
+
+    for (i = 0; i < MBIM_NNG_CACHE_WAYS; i++)
+    {
+        if (entries[i].buf && cache_entry_matches(&entries[i], request))
+            return &entries[i];
+    }
+
+    for (i = 0; i < MBIM_NNG_CACHE_WAYS; i++)
+    {
+        if (!entries[i].buf || now >= entries[i].expire)
+            return &entries[i];
+
+        if (entries[i].expire < victim->expire)
+            victim = &entries[i];
+    }
+
+    return victim;
+}
+
+/**
+ * Initialize the response cache.
+ *
+ * @return True on success, otherwise false
+ */
+bool cache_init(void)
+{
+    int ret;
+
+    if ((ret = nng_mtx_alloc(&g_mtx)) != 0)
+    {
+        printf("Cache : Unable to allocate lock [%d] : %s\n", ret, nng_strerror(ret));
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Release the cached responses and the cache lock.
+ */
+void cache_free(void)
+{
+    if (!g_mtx)
+        return;
+
+    cache_clear();
+    nng_mtx_free(g_mtx);
+    g_mtx = NULL;
+}
+
+/**
+ * Set the time to live of the responses of a request type.
+ *
+ * @param type   Request type
+ * @param ttl_ms Time to live in ms, 0 disables caching for the type
+ */
+void cache_set_ttl(Mbim_req_type type, unsigned int ttl_ms)
+{
+    if (type < MBIM_UNKOWN)
+        g_ttl[type] = ttl_ms;
+}
+
+/**
+ * Get the generation of the cache, captured when a request is submitted.
+ *
+ * @return Number of invalidations so far
+ */
+unsigned int cache_generation(void)
+{
+    unsigned int generation;
+
+    if (!g_mtx)
+        return 0;
+
+    nng_mtx_lock(g_mtx);
+    generation = g_generation;
+    nng_mtx_unlock(g_mtx);
+
+    return generation;
+}
+
+/**
+ * Write a valid cached response into a reply message.
+ *
+ * @param request Pointer to the request
+ * @param msg     Reply message, its body is only replaced on a hit
+ * @param compact Write the compact encoding of the response
+ *
+ * @return True if the response was found and written, otherwise false
+ */
+bool cache_get(const Mbim_request *request, nng_msg *msg, bool compact)
+{
+    Cache_entry *entries = cache_entry(request->proto, request->type, request->codes);
+    Cache_entry *entry;
+    bool found = false;
+    int i;
+
+    if (!entries || !cache_request_cacheable(request))
+        return false;
+
+    nng_mtx_lock(g_mtx);
+    for (i = 0; i < MBIM_NNG_CACHE_WAYS; i++)
+    {
+        entry = &entries[i];
+        if (entry->buf && nng_clock() < entry->expire && cache_entry_matches(entry, request))
+        {
+            if (compact && !entry->compact)
+                cache_entry_compact(entry);
+
+            nng_msg_clear(msg);
+            if (compact && entry->compact)
+                found = nng_msg_append(msg, entry->compact, entry->compact_len) == 0;
+            else
+                found = nng_msg_append(msg, entry->buf, entry->len) == 0;
+            break;
+        }
+    }
+    nng_mtx_unlock(g_mtx);
+
+    return found;
+}
+
+/**
+ * Store a successful response, unless the cache was invalidated while the
+ * request was in flight: the response may predate the change.
+ *
+ * @param request Pointer to the completed request, cache_gen set at submit
+ */
+void cache_put(const Mbim_request *request)
+{
+    Cache_entry *entries = cache_entry(request->proto, request->type, request->codes);
+    Cache_entry *entry;
+    const Databuf *resp = &request->resp;
+    unsigned char *buf;
+    unsigned int status = MBIM_ERROR;
+
+    if (!entries || !resp->buf || !cache_request_cacheable(request))
+        return;
+
+    mb_get_response((Databuf *) resp, &status);
+    if (status != MBIM_OK)
+        return;
+
+    buf = malloc(resp->len);
+    if (!buf)
+        return;
+
+    memcpy(buf, resp->buf, resp->len);
+
+    nng_mtx_lock(g_mtx);
+    if (request->cache_gen != g_generation)
+    {
+        nng_mtx_unlock(g_mtx);
+        free(buf);
+        return;
+    }
+
+    entry = cache_entry_victim(entries, request);
+    cache_entry_clear(entry);
+    entry->buf = buf;
+    entry->len = resp->len;
+    entry->expire = nng_clock() + g_ttl[request->type];
+    entry->projected = request->projected;
+    memcpy(entry->fields, request->fields, sizeof(entry->fields));
+    nng_mtx_unlock(g_mtx);
+}
+
+/**
+ * Drop the cached response of a request, used when its values change.
+ *
+ * @param proto Request protocol
+ * @param type  Request type
+ */
+void cache_invalidate(Mbim_protocol proto, Mbim_req_type type)
+{
+    Cache_entry *entries = cache_entry(proto, type, false);
+    Cache_entry *codes = cache_entry(proto, type, true);
+    int i;
+
+    if (!entries)
+        return;
+
+    nng_mtx_lock(g_mtx);
+    g_generation++;
+    for (i = 0; i < MBIM_NNG_CACHE_WAYS; i++)
+    {
+        cache_entry_clear(&entries[i]);
+        cache_entry_clear(&codes[i]);
+    }
+    nng_mtx_unlock(g_mtx);
+}
+
+/**
+ * Drop every cached response, used when the modem state changes.
+ */
+void cache_clear(void)
+{
+    int proto;
+    int type;
+    int codes;
+    int i;
+
+    if (!g_mtx)
+        return;
+
+    nng_mtx_lock(g_mtx);
+    g_generation++;
+    for (proto = 0; proto < MB_PROT_UNKOWN; proto++)
+    {
+        for (type = 0; type < MBIM_UNKOWN; type++)
+        {
+            for (codes = 0; codes < 2; codes++)
+            {
+                for (i = 0; i < MBIM_NNG_CACHE_WAYS; i++)
+                    cache_entry_clear(&g_entries[proto][type][codes][i]);
+            }
+        }
+    }
+    nng_mtx_unlock(g_mtx);
+}
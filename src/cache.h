@@ -0,0 +1,53 @@
+#ifndef MBIM_NNG_CACHE_H
+#define MBIM_NNG_CACHE_H
+
+#include <stdbool.h>
+#include "nng/nng.h"
+
+#include "databuf.h"
+#include "mbim.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Default time to live of the cached responses in ms, 0 disables the cache
+#ifndef MBIM_NNG_CACHE_TTL_PIN_STATUS
+#define MBIM_NNG_CACHE_TTL_PIN_STATUS 2000
+#endif
+#ifndef MBIM_NNG_CACHE_TTL_SUBSCRIBER
+#define MBIM_NNG_CACHE_TTL_SUBSCRIBER 10000
+#endif
+#ifndef MBIM_NNG_CACHE_TTL_REGISTER
+#define MBIM_NNG_CACHE_TTL_REGISTER 2000
+#endif
+#ifndef MBIM_NNG_CACHE_TTL_DEVICE_CAPS
+#define MBIM_NNG_CACHE_TTL_DEVICE_CAPS 600000
+#endif
+#ifndef MBIM_NNG_CACHE_TTL_SIGNAL
+#define MBIM_NNG_CACHE_TTL_SIGNAL 1000
+#endif
+#ifndef MBIM_NNG_CACHE_TTL_DICTIONARY
+#define MBIM_NNG_CACHE_TTL_DICTIONARY 3600000
+#endif
+
+// Responses kept per request type, one per field set of the projections
+#ifndef MBIM_NNG_CACHE_WAYS
+#define MBIM_NNG_CACHE_WAYS 4
+#endif
+
+bool cache_init(void);
+void cache_free(void);
+void cache_set_ttl(Mbim_req_type type, unsigned int ttl_ms);
+
+unsigned int cache_generation(void);
+bool cache_get(const Mbim_request *request, nng_msg *msg, bool compact);
+void cache_put(const Mbim_request *request);
+void cache_invalidate(Mbim_protocol proto, Mbim_req_type type);
+void cache_clear(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // MBIM_NNG_CACHE_H
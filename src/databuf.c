@@ -9,8 +9,18 @@
 #include <time.h>
 
 #include "databuf.h"
+#include "nng/supplemental/util/platform.h"
 
 #define CHUNK_SIZE 512
+#define POOL_CLASSES 8 // Buffers of CHUNK_SIZE up to CHUNK_SIZE << 7
+
+// Free buffers kept per size class
+#ifndef DATABUF_POOL_DEPTH
+#define DATABUF_POOL_DEPTH 16
+#endif
+#define INDEX_MIN_ENTRIES 16
+#define VARINT_MAX 10
+#define INDEX_NONE UINT32_MAX
 
 typedef struct data_var
 {
@@ -18,6 +28,360 @@ typedef struct data_var
     uint32_t size;
 } Data_var;
 
+typedef struct index_entry
+{
+    uint32_t var;
+    uint32_t offset; // Offset of the value in the buffer
+    uint32_t next;   // Next entry of the same variable
+} Index_entry;
+
+typedef struct index_slot
+{
+    uint32_t var;
+    uint32_t first;
+    uint32_t last;
+} Index_slot;
+
+struct databuf_index
+{
+    uint32_t mask;
+    uint32_t nb_entries;
+    uint32_t max_entries;
+    uint32_t last; // Entry of the last value returned, a lookup of the next one starts from it
+    size_t size;   // Size of the block holding the index, its slots and entries
+    bool pooled;
+    Index_slot *slots;
+    Index_entry *entries;
+};
+
+typedef struct pool_class
+{
+    unsigned char *free[DATABUF_POOL_DEPTH];
+    int nb_free;
+} Pool_class;
+
+static nng_mtx *g_pool_mtx;
+static Pool_class g_pool[POOL_CLASSES];
+static size_t g_pool_misses;
+
+/**
+ * Get the size class of a buffer size
+ *
+ * @param size Buffer size
+ *
+ * @return The size class, POOL_CLASSES if the size is too big for the pool
+ */
+static int pool_class(size_t size)
+{
+    int class = 0;
+
+    while (class < POOL_CLASSES && ((size_t) CHUNK_SIZE << class) < size)
+        class++;
+
+    return class;
+}
+
+/**
+ * Get a buffer of at least size bytes from the pool
+ *
+ * @param size Minimum buffer size
+ * @param class_size Pointer to store the size of the buffer
+ *
+ * @return The buffer, or NULL if the pool is not initialized or the size too big
+ */
+static unsigned char *pool_get(size_t size, size_t *class_size)
+{
+    unsigned char *buffer = NULL;
+    int class = pool_class(size);
+
+    if (!g_pool_mtx || class == POOL_CLASSES)
+        return NULL;
+
+    nng_mtx_lock(g_pool_mtx);
+    if (g_pool[class].nb_free > 0)
+        buffer = g_pool[class].free[--g_pool[class].nb_free];
+    else
+        g_pool_misses++;
+    nng_mtx_unlock(g_pool_mtx);
+
+    if (!buffer)
+        buffer = malloc((size_t) CHUNK_SIZE << class);
+
+    *class_size = (size_t) CHUNK_SIZE << class;
+
+    return buffer;
+}
+
+/**
+ * Give a buffer back to the pool
+ *
+ * @param buffer Buffer from pool_get()
+ * @param size Size of the buffer
+ */
+static void pool_put(unsigned char *buffer, size_t size)
+{
+    int class = pool_class(size);
+
+    nng_mtx_lock(g_pool_mtx);
+    if (g_pool[class].nb_free < DATABUF_POOL_DEPTH)
+    {
+        g_pool[class].free[g_pool[class].nb_free++] = buffer;
+        buffer = NULL;
+    }
+    nng_mtx_unlock(g_pool_mtx);
+
+    free(buffer);
+}
+
+/**
+ * Initialize the buffer pool, data buffers are then recycled
+ *
+ * Without the pool, data buffers are allocated with malloc.
+ *
+ * @return True on success, otherwise false
+ */
+bool databuf_pool_init(void)
+{
+    int ret;
+
+    if ((ret = nng_mtx_alloc(&g_pool_mtx)) != 0)
+    {
+        printf("Error: databuf pool lock allocation failed [%d] : %s\n", ret, nng_strerror(ret));
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Release the buffers of the pool, no data buffer from the pool may be in use
+ */
+void databuf_pool_free(void)
+{
+    int class;
+
+    if (!g_pool_mtx)
+        return;
+
+    for (class = 0; class < POOL_CLASSES; class++)
+    {
+        while (g_pool[class].nb_free > 0)
+            free(g_pool[class].free[--g_pool[class].nb_free]);
+    }
+
+    nng_mtx_free(g_pool_mtx);
+    g_pool_mtx = NULL;
+}
+
+/**
+ * Get the number of buffers the pool had to allocate, its misses. Only the
+ * pooled data buffers count: the nng messages of databuf_init_msg() and any
+ * other allocation of the caller are not seen by the pool.
+ *
+ * @return The number of misses, it stops growing once the pool is warm
+ */
+size_t databuf_pool_misses(void)
+{
+    size_t misses;
+
+    if (!g_pool_mtx)
+        return 0;
+
+    nng_mtx_lock(g_pool_mtx);
+    misses = g_pool_misses;
+    nng_mtx_unlock(g_pool_mtx);
+
+    return misses;
+}
+
+/**
+ * Allocate a buffer from the pool, or with malloc if the pool cannot serve it
+ *
+ * @param size Minimum buffer size
+ * @param capacity Pointer to store the size of the buffer
+ * @param pooled Pointer to store whether the buffer comes from the pool
+ *
+ * @return The buffer, or NULL on failure
+ */
+static void *databuf_alloc(size_t size, size_t *capacity, bool *pooled)
+{
+    void *buffer = pool_get(size, capacity);
+
+    *pooled = buffer != NULL;
+    if (!buffer)
+    {
+        buffer = malloc(size);
+        *capacity = size;
+    }
+
+    return buffer;
+}
+
+/**
+ * Release a buffer from databuf_alloc()
+ *
+ * @param buffer The buffer
+ * @param capacity Size of the buffer
+ * @param pooled Whether the buffer comes from the pool
+ */
+static void databuf_release(void *buffer, size_t capacity, bool pooled)
+{
+    if (pooled)
+        pool_put(buffer, capacity);
+    else
+        free(buffer);
+}
+
+/**
+ * Find the slot of a variable in the index
+ *
+ * @param index Pointer to the index
+ * @param var Variable identifier
+ *
+ * @return Pointer to the slot of the variable, or to the empty slot where it would be
+ */
+static Index_slot *databuf_index_slot(Databuf_index *index, unsigned int var)
+{
+    // Variables differ by their upper bytes, the low byte is the data type
+    uint32_t i = ((var >> 8) * 2654435761u) & index->mask;
+
+    while (index->slots[i].first != INDEX_NONE && index->slots[i].var != var)
+        i = (i + 1) & index->mask;
+
+    return &index->slots[i];
+}
+
+/**
+ * Retrieve data from the data buffer using its index
+ *
+ * @param buf Pointer to the data buffer structure, indexed
+ * @param var Variable identifier for the data type
+ * @param prev Pointer to the previous value used for searching (NULL if starting from beginning)
+ *
+ * @return Pointer to the retrieved data, or NULL if not found
+ */
+static unsigned char *databuf_index_get(Databuf *buf, unsigned int var, unsigned char *prev)
+{
+    Databuf_index *index = buf->index;
+    Index_slot *slot;
+    uint32_t entry;
+
+    // Iterating over a repeated variable resumes from the last value returned
+    if (prev && index->last != INDEX_NONE && index->entries[index->last].var == var &&
+        buf->buf + index->entries[index->last].offset == prev)
+        entry = index->entries[index->last].next;
+    else
+    {
+        slot = databuf_index_slot(index, var);
+        entry = slot->first;
+        while (prev && entry != INDEX_NONE && buf->buf + index->entries[entry].offset <= prev)
+            entry = index->entries[entry].next;
+    }
+
+    if (entry == INDEX_NONE)
+        return NULL;
+
+    index->last = entry;
+
+    return buf->buf + index->entries[entry].offset;
+}
+
+/**
+ * Allocate an empty index
+ *
+ * @param max_entries Number of entries the index can hold
+ *
+ * @return The index, or NULL on failure
+ */
+static Databuf_index *databuf_index_alloc(uint32_t max_entries)
+{
+    Databuf_index *index;
+    uint32_t nb_slots = 2 * INDEX_MIN_ENTRIES;
+    size_t size;
+    bool pooled;
+    uint32_t i;
+
+    // Keep the table at most half full
+    while (nb_slots < 2 * max_entries)
+        nb_slots <<= 1;
+
+    index = databuf_alloc(sizeof(*index) + nb_slots * sizeof(Index_slot) + max_entries * sizeof(Index_entry), &size, &pooled);
+    if (!index)
+        return NULL;
+
+    index->mask = nb_slots - 1;
+    index->nb_entries = 0;
+    index->max_entries = max_entries;
+    index->last = INDEX_NONE;
+    index->size = size;
+    index->pooled = pooled;
+    index->slots = (Index_slot *) (index + 1);
+    index->entries = (Index_entry *) (index->slots + nb_slots);
+    for (i = 0; i < nb_slots; i++)
+        index->slots[i].first = INDEX_NONE;
+
+    return index;
+}
+
+/**
+ * Link an entry at the end of the chain of its variable
+ *
+ * @param index Pointer to the index
+ * @param entry The entry
+ */
+static void databuf_index_link(Databuf_index *index, uint32_t entry)
+{
+    Index_slot *slot = databuf_index_slot(index, index->entries[entry].var);
+
+    index->entries[entry].next = INDEX_NONE;
+    if (slot->first == INDEX_NONE)
+    {
+        slot->var = index->entries[entry].var;
+        slot->first = entry;
+    }
+    else
+        index->entries[slot->last].next = entry;
+    slot->last = entry;
+}
+
+/**
+ * Add a variable to the index, growing it when full
+ *
+ * @param pindex Pointer to the index, replaced when it grows
+ * @param var Variable identifier
+ * @param offset Offset of the value in the buffer
+ *
+ * @return True on success, otherwise false
+ */
+static bool databuf_index_add(Databuf_index **pindex, uint32_t var, uint32_t offset)
+{
+    Databuf_index *index = *pindex;
+    Databuf_index *grown;
+    uint32_t i;
+
+    if (index->nb_entries == index->max_entries)
+    {
+        grown = databuf_index_alloc(2 * index->max_entries);
+        if (!grown)
+            return false;
+
+        memcpy(grown->entries, index->entries, index->nb_entries * sizeof(Index_entry));
+        grown->nb_entries = index->nb_entries;
+        for (i = 0; i < grown->nb_entries; i++)
+            databuf_index_link(grown, i);
+
+        databuf_release(index, index->size, index->pooled);
+        *pindex = index = grown;
+    }
+
+    index->entries[index->nb_entries].var = var;
+    index->entries[index->nb_entries].offset = offset;
+    databuf_index_link(index, index->nb_entries);
+    index->nb_entries++;
+
+    return true;
+}
+
 /**
  * Reallocate memory for the data buffer
  *
@@ -29,10 +393,40 @@ typedef struct data_var
 static bool databuf_realloc(Databuf *buf, size_t size)
 {
     unsigned char *new_buf;
-    size_t new_size = buf->size;
+    size_t new_size = buf->size ? buf->size : CHUNK_SIZE;
 
+    // Grow geometrically, a large response only reallocates a few times
     while (size > new_size)
-        new_size += CHUNK_SIZE;
+        new_size *= 2;
+
+    // The message body length follows the buffer size, it is trimmed when the message is taken
+    if (buf->msg)
+    {
+        if (nng_msg_realloc(buf->msg, new_size) != 0)
+            return false;
+
+        buf->buf = nng_msg_body(buf->msg);
+        buf->size = new_size;
+        return true;
+    }
+
+    if (buf->pooled)
+    {
+        bool pooled;
+
+        // Too big for the pool, the buffer is then allocated on its own
+        new_buf = databuf_alloc(new_size, &new_size, &pooled);
+        if (!new_buf)
+            return false;
+
+        memcpy(new_buf, buf->buf, buf->len);
+        pool_put(buf->buf, buf->size);
+
+        buf->buf = new_buf;
+        buf->size = new_size;
+        buf->pooled = pooled;
+        return true;
+    }
 
     new_buf = (unsigned char *) realloc(buf->buf, new_size);
     if (!new_buf)
@@ -63,6 +457,8 @@ static size_t databuf_add(Databuf *buf, unsigned int var, const void *value, siz
     if (!buf || !buf->buf)
         return 0;
 
+    databuf_unindex(buf);
+
     size = buf->len + len + sizeof(datavar);
     if (size > buf->size && !databuf_realloc(buf, size))
         return 0;
@@ -105,8 +501,11 @@ static unsigned char *databuf_get(Databuf *buf, unsigned int var, unsigned char
     if (!buf || !buf->buf)
         return NULL;
 
+    if (buf->index)
+        return databuf_index_get(buf, var, prev);
+
     offset = data_len;
-    while (offset < buf->len)
+    while (offset + data_len <= buf->len)
     {
         memcpy(&data, buf->buf + offset, data_len);
         if (var == data.type)
@@ -132,10 +531,46 @@ static unsigned char *databuf_get(Databuf *buf, unsigned int var, unsigned char
 bool databuf_init(Databuf *buf)
 {
     Data_var *header;
-    buf->buf = (unsigned char *) calloc(1, CHUNK_SIZE);
+    buf->msg = NULL;
+    buf->index = NULL;
+    buf->buf = databuf_alloc(CHUNK_SIZE, &buf->size, &buf->pooled);
     if (!buf->buf)
         return false;
 
+    buf->len = sizeof(Data_var);
+
+    header = (Data_var *) buf->buf;
+    header->type = DT_RAW;
+    header->size = 0;
+
+    return true;
+}
+
+/**
+ * Initialize a new data buffer in the body of a new nng message
+ *
+ * The response is then sent without copy, see databuf_take_msg().
+ *
+ * @param buf Pointer to the data buffer structure
+ *
+ * @return True on success, otherwise false
+ */
+bool databuf_init_msg(Databuf *buf)
+{
+    Data_var *header;
+
+    buf->buf = NULL;
+    buf->size = 0;
+    buf->len = 0;
+    buf->index = NULL;
+    buf->pooled = false;
+    if (nng_msg_alloc(&buf->msg, CHUNK_SIZE) != 0)
+    {
+        buf->msg = NULL;
+        return false;
+    }
+
+    buf->buf = nng_msg_body(buf->msg);
     buf->size = CHUNK_SIZE;
     buf->len = sizeof(Data_var);
 
@@ -163,90 +598,477 @@ void databuf_set_buf(Databuf *buf, unsigned char *buffer, size_t size)
 }
 
 /**
- * Add a string to the data buffer
+ * Set a received nng message as the buffer of the data buffer structure
+ *
+ * The data buffer owns the message, it is freed by databuf_free().
  *
  * @param buf Pointer to the data buffer structure
- * @param var Variable identifier for the data type
- * @param value Pointer to the string to be added
+ * @param msg Pointer to the nng message
  */
-void databuf_add_string(Databuf *buf, unsigned int var, const char *value)
+void databuf_set_msg(Databuf *buf, nng_msg *msg)
 {
-    int len = 0;
+    databuf_free(buf);
 
-    if ((var & 0xff) != DT_STRING)
-    {
-        printf("Error: databuf var %u is not of type string\n", var);
-        return;
-    }
+    buf->msg = msg;
+    buf->buf = nng_msg_body(msg);
+    buf->size = nng_msg_len(msg);
+    buf->len = buf->size;
+}
 
-    if (value)
-        len = strlen(value) + 1;
+/**
+ * Take the nng message of a data buffer initialized with databuf_init_msg()
+ *
+ * The message body is the data buffer content, the data buffer is left empty.
+ *
+ * @param buf Pointer to the data buffer structure
+ *
+ * @return The nng message, or NULL if the data buffer has none
+ */
+nng_msg *databuf_take_msg(Databuf *buf)
+{
+    nng_msg *msg = buf->msg;
 
-    databuf_add(buf, var, value, len);
+    if (!msg)
+        return NULL;
+
+    databuf_unindex(buf);
+
+    // Shrinking the body only updates its length
+    nng_msg_realloc(msg, buf->len);
+
+    buf->msg = NULL;
+    buf->buf = NULL;
+    buf->len = 0;
+    buf->size = 0;
+
+    return msg;
 }
 
 /**
- * Add an unsigned integer to the data buffer
+ * Add a value to the data buffer without checking the type of the variable
+ *
+ * Used by the accessors of mbim_schema.h, the types are checked at compile time.
  *
  * @param buf Pointer to the data buffer structure
  * @param var Variable identifier for the data type
- * @param value The unsigned integer to be added
+ * @param value Pointer to the data to be added
+ * @param len Length of the data
  */
-void databuf_add_uint(Databuf *buf, unsigned int var, unsigned int value)
+void databuf_put(Databuf *buf, unsigned int var, const void *value, size_t len)
 {
-    if ((var & 0xff) != DT_UINT)
-    {
-        printf("Error: databuf var %u is not of type uint\n", var);
-        return;
-    }
-
-    databuf_add(buf, var, &value, sizeof(unsigned int));
+    databuf_add(buf, var, value, len);
 }
 
 /**
- * Check if the data buffer is valid
+ * Find the next value of a variable without checking its type
+ *
+ * Used by the accessors of mbim_schema.h, the types are checked at compile time.
  *
  * @param buf Pointer to the data buffer structure
+ * @param var Variable identifier for the data type
+ * @param len Pointer to store the length of the value in bytes, may be NULL
+ * @param prev Pointer to the previous value used for searching (NULL if starting from beginning)
  *
- * @return True if the buffer is valid, otherwise false
+ * @return Pointer to the value, or NULL if not found
  */
-bool databuf_is_valid(Databuf *buf)
+unsigned char *databuf_find(Databuf *buf, unsigned int var, size_t *len, unsigned char *prev)
 {
-    int offset = 0;
-    Data_var data = {0};
-    int data_len = sizeof(data);
-
-    if (!buf || !buf->buf)
-        return false;
+    unsigned char *value = databuf_get(buf, var, prev);
+    Data_var data;
 
-    if (buf->len < data_len)
+    if (value && len)
+    {
+        memcpy(&data, value - sizeof(data), sizeof(data));
+        *len = data.size;
+    }
+
+    return value;
+}
+
+/**
+ * Add a string to the data buffer
+ *
+ * @param buf Pointer to the data buffer structure
+ * @param var Variable identifier for the data type
+ * @param value Pointer to the string to be added
+ */
+void databuf_add_string(Databuf *buf, unsigned int var, const char *value)
+{
+    int len = 0;
+
+    if ((var & 0xff) != DT_STRING)
+    {
+        printf("Error: databuf var %u is not of type string\n", var);
+        return;
+    }
+
+    // A string is always NUL terminated, NULL is sent as an empty string
+    if (!value)
+        value = "";
+    len = strlen(value) + 1;
+
+    databuf_add(buf, var, value, len);
+}
+
+/**
+ * Add an unsigned integer to the data buffer
+ *
+ * @param buf Pointer to the data buffer structure
+ * @param var Variable identifier for the data type
+ * @param value The unsigned integer to be added
+ */
+void databuf_add_uint(Databuf *buf, unsigned int var, unsigned int value)
+{
+    if ((var & 0xff) != DT_UINT)
+    {
+        printf("Error: databuf var %u is not of type uint\n", var);
+        return;
+    }
+
+    databuf_add(buf, var, &value, sizeof(unsigned int));
+}
+
+/**
+ * Add a fixed size value to the data buffer
+ *
+ * @param buf Pointer to the data buffer structure
+ * @param var Variable identifier for the data type
+ * @param type Data type expected for the variable
+ * @param value Pointer to the value to be added
+ * @param len Size of the value in bytes
+ */
+static void databuf_add_value(Databuf *buf, unsigned int var, unsigned int type, const void *value, size_t len)
+{
+    if ((var & 0xff) != type)
+    {
+        printf("Error: databuf var %u is not of type %u\n", var, type);
+        return;
+    }
+
+    databuf_add(buf, var, value, len);
+}
+
+/**
+ * Add a signed integer to the data buffer
+ *
+ * @param buf Pointer to the data buffer structure
+ * @param var Variable identifier for the data type
+ * @param value The signed integer to be added
+ */
+void databuf_add_int(Databuf *buf, unsigned int var, int32_t value)
+{
+    databuf_add_value(buf, var, DT_INT, &value, sizeof(value));
+}
+
+/**
+ * Add a 64-bit unsigned integer to the data buffer
+ *
+ * @param buf Pointer to the data buffer structure
+ * @param var Variable identifier for the data type
+ * @param value The 64-bit unsigned integer to be added
+ */
+void databuf_add_uint64(Databuf *buf, unsigned int var, uint64_t value)
+{
+    databuf_add_value(buf, var, DT_UINT64, &value, sizeof(value));
+}
+
+/**
+ * Add a 64-bit signed integer to the data buffer
+ *
+ * @param buf Pointer to the data buffer structure
+ * @param var Variable identifier for the data type
+ * @param value The 64-bit signed integer to be added
+ */
+void databuf_add_int64(Databuf *buf, unsigned int var, int64_t value)
+{
+    databuf_add_value(buf, var, DT_INT64, &value, sizeof(value));
+}
+
+/**
+ * Add binary data to the data buffer
+ *
+ * @param buf Pointer to the data buffer structure
+ * @param var Variable identifier for the data type
+ * @param value Pointer to the data to be added
+ * @param len Length of the data in bytes
+ */
+void databuf_add_binary(Databuf *buf, unsigned int var, const void *value, size_t len)
+{
+    databuf_add_value(buf, var, DT_BINARY, value, len);
+}
+
+/**
+ * Add a nested data buffer to the data buffer
+ *
+ * @param buf Pointer to the data buffer structure
+ * @param var Variable identifier for the data type
+ * @param value Pointer to the data buffer to be added, header included
+ */
+void databuf_add_databuf(Databuf *buf, unsigned int var, const Databuf *value)
+{
+    if ((var & 0xff) != DT_RAW)
+    {
+        printf("Error: databuf var %u is not of type raw\n", var);
+        return;
+    }
+
+    databuf_add(buf, var, value->buf, value->len);
+}
+
+/**
+ * Append the variables of a data buffer to the data buffer
+ *
+ * @param buf Pointer to the data buffer structure
+ * @param src Pointer to the data buffer to be merged
+ * @param skip Variable identifiers not to be merged
+ * @param nb_skip Number of variable identifiers in skip
+ */
+void databuf_merge(Databuf *buf, const Databuf *src, const unsigned int *skip, size_t nb_skip)
+{
+    size_t offset;
+    size_t i;
+    Data_var data = {0};
+    int data_len = sizeof(data);
+
+    if (!src || !src->buf)
+        return;
+
+    offset = data_len;
+    while (offset + data_len <= src->len)
+    {
+        memcpy(&data, src->buf + offset, data_len);
+
+        for (i = 0; i < nb_skip; i++)
+        {
+            if (skip[i] == data.type)
+                break;
+        }
+
+        if (i == nb_skip)
+            databuf_add(buf, data.type, src->buf + offset + data_len, data.size);
+
+        offset += data.size + data_len;
+    }
+}
+
+/**
+ * Check the header of a variable against the data buffer
+ *
+ * @param buf Pointer to the data buffer structure
+ * @param offset Offset of the variable header
+ * @param data The variable header
+ * @param strict Also check the value against the data type
+ *
+ * @return True if the variable is valid, otherwise false
+ */
+static bool databuf_check_var(const Databuf *buf, size_t offset, const Data_var *data, bool strict)
+{
+    const unsigned char *value = buf->buf + offset + sizeof(*data);
+
+    if (data->size > buf->len - offset - sizeof(*data))
+    {
+        printf("Error: databuf wrong data size for %04x (offset %zu)\n", data->type, offset);
+        return false;
+    }
+
+    if (!strict)
+        return true;
+
+    switch (data->type & 0xff)
+    {
+    case DT_UINT:
+    case DT_INT:
+        if (data->size == sizeof(uint32_t))
+            return true;
+        break;
+
+    case DT_UINT64:
+    case DT_INT64:
+        if (data->size == sizeof(uint64_t))
+            return true;
+        break;
+
+    case DT_STRING:
+        if (data->size > 0 && value[data->size - 1] == '\0')
+            return true;
+        break;
+
+    case DT_RAW:
+    case DT_BINARY:
+        return true;
+
+    default:
+        break;
+    }
+
+    printf("Error: databuf wrong value for %04x (offset %zu, size %u)\n", data->type, offset, data->size);
+    return false;
+}
+
+/**
+ * Check the header of the data buffer
+ *
+ * @param buf Pointer to the data buffer structure
+ *
+ * @return True if the header matches the buffer, otherwise false
+ */
+static bool databuf_check_header(const Databuf *buf)
+{
+    Data_var data = {0};
+
+    if (!buf || !buf->buf || buf->len < sizeof(data))
         return false;
 
-    memcpy(&data, buf->buf, data_len);
-    offset += data_len;
+    memcpy(&data, buf->buf, sizeof(data));
+    if (data.type == (DT_RAW | DATABUF_COMPACT))
+    {
+        printf("Error : databuf is compact, it must be expanded first\n");
+        return false;
+    }
 
-    if (data.size != (buf->len - data_len) || (data.type & 0xff) != DT_RAW)
+    if (data.size != (buf->len - sizeof(data)) || data.type != DT_RAW)
     {
-        printf("Error : databuf wrong message type/length. Expected %u but got %zu\n", data.size, (buf->len - data_len));
+        printf("Error : databuf wrong message type/length. Expected %u but got %zu\n", data.size, (buf->len - sizeof(data)));
         return false;
     }
 
+    return true;
+}
+
+/**
+ * Walk the variables of the data buffer once, checking and indexing them
+ *
+ * @param buf Pointer to the data buffer structure
+ * @param strict Also check the values against their data type
+ *
+ * @return True on success, otherwise false and the buffer has no index
+ */
+static bool databuf_build_index(Databuf *buf, bool strict)
+{
+    Databuf_index *index;
+    Data_var data = {0};
+    size_t data_len = sizeof(data);
+    size_t offset;
+
+    databuf_unindex(buf);
+
+    index = databuf_index_alloc(INDEX_MIN_ENTRIES);
+    if (!index)
+        return false;
+
+    offset = data_len;
     while (offset < buf->len)
     {
+        if (buf->len - offset < data_len)
+        {
+            printf("Error: databuf truncated variable (offset %zu)\n", offset);
+            databuf_release(index, index->size, index->pooled);
+            return false;
+        }
+
         memcpy(&data, buf->buf + offset, data_len);
+        if (!databuf_check_var(buf, offset, &data, strict) || !databuf_index_add(&index, data.type, offset + data_len))
+        {
+            databuf_release(index, index->size, index->pooled);
+            return false;
+        }
+
+        offset += data_len + data.size;
+    }
+
+    buf->index = index;
+
+    return true;
+}
+
+/**
+ * Check if the data buffer is valid
+ *
+ * The framing is checked, as well as the value of each variable against its
+ * data type: integers have the size of their type and a string is NUL
+ * terminated.
+ *
+ * @param buf Pointer to the data buffer structure
+ *
+ * @return True if the buffer is valid, otherwise false
+ */
+bool databuf_is_valid(Databuf *buf)
+{
+    size_t offset;
+    Data_var data = {0};
+    size_t data_len = sizeof(data);
 
-        if ((data.size + offset + data_len) > buf->len)
+    if (!databuf_check_header(buf))
+        return false;
+
+    offset = data_len;
+    while (offset < buf->len)
+    {
+        if (buf->len - offset < data_len)
         {
-            printf("Error: databuf wrong data size for %04x (offset %d)\n", data.type, offset);
+            printf("Error: databuf truncated variable (offset %zu)\n", offset);
             return false;
         }
 
+        memcpy(&data, buf->buf + offset, data_len);
+        if (!databuf_check_var(buf, offset, &data, true))
+            return false;
+
         offset += data_len + data.size;
     }
 
     return true;
 }
 
+/**
+ * Check and index a received data buffer in a single pass
+ *
+ * Same checks as databuf_is_valid(), the index built along the way serves the
+ * following lookups, see databuf_index().
+ *
+ * @param buf Pointer to the data buffer structure
+ *
+ * @return True if the buffer is valid, otherwise false
+ */
+bool databuf_parse(Databuf *buf)
+{
+    return databuf_check_header(buf) && databuf_build_index(buf, true);
+}
+
+/**
+ * Index the variables of the data buffer
+ *
+ * The buffer is indexed once, the following lookups no longer scan it. The
+ * index is dropped when a variable is added or the buffer is freed. A view
+ * on another buffer, such as a nested data buffer, must release its index
+ * with databuf_unindex() as it is not freed.
+ *
+ * @param buf Pointer to the data buffer structure
+ *
+ * @return True on success, otherwise false and the buffer is scanned on lookups
+ */
+bool databuf_index(Databuf *buf)
+{
+    if (!buf || !buf->buf || buf->len < sizeof(Data_var))
+        return false;
+
+    return databuf_build_index(buf, false);
+}
+
+/**
+ * Drop the index of the data buffer, if any
+ *
+ * @param buf Pointer to the data buffer structure
+ */
+void databuf_unindex(Databuf *buf)
+{
+    if (!buf || !buf->index)
+        return;
+
+    databuf_release(buf->index, buf->index->size, buf->index->pooled);
+    buf->index = NULL;
+}
+
 /**
  * Retrieve the next string from the data buffer based on variable identifier and previous value pointer
  *
@@ -323,6 +1145,788 @@ char *databuf_get_uint(Databuf *buf, unsigned int var, unsigned int *value)
     return databuf_get_next_uint(buf, var, value, NULL);
 }
 
+/**
+ * Retrieve the next fixed size value from the data buffer
+ *
+ * @param buf Pointer to the data buffer structure
+ * @param var Variable identifier for the data type
+ * @param type Data type expected for the variable
+ * @param value Pointer to store the retrieved value
+ * @param len Size of the value in bytes
+ * @param prev Pointer to the previous value used for searching (NULL if starting from beginning)
+ *
+ * @return Pointer to the retrieved value, or NULL if not found
+ */
+static char *databuf_get_next_value(Databuf *buf, unsigned int var, unsigned int type, void *value, size_t len,
+                                    unsigned char *prev)
+{
+    unsigned char *buffer;
+    Data_var data;
+
+    if ((var & 0xff) != type)
+    {
+        printf("Error: databuf var %u is not of type %u\n", var, type);
+        return NULL;
+    }
+
+    buffer = databuf_get(buf, var, prev);
+    if (!buffer)
+        return NULL;
+
+    memcpy(&data, buffer - sizeof(data), sizeof(data));
+    if (data.size != len)
+    {
+        printf("Error: databuf wrong data size for %04x\n", var);
+        return NULL;
+    }
+
+    memcpy(value, buffer, len);
+
+    return (char *) buffer;
+}
+
+/**
+ * Retrieve the next signed integer from the data buffer based on variable identifier and previous value pointer
+ *
+ * @param buf Pointer to the data buffer structure
+ * @param var Variable identifier for the data type
+ * @param value Pointer to store the retrieved signed integer
+ * @param prev Pointer to the previous value used for searching (NULL if starting from beginning)
+ *
+ * @return Pointer to the retrieved signed integer, or NULL if not found
+ */
+char *databuf_get_next_int(Databuf *buf, unsigned int var, int32_t *value, unsigned char *prev)
+{
+    return databuf_get_next_value(buf, var, DT_INT, value, sizeof(*value), prev);
+}
+
+/**
+ * Retrieve a signed integer from the data buffer based on variable identifier
+ *
+ * @param buf Pointer to the data buffer structure
+ * @param var Variable identifier for the data type
+ * @param value Pointer to store the retrieved signed integer
+ *
+ * @return Pointer to the retrieved signed integer, or NULL if not found
+ */
+char *databuf_get_int(Databuf *buf, unsigned int var, int32_t *value)
+{
+    return databuf_get_next_int(buf, var, value, NULL);
+}
+
+/**
+ * Retrieve the next 64-bit unsigned integer from the data buffer based on variable identifier and previous value pointer
+ *
+ * @param buf Pointer to the data buffer structure
+ * @param var Variable identifier for the data type
+ * @param value Pointer to store the retrieved 64-bit unsigned integer
+ * @param prev Pointer to the previous value used for searching (NULL if starting from beginning)
+ *
+ * @return Pointer to the retrieved 64-bit unsigned integer, or NULL if not found
+ */
+char *databuf_get_next_uint64(Databuf *buf, unsigned int var, uint64_t *value, unsigned char *prev)
+{
+    return databuf_get_next_value(buf, var, DT_UINT64, value, sizeof(*value), prev);
+}
+
+/**
+ * Retrieve a 64-bit unsigned integer from the data buffer based on variable identifier
+ *
+ * @param buf Pointer to the data buffer structure
+ * @param var Variable identifier for the data type
+ * @param value Pointer to store the retrieved 64-bit unsigned integer
+ *
+ * @return Pointer to the retrieved 64-bit unsigned integer, or NULL if not found
+ */
+char *databuf_get_uint64(Databuf *buf, unsigned int var, uint64_t *value)
+{
+    return databuf_get_next_uint64(buf, var, value, NULL);
+}
+
+/**
+ * Retrieve the next 64-bit signed integer from the data buffer based on variable identifier and previous value pointer
+ *
+ * @param buf Pointer to the data buffer structure
+ * @param var Variable identifier for the data type
+ * @param value Pointer to store the retrieved 64-bit signed integer
+ * @param prev Pointer to the previous value used for searching (NULL if starting from beginning)
+ *
+ * @return Pointer to the retrieved 64-bit signed integer, or NULL if not found
+ */
+char *databuf_get_next_int64(Databuf *buf, unsigned int var, int64_t *value, unsigned char *prev)
+{
+    return databuf_get_next_value(buf, var, DT_INT64, value, sizeof(*value), prev);
+}
+
+/**
+ * Retrieve a 64-bit signed integer from the data buffer based on variable identifier
+ *
+ * @param buf Pointer to the data buffer structure
+ * @param var Variable identifier for the data type
+ * @param value Pointer to store the retrieved 64-bit signed integer
+ *
+ * @return Pointer to the retrieved 64-bit signed integer, or NULL if not found
+ */
+char *databuf_get_int64(Databuf *buf, unsigned int var, int64_t *value)
+{
+    return databuf_get_next_int64(buf, var, value, NULL);
+}
+
+/**
+ * Retrieve the next binary data from the data buffer based on variable identifier and previous value pointer
+ *
+ * @param buf Pointer to the data buffer structure
+ * @param var Variable identifier for the data type
+ * @param len Pointer to store the length of the data in bytes
+ * @param prev Pointer to the previous value used for searching (NULL if starting from beginning)
+ *
+ * @return Pointer to the retrieved data, or NULL if not found
+ */
+unsigned char *databuf_get_next_binary(Databuf *buf, unsigned int var, size_t *len, unsigned char *prev)
+{
+    unsigned char *buffer;
+    Data_var data;
+
+    if ((var & 0xff) != DT_BINARY)
+    {
+        printf("Error: databuf var %u is not of type binary\n", var);
+        return NULL;
+    }
+
+    buffer = databuf_get(buf, var, prev);
+    if (!buffer)
+        return NULL;
+
+    memcpy(&data, buffer - sizeof(data), sizeof(data));
+    *len = data.size;
+
+    return buffer;
+}
+
+/**
+ * Retrieve binary data from the data buffer based on variable identifier
+ *
+ * @param buf Pointer to the data buffer structure
+ * @param var Variable identifier for the data type
+ * @param len Pointer to store the length of the data in bytes
+ *
+ * @return Pointer to the retrieved data, or NULL if not found
+ */
+unsigned char *databuf_get_binary(Databuf *buf, unsigned int var, size_t *len)
+{
+    return databuf_get_next_binary(buf, var, len, NULL);
+}
+
+/**
+ * Retrieve the next nested data buffer from the data buffer based on variable identifier and previous value pointer
+ *
+ * The nested data buffer is a read-only view on the data buffer, it must not be freed.
+ *
+ * @param buf Pointer to the data buffer structure
+ * @param var Variable identifier for the data type
+ * @param value Pointer to store the nested data buffer
+ * @param prev Pointer to the previous value used for searching (NULL if starting from beginning)
+ *
+ * @return Pointer to the retrieved data buffer, or NULL if not found
+ */
+char *databuf_get_next_databuf(Databuf *buf, unsigned int var, Databuf *value, unsigned char *prev)
+{
+    unsigned char *buffer;
+    Data_var data;
+
+    if ((var & 0xff) != DT_RAW)
+    {
+        printf("Error: databuf var %u is not of type raw\n", var);
+        return NULL;
+    }
+
+    buffer = databuf_get(buf, var, prev);
+    if (!buffer)
+        return NULL;
+
+    memcpy(&data, buffer - sizeof(data), sizeof(data));
+    value->buf = buffer;
+    value->size = data.size;
+    value->len = data.size;
+    value->msg = NULL;
+    value->index = NULL;
+    value->pooled = false;
+
+    return (char *) buffer;
+}
+
+/**
+ * Start iterating over the variables of the data buffer in wire order
+ *
+ * The iterator does not use the index, a whole buffer is decoded in a single
+ * pass with databuf_iter_next().
+ *
+ * @param iter Pointer to the iterator
+ * @param buf Pointer to the data buffer structure
+ */
+void databuf_iter_init(Databuf_iter *iter, const Databuf *buf)
+{
+    memset(iter, 0, sizeof(*iter));
+    iter->buf = buf;
+    iter->offset = sizeof(Data_var);
+}
+
+/**
+ * Move the iterator to the next variable of the data buffer
+ *
+ * @param iter Pointer to the iterator
+ *
+ * @return True if a variable is available, false at the end of the buffer or
+ *         if the next variable does not fit in it
+ */
+bool databuf_iter_next(Databuf_iter *iter)
+{
+    const Databuf *buf = iter->buf;
+    Data_var data;
+
+    if (!buf || !buf->buf || iter->offset >= buf->len)
+        return false;
+
+    if (buf->len - iter->offset < sizeof(data))
+    {
+        printf("Error: databuf truncated variable (offset %zu)\n", iter->offset);
+        iter->offset = buf->len;
+        return false;
+    }
+
+    memcpy(&data, buf->buf + iter->offset, sizeof(data));
+    if (data.size > buf->len - iter->offset - sizeof(data))
+    {
+        printf("Error: databuf wrong data size for %04x (offset %zu)\n", data.type, iter->offset);
+        iter->offset = buf->len;
+        return false;
+    }
+
+    iter->var = data.type;
+    iter->type = data.type & 0xff;
+    iter->value = buf->buf + iter->offset + sizeof(data);
+    iter->len = data.size;
+    iter->offset += sizeof(data) + data.size;
+
+    return true;
+}
+
+/**
+ * Read the current variable of the iterator as an unsigned integer
+ *
+ * @param iter Pointer to the iterator
+ * @param value Pointer to store the unsigned integer
+ *
+ * @return True on success, otherwise false
+ */
+bool databuf_iter_uint(const Databuf_iter *iter, unsigned int *value)
+{
+    if (iter->type != DT_UINT || iter->len != sizeof(unsigned int))
+        return false;
+
+    memcpy(value, iter->value, sizeof(unsigned int));
+
+    return true;
+}
+
+/**
+ * Read the current variable of the iterator as a signed integer
+ *
+ * @param iter Pointer to the iterator
+ * @param value Pointer to store the signed integer
+ *
+ * @return True on success, otherwise false
+ */
+bool databuf_iter_int(const Databuf_iter *iter, int32_t *value)
+{
+    if (iter->type != DT_INT || iter->len != sizeof(*value))
+        return false;
+
+    memcpy(value, iter->value, sizeof(*value));
+
+    return true;
+}
+
+/**
+ * Read the current variable of the iterator as a 64-bit unsigned integer
+ *
+ * @param iter Pointer to the iterator
+ * @param value Pointer to store the 64-bit unsigned integer
+ *
+ * @return True on success, otherwise false
+ */
+bool databuf_iter_uint64(const Databuf_iter *iter, uint64_t *value)
+{
+    if (iter->type != DT_UINT64 || iter->len != sizeof(*value))
+        return false;
+
+    memcpy(value, iter->value, sizeof(*value));
+
+    return true;
+}
+
+/**
+ * Read the current variable of the iterator as a 64-bit signed integer
+ *
+ * @param iter Pointer to the iterator
+ * @param value Pointer to store the 64-bit signed integer
+ *
+ * @return True on success, otherwise false
+ */
+bool databuf_iter_int64(const Databuf_iter *iter, int64_t *value)
+{
+    if (iter->type != DT_INT64 || iter->len != sizeof(*value))
+        return false;
+
+    memcpy(value, iter->value, sizeof(*value));
+
+    return true;
+}
+
+/**
+ * Read the current variable of the iterator as a string
+ *
+ * @param iter Pointer to the iterator
+ *
+ * @return The string, or NULL if the variable is not a NUL terminated string
+ */
+char *databuf_iter_string(const Databuf_iter *iter)
+{
+    if (iter->type != DT_STRING || iter->len == 0 || iter->value[iter->len - 1] != '\0')
+        return NULL;
+
+    return (char *) iter->value;
+}
+
+/**
+ * Read the current variable of the iterator as a nested data buffer
+ *
+ * The nested data buffer is a read-only view on the data buffer, it must not be freed.
+ *
+ * @param iter Pointer to the iterator
+ * @param value Pointer to store the nested data buffer
+ *
+ * @return True on success, otherwise false
+ */
+bool databuf_iter_databuf(const Databuf_iter *iter, Databuf *value)
+{
+    if (iter->type != DT_RAW)
+        return false;
+
+    value->buf = iter->value;
+    value->size = iter->len;
+    value->len = iter->len;
+    value->msg = NULL;
+    value->index = NULL;
+    value->pooled = false;
+
+    return true;
+}
+
+/**
+ * Append bytes to the data buffer, the header is not updated
+ *
+ * @param buf Pointer to the data buffer structure
+ * @param data Pointer to the bytes
+ * @param len Number of bytes
+ *
+ * @return True on success, otherwise false
+ */
+static bool databuf_append(Databuf *buf, const void *data, size_t len)
+{
+    if (buf->len + len > buf->size && !databuf_realloc(buf, buf->len + len))
+        return false;
+
+    memcpy(buf->buf + buf->len, data, len);
+    buf->len += len;
+
+    return true;
+}
+
+/**
+ * Write a varint, 7 bits per byte with the high bit set on all but the last one
+ *
+ * @param out Buffer of at least VARINT_MAX bytes
+ * @param value The value
+ *
+ * @return Number of bytes written
+ */
+static size_t varint_put(unsigned char *out, uint64_t value)
+{
+    size_t len = 0;
+
+    while (value >= 0x80)
+    {
+        out[len++] = (unsigned char) (value | 0x80);
+        value >>= 7;
+    }
+    out[len++] = (unsigned char) value;
+
+    return len;
+}
+
+/**
+ * Read a varint
+ *
+ * @param buf Pointer to the bytes
+ * @param len Number of bytes
+ * @param offset Pointer to the offset of the varint, moved past it
+ * @param value Pointer to store the value
+ *
+ * @return True on success, otherwise false
+ */
+static bool varint_get(const unsigned char *buf, size_t len, size_t *offset, uint64_t *value)
+{
+    unsigned int shift = 0;
+
+    *value = 0;
+    while (*offset < len && shift < 64)
+    {
+        unsigned char byte = buf[(*offset)++];
+
+        *value |= (uint64_t) (byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return true;
+        shift += 7;
+    }
+
+    return false;
+}
+
+static bool databuf_append_varint(Databuf *buf, uint64_t value)
+{
+    unsigned char bytes[VARINT_MAX];
+
+    return databuf_append(buf, bytes, varint_put(bytes, value));
+}
+
+// Zigzag mapping, small negative values get short varints too
+static uint64_t zigzag_encode(int64_t value)
+{
+    return ((uint64_t) value << 1) ^ (uint64_t) (value >> 63);
+}
+
+static int64_t zigzag_decode(uint64_t value)
+{
+    return (int64_t) (value >> 1) ^ -(int64_t) (value & 1);
+}
+
+/**
+ * Append the variables of a data buffer to out in the compact encoding
+ *
+ * @param buf   Pointer to the data buffer structure, header included
+ * @param out   Pointer to the output data buffer
+ * @param depth Nesting of buf, up to DATABUF_MAX_DEPTH
+ *
+ * @return True on success, otherwise false
+ */
+static bool compact_encode(Databuf *buf, Databuf *out, int depth)
+{
+    Databuf_iter iter;
+    Databuf nested;
+    unsigned char bytes[VARINT_MAX];
+    uint64_t value64;
+    uint32_t value32;
+    size_t start;
+    size_t len;
+
+    if (depth > DATABUF_MAX_DEPTH)
+    {
+        printf("Error: databuf nested deeper than %d\n", DATABUF_MAX_DEPTH);
+        return false;
+    }
+
+    if (!databuf_is_valid(buf))
+        return false;
+
+    databuf_iter_init(&iter, buf);
+    while (databuf_iter_next(&iter))
+    {
+        if (!databuf_append_varint(out, iter.var))
+            return false;
+
+        switch (iter.type)
+        {
+        case DT_UINT:
+        case DT_INT:
+            memcpy(&value32, iter.value, sizeof(value32));
+            value64 = iter.type == DT_UINT ? value32 : zigzag_encode((int32_t) value32);
+            if (!databuf_append_varint(out, value64))
+                return false;
+            break;
+
+        case DT_UINT64:
+        case DT_INT64:
+            memcpy(&value64, iter.value, sizeof(value64));
+            if (iter.type == DT_INT64)
+                value64 = zigzag_encode((int64_t) value64);
+            if (!databuf_append_varint(out, value64))
+                return false;
+            break;
+
+        case DT_STRING:
+            // The NUL is implied
+            if (!databuf_append_varint(out, iter.len - 1) || !databuf_append(out, iter.value, iter.len - 1))
+                return false;
+            break;
+
+        case DT_BINARY:
+            if (!databuf_append_varint(out, iter.len) || !databuf_append(out, iter.value, iter.len))
+                return false;
+            break;
+
+        case DT_RAW:
+            // A nested data buffer is encoded in place, its length is then
+            // inserted in front of it
+            databuf_iter_databuf(&iter, &nested);
+            start = out->len;
+            if (!compact_encode(&nested, out, depth + 1))
+                return false;
+
+            len = varint_put(bytes, out->len - start);
+            if (out->len + len > out->size && !databuf_realloc(out, out->len + len))
+                return false;
+            memmove(out->buf + start + len, out->buf + start, out->len - start);
+            memcpy(out->buf + start, bytes, len);
+            out->len += len;
+            break;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Append the compact variables to out in the standard encoding
+ *
+ * The nesting and the expanded size are bounded, a compact data buffer comes
+ * from the peer.
+ *
+ * @param buf   Pointer to the compact variables, header excluded
+ * @param len   Length of the compact variables
+ * @param out   Pointer to the output data buffer
+ * @param depth Nesting of buf, up to DATABUF_MAX_DEPTH
+ *
+ * @return True on success, otherwise false
+ */
+static bool compact_decode(const unsigned char *buf, size_t len, Databuf *out, int depth)
+{
+    Data_var data;
+    uint64_t var;
+    uint64_t value;
+    uint32_t value32;
+    int64_t svalue;
+    size_t offset = 0;
+    size_t start;
+
+    if (depth > DATABUF_MAX_DEPTH)
+    {
+        printf("Error: databuf nested deeper than %d\n", DATABUF_MAX_DEPTH);
+        return false;
+    }
+
+    while (offset < len)
+    {
+        if (out->len > DATABUF_MAX_EXPANDED)
+        {
+            printf("Error: databuf expands beyond %d bytes\n", DATABUF_MAX_EXPANDED);
+            return false;
+        }
+
+        if (!varint_get(buf, len, &offset, &var) || var > UINT32_MAX || !varint_get(buf, len, &offset, &value))
+            return false;
+
+        data.type = (uint32_t) var;
+        start = out->len;
+        switch (var & 0xff)
+        {
+        case DT_UINT:
+            if (value > UINT32_MAX)
+                return false;
+            value32 = (uint32_t) value;
+            data.size = sizeof(value32);
+            if (!databuf_append(out, &data, sizeof(data)) || !databuf_append(out, &value32, sizeof(value32)))
+                return false;
+            break;
+
+        case DT_INT:
+            svalue = zigzag_decode(value);
+            if (svalue < INT32_MIN || svalue > INT32_MAX)
+                return false;
+            value32 = (uint32_t) (int32_t) svalue;
+            data.size = sizeof(value32);
+            if (!databuf_append(out, &data, sizeof(data)) || !databuf_append(out, &value32, sizeof(value32)))
+                return false;
+            break;
+
+        case DT_UINT64:
+        case DT_INT64:
+            if ((var & 0xff) == DT_INT64)
+                value = (uint64_t) zigzag_decode(value);
+            data.size = sizeof(value);
+            if (!databuf_append(out, &data, sizeof(data)) || !databuf_append(out, &value, sizeof(value)))
+                return false;
+            break;
+
+        case DT_STRING:
+            if (value > len - offset)
+                return false;
+            data.size = value + 1;
+            if (!databuf_append(out, &data, sizeof(data)) || !databuf_append(out, buf + offset, value) ||
+                !databuf_append(out, "", 1))
+                return false;
+            offset += value;
+            break;
+
+        case DT_BINARY:
+            if (value > len - offset)
+                return false;
+            data.size = value;
+            if (!databuf_append(out, &data, sizeof(data)) || !databuf_append(out, buf + offset, value))
+                return false;
+            offset += value;
+            break;
+
+        case DT_RAW:
+            // Variable and nested data buffer headers, both sized once decoded
+            if (value > len - offset || !databuf_append(out, &data, sizeof(data)) ||
+                !databuf_append(out, &data, sizeof(data)) || !compact_decode(buf + offset, value, out, depth + 1))
+                return false;
+            offset += value;
+
+            data.size = out->len - start - sizeof(data);
+            memcpy(out->buf + start, &data, sizeof(data));
+            data.type = DT_RAW;
+            data.size -= sizeof(data);
+            memcpy(out->buf + start + sizeof(data), &data, sizeof(data));
+            break;
+
+        default:
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Check if the data buffer uses the compact encoding
+ *
+ * @param buf Pointer to the data buffer structure
+ *
+ * @return True if the header has the DATABUF_COMPACT flag, otherwise false
+ */
+bool databuf_is_compact(const Databuf *buf)
+{
+    Data_var data;
+
+    if (!buf || !buf->buf || buf->len < sizeof(data))
+        return false;
+
+    memcpy(&data, buf->buf, sizeof(data));
+
+    return data.type == (DT_RAW | DATABUF_COMPACT);
+}
+
+/**
+ * Initialize out like the data buffer, in a message if it has one
+ *
+ * @param buf Pointer to the data buffer structure
+ * @param out Pointer to the data buffer to initialize
+ *
+ * @return True on success, otherwise false
+ */
+static bool databuf_init_like(const Databuf *buf, Databuf *out)
+{
+    return buf->msg ? databuf_init_msg(out) : databuf_init(out);
+}
+
+/**
+ * Convert the data buffer to the compact encoding
+ *
+ * Variable identifiers and lengths are varints, integers are varints, signed
+ * ones zigzag encoded, and strings lose their NUL. The header keeps its
+ * layout, its type has the DATABUF_COMPACT flag. A compact data buffer is only
+ * sent on the wire, it must be expanded with databuf_expand() before any
+ * lookup.
+ *
+ * @param buf Pointer to the data buffer structure, replaced by its compact encoding
+ *
+ * @return True on success, otherwise false and the data buffer is unchanged
+ */
+bool databuf_compact(Databuf *buf)
+{
+    Databuf out = {0};
+    Data_var *header;
+
+    if (databuf_is_compact(buf))
+        return true;
+
+    if (!databuf_init_like(buf, &out))
+        return false;
+
+    if (!compact_encode(buf, &out, 0))
+    {
+        printf("Error: databuf compact encoding failed\n");
+        databuf_free(&out);
+        return false;
+    }
+
+    header = (Data_var *) out.buf;
+    header->type = DT_RAW | DATABUF_COMPACT;
+    header->size = out.len - sizeof(*header);
+
+    databuf_free(buf);
+    *buf = out;
+
+    return true;
+}
+
+/**
+ * Convert a compact data buffer back to the standard encoding
+ *
+ * The previous buffer is freed like with databuf_free(), a view on a buffer
+ * owned elsewhere must be copied first.
+ *
+ * @param buf Pointer to the data buffer structure, replaced by its standard encoding
+ *
+ * @return True on success, otherwise false and the data buffer is unchanged
+ */
+bool databuf_expand(Databuf *buf)
+{
+    Databuf out = {0};
+    Data_var data;
+    Data_var *header;
+
+    if (!databuf_is_compact(buf))
+        return true;
+
+    memcpy(&data, buf->buf, sizeof(data));
+    if (data.size != buf->len - sizeof(data))
+    {
+        printf("Error: databuf wrong compact length\n");
+        return false;
+    }
+
+    if (!databuf_init_like(buf, &out))
+        return false;
+
+    if (!compact_decode(buf->buf + sizeof(data), data.size, &out, 0) || out.len > DATABUF_MAX_EXPANDED)
+    {
+        printf("Error: databuf compact decoding failed\n");
+        databuf_free(&out);
+        return false;
+    }
+
+    header = (Data_var *) out.buf;
+    header->size = out.len - sizeof(*header);
+
+    databuf_free(buf);
+    *buf = out;
+
+    return true;
+}
+
 /**
  * Free the memory allocated for the data buffer
  *
@@ -333,7 +1937,13 @@ void databuf_free(Databuf *buf)
     if (!buf)
         return;
 
-    free(buf->buf);
+    databuf_unindex(buf);
+    if (buf->msg)
+        nng_msg_free(buf->msg);
+    else
+        databuf_release(buf->buf, buf->size, buf->pooled);
+    buf->msg = NULL;
+    buf->pooled = false;
     buf->buf = NULL;
     buf->len = 0;
     buf->size = 0;
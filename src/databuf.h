@@ -2,6 +2,7 @@
 #define MBIM_NNG_DATABUF_H
 
 #include <stdint.h>
+#include "nng/nng.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -13,28 +14,99 @@ enum data_type // 2 Bytes
 {
     DT_RAW = 1,
     DT_UINT,
-    DT_STRING
+    DT_STRING,
+    DT_INT,    // 32-bit signed integer
+    DT_UINT64,
+    DT_INT64,
+    DT_BINARY  // Opaque bytes, not NUL terminated
 };
 
+// Flag of the top-level header type of a compact data buffer, see databuf_compact()
+#define DATABUF_COMPACT (1 << 8)
+
+// Nesting of the data buffers held by a data buffer, deeper ones are rejected
+#ifndef DATABUF_MAX_DEPTH
+#define DATABUF_MAX_DEPTH 8
+#endif
+
+// Size a compact data buffer may expand to, see databuf_expand()
+#ifndef DATABUF_MAX_EXPANDED
+#define DATABUF_MAX_EXPANDED (1 << 20)
+#endif
+
+typedef struct databuf_index Databuf_index;
+
 typedef struct databuf
 {
     unsigned char *buf;
     size_t size;
     size_t len;
+    nng_msg *msg; // Message holding buf as its body, NULL if buf is allocated with malloc
+    Databuf_index *index; // Lookup table of the variables, NULL to scan the buffer
+    bool pooled; // buf comes from the buffer pool
 } Databuf;
 
+typedef struct databuf_iter
+{
+    const Databuf *buf;
+    size_t offset;        // Offset of the next variable
+    unsigned int var;     // Identifier of the current variable
+    unsigned int type;    // Data type of the current variable
+    unsigned char *value; // Value of the current variable, in the buffer
+    size_t len;           // Length of the value in bytes
+} Databuf_iter;
+
+bool databuf_pool_init(void);
+void databuf_pool_free(void);
+size_t databuf_pool_misses(void);
+
 bool databuf_init(Databuf *buf);
+bool databuf_init_msg(Databuf *buf);
 void databuf_free(Databuf *buf);
 void databuf_set_buf(Databuf *buf, unsigned char *buffer, size_t size);
+void databuf_set_msg(Databuf *buf, nng_msg *msg);
+nng_msg *databuf_take_msg(Databuf *buf);
 bool databuf_is_valid(Databuf *buf);
+bool databuf_parse(Databuf *buf);
+bool databuf_index(Databuf *buf);
+void databuf_unindex(Databuf *buf);
+bool databuf_is_compact(const Databuf *buf);
+bool databuf_compact(Databuf *buf);
+bool databuf_expand(Databuf *buf);
 
 void databuf_add_string(Databuf *buf, unsigned int var, const char *value);
 void databuf_add_uint(Databuf *buf, unsigned int var, unsigned int value);
+void databuf_add_int(Databuf *buf, unsigned int var, int32_t value);
+void databuf_add_uint64(Databuf *buf, unsigned int var, uint64_t value);
+void databuf_add_int64(Databuf *buf, unsigned int var, int64_t value);
+void databuf_add_binary(Databuf *buf, unsigned int var, const void *value, size_t len);
+void databuf_add_databuf(Databuf *buf, unsigned int var, const Databuf *value);
+void databuf_merge(Databuf *buf, const Databuf *src, const unsigned int *skip, size_t nb_skip);
+void databuf_put(Databuf *buf, unsigned int var, const void *value, size_t len);
+unsigned char *databuf_find(Databuf *buf, unsigned int var, size_t *len, unsigned char *prev);
 
 char *databuf_get_next_string(Databuf *buf, unsigned int var, unsigned char *prev);
 char *databuf_get_string(Databuf *buf, unsigned int var);
 char *databuf_get_next_uint(Databuf *buf, unsigned int var, unsigned int *value, unsigned char *prev);
 char *databuf_get_uint(Databuf *buf, unsigned int var, unsigned int *value);
+char *databuf_get_next_int(Databuf *buf, unsigned int var, int32_t *value, unsigned char *prev);
+char *databuf_get_int(Databuf *buf, unsigned int var, int32_t *value);
+char *databuf_get_next_uint64(Databuf *buf, unsigned int var, uint64_t *value, unsigned char *prev);
+char *databuf_get_uint64(Databuf *buf, unsigned int var, uint64_t *value);
+char *databuf_get_next_int64(Databuf *buf, unsigned int var, int64_t *value, unsigned char *prev);
+char *databuf_get_int64(Databuf *buf, unsigned int var, int64_t *value);
+unsigned char *databuf_get_next_binary(Databuf *buf, unsigned int var, size_t *len, unsigned char *prev);
+unsigned char *databuf_get_binary(Databuf *buf, unsigned int var, size_t *len);
+char *databuf_get_next_databuf(Databuf *buf, unsigned int var, Databuf *value, unsigned char *prev);
+
+void databuf_iter_init(Databuf_iter *iter, const Databuf *buf);
+bool databuf_iter_next(Databuf_iter *iter);
+bool databuf_iter_uint(const Databuf_iter *iter, unsigned int *value);
+bool databuf_iter_int(const Databuf_iter *iter, int32_t *value);
+bool databuf_iter_uint64(const Databuf_iter *iter, uint64_t *value);
+bool databuf_iter_int64(const Databuf_iter *iter, int64_t *value);
+char *databuf_iter_string(const Databuf_iter *iter);
+bool databuf_iter_databuf(const Databuf_iter *iter, Databuf *value);
 
 #ifdef __cplusplus
 }
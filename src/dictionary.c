@@ -0,0 +1,166 @@
+/**
+ * @file
+ * @brief Names of the values sent with MB_CODES, MBIM_DICTIONARY
+ * @ccmod{MBIM_X_MMG}
+ */
+#include <stdbool.h>
+#include <glib.h>
+#include "libmbim-glib/libmbim-glib.h"
+
+#include "dictionary.h"
+
+typedef const gchar *(*Dict_get_string)(guint value);
+typedef gchar *(*Dict_build_string)(guint mask);
+
+// Code variables and the libmbim functions naming their values, for MBIM_DICTIONARY
+typedef struct dict_entry
+{
+    unsigned int var;
+    Dict_get_string get_string;     // Enumeration
+    Dict_build_string build_string; // Bitmask, each bit is named on its own
+} Dict_entry;
+
+// Wrappers calling the libmbim functions with their own enumeration type
+#define DICT_GET_STRING(fn, type)                                                                  \
+    static const gchar *dict_##fn(guint value)                                                     \
+    {                                                                                              \
+        return fn((type) value);                                                                   \
+    }
+#define DICT_BUILD_STRING(fn, type)                                                                \
+    static gchar *dict_##fn(guint mask)                                                            \
+    {                                                                                              \
+        return fn((type) mask);                                                                    \
+    }
+
+DICT_GET_STRING(mbim_subscriber_ready_state_get_string, MbimSubscriberReadyState)
+DICT_GET_STRING(mbim_register_state_get_string, MbimRegisterState)
+DICT_GET_STRING(mbim_nw_error_get_string, MbimNwError)
+DICT_GET_STRING(mbim_register_mode_get_string, MbimRegisterMode)
+DICT_GET_STRING(mbim_packet_service_state_get_string, MbimPacketServiceState)
+DICT_GET_STRING(mbim_activation_state_get_string, MbimActivationState)
+DICT_GET_STRING(mbim_voice_call_state_get_string, MbimVoiceCallState)
+DICT_GET_STRING(mbim_context_ip_type_get_string, MbimContextIpType)
+DICT_GET_STRING(mbim_context_type_get_string, MbimContextType)
+DICT_GET_STRING(mbim_device_type_get_string, MbimDeviceType)
+DICT_GET_STRING(mbim_voice_class_get_string, MbimVoiceClass)
+DICT_BUILD_STRING(mbim_ready_info_flag_build_string_from_mask, MbimReadyInfoFlag)
+DICT_BUILD_STRING(mbim_data_class_build_string_from_mask, MbimDataClass)
+DICT_BUILD_STRING(mbim_cellular_class_build_string_from_mask, MbimCellularClass)
+DICT_BUILD_STRING(mbim_registration_flag_build_string_from_mask, MbimRegistrationFlag)
+DICT_BUILD_STRING(mbim_sim_class_build_string_from_mask, MbimSimClass)
+DICT_BUILD_STRING(mbim_sms_caps_build_string_from_mask, MbimSmsCaps)
+DICT_BUILD_STRING(mbim_ctrl_caps_build_string_from_mask, MbimCtrlCaps)
+
+#define DICT_ENUM(var, fn) {var, dict_##fn, NULL}
+#define DICT_MASK(var, fn) {var, NULL, dict_##fn}
+
+// Values of an enumeration looked up, the libmbim ones are below
+#define DICT_ENUM_MAX 256
+
+static const Dict_entry g_dictionary[] = {
+    DICT_ENUM(MB_SUB_STATE_CODE, mbim_subscriber_ready_state_get_string),
+    DICT_MASK(MB_SUB_READY_INFO_CODE, mbim_ready_info_flag_build_string_from_mask),
+    DICT_ENUM(MB_REGISTER_STATE, mbim_register_state_get_string),
+    DICT_ENUM(MB_REGISTER_NET_ERROR_CODE, mbim_nw_error_get_string),
+    DICT_ENUM(MB_REGISTER_MODE_CODE, mbim_register_mode_get_string),
+    DICT_MASK(MB_REGISTER_DATA_CLASS_CODE, mbim_data_class_build_string_from_mask),
+    DICT_MASK(MB_REGISTER_CLASS_CODE, mbim_cellular_class_build_string_from_mask),
+    DICT_MASK(MB_REGISTER_FLAGS_CODE, mbim_registration_flag_build_string_from_mask),
+    DICT_ENUM(MB_ATTACH_NET_ERROR_CODE, mbim_nw_error_get_string),
+    DICT_ENUM(MB_ATTACH_PCK_SERVICE_STATE_CODE, mbim_packet_service_state_get_string),
+    DICT_MASK(MB_ATTACH_DATA_CLASS_CODE, mbim_data_class_build_string_from_mask),
+    DICT_ENUM(MB_STATE_ACTIVATION, mbim_activation_state_get_string),
+    DICT_ENUM(MB_STATE_VOICE_CALL_STATE_CODE, mbim_voice_call_state_get_string),
+    DICT_ENUM(MB_STATE_IP_TYPE_CODE, mbim_context_ip_type_get_string),
+    DICT_ENUM(MB_STATE_CONTEXT_TYPE_CODE, mbim_context_type_get_string),
+    DICT_ENUM(MB_STATE_NETWORK_ERROR_CODE, mbim_nw_error_get_string),
+    DICT_ENUM(MB_DEV_TYPE_CODE, mbim_device_type_get_string),
+    DICT_MASK(MB_DEV_CELL_CLASS_CODE, mbim_cellular_class_build_string_from_mask),
+    DICT_ENUM(MB_DEV_VOICE_CLASS_CODE, mbim_voice_class_get_string),
+    DICT_MASK(MB_DEV_SIM_CLASS_CODE, mbim_sim_class_build_string_from_mask),
+    DICT_MASK(MB_DEV_DATA_CLASS_CODE, mbim_data_class_build_string_from_mask),
+    DICT_MASK(MB_DEV_SMS_CAPS_CODE, mbim_sms_caps_build_string_from_mask),
+    DICT_MASK(MB_DEV_CTRL_CAPS_CODE, mbim_ctrl_caps_build_string_from_mask),
+};
+
+/**
+ * Add the names of the values of a code variable as a MB_DICT_ENTRY section.
+ *
+ * @param resp  Databuf of the response
+ * @param entry Dict_entry of the variable
+ */
+static void dictionary_add_entry(Databuf *resp, const Dict_entry *entry)
+{
+    Databuf section = {0};
+    const gchar *name;
+    gchar *mask_name;
+    guint value;
+
+    if (!databuf_init(&section))
+        return;
+
+    mb_add_dict_var(&section, entry->var);
+    mb_add_dict_mask(&section, entry->build_string != NULL);
+
+    if (entry->get_string)
+    {
+        for (value = 0; value < DICT_ENUM_MAX; value++)
+        {
+            name = entry->get_string(value);
+            if (!name)
+                continue;
+
+            mb_add_dict_code(&section, value);
+            mb_add_dict_name(&section, name);
+        }
+    }
+    else
+    {
+        for (value = 0; value < 32; value++)
+        {
+            mask_name = entry->build_string(1u << value);
+            if (mask_name && *mask_name)
+            {
+                mb_add_dict_code(&section, 1u << value);
+                mb_add_dict_name(&section, mask_name);
+            }
+            g_free(mask_name);
+        }
+    }
+
+    mb_add_dict_entry(resp, &section);
+    databuf_free(&section);
+}
+
+/**
+ * Answer MBIM_DICTIONARY, the names of the values sent with MB_CODES. The
+ * names come from libmbim, they do not depend on the device nor on the
+ * protocol of the request.
+ *
+ * The request may list the code variables it needs with MB_DICT_VAR, every
+ * one is sent otherwise.
+ *
+ * @param request Pointer to the Mbim_request structure, completed by the caller
+ */
+void dictionary_answer(Mbim_request *request)
+{
+    unsigned char *prev = NULL;
+    unsigned int var;
+    bool filtered = false;
+    guint i;
+
+    while ((prev = (unsigned char *) mb_get_next_dict_var(&request->req, &var, prev)) != NULL)
+    {
+        filtered = true;
+        for (i = 0; i < G_N_ELEMENTS(g_dictionary); i++)
+        {
+            if (g_dictionary[i].var == var)
+                dictionary_add_entry(&request->resp, &g_dictionary[i]);
+        }
+    }
+
+    for (i = 0; !filtered && i < G_N_ELEMENTS(g_dictionary); i++)
+        dictionary_add_entry(&request->resp, &g_dictionary[i]);
+
+    mb_add_response(&request->resp, MBIM_OK);
+}
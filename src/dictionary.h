@@ -0,0 +1,16 @@
+#ifndef MBIM_NNG_DICTIONARY_H
+#define MBIM_NNG_DICTIONARY_H
+
+#include "mbim.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void dictionary_answer(Mbim_request *request);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // MBIM_NNG_DICTIONARY_H
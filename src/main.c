@@ -2,59 +2,125 @@
  * @file
  * @ccmod{MBIM_X_MMG}
  */
+#include <errno.h>
+#include <semaphore.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
+#include "cache.h"
+#include "databuf.h"
+#include "modem.h"
 #include "nng_server.h"
+#include "notify.h"
+#include "sim.h"
+#include "trace.h"
 
 #ifndef MBIM_NNG_SOCKET_FILE
 #define MBIM_NNG_SOCKET_FILE "ipc:///tmp/mbim_nng.socket"
 #endif
 
-static bool is_running = true;
-
-void signal_handler(int sig)
-{
-    if (sig == SIGINT)
-        is_running = false;
-}
+#ifndef MBIM_NNG_NOTIFY_SOCKET_FILE
+#define MBIM_NNG_NOTIFY_SOCKET_FILE "ipc:///tmp/mbim_nng_notify.socket"
+#endif
 
-/** Process incoming requests and handle them until stopped
- *
- * @param sock     Pointer to the socket
- * @param request  Pointer to the Mbim_request structure
- */
-static void handle_request(nng_socket *sock, Mbim_request *request)
-{
-    bool ret = true;
+#ifndef MBIM_NNG_WORKERS
+#define MBIM_NNG_WORKERS 8
+#endif
 
-    while (is_running && ret)
-        ret = rep_server_perform_request(sock, request);
+static sem_t stop_sem;
 
-    if (ret)
-        nng_close(*sock);
+void signal_handler(int sig)
+{
+    if (sig == SIGINT || sig == SIGTERM)
+        sem_post(&stop_sem);
 }
 
 int main(int argc, char *argv[])
 {
-    nng_socket sock;
-    Mbim_request request = {0};
-    struct sigaction act;
+    Rep_server server = {0};
+    struct sigaction act = {0};
+
+    sem_init(&stop_sem, 0, 0);
 
     act.sa_handler = signal_handler;
     sigaction(SIGINT, &act, NULL);
+    sigaction(SIGTERM, &act, NULL);
+
+    // mbim_nng sim [configuration], the simulated modem serves both protocols
+    if (argc > 1 && strcmp(argv[1], "sim") == 0)
+    {
+        if (argc > 2 && !sim_configure(argv[2]))
+            return 1;
 
-    while (is_running)
+        modem_set_backend(MB_PROT_MBIM, &sim_backend);
+        modem_set_backend(MB_PROT_QMI, &sim_backend);
+    }
+    // mbim_nng replay <trace> [scale], the recorded responses serve both protocols
+    else if (argc > 2 && strcmp(argv[1], "replay") == 0)
     {
-        if (!rep_server_open(&sock, MBIM_NNG_SOCKET_FILE))
-        {
-            printf("Server : Unable to start the server, exit");
+        if (!trace_replay(argv[2], argc > 3 ? atof(argv[3]) : 1.0))
             return 1;
-        }
 
-        handle_request(&sock, &request);
+        modem_set_backend(MB_PROT_MBIM, &replay_backend);
+        modem_set_backend(MB_PROT_QMI, &replay_backend);
     }
+    else
+    {
+        // mbim_nng record <trace>, the device requests and indications are recorded
+        if (argc > 2 && strcmp(argv[1], "record") == 0 && !trace_record(argv[2]))
+            return 1;
+
+        modem_set_backend(MB_PROT_MBIM, &mbim_backend);
+        modem_set_backend(MB_PROT_QMI, &qmi_backend);
+    }
+
+    if (!databuf_pool_init())
+        return 1;
+
+    if (!cache_init())
+        return 1;
+
+    // Requests are still served without notifications
+    if (!notify_open(MBIM_NNG_NOTIFY_SOCKET_FILE))
+        printf("Notify : Unable to open the notification socket\n");
+
+    if (!modem_start())
+    {
+        notify_close();
+        return 1;
+    }
+
+    if (!rep_server_open(&server.sock, MBIM_NNG_SOCKET_FILE))
+    {
+        printf("Server : Unable to start the server, exit");
+        modem_stop();
+        notify_close();
+        return 1;
+    }
+
+    if (!rep_server_start(&server, MBIM_NNG_WORKERS))
+    {
+        nng_close(server.sock);
+        modem_stop();
+        notify_close();
+        return 1;
+    }
+
+    // Requests are handled from the nng aio callbacks until stopped
+    while (sem_wait(&stop_sem) != 0 && errno == EINTR)
+        ;
+
+    modem_cancel();
+    rep_server_stop(&server);
+    modem_stop();
+    trace_stop();
+    notify_close();
+    cache_free();
+    databuf_pool_free();
+    sem_destroy(&stop_sem);
 
     return 0;
 }
@@ -6,68 +6,193 @@
 
 #include <stdio.h>
 #include <stdbool.h>
+#include <string.h>
 #include <glib.h>
 #include <glib/gprintf.h>
 #include <gio/gio.h>
-#include <glib-unix.h>
 #include "libmbim-glib/libmbim-glib.h"
 
 #include "mbim.h"
-#include "nng_server.h"
+#include "modem.h"
+#include "notify.h"
 
-static GMainLoop *g_loop;
-static GCancellable *g_cancellable;
 static MbimDevice *g_device;
+static gboolean g_device_opening;
+static gboolean g_device_removed;
+static gboolean g_in_session;
+static guint g_session_tid;
+static gboolean g_subscribed; // The indications are published, see mbim_subscribe()
 
-/** Handle the SIGINT, SIGHUP, and SIGTERM signals gracefully
- *
- * @param psignum  Signal number
+// Requests waiting for the device to be opened
+static GQueue g_waiting = G_QUEUE_INIT;
+
+/** Callback function when device close operation is ready
  *
- * @return FALSE to remove the signal handler
+ * @param dev      MbimDevice pointer
+ * @param res      GAsyncResult pointer
+ * @param loop     GMainLoop waiting for the close
  */
-static gboolean signals_handler(gpointer psignum)
+static void device_close_ready(MbimDevice *dev, GAsyncResult *res, GMainLoop *loop)
 {
-    if (g_cancellable && !g_cancellable_is_cancelled(g_cancellable))
+    GError *error = NULL;
+
+    if (!mbim_device_close_finish(dev, res, &error))
     {
-        g_cancellable_cancel(g_cancellable);
-        g_unix_signal_add(GPOINTER_TO_INT(psignum), (GSourceFunc)signals_handler, psignum);
-        return FALSE;
+        printf("Couldn't close device: %s\n", error->message);
+        g_error_free(error);
     }
 
-    if (g_loop && g_main_loop_is_running(g_loop))
-        g_idle_add((GSourceFunc)g_main_loop_quit, g_loop);
+    g_main_loop_quit(loop);
+}
 
-    return FALSE;
+/** Callback function when the device is removed (unplugged or proxy gone)
+ *
+ * @param dev        MbimDevice pointer
+ * @param user_data  Unused
+ */
+static void device_removed(MbimDevice *dev, gpointer user_data)
+{
+    (void) user_data;
+
+    printf("Mbim : Device %s removed\n", mbim_device_get_path_display(dev));
+    g_device_removed = TRUE;
 }
 
-/** Callback function when device close operation is ready
+/** Callback function when the device sends an unsolicited indication,
+ *  the basic connect state changes are published
  *
- * @param dev      MbimDevice pointer
- * @param res      GAsyncResult pointer
+ * @param dev           MbimDevice pointer
+ * @param notification  MbimMessage of the indication
+ * @param user_data     Unused
  */
-static void device_close_ready(MbimDevice *dev, GAsyncResult *res)
+static void device_indication(MbimDevice *dev, MbimMessage *notification, gpointer user_data)
 {
     GError *error = NULL;
+    Databuf msg = {0};
+    Notify_topic topic = NOTIFY_UNKOWN;
+    Mbim_req_type type = MBIM_UNKOWN;
 
-    if (!mbim_device_close_finish(dev, res, &error))
+    (void) user_data;
+
+    if (mbim_message_indicate_status_get_service(notification) != MBIM_SERVICE_BASIC_CONNECT || !databuf_init(&msg))
+        return;
+
+    mb_add_device(&msg, mbim_device_get_path_display(dev));
+
+    switch (mbim_message_indicate_status_get_cid(notification))
     {
-        printf("Couldn't close device: %s\n", error->message);
+        case MBIM_CID_BASIC_CONNECT_SIGNAL_STATE: {
+            guint32 rssi;
+            guint32 error_rate;
+
+            if (!mbim_message_signal_state_notification_parse(notification, &rssi, &error_rate, NULL, NULL, NULL, &error))
+                break;
+
+            mb_add_signal_rssi(&msg, rssi);
+            mb_add_signal_error_rate(&msg, error_rate);
+            topic = NOTIFY_SIGNAL;
+            type = MBIM_SIGNAL;
+            break;
+        }
+
+        case MBIM_CID_BASIC_CONNECT_REGISTER_STATE: {
+            MbimNwError nw_error;
+            MbimRegisterState register_state;
+            gchar *provider_id;
+            gchar *provider_name;
+
+            if (!mbim_message_register_state_notification_parse(notification, &nw_error, &register_state, NULL, NULL, NULL,
+                                                                &provider_id, &provider_name, NULL, NULL, &error))
+                break;
+
+            mb_add_register_state(&msg, register_state);
+            mb_add_register_net_error_code(&msg, nw_error);
+            mb_add_register_net_error(&msg, VALIDATE_UNKNOWN(mbim_nw_error_get_string(nw_error)));
+            mb_add_register_state_str(&msg, VALIDATE_UNKNOWN(mbim_register_state_get_string(register_state)));
+            mb_add_register_provider_id(&msg, VALIDATE_UNKNOWN(provider_id));
+            mb_add_register_provider_name(&msg, VALIDATE_UNKNOWN(provider_name));
+            g_free(provider_id);
+            g_free(provider_name);
+            topic = NOTIFY_REGISTER;
+            type = MBIM_REGISTER;
+            break;
+        }
+
+        case MBIM_CID_BASIC_CONNECT_PACKET_SERVICE: {
+            guint32 nw_error;
+            MbimPacketServiceState packet_service_state;
+
+            if (!mbim_message_packet_service_notification_parse(notification, &nw_error, &packet_service_state, NULL, NULL, NULL,
+                                                                &error))
+                break;
+
+            mb_add_attach_net_error_code(&msg, nw_error);
+            mb_add_attach_pck_service_state_code(&msg, packet_service_state);
+            mb_add_attach_net_error(&msg, VALIDATE_UNKNOWN(mbim_nw_error_get_string(nw_error)));
+            mb_add_attach_pck_service_state(&msg, VALIDATE_UNKNOWN(mbim_packet_service_state_get_string(packet_service_state)));
+            topic = NOTIFY_CONNECT;
+            type = MBIM_PACKET_SERVICE;
+            break;
+        }
+
+        case MBIM_CID_BASIC_CONNECT_CONNECT: {
+            guint32 session_id;
+            MbimActivationState activation_state;
+
+            if (!mbim_message_connect_notification_parse(notification, &session_id, &activation_state, NULL, NULL, NULL, NULL,
+                                                         &error))
+                break;
+
+            mb_add_state_activation(&msg, activation_state);
+            mb_add_state_activation_str(&msg, VALIDATE_UNKNOWN(mbim_activation_state_get_string(activation_state)));
+            mb_add_state_session_id(&msg, session_id);
+            topic = NOTIFY_CONNECT;
+            type = MBIM_STATUS;
+            break;
+        }
+
+        case MBIM_CID_BASIC_CONNECT_SUBSCRIBER_READY_STATUS: {
+            MbimSubscriberReadyState ready_state;
+            gchar *subscriber_id;
+            gchar *sim_iccid;
+
+            if (!mbim_message_subscriber_ready_status_notification_parse(notification, &ready_state, &subscriber_id, &sim_iccid, NULL,
+                                                                         NULL, NULL, &error))
+                break;
+
+            mb_add_sub_state_code(&msg, ready_state);
+            mb_add_sub_state(&msg, VALIDATE_UNKNOWN(mbim_subscriber_ready_state_get_string(ready_state)));
+            mb_add_sub_id(&msg, VALIDATE_UNKNOWN(subscriber_id));
+            mb_add_sub_sim_iccd(&msg, VALIDATE_UNKNOWN(sim_iccid));
+            g_free(subscriber_id);
+            g_free(sim_iccid);
+            topic = NOTIFY_SIM;
+            type = MBIM_SUBSCRIBER;
+            break;
+        }
+
+        default:
+            break;
+    }
+
+    if (error)
+    {
+        printf("Mbim : Couldn't parse indication: %s\n", error->message);
         g_error_free(error);
     }
+    else if (topic != NOTIFY_UNKOWN)
+        notify_publish(topic, MB_PROT_MBIM, type, &msg);
 
-    g_main_loop_quit(g_loop);
+    databuf_free(&msg);
 }
 
-/** Close the MBIM connection and clean up resources
+/** Finish a request, the device is kept open for the next one
  *
  * @param request  Mbim_request pointer
  */
-static void mbim_close(Mbim_request *request)
+static void mbim_request_done(Mbim_request *request)
 {
-    g_clear_object(&g_cancellable);
-    g_object_set(g_device, MBIM_DEVICE_IN_SESSION, request->tid ? TRUE : FALSE, NULL);
-
-    mbim_device_close(g_device, 15, g_cancellable, (GAsyncReadyCallback)device_close_ready, NULL);
+    request->done(request);
 }
 
 /** Set an error response for a Mbim_request
@@ -77,8 +202,8 @@ static void mbim_close(Mbim_request *request)
  */
 static void set_error(Mbim_request *request, const char *error)
 {
-    databuf_add_string(&request->resp, MB_ERROR, error);
-    databuf_add_uint(&request->resp, MB_RESPONSE, MBIM_ERROR);
+    mb_add_error(&request->resp, error);
+    mb_add_response(&request->resp, MBIM_ERROR);
 }
 
 /** Callback function when PIN operation is ready
@@ -112,7 +237,7 @@ static void pin_ready(MbimDevice *device, GAsyncResult *res, Mbim_request *reque
         if (response)
             mbim_message_unref(response);
 
-        mbim_close(request);
+        mbim_request_done(request);
         return;
     }
 
@@ -122,7 +247,7 @@ static void pin_ready(MbimDevice *device, GAsyncResult *res, Mbim_request *reque
         set_error(request, "Couldn't parse response message");
         g_error_free(error);
         mbim_message_unref(response);
-        mbim_close(request);
+        mbim_request_done(request);
         return;
     }
 
@@ -133,11 +258,11 @@ static void pin_ready(MbimDevice *device, GAsyncResult *res, Mbim_request *reque
     {
         printf("PIN is UNLOCKED\n");
 
-        databuf_add_uint(&request->resp, MB_PIN_STATUS, MBIM_PIN_UNLOCK);
-        databuf_add_uint(&request->resp, MB_RESPONSE, MBIM_OK);
+        modem_add_uint(request, MB_PIN_STATUS, MBIM_PIN_UNLOCK);
+        mb_add_response(&request->resp, MBIM_OK);
 
         mbim_message_unref(response);
-        mbim_close(request);
+        mbim_request_done(request);
         return;
     }
 
@@ -148,15 +273,15 @@ static void pin_ready(MbimDevice *device, GAsyncResult *res, Mbim_request *reque
         printf("Only PIN1 is supported\n");
         set_error(request, "Only PIN1 is supported");
         mbim_message_unref(response);
-        mbim_close(request);
+        mbim_request_done(request);
         return;
     }
 
-    databuf_add_uint(&request->resp, MB_PIN_STATUS, MBIM_PIN_LOCK);
-    databuf_add_uint(&request->resp, MB_RESPONSE, MBIM_OK);
+    modem_add_uint(request, MB_PIN_STATUS, MBIM_PIN_LOCK);
+    mb_add_response(&request->resp, MBIM_OK);
 
     mbim_message_unref(response);
-    mbim_close(request);
+    mbim_request_done(request);
 }
 
 /** Callback function when subscriber ready status query operation is ready
@@ -188,7 +313,7 @@ static void query_subscriber_ready_status_ready(MbimDevice *device, GAsyncResult
         g_error_free(error);
         if (response)
             mbim_message_unref(response);
-        mbim_close(request);
+        mbim_request_done(request);
         return;
     }
 
@@ -200,41 +325,52 @@ static void query_subscriber_ready_status_ready(MbimDevice *device, GAsyncResult
 
         g_error_free(error);
         mbim_message_unref(response);
-        mbim_close(request);
+        mbim_request_done(request);
         return;
     }
 
-    telephone_numbers_str = (telephone_numbers ? g_strjoinv(", ", telephone_numbers) : NULL);
-    ready_state_str = mbim_subscriber_ready_state_get_string(ready_state);
-    ready_info_str = mbim_ready_info_flag_build_string_from_mask(ready_info);
+    telephone_numbers_str = (telephone_numbers && modem_wants(request, MB_SUB_TEL_NUM) ? g_strjoinv(", ", telephone_numbers) : NULL);
 
-    printf("[%s] Subscriber ready status retrieved:\n"
-             "\t      Ready state: '%s'\n"
-             "\t    Subscriber ID: '%s'\n"
-             "\t        SIM ICCID: '%s'\n"
-             "\t       Ready info: '%s'\n"
-             "\tTelephone numbers: (%u) '%s'\n",
-             mbim_device_get_path_display(device), VALIDATE_UNKNOWN(ready_state_str), VALIDATE_UNKNOWN(subscriber_id),
-             VALIDATE_UNKNOWN(sim_iccid), VALIDATE_UNKNOWN(ready_info_str), telephone_numbers_count,
-             VALIDATE_UNKNOWN(telephone_numbers_str));
+    if (request->codes)
+    {
+        modem_add_uint(request, MB_SUB_STATE_CODE, ready_state);
+        modem_add_uint(request, MB_SUB_READY_INFO_CODE, ready_info);
+    }
+    else
+    {
+        ready_state_str = mbim_subscriber_ready_state_get_string(ready_state);
+        ready_info_str = modem_wants(request, MB_SUB_READY_INFO) ? mbim_ready_info_flag_build_string_from_mask(ready_info) : NULL;
+
+        if (!request->projected)
+            printf("[%s] Subscriber ready status retrieved:\n"
+                     "\t      Ready state: '%s'\n"
+                     "\t    Subscriber ID: '%s'\n"
+                     "\t        SIM ICCID: '%s'\n"
+                     "\t       Ready info: '%s'\n"
+                     "\tTelephone numbers: (%u) '%s'\n",
+                     mbim_device_get_path_display(device), VALIDATE_UNKNOWN(ready_state_str), VALIDATE_UNKNOWN(subscriber_id),
+                     VALIDATE_UNKNOWN(sim_iccid), VALIDATE_UNKNOWN(ready_info_str), telephone_numbers_count,
+                     VALIDATE_UNKNOWN(telephone_numbers_str));
+
+        modem_add_string(request, MB_SUB_STATE, VALIDATE_UNKNOWN(ready_state_str));
+        modem_add_string(request, MB_SUB_READY_INFO, VALIDATE_UNKNOWN(ready_info_str));
+        g_free(ready_info_str);
+    }
 
-    databuf_add_string(&request->resp, MB_SUB_STATE, VALIDATE_UNKNOWN(ready_state_str));
-    databuf_add_string(&request->resp, MB_SUB_ID, VALIDATE_UNKNOWN(subscriber_id));
-    databuf_add_string(&request->resp, MB_SUB_SIM_ICCD, VALIDATE_UNKNOWN(sim_iccid));
-    databuf_add_string(&request->resp, MB_SUB_READY_INFO, VALIDATE_UNKNOWN(ready_info_str));
-    databuf_add_uint(&request->resp, MB_SUB_TEL_NB, telephone_numbers_count);
-    databuf_add_string(&request->resp, MB_SUB_TEL_NUM, VALIDATE_UNKNOWN(telephone_numbers_str));
+    modem_add_string(request, MB_SUB_ID, VALIDATE_UNKNOWN(subscriber_id));
+    modem_add_string(request, MB_SUB_SIM_ICCD, VALIDATE_UNKNOWN(sim_iccid));
+    modem_add_uint(request, MB_SUB_TEL_NB, telephone_numbers_count);
+    modem_add_string(request, MB_SUB_TEL_NUM, VALIDATE_UNKNOWN(telephone_numbers_str));
 
-    databuf_add_uint(&request->resp, MB_RESPONSE, MBIM_OK);
+    mb_add_response(&request->resp, MBIM_OK);
 
     g_free(subscriber_id);
     g_free(sim_iccid);
-    g_free(ready_info_str);
     g_strfreev(telephone_numbers);
     g_free(telephone_numbers_str);
 
     mbim_message_unref(response);
-    mbim_close(request);
+    mbim_request_done(request);
 }
 
 /** Callback function when register state query operation is ready
@@ -269,7 +405,7 @@ static void register_state_ready(MbimDevice *device, GAsyncResult *res, Mbim_req
         g_error_free(error);
         if (response)
             mbim_message_unref(response);
-        mbim_close(request);
+        mbim_request_done(request);
         return;
     }
 
@@ -282,52 +418,65 @@ static void register_state_ready(MbimDevice *device, GAsyncResult *res, Mbim_req
 
         g_error_free(error);
         mbim_message_unref(response);
-        mbim_close(request);
+        mbim_request_done(request);
         return;
     }
 
-    available_data_classes_str = mbim_data_class_build_string_from_mask(available_data_classes);
-    cellular_class_str = mbim_cellular_class_build_string_from_mask(cellular_class);
-    registration_flag_str = mbim_registration_flag_build_string_from_mask(registration_flag);
-
-    printf("[%s] Registration status:\n"
-           "\t         Network error: '%s'\n"
-           "\t        Register state: '%s'\n"
-           "\t         Register mode: '%s'\n"
-           "\tAvailable data classes: '%s'\n"
-           "\tCurrent cellular class: '%s'\n"
-           "\t           Provider ID: '%s'\n"
-           "\t         Provider name: '%s'\n"
-           "\t          Roaming text: '%s'\n"
-           "\t    Registration flags: '%s'\n",
-           mbim_device_get_path_display(device), VALIDATE_UNKNOWN(mbim_nw_error_get_string(nw_error)),
-           VALIDATE_UNKNOWN(mbim_register_state_get_string(register_state)),
-           VALIDATE_UNKNOWN(mbim_register_mode_get_string(register_mode)), VALIDATE_UNKNOWN(available_data_classes_str),
-           VALIDATE_UNKNOWN(cellular_class_str), VALIDATE_UNKNOWN(provider_id), VALIDATE_UNKNOWN(provider_name),
-           VALIDATE_UNKNOWN(roaming_text), VALIDATE_UNKNOWN(registration_flag_str));
-
-    databuf_add_uint(&request->resp, MB_REGISTER_STATE, register_state);
-    databuf_add_string(&request->resp, MB_REGISTER_NET_ERROR, VALIDATE_UNKNOWN(mbim_nw_error_get_string(nw_error)));
-    databuf_add_string(&request->resp, MB_REGISTER_STATE_STR, VALIDATE_UNKNOWN(mbim_register_state_get_string(register_state)));
-    databuf_add_string(&request->resp, MB_REGISTER_MODE, VALIDATE_UNKNOWN(mbim_register_mode_get_string(register_mode)));
-    databuf_add_string(&request->resp, MB_REGISTER_DATA_CLASS, VALIDATE_UNKNOWN(available_data_classes_str));
-    databuf_add_string(&request->resp, MB_REGISTER_CLASS, VALIDATE_UNKNOWN(cellular_class_str));
-    databuf_add_string(&request->resp, MB_REGISTER_PROVIDER_ID, VALIDATE_UNKNOWN(provider_id));
-    databuf_add_string(&request->resp, MB_REGISTER_PROVIDER_NAME, VALIDATE_UNKNOWN(provider_name));
-    databuf_add_string(&request->resp, MB_REGISTER_ROAMING, VALIDATE_UNKNOWN(roaming_text));
-    databuf_add_string(&request->resp, MB_REGISTER_FLAGS, VALIDATE_UNKNOWN(registration_flag_str));
-
-    databuf_add_uint(&request->resp, MB_RESPONSE, MBIM_OK);
-
-    g_free(available_data_classes_str);
-    g_free(cellular_class_str);
-    g_free(registration_flag_str);
+    if (request->codes)
+    {
+        modem_add_uint(request, MB_REGISTER_NET_ERROR_CODE, nw_error);
+        modem_add_uint(request, MB_REGISTER_MODE_CODE, register_mode);
+        modem_add_uint(request, MB_REGISTER_DATA_CLASS_CODE, available_data_classes);
+        modem_add_uint(request, MB_REGISTER_CLASS_CODE, cellular_class);
+        modem_add_uint(request, MB_REGISTER_FLAGS_CODE, registration_flag);
+    }
+    else
+    {
+        available_data_classes_str = modem_wants(request, MB_REGISTER_DATA_CLASS) ? mbim_data_class_build_string_from_mask(available_data_classes) : NULL;
+        cellular_class_str = modem_wants(request, MB_REGISTER_CLASS) ? mbim_cellular_class_build_string_from_mask(cellular_class) : NULL;
+        registration_flag_str = modem_wants(request, MB_REGISTER_FLAGS) ? mbim_registration_flag_build_string_from_mask(registration_flag) : NULL;
+
+        if (!request->projected)
+            printf("[%s] Registration status:\n"
+                   "\t         Network error: '%s'\n"
+                   "\t        Register state: '%s'\n"
+                   "\t         Register mode: '%s'\n"
+                   "\tAvailable data classes: '%s'\n"
+                   "\tCurrent cellular class: '%s'\n"
+                   "\t           Provider ID: '%s'\n"
+                   "\t         Provider name: '%s'\n"
+                   "\t          Roaming text: '%s'\n"
+                   "\t    Registration flags: '%s'\n",
+                   mbim_device_get_path_display(device), VALIDATE_UNKNOWN(mbim_nw_error_get_string(nw_error)),
+                   VALIDATE_UNKNOWN(mbim_register_state_get_string(register_state)),
+                   VALIDATE_UNKNOWN(mbim_register_mode_get_string(register_mode)), VALIDATE_UNKNOWN(available_data_classes_str),
+                   VALIDATE_UNKNOWN(cellular_class_str), VALIDATE_UNKNOWN(provider_id), VALIDATE_UNKNOWN(provider_name),
+                   VALIDATE_UNKNOWN(roaming_text), VALIDATE_UNKNOWN(registration_flag_str));
+
+        modem_add_string(request, MB_REGISTER_NET_ERROR, VALIDATE_UNKNOWN(mbim_nw_error_get_string(nw_error)));
+        modem_add_string(request, MB_REGISTER_STATE_STR, VALIDATE_UNKNOWN(mbim_register_state_get_string(register_state)));
+        modem_add_string(request, MB_REGISTER_MODE, VALIDATE_UNKNOWN(mbim_register_mode_get_string(register_mode)));
+        modem_add_string(request, MB_REGISTER_DATA_CLASS, VALIDATE_UNKNOWN(available_data_classes_str));
+        modem_add_string(request, MB_REGISTER_CLASS, VALIDATE_UNKNOWN(cellular_class_str));
+        modem_add_string(request, MB_REGISTER_FLAGS, VALIDATE_UNKNOWN(registration_flag_str));
+
+        g_free(available_data_classes_str);
+        g_free(cellular_class_str);
+        g_free(registration_flag_str);
+    }
+
+    modem_add_uint(request, MB_REGISTER_STATE, register_state);
+    modem_add_string(request, MB_REGISTER_PROVIDER_ID, VALIDATE_UNKNOWN(provider_id));
+    modem_add_string(request, MB_REGISTER_PROVIDER_NAME, VALIDATE_UNKNOWN(provider_name));
+    modem_add_string(request, MB_REGISTER_ROAMING, VALIDATE_UNKNOWN(roaming_text));
+
+    mb_add_response(&request->resp, MBIM_OK);
     g_free(provider_name);
     g_free(provider_id);
     g_free(roaming_text);
 
     mbim_message_unref(response);
-    mbim_close(request);
+    mbim_request_done(request);
 }
 
 /** Callback function when packet service set operation is ready
@@ -358,7 +507,7 @@ static void packet_service_ready(MbimDevice *device, GAsyncResult *res, Mbim_req
         g_error_free(error);
         if (response)
             mbim_message_unref(response);
-        mbim_close(request);
+        mbim_request_done(request);
         return;
     }
 
@@ -370,40 +519,53 @@ static void packet_service_ready(MbimDevice *device, GAsyncResult *res, Mbim_req
 
         g_error_free(error);
         mbim_message_unref(response);
-        mbim_close(request);
+        mbim_request_done(request);
         return;
     }
 
-    highest_available_data_class_str = mbim_data_class_build_string_from_mask(highest_available_data_class);
-    uplink_speed_str = g_strdup_printf("%" G_GUINT64_FORMAT " bps", uplink_speed);
-    downlink_speed_str = g_strdup_printf("%" G_GUINT64_FORMAT " bps", downlink_speed);
-
-    printf("[%s] Packet service status:\n"
-             "\t         Network error: '%s'\n"
-             "\t  Packet service state: '%s'\n"
-             "\tAvailable data classes: '%s'\n"
-             "\t          Uplink speed: '%" G_GUINT64_FORMAT " bps'\n"
-             "\t        Downlink speed: '%" G_GUINT64_FORMAT " bps'\n",
-             mbim_device_get_path_display(device), VALIDATE_UNKNOWN(mbim_nw_error_get_string(nw_error)),
-             VALIDATE_UNKNOWN(mbim_packet_service_state_get_string(packet_service_state)),
-             VALIDATE_UNKNOWN(highest_available_data_class_str), uplink_speed, downlink_speed);
-
-    databuf_add_string(&request->resp, MB_ATTACH_NET_ERROR, VALIDATE_UNKNOWN(mbim_nw_error_get_string(nw_error)));
-    databuf_add_string(&request->resp, MB_ATTACH_PCK_SERVICE_STATE, VALIDATE_UNKNOWN(mbim_packet_service_state_get_string(packet_service_state)));
-    databuf_add_string(&request->resp, MB_ATTACH_DATA_CLASS, VALIDATE_UNKNOWN(highest_available_data_class_str));
-    databuf_add_string(&request->resp, MB_ATTACH_UP_SPEED_STR, VALIDATE_UNKNOWN(uplink_speed_str));
-    databuf_add_string(&request->resp, MB_ATTACH_DOWN_SPEED_STR, VALIDATE_UNKNOWN(downlink_speed_str));
-    databuf_add_uint(&request->resp, MB_ATTACH_UP_SPEED, (unsigned int) uplink_speed);
-    databuf_add_uint(&request->resp, MB_ATTACH_DOWN_SPEED, (unsigned int) downlink_speed);
+    if (request->codes)
+    {
+        modem_add_uint(request, MB_ATTACH_NET_ERROR_CODE, nw_error);
+        modem_add_uint(request, MB_ATTACH_PCK_SERVICE_STATE_CODE, packet_service_state);
+        modem_add_uint(request, MB_ATTACH_DATA_CLASS_CODE, highest_available_data_class);
+    }
+    else
+    {
+        highest_available_data_class_str = modem_wants(request, MB_ATTACH_DATA_CLASS) ? mbim_data_class_build_string_from_mask(highest_available_data_class) : NULL;
+        uplink_speed_str = modem_wants(request, MB_ATTACH_UP_SPEED_STR) ? g_strdup_printf("%" G_GUINT64_FORMAT " bps", uplink_speed) : NULL;
+        downlink_speed_str = modem_wants(request, MB_ATTACH_DOWN_SPEED_STR) ? g_strdup_printf("%" G_GUINT64_FORMAT " bps", downlink_speed) : NULL;
+
+        if (!request->projected)
+            printf("[%s] Packet service status:\n"
+                     "\t         Network error: '%s'\n"
+                     "\t  Packet service state: '%s'\n"
+                     "\tAvailable data classes: '%s'\n"
+                     "\t          Uplink speed: '%" G_GUINT64_FORMAT " bps'\n"
+                     "\t        Downlink speed: '%" G_GUINT64_FORMAT " bps'\n",
+                     mbim_device_get_path_display(device), VALIDATE_UNKNOWN(mbim_nw_error_get_string(nw_error)),
+                     VALIDATE_UNKNOWN(mbim_packet_service_state_get_string(packet_service_state)),
+                     VALIDATE_UNKNOWN(highest_available_data_class_str), uplink_speed, downlink_speed);
+
+        modem_add_string(request, MB_ATTACH_NET_ERROR, VALIDATE_UNKNOWN(mbim_nw_error_get_string(nw_error)));
+        modem_add_string(request, MB_ATTACH_PCK_SERVICE_STATE, VALIDATE_UNKNOWN(mbim_packet_service_state_get_string(packet_service_state)));
+        modem_add_string(request, MB_ATTACH_DATA_CLASS, VALIDATE_UNKNOWN(highest_available_data_class_str));
+        modem_add_string(request, MB_ATTACH_UP_SPEED_STR, VALIDATE_UNKNOWN(uplink_speed_str));
+        modem_add_string(request, MB_ATTACH_DOWN_SPEED_STR, VALIDATE_UNKNOWN(downlink_speed_str));
+
+        g_free(highest_available_data_class_str);
+        g_free(uplink_speed_str);
+        g_free(downlink_speed_str);
+    }
 
-    databuf_add_uint(&request->resp, MB_RESPONSE, MBIM_OK);
+    modem_add_uint(request, MB_ATTACH_UP_SPEED, (unsigned int) uplink_speed);
+    modem_add_uint(request, MB_ATTACH_DOWN_SPEED, (unsigned int) downlink_speed);
+    modem_add_uint64(request, MB_ATTACH_UP_SPEED64, uplink_speed);
+    modem_add_uint64(request, MB_ATTACH_DOWN_SPEED64, downlink_speed);
 
-    g_free(highest_available_data_class_str);
-    g_free(uplink_speed_str);
-    g_free(downlink_speed_str);
+    mb_add_response(&request->resp, MBIM_OK);
 
     mbim_message_unref(response);
-    mbim_close(request);
+    mbim_request_done(request);
 }
 
 /** Callback function when connect set operation is ready
@@ -432,7 +594,7 @@ static void connect_ready(MbimDevice *device, GAsyncResult *res, Mbim_request *r
         g_error_free(error);
         if (response)
             mbim_message_unref(response);
-        mbim_close(request);
+        mbim_request_done(request);
         return;
     }
 
@@ -444,43 +606,54 @@ static void connect_ready(MbimDevice *device, GAsyncResult *res, Mbim_request *r
 
         g_error_free(error);
         mbim_message_unref(response);
-        mbim_close(request);
+        mbim_request_done(request);
         return;
     }
     mbim_message_unref(response);
 
-    databuf_add_uint(&request->resp, MB_RESPONSE, MBIM_OK);
+    mb_add_response(&request->resp, MBIM_OK);
 
     if (!request->user_data)
     {
         printf("[%s] Successfully connected\n", mbim_device_get_path_display(device));
-        mbim_close(request);
+        mbim_request_done(request);
         return;
     }
 
-    printf("[%s] Connection status:\n"
-           "\t      Session ID: '%u'\n"
-           "\tActivation state: '%s'\n"
-           "\tVoice call state: '%s'\n"
-           "\t         IP type: '%s'\n"
-           "\t    Context type: '%s'\n"
-           "\t   Network error: '%s'\n",
-           mbim_device_get_path_display(device), session_id, VALIDATE_UNKNOWN(mbim_activation_state_get_string(activation_state)),
-           VALIDATE_UNKNOWN(mbim_voice_call_state_get_string(voice_call_state)),
-           VALIDATE_UNKNOWN(mbim_context_ip_type_get_string(ip_type)),
-           VALIDATE_UNKNOWN(mbim_context_type_get_string(mbim_uuid_to_context_type(context_type))),
-           VALIDATE_UNKNOWN(mbim_nw_error_get_string(nw_error)));
-
-    databuf_add_string(&request->resp, MB_STATE_ACTIVATION_STR, VALIDATE_UNKNOWN(mbim_activation_state_get_string(activation_state)));
-    databuf_add_string(&request->resp, MB_STATE_VOICE_CALL_STATE, VALIDATE_UNKNOWN(mbim_voice_call_state_get_string(voice_call_state)));
-    databuf_add_string(&request->resp, MB_STATE_IP_TYPE, VALIDATE_UNKNOWN(mbim_context_ip_type_get_string(ip_type)));
-    databuf_add_string(&request->resp, MB_STATE_CONTEXT_TYPE, VALIDATE_UNKNOWN(mbim_context_type_get_string(mbim_uuid_to_context_type(context_type))));
-    databuf_add_string(&request->resp, MB_STATE_NETWORK_ERROR, VALIDATE_UNKNOWN(mbim_nw_error_get_string(nw_error)));
-
-    databuf_add_uint(&request->resp, MB_STATE_ACTIVATION, activation_state);
-    databuf_add_uint(&request->resp, MB_STATE_SESSION_ID, session_id);
-
-    mbim_close(request);
+    if (request->codes)
+    {
+        modem_add_uint(request, MB_STATE_VOICE_CALL_STATE_CODE, voice_call_state);
+        modem_add_uint(request, MB_STATE_IP_TYPE_CODE, ip_type);
+        modem_add_uint(request, MB_STATE_CONTEXT_TYPE_CODE, mbim_uuid_to_context_type(context_type));
+        modem_add_uint(request, MB_STATE_NETWORK_ERROR_CODE, nw_error);
+    }
+    else
+    {
+        if (!request->projected)
+            printf("[%s] Connection status:\n"
+                   "\t      Session ID: '%u'\n"
+                   "\tActivation state: '%s'\n"
+                   "\tVoice call state: '%s'\n"
+                   "\t         IP type: '%s'\n"
+                   "\t    Context type: '%s'\n"
+                   "\t   Network error: '%s'\n",
+                   mbim_device_get_path_display(device), session_id, VALIDATE_UNKNOWN(mbim_activation_state_get_string(activation_state)),
+                   VALIDATE_UNKNOWN(mbim_voice_call_state_get_string(voice_call_state)),
+                   VALIDATE_UNKNOWN(mbim_context_ip_type_get_string(ip_type)),
+                   VALIDATE_UNKNOWN(mbim_context_type_get_string(mbim_uuid_to_context_type(context_type))),
+                   VALIDATE_UNKNOWN(mbim_nw_error_get_string(nw_error)));
+
+        modem_add_string(request, MB_STATE_ACTIVATION_STR, VALIDATE_UNKNOWN(mbim_activation_state_get_string(activation_state)));
+        modem_add_string(request, MB_STATE_VOICE_CALL_STATE, VALIDATE_UNKNOWN(mbim_voice_call_state_get_string(voice_call_state)));
+        modem_add_string(request, MB_STATE_IP_TYPE, VALIDATE_UNKNOWN(mbim_context_ip_type_get_string(ip_type)));
+        modem_add_string(request, MB_STATE_CONTEXT_TYPE, VALIDATE_UNKNOWN(mbim_context_type_get_string(mbim_uuid_to_context_type(context_type))));
+        modem_add_string(request, MB_STATE_NETWORK_ERROR, VALIDATE_UNKNOWN(mbim_nw_error_get_string(nw_error)));
+    }
+
+    modem_add_uint(request, MB_STATE_ACTIVATION, activation_state);
+    modem_add_uint(request, MB_STATE_SESSION_ID, session_id);
+
+    mbim_request_done(request);
 }
 
 /** Callback function when IP configuration query operation is ready
@@ -521,7 +694,7 @@ static void ip_configuration_query_ready(MbimDevice *device, GAsyncResult *res,
         if (response)
             mbim_message_unref(response);
 
-        mbim_close(request);
+        mbim_request_done(request);
         return;
     }
 
@@ -551,11 +724,11 @@ static void ip_configuration_query_ready(MbimDevice *device, GAsyncResult *res,
         if (response)
             mbim_message_unref(response);
 
-        mbim_close(request);
+        mbim_request_done(request);
         return;
     }
 
-    databuf_add_uint(&request->resp, MB_RESPONSE, MBIM_OK);
+    mb_add_response(&request->resp, MBIM_OK);
 
     if (!(ipv4configurationavailable & MBIM_IP_CONFIGURATION_AVAILABLE_FLAG_GATEWAY))
         ipv4gateway = NULL;
@@ -563,45 +736,45 @@ static void ip_configuration_query_ready(MbimDevice *device, GAsyncResult *res,
     if (!(ipv6configurationavailable & MBIM_IP_CONFIGURATION_AVAILABLE_FLAG_GATEWAY))
         ipv6gateway = NULL;
 
-    databuf_add_uint(&request->resp, MB_IPV4_NB, ipv4addresscount);
-    databuf_add_uint(&request->resp, MB_IPV6_NB, ipv6addresscount);
+    modem_add_uint(request, MB_IPV4_NB, ipv4addresscount);
+    modem_add_uint(request, MB_IPV6_NB, ipv6addresscount);
 
-    if (ipv4gateway)
+    if (ipv4gateway && modem_wants(request, MB_IPV4_GW))
     {
         addr = g_inet_address_new_from_bytes((const guint8 *) ipv4gateway, G_SOCKET_FAMILY_IPV4);
         str = g_inet_address_to_string (addr);
-        databuf_add_string(&request->resp, MB_IPV4_GW, str);
+        modem_add_string(request, MB_IPV4_GW, str);
         g_object_unref(addr);
     }
 
-    if (ipv6gateway)
+    if (ipv6gateway && modem_wants(request, MB_IPV6_GW))
     {
         addr = g_inet_address_new_from_bytes((const guint8 *) ipv6gateway, G_SOCKET_FAMILY_IPV6);
         str = g_inet_address_to_string(addr);
-        databuf_add_string(&request->resp, MB_IPV6_GW, str);
+        modem_add_string(request, MB_IPV6_GW, str);
         g_object_unref(addr);
     }
 
-    for (int i = 0; i < ipv4addresscount; i++)
+    for (int i = 0; modem_wants(request, MB_IPV4_ADDR) && i < ipv4addresscount; i++)
     {
         addr = g_inet_address_new_from_bytes((guint8 *) &ipv4address[i]->ipv4_address, G_SOCKET_FAMILY_IPV4);
         str = g_inet_address_to_string (addr);
         cidr = g_strdup_printf("%s/%u", str, ipv4address[i]->on_link_prefix_length);
 
-        databuf_add_string(&request->resp, MB_IPV4_ADDR, cidr);
+        modem_add_string(request, MB_IPV4_ADDR, cidr);
 
         g_free(str);
         g_free(cidr);
         g_object_unref(addr);
     }
 
-    for (int i = 0; i < ipv6addresscount; i++)
+    for (int i = 0; modem_wants(request, MB_IPV6_ADDR) && i < ipv6addresscount; i++)
     {
         addr = g_inet_address_new_from_bytes((guint8 *) &ipv6address[i]->ipv6_address, G_SOCKET_FAMILY_IPV6);
         str = g_inet_address_to_string(addr);
         cidr = g_strdup_printf("%s/%u", str, ipv6address[i]->on_link_prefix_length);
 
-        databuf_add_string(&request->resp, MB_IPV6_ADDR, cidr);
+        modem_add_string(request, MB_IPV6_ADDR, cidr);
 
         g_free(str);
         g_free(cidr);
@@ -615,7 +788,7 @@ static void ip_configuration_query_ready(MbimDevice *device, GAsyncResult *res,
 
     if (response)
         mbim_message_unref(response);
-    mbim_close(request);
+    mbim_request_done(request);
 }
 
 /** Callback function when query device caps operation is ready
@@ -656,7 +829,7 @@ static void query_device_caps_ready(MbimDevice *device, GAsyncResult *res, Mbim_
         g_error_free(error);
         if (response)
             mbim_message_unref(response);
-        mbim_close(request);
+        mbim_request_done(request);
         return;
     }
 
@@ -680,45 +853,60 @@ static void query_device_caps_ready(MbimDevice *device, GAsyncResult *res, Mbim_
         set_error(request, error->message);
         g_error_free(error);
         mbim_message_unref(response);
-        mbim_close(request);
+        mbim_request_done(request);
         return;
     }
 
-    databuf_add_uint(&request->resp, MB_RESPONSE, MBIM_OK);
-
-    device_type_str = mbim_device_type_get_string (device_type);
-    cellular_class_str = mbim_cellular_class_build_string_from_mask (cellular_class);
-    voice_class_str = mbim_voice_class_get_string (voice_class);
-    sim_class_str = mbim_sim_class_build_string_from_mask (sim_class);
-    data_class_str = mbim_data_class_build_string_from_mask (data_class);
-    sms_caps_str = mbim_sms_caps_build_string_from_mask (sms_caps);
-    ctrl_caps_str = mbim_ctrl_caps_build_string_from_mask (ctrl_caps);
-
-    databuf_add_uint(&request->resp, MB_DEV_MAX_SESSION, max_sessions);
-    databuf_add_string(&request->resp, MB_DEV_TYPE, VALIDATE_UNKNOWN(device_type_str));
-    databuf_add_string(&request->resp, MB_DEV_CELL_CLASS, VALIDATE_UNKNOWN(cellular_class_str));
-    databuf_add_string(&request->resp, MB_DEV_VOICE_CLASS, VALIDATE_UNKNOWN(voice_class_str));
-    databuf_add_string(&request->resp, MB_DEV_SIM_CLASS, VALIDATE_UNKNOWN(sim_class_str));
-    databuf_add_string(&request->resp, MB_DEV_DATA_CLASS, VALIDATE_UNKNOWN(data_class_str));
-    databuf_add_string(&request->resp, MB_DEV_SMS_CAPS, VALIDATE_UNKNOWN(sms_caps_str));
-    databuf_add_string(&request->resp, MB_DEV_CTRL_CAPS, VALIDATE_UNKNOWN(ctrl_caps_str));
-    databuf_add_string(&request->resp, MB_DEV_CUST_DATA_CLASS, VALIDATE_UNKNOWN(custom_data_class));
-    databuf_add_string(&request->resp, MB_DEV_ID, VALIDATE_UNKNOWN(device_id));
-    databuf_add_string(&request->resp, MB_DEV_FMW_INFO, VALIDATE_UNKNOWN(firmware_info));
-    databuf_add_string(&request->resp, MB_DEV_HW_INFO, VALIDATE_UNKNOWN(hardware_info));
-
-    g_free(cellular_class_str);
-    g_free(sim_class_str);
-    g_free(data_class_str);
-    g_free(sms_caps_str);
-    g_free(ctrl_caps_str);
+    mb_add_response(&request->resp, MBIM_OK);
+
+    if (request->codes)
+    {
+        modem_add_uint(request, MB_DEV_TYPE_CODE, device_type);
+        modem_add_uint(request, MB_DEV_CELL_CLASS_CODE, cellular_class);
+        modem_add_uint(request, MB_DEV_VOICE_CLASS_CODE, voice_class);
+        modem_add_uint(request, MB_DEV_SIM_CLASS_CODE, sim_class);
+        modem_add_uint(request, MB_DEV_DATA_CLASS_CODE, data_class);
+        modem_add_uint(request, MB_DEV_SMS_CAPS_CODE, sms_caps);
+        modem_add_uint(request, MB_DEV_CTRL_CAPS_CODE, ctrl_caps);
+    }
+    else
+    {
+        device_type_str = mbim_device_type_get_string (device_type);
+        cellular_class_str = modem_wants(request, MB_DEV_CELL_CLASS) ? mbim_cellular_class_build_string_from_mask (cellular_class) : NULL;
+        voice_class_str = mbim_voice_class_get_string (voice_class);
+        sim_class_str = modem_wants(request, MB_DEV_SIM_CLASS) ? mbim_sim_class_build_string_from_mask (sim_class) : NULL;
+        data_class_str = modem_wants(request, MB_DEV_DATA_CLASS) ? mbim_data_class_build_string_from_mask (data_class) : NULL;
+        sms_caps_str = modem_wants(request, MB_DEV_SMS_CAPS) ? mbim_sms_caps_build_string_from_mask (sms_caps) : NULL;
+        ctrl_caps_str = modem_wants(request, MB_DEV_CTRL_CAPS) ? mbim_ctrl_caps_build_string_from_mask (ctrl_caps) : NULL;
+
+        modem_add_string(request, MB_DEV_TYPE, VALIDATE_UNKNOWN(device_type_str));
+        modem_add_string(request, MB_DEV_CELL_CLASS, VALIDATE_UNKNOWN(cellular_class_str));
+        modem_add_string(request, MB_DEV_VOICE_CLASS, VALIDATE_UNKNOWN(voice_class_str));
+        modem_add_string(request, MB_DEV_SIM_CLASS, VALIDATE_UNKNOWN(sim_class_str));
+        modem_add_string(request, MB_DEV_DATA_CLASS, VALIDATE_UNKNOWN(data_class_str));
+        modem_add_string(request, MB_DEV_SMS_CAPS, VALIDATE_UNKNOWN(sms_caps_str));
+        modem_add_string(request, MB_DEV_CTRL_CAPS, VALIDATE_UNKNOWN(ctrl_caps_str));
+
+        g_free(cellular_class_str);
+        g_free(sim_class_str);
+        g_free(data_class_str);
+        g_free(sms_caps_str);
+        g_free(ctrl_caps_str);
+    }
+
+    modem_add_uint(request, MB_DEV_MAX_SESSION, max_sessions);
+    modem_add_string(request, MB_DEV_CUST_DATA_CLASS, VALIDATE_UNKNOWN(custom_data_class));
+    modem_add_string(request, MB_DEV_ID, VALIDATE_UNKNOWN(device_id));
+    modem_add_string(request, MB_DEV_FMW_INFO, VALIDATE_UNKNOWN(firmware_info));
+    modem_add_string(request, MB_DEV_HW_INFO, VALIDATE_UNKNOWN(hardware_info));
+
     g_free(custom_data_class);
     g_free(device_id);
     g_free(firmware_info);
     g_free(hardware_info);
 
     mbim_message_unref(response);
-    mbim_close(request);
+    mbim_request_done(request);
 }
 
 /** Callback function when query signal operation is ready
@@ -741,7 +929,7 @@ static void query_signal_ready(MbimDevice *device, GAsyncResult *res, Mbim_reque
         g_error_free (error);
         if (response)
             mbim_message_unref (response);
-        mbim_close(request);
+        mbim_request_done(request);
         return;
     }
 
@@ -760,31 +948,117 @@ static void query_signal_ready(MbimDevice *device, GAsyncResult *res, Mbim_reque
         set_error(request, error->message);
         g_error_free(error);
         mbim_message_unref(response);
-        mbim_close(request);
+        mbim_request_done(request);
         return;
     }
 
-    databuf_add_uint(&request->resp, MB_RESPONSE, MBIM_OK);
+    mb_add_response(&request->resp, MBIM_OK);
 
-    databuf_add_uint(&request->resp, MB_SIGNAL_RSSI, rssi);
-    databuf_add_uint(&request->resp, MB_SIGNAL_ERROR_RATE, error_rate);
-    databuf_add_uint(&request->resp, MB_SIGNAL_RSCP, rscp);
-    databuf_add_uint(&request->resp, MB_SIGNAL_ECNO, ecno);
-    databuf_add_uint(&request->resp, MB_SIGNAL_RSRQ, rsrq);
-    databuf_add_uint(&request->resp, MB_SIGNAL_RSRP, rsrp);
-    databuf_add_uint(&request->resp, MB_SIGNAL_RSSNR, rssnr);
+    modem_add_uint(request, MB_SIGNAL_RSSI, rssi);
+    modem_add_uint(request, MB_SIGNAL_ERROR_RATE, error_rate);
+    modem_add_uint(request, MB_SIGNAL_RSCP, rscp);
+    modem_add_uint(request, MB_SIGNAL_ECNO, ecno);
+    modem_add_uint(request, MB_SIGNAL_RSRQ, rsrq);
+    modem_add_uint(request, MB_SIGNAL_RSRP, rsrp);
+    modem_add_uint(request, MB_SIGNAL_RSSNR, rssnr);
 
     mbim_message_unref(response);
-    mbim_close(request);
+    mbim_request_done(request);
 }
 
-/** Callback function when device open operation is ready
+// Requests issued concurrently for MBIM_FULL_STATUS
+static const Mbim_req_type g_full_status_parts[] = {
+    MBIM_SUBSCRIBER, MBIM_REGISTER, MBIM_PACKET_SERVICE, MBIM_STATUS, MBIM_IP, MBIM_SIGNAL,
+};
+
+typedef struct full_status
+{
+    Mbim_request *request;
+    Mbim_request parts[G_N_ELEMENTS(g_full_status_parts)];
+    guint pending;
+    guint failed;
+} Full_status;
+
+static void device_command(MbimDevice *dev, Mbim_request *request);
+
+/** Merge the response of a part of MBIM_FULL_STATUS, the request is complete
+ *  once every part is merged
+ *
+ * @param part  Mbim_request pointer of the part
+ */
+static void full_status_part_done(Mbim_request *part)
+{
+    static const unsigned int skip[] = {MB_RESPONSE, MB_ERROR, MB_DEVICE};
+    Full_status *full = part->priv;
+    Mbim_request *request = full->request;
+    unsigned int status = MBIM_ERROR;
+    gchar *error;
+
+    mb_get_response(&part->resp, &status);
+    if (status == MBIM_OK)
+        databuf_merge(&request->resp, &part->resp, skip, G_N_ELEMENTS(skip));
+    else
+    {
+        error = g_strdup_printf("Request %u failed : %s", part->type, VALIDATE_UNKNOWN(mb_get_error(&part->resp)));
+        mb_add_error(&request->resp, error);
+        g_free(error);
+        full->failed++;
+    }
+    databuf_free(&part->resp);
+
+    if (--full->pending)
+        return;
+
+    mb_add_response(&request->resp, full->failed < G_N_ELEMENTS(full->parts) ? MBIM_OK : MBIM_ERROR);
+    g_free(full);
+    mbim_request_done(request);
+}
+
+/** Issue every part of MBIM_FULL_STATUS at once on the opened device
+ *
+ * The transactions are outstanding together, the request takes as long as
+ * the slowest one. The responses are merged into the response of the
+ * request, a part that fails adds an MB_ERROR and the response is only an
+ * error if every part failed.
  *
  * @param dev      MbimDevice pointer
- * @param res      GAsyncResult pointer
  * @param request  Mbim_request pointer
  */
-static void device_open_ready(MbimDevice *dev, GAsyncResult *res, Mbim_request *request)
+static void full_status_command(MbimDevice *dev, Mbim_request *request)
+{
+    Full_status *full = g_new0(Full_status, 1);
+    guint i;
+
+    full->request = request;
+    full->pending = G_N_ELEMENTS(g_full_status_parts);
+
+    for (i = 0; i < G_N_ELEMENTS(g_full_status_parts); i++)
+    {
+        Mbim_request *part = &full->parts[i];
+
+        part->type = g_full_status_parts[i];
+        part->proto = request->proto;
+        part->tid = request->tid;
+        part->codes = request->codes;
+        part->projected = request->projected;
+        memcpy(part->fields, request->fields, sizeof(part->fields));
+        part->req = request->req;
+        part->done = full_status_part_done;
+        part->priv = full;
+        databuf_init(&part->resp);
+    }
+
+    // The last part may complete the request and free full
+    for (i = 0; i < G_N_ELEMENTS(g_full_status_parts); i++)
+        device_command(dev, &full->parts[i]);
+}
+
+/** Send the MBIM command matching the request on the opened device
+ *
+ * @param dev      MbimDevice pointer
+ * @param request  Mbim_request pointer
+ */
+static void device_command(MbimDevice *dev, Mbim_request *request)
 {
     int timeout = 40;
     char *pin_code;
@@ -797,17 +1071,14 @@ static void device_open_ready(MbimDevice *dev, GAsyncResult *res, Mbim_request *
     MbimMessage *mb_request = NULL;
     GAsyncReadyCallback callback = NULL;
 
-    if (!mbim_device_open_finish(dev, res, &error))
+    mb_add_device(&request->resp, mbim_device_get_path_display(dev));
+
+    if (request->type == MBIM_FULL_STATUS)
     {
-        printf("Couldn't open the MbimDevice: %s\n", error->message);
-        set_error(request, error->message);
-        g_error_free(error);
-        g_main_loop_quit(g_loop);
+        full_status_command(dev, request);
         return;
     }
 
-    databuf_add_string(&request->resp, MB_DEVICE, mbim_device_get_path_display(dev));
-
     request->user_data = 0;
     switch (request->type)
     {
@@ -817,7 +1088,7 @@ static void device_open_ready(MbimDevice *dev, GAsyncResult *res, Mbim_request *
             break;
 
         case MBIM_PIN_ENTER:
-            pin_code = databuf_get_string(&request->req, MB_PIN_CODE);
+            pin_code = mb_get_pin_code(&request->req);
             if (!pin_code)
             {
                 set_error(request, "You must provide a pin code (MB_PIN_CODE)");
@@ -852,22 +1123,22 @@ static void device_open_ready(MbimDevice *dev, GAsyncResult *res, Mbim_request *
             break;
 
         case MBIM_CONNECT:
-            apn = databuf_get_string(&request->req, MB_APN);
+            apn = mb_get_apn(&request->req);
             if (!apn)
             {
                 set_error(request, "You must provide an APN (MB_APN)");
                 break;
             }
 
-            databuf_get_uint(&request->req, MB_AUTH, &auth);
+            mb_get_auth(&request->req, &auth);
             if (auth == -1)
             {
                 set_error(request, "You must provide a auth protocol (MB_AUTH)");
                 break;
             }
 
-            username = databuf_get_string(&request->req, MB_USERNAME);
-            password = databuf_get_string(&request->req, MB_PASSWORD);
+            username = mb_get_username(&request->req);
+            password = mb_get_password(&request->req);
 
             mb_request = mbim_message_connect_set_new(session_id, MBIM_ACTIVATION_COMMAND_ACTIVATE, apn, username,
                                                       password, MBIM_COMPRESSION_NONE, auth, MBIM_CONTEXT_IP_TYPE_DEFAULT,
@@ -921,7 +1192,7 @@ static void device_open_ready(MbimDevice *dev, GAsyncResult *res, Mbim_request *
     }
 
     if (callback)
-        mbim_device_command(g_device, mb_request, timeout, g_cancellable, callback, request);
+        mbim_device_command(dev, mb_request, timeout, modem_get_cancellable(), callback, request);
 
     if (mb_request)
         mbim_message_unref(mb_request);
@@ -930,83 +1201,230 @@ static void device_open_ready(MbimDevice *dev, GAsyncResult *res, Mbim_request *
     {
         set_error(request, error->message);
         g_error_free(error);
-        mbim_close(request);
     }
+
+    if (!callback)
+        mbim_request_done(request);
+}
+
+/** Check if the long-lived device can be used for the next request
+ *
+ * @return TRUE if the device is opened and was not removed
+ */
+static gboolean device_is_usable(void)
+{
+    return g_device && !g_device_removed && mbim_device_is_open(g_device);
+}
+
+static void device_open(void);
+
+/** Check that a request runs in the session of the device, else complete it
+ * with an error
+ *
+ * The device is opened once, in the session of the MB_SESSION_TID of the
+ * request that opened it, if any. A request giving another MB_SESSION_TID is
+ * rejected rather than sent in a session it did not ask for.
+ *
+ * @param request  Mbim_request pointer
+ *
+ * @return TRUE if the request can be sent to the device
+ */
+static gboolean device_session_matches(Mbim_request *request)
+{
+    if (!request->tid || request->tid == g_session_tid)
+        return TRUE;
+
+    printf("Session %u requested, the device is opened in session %u\n", request->tid, g_session_tid);
+    set_error(request, "MB_SESSION_TID differs from the session of the opened device");
+    mbim_request_done(request);
+
+    return FALSE;
+}
+
+/** Run a request on the device, or queue it until the device is opened
+ *
+ * @param request  Mbim_request pointer
+ */
+static void device_submit(Mbim_request *request)
+{
+    if (!g_device_opening && device_is_usable())
+    {
+        if (device_session_matches(request))
+            device_command(g_device, request);
+        return;
+    }
+
+    g_queue_push_tail(&g_waiting, request);
+    if (!g_device_opening)
+        device_open();
+}
+
+/** Complete the requests waiting for the device to be opened
+ *
+ * @param error  Open error, NULL if the device is opened
+ */
+static void device_waiting_complete(const GError *error)
+{
+    Mbim_request *request;
+
+    g_device_opening = FALSE;
+
+    while ((request = g_queue_pop_head(&g_waiting)))
+    {
+        if (error)
+        {
+            set_error(request, error->message);
+            mbim_request_done(request);
+        }
+        else if (device_session_matches(request))
+            device_command(g_device, request);
+    }
+}
+
+/** Callback function when device open operation is ready
+ *
+ * @param dev      MbimDevice pointer
+ * @param res      GAsyncResult pointer
+ * @param unused   Unused parameter
+ */
+static void device_open_ready(MbimDevice *dev, GAsyncResult *res, gpointer unused)
+{
+    GError *error = NULL;
+
+    (void) unused;
+
+    if (!mbim_device_open_finish(dev, res, &error))
+    {
+        printf("Couldn't open the MbimDevice: %s\n", error->message);
+        g_clear_object(&g_device);
+        device_waiting_complete(error);
+        g_error_free(error);
+        return;
+    }
+
+    g_device_removed = FALSE;
+    g_signal_connect(dev, MBIM_DEVICE_SIGNAL_REMOVED, G_CALLBACK(device_removed), NULL);
+    if (g_subscribed)
+        g_signal_connect(dev, MBIM_DEVICE_SIGNAL_INDICATE_STATUS, G_CALLBACK(device_indication), NULL);
+
+    device_waiting_complete(NULL);
 }
 
 /** Callback function when new device is available
  *
  * @param unused   Unused parameter
  * @param res      GAsyncResult pointer
- * @param request  Mbim_request pointer
+ * @param unused2  Unused parameter
  */
-static void device_new_ready(GObject *unused, GAsyncResult *res, Mbim_request *request)
+static void device_new_ready(GObject *unused, GAsyncResult *res, gpointer unused2)
 {
     GError *error = NULL;
     MbimDeviceOpenFlags open_flags = MBIM_DEVICE_OPEN_FLAGS_PROXY;
+    Mbim_request *request;
 
     (void) unused;
+    (void) unused2;
 
     g_device = mbim_device_new_finish(res, &error);
     if (!g_device)
     {
         printf("Couldn't create MbimDevice: %s\n", error->message);
-        set_error(request, error->message);
+        device_waiting_complete(error);
         g_error_free(error);
-        g_main_loop_quit(g_loop);
         return;
     }
 
-    if (request->tid)
+    // The request that triggered the open provides the session
+    request = g_queue_peek_head(&g_waiting);
+    g_in_session = request && request->tid ? TRUE : FALSE;
+    g_session_tid = g_in_session ? request->tid : 0;
+    if (g_in_session)
         g_object_set(g_device, MBIM_DEVICE_IN_SESSION, TRUE, MBIM_DEVICE_TRANSACTION_ID, request->tid, NULL);
 
-    mbim_device_open_full(g_device, open_flags, 5, g_cancellable, (GAsyncReadyCallback) device_open_ready, request);
+    mbim_device_open_full(g_device, open_flags, 5, modem_get_cancellable(), (GAsyncReadyCallback) device_open_ready, NULL);
 }
 
-/** Perform the MBIM request and handle the response
+/** Start opening the MbimDevice, the requests wait for it in g_waiting
+ */
+static void device_open(void)
+{
+    GFile *file;
+
+    g_device_opening = TRUE;
+
+    // A late signal of the previous device must not apply to the next one
+    if (g_device)
+    {
+        g_signal_handlers_disconnect_by_func(g_device, G_CALLBACK(device_removed), NULL);
+        g_signal_handlers_disconnect_by_func(g_device, G_CALLBACK(device_indication), NULL);
+    }
+    g_clear_object(&g_device);
+
+    file = g_file_new_for_commandline_arg(MBIM_NNG_DEVICE);
+    mbim_device_new(file, modem_get_cancellable(), (GAsyncReadyCallback) device_new_ready, NULL);
+    g_object_unref(file);
+}
+
+/** Perform the MBIM request, runs on the modem thread
+ *
+ * The MbimDevice is opened on the first request and kept open for the
+ * following ones, it is only reopened when it was removed or closed on error. The request is completed through
+ * its done callback.
  *
  * @param request  Mbim_request pointer
  */
 void mbim_perform_request(Mbim_request *request)
 {
-    GFile *file;
-    guint intid;
-    guint hupid;
-    guint termid;
     const char *mbim_device = MBIM_NNG_DEVICE;
 
     if (access(mbim_device, R_OK) != 0)
     {
         printf("No %s file\n", mbim_device);
         set_error(request, "No mbim device file");
+        if (!g_device_opening)
+            g_clear_object(&g_device);
+        mbim_request_done(request);
         return;
     }
 
-    file = g_file_new_for_commandline_arg(mbim_device);
+    device_submit(request);
+}
 
-    g_cancellable = g_cancellable_new();
-    g_loop = g_main_loop_new(NULL, FALSE);
+/** Publish the MBIM indications, runs on the modem thread
+ *
+ * The indication handler is attached to the device once opened by a request,
+ * and again on every reopen.
+ */
+static void mbim_subscribe(void)
+{
+    g_subscribed = TRUE;
 
-    intid = g_unix_signal_add(SIGINT, (GSourceFunc) signals_handler, GUINT_TO_POINTER(SIGINT));
-    hupid = g_unix_signal_add(SIGHUP, (GSourceFunc) signals_handler, GUINT_TO_POINTER(SIGHUP));
-    termid = g_unix_signal_add(SIGTERM, (GSourceFunc) signals_handler, GUINT_TO_POINTER(SIGTERM));
+    if (!g_device_opening && device_is_usable())
+        g_signal_connect(g_device, MBIM_DEVICE_SIGNAL_INDICATE_STATUS, G_CALLBACK(device_indication), NULL);
+}
 
-    mbim_device_new(file, g_cancellable, (GAsyncReadyCallback) device_new_ready, request);
-    g_main_loop_run(g_loop);
+/** Close the long-lived MBIM device, if opened, runs on the modem thread
+ */
+void mbim_shutdown(void)
+{
+    GMainLoop *loop;
 
-    g_source_remove(intid);
-    g_source_remove(hupid);
-    g_source_remove(termid);
+    if (!g_device)
+        return;
 
-    if (g_cancellable)
-        g_object_unref(g_cancellable);
-    if (g_device)
-        g_object_unref(g_device);
+    loop = g_main_loop_new(g_main_context_get_thread_default(), FALSE);
 
-    g_main_loop_unref(g_loop);
-    g_object_unref(file);
+    g_object_set(g_device, MBIM_DEVICE_IN_SESSION, g_in_session, NULL);
+    mbim_device_close(g_device, 15, NULL, (GAsyncReadyCallback) device_close_ready, loop);
+    g_main_loop_run(loop);
 
-    g_device = NULL;
-    g_loop = NULL;
-    g_cancellable = NULL;
+    g_main_loop_unref(loop);
+    g_clear_object(&g_device);
 }
+
+const Modem_backend mbim_backend = {
+    .name = "mbim",
+    .execute = mbim_perform_request,
+    .subscribe = mbim_subscribe,
+    .close = mbim_shutdown,
+};
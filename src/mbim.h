@@ -2,7 +2,7 @@
 #define MBIM_NNG_MBIM_H
 
 #include "databuf.h"
-#include "mbim_enum.h"
+#include "mbim_schema.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -12,6 +12,13 @@ extern "C" {
 #define MBIM_NNG_DEVICE "/dev/cdc-wdm0"
 #endif
 #define VALIDATE_UNKNOWN(str) ((str) ? (str) : "unknown")
+// Words of the MB_FIELD set, one bit per variable number (var >> 8)
+#define MB_FIELD_WORDS 8
+
+typedef struct mbim_request Mbim_request;
+
+// Called on the modem thread once the response is complete
+typedef void (*Mbim_request_done)(Mbim_request *request);
 
 typedef struct mbim_request
 {
@@ -19,12 +26,36 @@ typedef struct mbim_request
     Mbim_protocol proto;
     unsigned int tid;
     unsigned int user_data;
+    bool codes; // MB_CODES, enumerations and bitmasks are sent as codes
+    bool projected; // MB_FIELD given, only the variables of fields are sent
+    uint32_t fields[MB_FIELD_WORDS];
     Databuf req;
     Databuf resp;
+    Mbim_request_done done;
+    void *priv;
+    unsigned int cache_gen; // Cache generation at submit, see cache_put()
+    int64_t trace_start; // Start on the backend, see trace_request()
+    Mbim_request_done trace_done;
 } Mbim_request;
 
+// Modem backend, its functions run on the modem thread, see modem_set_backend()
+typedef struct modem_backend
+{
+    const char *name;
+    bool (*open)(void);                      // Optional, before the first request
+    void (*execute)(Mbim_request *request);  // Complete the request with its done callback
+    void (*subscribe)(void);                 // Optional, publish the state changes with notify_publish()
+    void (*close)(void);                     // Close the device, the requests have completed
+} Modem_backend;
+
 void mbim_perform_request(Mbim_request *request);
+void mbim_shutdown(void);
 void qmi_perform_request(Mbim_request *request);
+void qmi_shutdown(void);
+
+// The devices are opened by their first request, the indications follow
+extern const Modem_backend mbim_backend;
+extern const Modem_backend qmi_backend;
 
 #ifdef __cplusplus
 }
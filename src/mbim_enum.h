@@ -20,6 +20,8 @@ typedef enum
     MBIM_DEVICE_CAPS,
     MBIM_PACKET_SERVICE,
     MBIM_SIGNAL,
+    MBIM_FULL_STATUS,
+    MBIM_DICTIONARY, // Names of the values sent with MB_CODES
     MBIM_UNKOWN
 } Mbim_req_type;
 
@@ -36,6 +38,12 @@ typedef enum
     MBIM_ERROR
 } Mbim_resp_status;
 
+typedef enum
+{
+    MB_ENCODING_STANDARD = 0,
+    MB_ENCODING_COMPACT // Varint encoding, see databuf_compact()
+} Mbim_encoding;
+
 typedef enum
 {
     MBIM_PIN_UNLOCK = 0,
@@ -79,85 +87,161 @@ typedef enum
     MBIM_ACTIVATION_DEACTIVATING
 } Mbim_activation_state;
 
-enum mbim_vartype // 2 bytes (var name), 2 bytes data type
-{
-    // Request/response
-    MB_ERROR = ((1 << 8) | DT_STRING),
-    MB_REQUEST = ((2 << 8) | DT_UINT), // Mbim_req_type
-    MB_RESPONSE = ((3 << 8) | DT_UINT), // Mbim_resp_status
-    MB_SESSION_TID  = ((4 << 8) | DT_UINT),
-    MB_APN = ((5 << 8) | DT_STRING),
-    MB_USERNAME = ((6 << 8) | DT_STRING),
-    MB_PASSWORD = ((7 << 8) | DT_STRING),
-    MB_AUTH = ((8 << 8) | DT_UINT), // Mbim_auth
-    MB_DEVICE = ((9 << 8) | DT_STRING),
-    // Pin
-    MB_PIN_STATUS = ((10 << 8) | DT_UINT), // Mbim_pin_status
-    MB_PIN_CODE = ((11 << 8) | DT_STRING),
-    MB_PROTOCOL = ((12 << 8) | DT_UINT), // Mbim_protocol
-    // Subscriber
-    MB_SUB_STATE = ((20 << 8) | DT_STRING),
-    MB_SUB_ID = ((21 << 8) | DT_STRING),
-    MB_SUB_SIM_ICCD = ((22 << 8) | DT_STRING),
-    MB_SUB_READY_INFO = ((23 << 8) | DT_STRING),
-    MB_SUB_TEL_NB = ((24 << 8) | DT_UINT),
-    MB_SUB_TEL_NUM = ((25 << 8) | DT_STRING),
-    // Register
-    MB_REGISTER_STATE = ((30 << 8) | DT_UINT), // Mbim_register_state
-    MB_REGISTER_NET_ERROR = ((31 << 8) | DT_STRING),
-    MB_REGISTER_STATE_STR = ((32 << 8) | DT_STRING),
-    MB_REGISTER_MODE = ((33 << 8) | DT_STRING),
-    MB_REGISTER_DATA_CLASS = ((34 << 8) | DT_STRING),
-    MB_REGISTER_CLASS = ((35 << 8) | DT_STRING),
-    MB_REGISTER_PROVIDER_ID = ((36 << 8) | DT_STRING),
-    MB_REGISTER_PROVIDER_NAME = ((37 << 8) | DT_STRING),
-    MB_REGISTER_ROAMING = ((38 << 8) | DT_STRING),
-    MB_REGISTER_FLAGS = ((39 << 8) | DT_STRING),
-    // Attach
-    MB_ATTACH_NET_ERROR = ((50 << 8) | DT_STRING),
-    MB_ATTACH_PCK_SERVICE_STATE = ((51 << 8) | DT_STRING),
-    MB_ATTACH_DATA_CLASS = ((52 << 8) | DT_STRING),
-    MB_ATTACH_UP_SPEED = ((53 << 8) | DT_UINT),
-    MB_ATTACH_DOWN_SPEED = ((54 << 8) | DT_UINT),
-    MB_ATTACH_UP_SPEED_STR = ((55 << 8) | DT_STRING),
-    MB_ATTACH_DOWN_SPEED_STR = ((56 << 8) | DT_STRING),
-    // Status
-    MB_STATE_ACTIVATION = ((60 << 8) | DT_UINT), // Mbim_activation_state
-    MB_STATE_ACTIVATION_STR = ((61 << 8) | DT_STRING),
-    MB_STATE_SESSION_ID = ((62 << 8) | DT_UINT),
-    MB_STATE_VOICE_CALL_STATE = ((63 << 8) | DT_STRING),
-    MB_STATE_IP_TYPE = ((64 << 8) | DT_STRING),
-    MB_STATE_CONTEXT_TYPE = ((65 << 8) | DT_STRING),
-    MB_STATE_NETWORK_ERROR = ((66 << 8) | DT_STRING),
-    // IP
-    MB_IPV4_NB = ((70 << 8) | DT_UINT),
-    MB_IPV6_NB = ((71 << 8) | DT_UINT),
-    MB_IPV4_GW = ((72 << 8) | DT_STRING),
-    MB_IPV6_GW = ((73 << 8) | DT_STRING),
-    MB_IPV4_ADDR = ((74 << 8) | DT_STRING),
-    MB_IPV6_ADDR = ((75 << 8) | DT_STRING),
-    // Device caps
-    MB_DEV_TYPE = ((80 << 8) | DT_STRING),
-    MB_DEV_CELL_CLASS = ((81 << 8) | DT_STRING),
-    MB_DEV_VOICE_CLASS = ((82 << 8) | DT_STRING),
-    MB_DEV_SIM_CLASS = ((83 << 8) | DT_STRING),
-    MB_DEV_DATA_CLASS = ((84 << 8) | DT_STRING),
-    MB_DEV_SMS_CAPS = ((85 << 8) | DT_STRING),
-    MB_DEV_CTRL_CAPS = ((86 << 8) | DT_STRING),
-    MB_DEV_MAX_SESSION = ((87 << 8) | DT_UINT),
-    MB_DEV_CUST_DATA_CLASS = ((88 << 8) | DT_STRING),
-    MB_DEV_ID = ((89 << 8) | DT_STRING),
-    MB_DEV_FMW_INFO = ((90 << 8) | DT_STRING),
-    MB_DEV_HW_INFO = ((91 << 8) | DT_STRING),
-    // Signal
-    MB_SIGNAL_RSSI = ((100 << 8) | DT_UINT),
-    MB_SIGNAL_ERROR_RATE = ((101 << 8) | DT_UINT),
-    MB_SIGNAL_RSCP = ((102 << 8) | DT_UINT),
-    MB_SIGNAL_ECNO = ((103 << 8) | DT_UINT),
-    MB_SIGNAL_RSRQ = ((104 << 8) | DT_UINT),
-    MB_SIGNAL_RSRP = ((105 << 8) | DT_UINT),
-    MB_SIGNAL_RSSNR = ((106 << 8) | DT_UINT),
+// Topics of the notifications, a notification is the NUL terminated topic followed by a databuf
+#define MB_TOPIC_SIGNAL "signal"
+#define MB_TOPIC_REGISTER "register"
+#define MB_TOPIC_CONNECT "connect"
+#define MB_TOPIC_SIM "sim"
 
+// Requests whose responses hold a variable, see MB_VARS
+#define MB_IN(type) (1u << (type))
+#define MB_IN_ANY 0xffffffffu
+#define MB_IN_PIN (MB_IN(MBIM_PIN_STATUS) | MB_IN(MBIM_PIN_ENTER))
+#define MB_IN_SUB (MB_IN(MBIM_SUBSCRIBER) | MB_IN(MBIM_FULL_STATUS))
+// QMI answers MBIM_PACKET_SERVICE with the serving system
+#define MB_IN_REG (MB_IN(MBIM_REGISTER) | MB_IN(MBIM_PACKET_SERVICE) | MB_IN(MBIM_FULL_STATUS))
+#define MB_IN_ATTACH (MB_IN(MBIM_ATTACH) | MB_IN(MBIM_PACKET_SERVICE) | MB_IN(MBIM_FULL_STATUS))
+#define MB_IN_STATE (MB_IN(MBIM_CONNECT) | MB_IN(MBIM_STATUS) | MB_IN(MBIM_FULL_STATUS))
+#define MB_IN_IP (MB_IN(MBIM_IP) | MB_IN(MBIM_FULL_STATUS))
+#define MB_IN_DEV MB_IN(MBIM_DEVICE_CAPS)
+#define MB_IN_SIGNAL (MB_IN(MBIM_SIGNAL) | MB_IN(MBIM_FULL_STATUS))
+#define MB_IN_DICT MB_IN(MBIM_DICTIONARY)
+
+/*
+ * Schema of the variables: X(var, name, number, type, cardinality, requests)
+ *
+ * The identifier of a variable is its number (2 bytes) followed by its
+ * DT_ type (2 bytes). A variable of cardinality ONE is sent at most once per
+ * response, MANY may be repeated. requests are the MB_IN() of the requests
+ * whose responses may hold it. mbim_schema.h generates the typed accessors,
+ * mbim_schema.c the validator.
+ */
+#define MB_VARS(X) \
+    /* Request/response */ \
+    X(MB_ERROR, error, 1, STRING, MANY, MB_IN_ANY) \
+    X(MB_REQUEST, request, 2, UINT, MANY, MB_IN_ANY) /* Mbim_req_type */ \
+    X(MB_RESPONSE, response, 3, UINT, ONE, MB_IN_ANY) /* Mbim_resp_status */ \
+    X(MB_SESSION_TID, session_tid, 4, UINT, ONE, MB_IN_ANY) \
+    X(MB_APN, apn, 5, STRING, ONE, MB_IN(MBIM_CONNECT)) \
+    X(MB_USERNAME, username, 6, STRING, ONE, MB_IN(MBIM_CONNECT)) \
+    X(MB_PASSWORD, password, 7, STRING, ONE, MB_IN(MBIM_CONNECT)) \
+    X(MB_AUTH, auth, 8, UINT, ONE, MB_IN(MBIM_CONNECT)) /* Mbim_auth */ \
+    X(MB_DEVICE, device, 9, STRING, ONE, MB_IN_ANY) \
+    /* Pin */ \
+    X(MB_PIN_STATUS, pin_status, 10, UINT, ONE, MB_IN_PIN) /* Mbim_pin_status */ \
+    X(MB_PIN_CODE, pin_code, 11, STRING, ONE, MB_IN(MBIM_PIN_ENTER)) \
+    X(MB_PROTOCOL, protocol, 12, UINT, ONE, MB_IN_ANY) /* Mbim_protocol */ \
+    /* Batch */ \
+    X(MB_BATCH_RESPONSE, batch_response, 13, RAW, MANY, MB_IN_ANY) /* Response of one MB_REQUEST of a batch */ \
+    /* Encoding */ \
+    X(MB_ENCODING, encoding, 14, UINT, ONE, MB_IN_ANY) /* Mbim_encoding of the responses on the connection */ \
+    /* Codes */ \
+    X(MB_CODES, codes, 15, UINT, ONE, MB_IN_ANY) /* Non zero: MBIM enumerations and bitmasks are sent as *_CODE instead of strings */ \
+    /* Projection */ \
+    X(MB_FIELD, field, 16, UINT, MANY, MB_IN_ANY) /* Repeated, variable wanted in the response, all are sent without any */ \
+    /* Subscriber */ \
+    X(MB_SUB_STATE, sub_state, 20, STRING, ONE, MB_IN_SUB) \
+    X(MB_SUB_ID, sub_id, 21, STRING, ONE, MB_IN_SUB) \
+    X(MB_SUB_SIM_ICCD, sub_sim_iccd, 22, STRING, ONE, MB_IN_SUB) \
+    X(MB_SUB_READY_INFO, sub_ready_info, 23, STRING, ONE, MB_IN_SUB) \
+    X(MB_SUB_TEL_NB, sub_tel_nb, 24, UINT, ONE, MB_IN_SUB) \
+    X(MB_SUB_TEL_NUM, sub_tel_num, 25, STRING, ONE, MB_IN_SUB) \
+    /* Register */ \
+    X(MB_REGISTER_STATE, register_state, 30, UINT, ONE, MB_IN_REG) /* Mbim_register_state */ \
+    X(MB_REGISTER_NET_ERROR, register_net_error, 31, STRING, ONE, MB_IN_REG) \
+    X(MB_REGISTER_STATE_STR, register_state_str, 32, STRING, ONE, MB_IN_REG) \
+    X(MB_REGISTER_MODE, register_mode, 33, STRING, ONE, MB_IN_REG) \
+    X(MB_REGISTER_DATA_CLASS, register_data_class, 34, STRING, ONE, MB_IN_REG) \
+    X(MB_REGISTER_CLASS, register_class, 35, STRING, ONE, MB_IN_REG) \
+    X(MB_REGISTER_PROVIDER_ID, register_provider_id, 36, STRING, ONE, MB_IN_REG) \
+    X(MB_REGISTER_PROVIDER_NAME, register_provider_name, 37, STRING, ONE, MB_IN_REG) \
+    X(MB_REGISTER_ROAMING, register_roaming, 38, STRING, ONE, MB_IN_REG) \
+    X(MB_REGISTER_FLAGS, register_flags, 39, STRING, ONE, MB_IN_REG) \
+    /* Attach */ \
+    X(MB_ATTACH_NET_ERROR, attach_net_error, 50, STRING, ONE, MB_IN_ATTACH) \
+    X(MB_ATTACH_PCK_SERVICE_STATE, attach_pck_service_state, 51, STRING, ONE, MB_IN_ATTACH | MB_IN_REG) \
+    X(MB_ATTACH_DATA_CLASS, attach_data_class, 52, STRING, ONE, MB_IN_ATTACH) \
+    X(MB_ATTACH_UP_SPEED, attach_up_speed, 53, UINT, ONE, MB_IN_ATTACH) \
+    X(MB_ATTACH_DOWN_SPEED, attach_down_speed, 54, UINT, ONE, MB_IN_ATTACH) \
+    X(MB_ATTACH_UP_SPEED_STR, attach_up_speed_str, 55, STRING, ONE, MB_IN_ATTACH) \
+    X(MB_ATTACH_DOWN_SPEED_STR, attach_down_speed_str, 56, STRING, ONE, MB_IN_ATTACH) \
+    X(MB_ATTACH_UP_SPEED64, attach_up_speed64, 57, UINT64, ONE, MB_IN_ATTACH) /* bps, MB_ATTACH_UP_SPEED wraps above 4.29 Gbit/s */ \
+    X(MB_ATTACH_DOWN_SPEED64, attach_down_speed64, 58, UINT64, ONE, MB_IN_ATTACH) /* bps, MB_ATTACH_DOWN_SPEED wraps above 4.29 Gbit/s */ \
+    /* Status */ \
+    X(MB_STATE_ACTIVATION, state_activation, 60, UINT, ONE, MB_IN_STATE) /* Mbim_activation_state */ \
+    X(MB_STATE_ACTIVATION_STR, state_activation_str, 61, STRING, ONE, MB_IN_STATE) \
+    X(MB_STATE_SESSION_ID, state_session_id, 62, UINT, ONE, MB_IN_STATE) \
+    X(MB_STATE_VOICE_CALL_STATE, state_voice_call_state, 63, STRING, ONE, MB_IN_STATE) \
+    X(MB_STATE_IP_TYPE, state_ip_type, 64, STRING, ONE, MB_IN_STATE) \
+    X(MB_STATE_CONTEXT_TYPE, state_context_type, 65, STRING, ONE, MB_IN_STATE) \
+    X(MB_STATE_NETWORK_ERROR, state_network_error, 66, STRING, ONE, MB_IN_STATE) \
+    /* IP */ \
+    X(MB_IPV4_NB, ipv4_nb, 70, UINT, ONE, MB_IN_IP) \
+    X(MB_IPV6_NB, ipv6_nb, 71, UINT, ONE, MB_IN_IP) \
+    X(MB_IPV4_GW, ipv4_gw, 72, STRING, ONE, MB_IN_IP) \
+    X(MB_IPV6_GW, ipv6_gw, 73, STRING, ONE, MB_IN_IP) \
+    X(MB_IPV4_ADDR, ipv4_addr, 74, STRING, MANY, MB_IN_IP) \
+    X(MB_IPV6_ADDR, ipv6_addr, 75, STRING, MANY, MB_IN_IP) \
+    /* Device caps */ \
+    X(MB_DEV_TYPE, dev_type, 80, STRING, ONE, MB_IN_DEV) \
+    X(MB_DEV_CELL_CLASS, dev_cell_class, 81, STRING, ONE, MB_IN_DEV) \
+    X(MB_DEV_VOICE_CLASS, dev_voice_class, 82, STRING, ONE, MB_IN_DEV) \
+    X(MB_DEV_SIM_CLASS, dev_sim_class, 83, STRING, ONE, MB_IN_DEV) \
+    X(MB_DEV_DATA_CLASS, dev_data_class, 84, STRING, ONE, MB_IN_DEV) \
+    X(MB_DEV_SMS_CAPS, dev_sms_caps, 85, STRING, ONE, MB_IN_DEV) \
+    X(MB_DEV_CTRL_CAPS, dev_ctrl_caps, 86, STRING, ONE, MB_IN_DEV) \
+    X(MB_DEV_MAX_SESSION, dev_max_session, 87, UINT, ONE, MB_IN_DEV) \
+    X(MB_DEV_CUST_DATA_CLASS, dev_cust_data_class, 88, STRING, ONE, MB_IN_DEV) \
+    X(MB_DEV_ID, dev_id, 89, STRING, ONE, MB_IN_DEV) \
+    X(MB_DEV_FMW_INFO, dev_fmw_info, 90, STRING, ONE, MB_IN_DEV) \
+    X(MB_DEV_HW_INFO, dev_hw_info, 91, STRING, ONE, MB_IN_DEV) \
+    /* Signal */ \
+    X(MB_SIGNAL_RSSI, signal_rssi, 100, UINT, ONE, MB_IN_SIGNAL) \
+    X(MB_SIGNAL_ERROR_RATE, signal_error_rate, 101, UINT, ONE, MB_IN_SIGNAL) \
+    X(MB_SIGNAL_RSCP, signal_rscp, 102, UINT, ONE, MB_IN_SIGNAL) \
+    X(MB_SIGNAL_ECNO, signal_ecno, 103, UINT, ONE, MB_IN_SIGNAL) \
+    X(MB_SIGNAL_RSRQ, signal_rsrq, 104, UINT, ONE, MB_IN_SIGNAL) \
+    X(MB_SIGNAL_RSRP, signal_rsrp, 105, UINT, ONE, MB_IN_SIGNAL) \
+    X(MB_SIGNAL_RSSNR, signal_rssnr, 106, UINT, ONE, MB_IN_SIGNAL) \
+    /* Signal in dB/dBm, QMI only, the uint values above carry them as two's complement */ \
+    X(MB_SIGNAL_RSSI_DBM, signal_rssi_dbm, 107, INT, ONE, MB_IN_SIGNAL) \
+    X(MB_SIGNAL_RSRQ_DB, signal_rsrq_db, 108, INT, ONE, MB_IN_SIGNAL) \
+    X(MB_SIGNAL_RSRP_DBM, signal_rsrp_dbm, 109, INT, ONE, MB_IN_SIGNAL) \
+    X(MB_SIGNAL_SNR, signal_snr, 110, INT, ONE, MB_IN_SIGNAL) /* 0.1 dB */ \
+    /* Codes of the strings, sent with MB_CODES, see MBIM_DICTIONARY for their names */ \
+    X(MB_SUB_STATE_CODE, sub_state_code, 120, UINT, ONE, MB_IN_SUB) \
+    X(MB_SUB_READY_INFO_CODE, sub_ready_info_code, 121, UINT, ONE, MB_IN_SUB) /* Bitmask */ \
+    X(MB_REGISTER_NET_ERROR_CODE, register_net_error_code, 122, UINT, ONE, MB_IN_REG) \
+    X(MB_REGISTER_MODE_CODE, register_mode_code, 123, UINT, ONE, MB_IN_REG) \
+    X(MB_REGISTER_DATA_CLASS_CODE, register_data_class_code, 124, UINT, ONE, MB_IN_REG) /* Bitmask */ \
+    X(MB_REGISTER_CLASS_CODE, register_class_code, 125, UINT, ONE, MB_IN_REG) /* Bitmask */ \
+    X(MB_REGISTER_FLAGS_CODE, register_flags_code, 126, UINT, ONE, MB_IN_REG) /* Bitmask */ \
+    X(MB_ATTACH_NET_ERROR_CODE, attach_net_error_code, 127, UINT, ONE, MB_IN_ATTACH) \
+    X(MB_ATTACH_PCK_SERVICE_STATE_CODE, attach_pck_service_state_code, 128, UINT, ONE, MB_IN_ATTACH | MB_IN_REG) \
+    X(MB_ATTACH_DATA_CLASS_CODE, attach_data_class_code, 129, UINT, ONE, MB_IN_ATTACH) /* Bitmask */ \
+    X(MB_STATE_VOICE_CALL_STATE_CODE, state_voice_call_state_code, 130, UINT, ONE, MB_IN_STATE) \
+    X(MB_STATE_IP_TYPE_CODE, state_ip_type_code, 131, UINT, ONE, MB_IN_STATE) \
+    X(MB_STATE_CONTEXT_TYPE_CODE, state_context_type_code, 132, UINT, ONE, MB_IN_STATE) \
+    X(MB_STATE_NETWORK_ERROR_CODE, state_network_error_code, 133, UINT, ONE, MB_IN_STATE) \
+    X(MB_DEV_TYPE_CODE, dev_type_code, 134, UINT, ONE, MB_IN_DEV) \
+    X(MB_DEV_CELL_CLASS_CODE, dev_cell_class_code, 135, UINT, ONE, MB_IN_DEV) /* Bitmask */ \
+    X(MB_DEV_VOICE_CLASS_CODE, dev_voice_class_code, 136, UINT, ONE, MB_IN_DEV) \
+    X(MB_DEV_SIM_CLASS_CODE, dev_sim_class_code, 137, UINT, ONE, MB_IN_DEV) /* Bitmask */ \
+    X(MB_DEV_DATA_CLASS_CODE, dev_data_class_code, 138, UINT, ONE, MB_IN_DEV) /* Bitmask */ \
+    X(MB_DEV_SMS_CAPS_CODE, dev_sms_caps_code, 139, UINT, ONE, MB_IN_DEV) /* Bitmask */ \
+    X(MB_DEV_CTRL_CAPS_CODE, dev_ctrl_caps_code, 140, UINT, ONE, MB_IN_DEV) /* Bitmask */ \
+    /* Dictionary */ \
+    X(MB_DICT_ENTRY, dict_entry, 150, RAW, MANY, MB_IN_DICT) /* Names of the values of one code variable */ \
+    X(MB_DICT_VAR, dict_var, 151, UINT, ONE, MB_IN_DICT) /* Code variable of the entry, or of the entries requested */ \
+    X(MB_DICT_MASK, dict_mask, 152, UINT, ONE, MB_IN_DICT) /* Non zero: each MB_DICT_CODE is a bit of a bitmask */ \
+    X(MB_DICT_CODE, dict_code, 153, UINT, MANY, MB_IN_DICT) /* Followed by its MB_DICT_NAME */ \
+    X(MB_DICT_NAME, dict_name, 154, STRING, MANY, MB_IN_DICT)
+
+#define MB_VAR_ENUM(var, name, num, type, card, in) var = ((num << 8) | DT_##type),
+
+enum mbim_vartype
+{
+    MB_VARS(MB_VAR_ENUM)
 };
 
 #ifdef __cplusplus
@@ -0,0 +1,120 @@
+/**
+ * @file
+ * @brief Schema of the databuf variables
+ * @ccmod{MBIM_X_MMG}
+ */
+#include <stdio.h>
+
+#include "mbim_schema.h"
+
+#define MB_VAR_ENTRY(var, name, num, type, card, in) [num] = {var, #var, MB_##card, in},
+
+static const Mb_schema_var g_vars[MB_SCHEMA_MAX] = {
+    MB_VARS(MB_VAR_ENTRY)
+};
+
+#define MB_VAR_CASE(var, name, num, type, card, in) case num:
+
+/**
+ * Look up a variable in the schema.
+ *
+ * @param var Variable identifier
+ *
+ * @return Pointer to the schema entry, NULL if the number or the type is unknown
+ */
+const Mb_schema_var *mbim_schema_var(unsigned int var)
+{
+    // Two variables with the same number are duplicate case labels
+    switch (var >> 8)
+    {
+        MB_VARS(MB_VAR_CASE)
+            break;
+
+        default:
+            return NULL;
+    }
+
+    return g_vars[var >> 8].var == var ? &g_vars[var >> 8] : NULL;
+}
+
+/**
+ * Check a response, or a nested data buffer of it, against the schema.
+ *
+ * @param type  Request type of the response
+ * @param buf   Pointer to the response
+ * @param depth Nesting of buf, up to DATABUF_MAX_DEPTH
+ *
+ * @return True if the response follows the schema, otherwise false
+ */
+static bool schema_validate(Mbim_req_type type, const Databuf *buf, int depth)
+{
+    unsigned char count[MB_SCHEMA_MAX] = {0};
+    const Mb_schema_var *entry;
+    Databuf_iter iter;
+    Databuf section;
+    unsigned int sub_type;
+
+    if (depth > DATABUF_MAX_DEPTH)
+    {
+        printf("Schema : Nested deeper than %d\n", DATABUF_MAX_DEPTH);
+        return false;
+    }
+
+    databuf_iter_init(&iter, buf);
+    while (databuf_iter_next(&iter))
+    {
+        entry = mbim_schema_var(iter.var);
+        if (!entry)
+        {
+            printf("Schema : Unknown variable %04x\n", iter.var);
+            return false;
+        }
+
+        if (entry->in != MB_IN_ANY && (type >= MBIM_UNKOWN || !(entry->in & MB_IN(type))))
+        {
+            printf("Schema : %s not expected in the response of request %u\n", entry->name, type);
+            return false;
+        }
+
+        if (entry->card == MB_ONE && count[iter.var >> 8]++)
+        {
+            printf("Schema : %s repeated\n", entry->name);
+            return false;
+        }
+
+        if (iter.type != DT_RAW)
+            continue;
+
+        if (!databuf_iter_databuf(&iter, &section))
+            return false;
+
+        sub_type = type;
+        if (iter.var == MB_BATCH_RESPONSE && !mb_get_request(&section, &sub_type))
+        {
+            printf("Schema : %s without MB_REQUEST\n", entry->name);
+            return false;
+        }
+
+        if (!schema_validate(sub_type, &section, depth + 1))
+            return false;
+    }
+
+    return true;
+}
+
+/**
+ * Check a response against the schema: each variable is known, expected in
+ * the response of the request and not repeated unless its cardinality is
+ * MANY. Nested data buffers are checked as well, an MB_BATCH_RESPONSE against
+ * its own MB_REQUEST, down to DATABUF_MAX_DEPTH. The framing must already be
+ * valid, see databuf_parse().
+ *
+ * @param type Request type of the response
+ * @param buf  Pointer to the response
+ *
+ * @return True if the response follows the schema, otherwise false
+ */
+bool mbim_schema_validate(Mbim_req_type type, const Databuf *buf)
+{
+    return schema_validate(type, buf, 0);
+}
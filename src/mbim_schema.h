@@ -0,0 +1,132 @@
+#ifndef MBIM_NNG_MBIM_SCHEMA_H
+#define MBIM_NNG_MBIM_SCHEMA_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include "databuf.h"
+#include "mbim_enum.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Variable numbers of the schema, one byte
+#define MB_SCHEMA_MAX 256
+
+typedef enum
+{
+    MB_ONE = 0, // At most once per response
+    MB_MANY     // Repeated
+} Mb_cardinality;
+
+typedef struct mb_schema_var
+{
+    unsigned int var;    // Identifier, number and type
+    const char *name;    // Name of the enum value, "MB_..."
+    Mb_cardinality card;
+    uint32_t in;         // MB_IN() of the requests whose responses hold it
+} Mb_schema_var;
+
+const Mb_schema_var *mbim_schema_var(unsigned int var);
+bool mbim_schema_validate(Mbim_req_type type, const Databuf *buf);
+
+/*
+ * Typed accessors generated from MB_VARS, for each variable:
+ *
+ *   mb_add_<name>(buf, value)
+ *   mb_get_<name>(buf, ...)
+ *   mb_get_next_<name>(buf, ..., prev)
+ *
+ * The value has the C type of the variable, a mismatch is a compile error or
+ * warning instead of a runtime check. They take and return the same values as
+ * the databuf_add_*() and databuf_get_*() functions of the type.
+ */
+#define MB_ACCESSORS_FIXED(var, name, ctype)                                                        \
+    static inline void mb_add_##name(Databuf *buf, ctype value)                                     \
+    {                                                                                               \
+        databuf_put(buf, var, &value, sizeof(value));                                               \
+    }                                                                                               \
+    static inline char *mb_get_next_##name(Databuf *buf, ctype *value, unsigned char *prev)         \
+    {                                                                                               \
+        size_t len = 0;                                                                             \
+        unsigned char *found = databuf_find(buf, var, &len, prev);                                  \
+        if (!found || len != sizeof(*value))                                                        \
+            return NULL;                                                                            \
+        memcpy(value, found, sizeof(*value));                                                       \
+        return (char *) found;                                                                      \
+    }                                                                                               \
+    static inline char *mb_get_##name(Databuf *buf, ctype *value)                                   \
+    {                                                                                               \
+        return mb_get_next_##name(buf, value, NULL);                                                \
+    }
+
+#define MB_ACCESSORS_UINT(var, name) MB_ACCESSORS_FIXED(var, name, unsigned int)
+#define MB_ACCESSORS_INT(var, name) MB_ACCESSORS_FIXED(var, name, int32_t)
+#define MB_ACCESSORS_UINT64(var, name) MB_ACCESSORS_FIXED(var, name, uint64_t)
+#define MB_ACCESSORS_INT64(var, name) MB_ACCESSORS_FIXED(var, name, int64_t)
+
+#define MB_ACCESSORS_STRING(var, name)                                                              \
+    static inline void mb_add_##name(Databuf *buf, const char *value)                               \
+    {                                                                                               \
+        if (!value)                                                                                 \
+            value = "";                                                                             \
+        databuf_put(buf, var, value, strlen(value) + 1);                                            \
+    }                                                                                               \
+    static inline char *mb_get_next_##name(Databuf *buf, unsigned char *prev)                       \
+    {                                                                                               \
+        return (char *) databuf_find(buf, var, NULL, prev);                                         \
+    }                                                                                               \
+    static inline char *mb_get_##name(Databuf *buf)                                                 \
+    {                                                                                               \
+        return mb_get_next_##name(buf, NULL);                                                       \
+    }
+
+#define MB_ACCESSORS_BINARY(var, name)                                                              \
+    static inline void mb_add_##name(Databuf *buf, const void *value, size_t len)                   \
+    {                                                                                               \
+        databuf_put(buf, var, value, len);                                                          \
+    }                                                                                               \
+    static inline unsigned char *mb_get_next_##name(Databuf *buf, size_t *len, unsigned char *prev) \
+    {                                                                                               \
+        return databuf_find(buf, var, len, prev);                                                   \
+    }                                                                                               \
+    static inline unsigned char *mb_get_##name(Databuf *buf, size_t *len)                           \
+    {                                                                                               \
+        return mb_get_next_##name(buf, len, NULL);                                                  \
+    }
+
+// The nested data buffer is a read-only view, as with databuf_get_next_databuf()
+#define MB_ACCESSORS_RAW(var, name)                                                                 \
+    static inline void mb_add_##name(Databuf *buf, const Databuf *value)                            \
+    {                                                                                               \
+        databuf_put(buf, var, value->buf, value->len);                                              \
+    }                                                                                               \
+    static inline char *mb_get_next_##name(Databuf *buf, Databuf *value, unsigned char *prev)       \
+    {                                                                                               \
+        size_t len = 0;                                                                             \
+        unsigned char *found = databuf_find(buf, var, &len, prev);                                  \
+        if (!found)                                                                                 \
+            return NULL;                                                                            \
+        value->buf = found;                                                                         \
+        value->size = len;                                                                          \
+        value->len = len;                                                                           \
+        value->msg = NULL;                                                                          \
+        value->index = NULL;                                                                        \
+        value->pooled = false;                                                                      \
+        return (char *) found;                                                                      \
+    }                                                                                               \
+    static inline char *mb_get_##name(Databuf *buf, Databuf *value)                                 \
+    {                                                                                               \
+        return mb_get_next_##name(buf, value, NULL);                                                \
+    }
+
+#define MB_VAR_ACCESSORS(var, name, num, type, card, in) MB_ACCESSORS_##type(var, name)
+
+MB_VARS(MB_VAR_ACCESSORS)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // MBIM_NNG_MBIM_SCHEMA_H
@@ -0,0 +1,412 @@
+/**
+ * @file
+ * @brief Modem thread
+ * @ccmod{MBIM_X_MMG}
+ */
+#include <stdio.h>
+#include <glib.h>
+
+#include "modem.h"
+#include "dictionary.h"
+#include "trace.h"
+
+static GMainContext *g_context;
+static GMainLoop *g_loop;
+static GThread *g_thread;
+static GCancellable *g_cancellable;
+
+// Backend of each protocol, the same backend may serve both
+static const Modem_backend *g_backends[MB_PROT_UNKOWN];
+
+// Requests changing the modem state run one at a time, in arrival order
+static Mbim_request *g_exclusive;
+static Mbim_request_done g_exclusive_done;
+static GQueue g_exclusive_waiting = G_QUEUE_INIT;
+
+/**
+ * Check if a backend was already handled for a lower protocol.
+ *
+ * @param proto Protocol of the backend
+ *
+ * @return True if the backend of proto also serves a lower protocol
+ */
+static bool modem_backend_seen(int proto)
+{
+    int i;
+
+    for (i = 0; i < proto; i++)
+    {
+        if (g_backends[i] == g_backends[proto])
+            return true;
+    }
+
+    return false;
+}
+
+/**
+ * Open the backends and subscribe to their state changes, runs on the
+ * modem thread. A backend that fails to open is not used.
+ */
+static void modem_backends_open(void)
+{
+    const Modem_backend *backend;
+    int proto;
+    int i;
+
+    for (proto = 0; proto < MB_PROT_UNKOWN; proto++)
+    {
+        backend = g_backends[proto];
+        if (!backend || modem_backend_seen(proto))
+            continue;
+
+        if (backend->open && !backend->open())
+        {
+            printf("Modem : Unable to open the %s backend\n", backend->name);
+            for (i = proto; i < MB_PROT_UNKOWN; i++)
+            {
+                if (g_backends[i] == backend)
+                    g_backends[i] = NULL;
+            }
+            continue;
+        }
+
+        if (backend->subscribe)
+            backend->subscribe();
+    }
+}
+
+/**
+ * Close the backends, runs on the modem thread.
+ */
+static void modem_backends_close(void)
+{
+    int proto;
+
+    for (proto = 0; proto < MB_PROT_UNKOWN; proto++)
+    {
+        if (g_backends[proto] && !modem_backend_seen(proto) && g_backends[proto]->close)
+            g_backends[proto]->close();
+    }
+}
+
+/**
+ * Modem thread, runs the modem main loop until stopped and closes the
+ * devices before exiting.
+ *
+ * @param unused Unused
+ *
+ * @return NULL
+ */
+static gpointer modem_thread(gpointer unused)
+{
+    (void) unused;
+
+    // libmbim and libqmi complete their operations on the thread default context
+    g_main_context_push_thread_default(g_context);
+
+    modem_backends_open();
+
+    g_main_loop_run(g_loop);
+
+    modem_backends_close();
+
+    g_main_context_pop_thread_default(g_context);
+
+    return NULL;
+}
+
+/**
+ * Check if a request changes the modem state. Such requests must not overlap
+ * with each other and make the previous query results stale.
+ *
+ * @param type Request type
+ *
+ * @return True if the request changes the modem state
+ */
+bool modem_changes_state(Mbim_req_type type)
+{
+    switch (type)
+    {
+    case MBIM_PIN_ENTER:
+    case MBIM_ATTACH:
+    case MBIM_CONNECT: return true;
+    default: return false;
+    }
+}
+
+/**
+ * Check if a variable belongs in the response of a request. MB_RESPONSE,
+ * MB_ERROR and MB_REQUEST are always sent.
+ *
+ * @param request Pointer to the Mbim_request structure
+ * @param var     Variable identifier
+ *
+ * @return True if the variable was asked with MB_FIELD, or no MB_FIELD was given
+ */
+bool modem_wants(const Mbim_request *request, unsigned int var)
+{
+    unsigned int num = var >> 8;
+
+    if (!request->projected || num >= MB_FIELD_WORDS * 32)
+        return true;
+
+    return (request->fields[num / 32] & (1u << (num % 32))) != 0;
+}
+
+/**
+ * Add an unsigned integer to the response of a request, if it wants it.
+ *
+ * @param request Pointer to the Mbim_request structure
+ * @param var     Variable identifier
+ * @param value   Value to add
+ */
+void modem_add_uint(Mbim_request *request, unsigned int var, unsigned int value)
+{
+    if (modem_wants(request, var))
+        databuf_add_uint(&request->resp, var, value);
+}
+
+/**
+ * Add a signed integer to the response of a request, if it wants it.
+ *
+ * @param request Pointer to the Mbim_request structure
+ * @param var     Variable identifier
+ * @param value   Value to add
+ */
+void modem_add_int(Mbim_request *request, unsigned int var, int value)
+{
+    if (modem_wants(request, var))
+        databuf_add_int(&request->resp, var, value);
+}
+
+/**
+ * Add a 64-bit unsigned integer to the response of a request, if it wants it.
+ *
+ * @param request Pointer to the Mbim_request structure
+ * @param var     Variable identifier
+ * @param value   Value to add
+ */
+void modem_add_uint64(Mbim_request *request, unsigned int var, uint64_t value)
+{
+    if (modem_wants(request, var))
+        databuf_add_uint64(&request->resp, var, value);
+}
+
+/**
+ * Add a string to the response of a request, if it wants it.
+ *
+ * @param request Pointer to the Mbim_request structure
+ * @param var     Variable identifier
+ * @param value   String to add
+ */
+void modem_add_string(Mbim_request *request, unsigned int var, const char *value)
+{
+    if (modem_wants(request, var))
+        databuf_add_string(&request->resp, var, value);
+}
+
+/**
+ * Run a request on the backend of its protocol. MBIM_DICTIONARY needs no
+ * device, it is answered here for every protocol and backend.
+ *
+ * @param request Pointer to the Mbim_request structure
+ */
+static void modem_perform(Mbim_request *request)
+{
+    const Modem_backend *backend = NULL;
+
+    if (request->type == MBIM_DICTIONARY)
+    {
+        dictionary_answer(request);
+        request->done(request);
+        return;
+    }
+
+    if (request->proto < MB_PROT_UNKOWN)
+        backend = g_backends[request->proto];
+
+    if (!backend)
+    {
+        mb_add_error(&request->resp, "No modem backend");
+        mb_add_response(&request->resp, MBIM_ERROR);
+        request->done(request);
+        return;
+    }
+
+    trace_request(request);
+    backend->execute(request);
+}
+
+static void modem_exclusive_run(Mbim_request *request);
+
+/**
+ * Completion of a serialized request, starts the next waiting one.
+ *
+ * @param request Pointer to the Mbim_request structure
+ */
+static void modem_exclusive_done(Mbim_request *request)
+{
+    Mbim_request *next;
+
+    request->done = g_exclusive_done;
+    g_exclusive = NULL;
+    g_exclusive_done = NULL;
+
+    request->done(request);
+
+    // The completion may already have submitted the next serialized request
+    if (g_exclusive)
+        return;
+
+    next = g_queue_pop_head(&g_exclusive_waiting);
+    if (next)
+        modem_exclusive_run(next);
+}
+
+/**
+ * Run a serialized request, its completion is intercepted to start the next one.
+ *
+ * @param request Pointer to the Mbim_request structure
+ */
+static void modem_exclusive_run(Mbim_request *request)
+{
+    g_exclusive = request;
+    g_exclusive_done = request->done;
+    request->done = modem_exclusive_done;
+
+    modem_perform(request);
+}
+
+/**
+ * Run a request on the modem thread.
+ *
+ * Read-only requests run as soon as they arrive and may overlap, requests
+ * changing the modem state wait for the previous one to complete.
+ *
+ * @param data Pointer to the Mbim_request structure
+ *
+ * @return G_SOURCE_REMOVE
+ */
+static gboolean modem_dispatch(gpointer data)
+{
+    Mbim_request *request = data;
+
+    if (!modem_changes_state(request->type))
+        modem_perform(request);
+    else if (g_exclusive)
+        g_queue_push_tail(&g_exclusive_waiting, request);
+    else
+        modem_exclusive_run(request);
+
+    return G_SOURCE_REMOVE;
+}
+
+/**
+ * Quit the modem main loop, runs on the modem thread.
+ *
+ * @param unused Unused
+ *
+ * @return G_SOURCE_REMOVE
+ */
+static gboolean modem_quit(gpointer unused)
+{
+    (void) unused;
+
+    g_main_loop_quit(g_loop);
+
+    return G_SOURCE_REMOVE;
+}
+
+/**
+ * Set the backend running the requests of a protocol, before modem_start().
+ *
+ * @param proto   Protocol of the requests
+ * @param backend Pointer to the backend, NULL to reject the requests
+ */
+void modem_set_backend(Mbim_protocol proto, const Modem_backend *backend)
+{
+    if (proto < MB_PROT_UNKOWN)
+        g_backends[proto] = backend;
+}
+
+/**
+ * Start the modem thread and its main loop.
+ *
+ * @return True on success, otherwise false
+ */
+bool modem_start(void)
+{
+    GError *error = NULL;
+
+    g_context = g_main_context_new();
+    g_loop = g_main_loop_new(g_context, FALSE);
+    g_cancellable = g_cancellable_new();
+
+    g_thread = g_thread_try_new("modem", modem_thread, NULL, &error);
+    if (!g_thread)
+    {
+        printf("Modem : Unable to start the modem thread: %s\n", error->message);
+        g_error_free(error);
+        g_clear_object(&g_cancellable);
+        g_main_loop_unref(g_loop);
+        g_main_context_unref(g_context);
+        g_loop = NULL;
+        g_context = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Queue a request on the modem thread.
+ *
+ * The request is completed on the modem thread by calling its done callback,
+ * the request must stay valid until then.
+ *
+ * @param request Pointer to the Mbim_request structure
+ */
+void modem_submit(Mbim_request *request)
+{
+    g_main_context_invoke(g_context, modem_dispatch, request);
+}
+
+/**
+ * Cancel the modem operations in flight, they complete with an error.
+ */
+void modem_cancel(void)
+{
+    if (g_cancellable)
+        g_cancellable_cancel(g_cancellable);
+}
+
+/**
+ * Get the cancellable shared by the modem operations.
+ *
+ * @return The modem GCancellable
+ */
+GCancellable *modem_get_cancellable(void)
+{
+    return g_cancellable;
+}
+
+/**
+ * Close the devices and stop the modem thread.
+ *
+ * Every submitted request must have completed.
+ */
+void modem_stop(void)
+{
+    if (!g_thread)
+        return;
+
+    g_main_context_invoke(g_context, modem_quit, NULL);
+    g_thread_join(g_thread);
+    g_thread = NULL;
+
+    g_clear_object(&g_cancellable);
+    g_main_loop_unref(g_loop);
+    g_main_context_unref(g_context);
+    g_loop = NULL;
+    g_context = NULL;
+}
@@ -0,0 +1,31 @@
+#ifndef MBIM_NNG_MODEM_H
+#define MBIM_NNG_MODEM_H
+
+#include <stdbool.h>
+#include <gio/gio.h>
+
+#include "mbim.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void modem_set_backend(Mbim_protocol proto, const Modem_backend *backend);
+bool modem_start(void);
+void modem_submit(Mbim_request *request);
+void modem_cancel(void);
+void modem_stop(void);
+bool modem_changes_state(Mbim_req_type type);
+bool modem_wants(const Mbim_request *request, unsigned int var);
+void modem_add_uint(Mbim_request *request, unsigned int var, unsigned int value);
+void modem_add_int(Mbim_request *request, unsigned int var, int value);
+void modem_add_uint64(Mbim_request *request, unsigned int var, uint64_t value);
+void modem_add_string(Mbim_request *request, unsigned int var, const char *value);
+
+GCancellable *modem_get_cancellable(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // MBIM_NNG_MODEM_H
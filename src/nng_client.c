@@ -0,0 +1,442 @@
+/**
+ * @file
+ * @brief Mbim NNG asynchronous client
+ * @ccmod{MBIM_X_MMG}
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nng_client.h"
+#include "mbim_schema.h"
+#include "nng/protocol/reqrep0/req.h"
+
+#ifndef MBIM_NNG_CLIENT_TIMEOUT_MS
+#define MBIM_NNG_CLIENT_TIMEOUT_MS 10000
+#endif
+
+#ifndef MBIM_NNG_CLIENT_RECONNECT_MIN_MS
+#define MBIM_NNG_CLIENT_RECONNECT_MIN_MS 100
+#endif
+
+#ifndef MBIM_NNG_CLIENT_RECONNECT_MAX_MS
+#define MBIM_NNG_CLIENT_RECONNECT_MAX_MS 5000
+#endif
+
+/**
+ * Read a reply into a data buffer, expanded from the compact encoding.
+ *
+ * @param msg      Reply, owned by the response afterwards
+ * @param response Pointer to the response
+ *
+ * @return 0 on success, otherwise NNG_EPROTO and the response is freed
+ */
+static int call_response(nng_msg *msg, Databuf *response)
+{
+    databuf_set_msg(response, msg);
+    if (!databuf_expand(response) || !databuf_is_valid(response))
+    {
+        printf("Client : Malformed response\n");
+        databuf_free(response);
+        return NNG_EPROTO;
+    }
+
+    return 0;
+}
+
+/**
+ * Put a call back on the free list. The client lock must be held.
+ *
+ * @param call Pointer to the call
+ */
+static void call_release(Req_call *call)
+{
+    Req_client *client = call->client;
+
+    call->cb = NULL;
+    call->arg = NULL;
+    call->reply = NULL;
+    call->next = client->free_calls;
+    client->free_calls = call;
+}
+
+/**
+ * Complete a call: run its callback, or hand the reply over to
+ * req_call_wait().
+ *
+ * @param call   Pointer to the call
+ * @param result 0, otherwise the nng error
+ * @param msg    Reply, NULL on error
+ */
+static void call_complete(Req_call *call, int result, nng_msg *msg)
+{
+    Req_client *client = call->client;
+    Databuf response = {0};
+
+    if (call->cb)
+    {
+        if (result == 0)
+            result = call_response(msg, &response);
+
+        call->cb(result, result == 0 ? &response : NULL, call->arg);
+        databuf_free(&response);
+
+        nng_mtx_lock(client->mtx);
+        call_release(call);
+        client->outstanding--;
+        nng_cv_wake(client->cv);
+        nng_mtx_unlock(client->mtx);
+        return;
+    }
+
+    nng_mtx_lock(client->mtx);
+    call->result = result;
+    call->reply = msg;
+    call->state = REQ_CALL_DONE;
+    client->outstanding--;
+    nng_cv_wake(client->cv);
+    nng_mtx_unlock(client->mtx);
+}
+
+/**
+ * Time left before the deadline of a call.
+ *
+ * @param call Pointer to the call
+ *
+ * @return Timeout of the next operation of the call
+ */
+static nng_duration call_remaining(Req_call *call)
+{
+    nng_time now;
+
+    if (call->timeout == NNG_DURATION_INFINITE)
+        return NNG_DURATION_INFINITE;
+
+    now = nng_clock();
+
+    // A zero timeout still completes an operation that does not wait
+    return call->expire > now ? (nng_duration) (call->expire - now) : 0;
+}
+
+/**
+ * Asynchronous callback of a call, sends the request then receives the
+ * reply on the context of the call.
+ *
+ * @param arg Pointer to the Req_call structure
+ */
+static void client_cb(void *arg)
+{
+    Req_call *call = arg;
+    int ret;
+
+    ret = nng_aio_result(call->aio);
+
+    switch (call->state)
+    {
+    case REQ_CALL_SEND:
+        if (ret != 0)
+        {
+            nng_msg_free(nng_aio_get_msg(call->aio));
+            call_complete(call, ret, NULL);
+            return;
+        }
+
+        call->state = REQ_CALL_RECV;
+        nng_aio_set_timeout(call->aio, call_remaining(call));
+        nng_ctx_recv(call->ctx, call->aio);
+        break;
+
+    case REQ_CALL_RECV:
+        call_complete(call, ret, ret == 0 ? nng_aio_get_msg(call->aio) : NULL);
+        break;
+
+    case REQ_CALL_DONE:
+        break;
+    }
+}
+
+/**
+ * Take a free call of the client, or allocate a new one with its own
+ * context. The client lock must be held.
+ *
+ * @param client Pointer to the client
+ *
+ * @return Pointer to the call, NULL on error
+ */
+static Req_call *call_get(Req_client *client)
+{
+    Req_call **calls;
+    Req_call *call;
+    int ret;
+
+    call = client->free_calls;
+    if (call)
+    {
+        client->free_calls = call->next;
+        return call;
+    }
+
+    if (client->nb_calls == client->max_calls)
+    {
+        calls = realloc(client->calls, (client->max_calls * 2 + 8) * sizeof(*calls));
+        if (!calls)
+            return NULL;
+
+        client->calls = calls;
+        client->max_calls = client->max_calls * 2 + 8;
+    }
+
+    call = calloc(1, sizeof(*call));
+    if (!call)
+        return NULL;
+
+    call->client = client;
+    ret = nng_aio_alloc(&call->aio, client_cb, call);
+    if (ret)
+    {
+        printf("Client : Allocate AIO failed [%d] : %s\n", ret, nng_strerror(ret));
+        free(call);
+        return NULL;
+    }
+
+    ret = nng_ctx_open(&call->ctx, client->sock);
+    if (ret)
+    {
+        printf("Client : Open context failed [%d] : %s\n", ret, nng_strerror(ret));
+        nng_aio_free(call->aio);
+        free(call);
+        return NULL;
+    }
+
+    client->calls[client->nb_calls++] = call;
+
+    return call;
+}
+
+/**
+ * Start a request on a call of the client.
+ *
+ * @param client  Pointer to the client
+ * @param request Pointer to the request, sent without copy, it is empty
+ *                afterwards
+ * @param timeout Timeout of the request in ms, NNG_DURATION_DEFAULT for the
+ *                client timeout
+ * @param cb      Completion callback, NULL for req_call_wait()
+ * @param arg     Argument of the callback
+ *
+ * @return Pointer to the call, NULL on error
+ */
+static Req_call *call_start(Req_client *client, Databuf *request, nng_duration timeout, Req_client_cb cb, void *arg)
+{
+    unsigned int encoding;
+    nng_msg *msg;
+    Req_call *call;
+
+    // Each request asks for it, the connection may be a new one after a redial
+    if (client->compact && !mb_get_encoding(request, &encoding))
+        mb_add_encoding(request, MB_ENCODING_COMPACT);
+
+    msg = databuf_take_msg(request);
+    if (!msg)
+    {
+        if (nng_msg_alloc(&msg, 0) != 0)
+            return NULL;
+
+        if (nng_msg_append(msg, request->buf, request->len) != 0)
+        {
+            nng_msg_free(msg);
+            return NULL;
+        }
+    }
+
+    nng_mtx_lock(client->mtx);
+    call = call_get(client);
+    if (!call)
+    {
+        nng_mtx_unlock(client->mtx);
+        nng_msg_free(msg);
+        return NULL;
+    }
+    client->outstanding++;
+    nng_mtx_unlock(client->mtx);
+
+    if (timeout == NNG_DURATION_DEFAULT)
+        timeout = client->timeout;
+
+    call->timeout = timeout;
+    call->expire = timeout == NNG_DURATION_INFINITE ? 0 : nng_clock() + timeout;
+    call->cb = cb;
+    call->arg = arg;
+    call->result = 0;
+    call->reply = NULL;
+    call->state = REQ_CALL_SEND;
+
+    // Without connection, the send waits for the redial until the timeout
+    nng_aio_set_msg(call->aio, msg);
+    nng_aio_set_timeout(call->aio, call_remaining(call));
+    nng_ctx_send(call->ctx, call->aio);
+
+    return call;
+}
+
+/**
+ * Open a client on a REQ socket. The socket is dialed in the background and
+ * redialed whenever the connection is lost, the requests wait for it. A
+ * request outstanding on a lost connection is sent again on the new one.
+ *
+ * @param url     URL of the server
+ * @param compact Ask for the compact encoding of the responses
+ *
+ * @return Pointer to the client, NULL on error
+ */
+Req_client *req_client_open(const char *url, bool compact)
+{
+    Req_client *client;
+    int ret;
+
+    client = calloc(1, sizeof(*client));
+    if (!client)
+        return NULL;
+
+    client->compact = compact;
+    client->timeout = MBIM_NNG_CLIENT_TIMEOUT_MS;
+
+    if (nng_mtx_alloc(&client->mtx) != 0)
+    {
+        free(client);
+        return NULL;
+    }
+
+    if (nng_cv_alloc(&client->cv, client->mtx) != 0)
+    {
+        nng_mtx_free(client->mtx);
+        free(client);
+        return NULL;
+    }
+
+    ret = nng_req0_open(&client->sock);
+    if (ret)
+    {
+        printf("Client : Open REQ socket failed [%d] : %s\n", ret, nng_strerror(ret));
+        nng_cv_free(client->cv);
+        nng_mtx_free(client->mtx);
+        free(client);
+        return NULL;
+    }
+
+    nng_socket_set_ms(client->sock, NNG_OPT_RECONNMINT, MBIM_NNG_CLIENT_RECONNECT_MIN_MS);
+    nng_socket_set_ms(client->sock, NNG_OPT_RECONNMAXT, MBIM_NNG_CLIENT_RECONNECT_MAX_MS);
+
+    ret = nng_dial(client->sock, url, NULL, NNG_FLAG_NONBLOCK);
+    if (ret)
+    {
+        printf("Client : Dial REQ socket failed [%d] : %s\n", ret, nng_strerror(ret));
+        req_client_close(client);
+        return NULL;
+    }
+
+    return client;
+}
+
+/**
+ * Close a client. The outstanding requests complete with NNG_ECLOSED, the
+ * calls not waited for with req_call_wait() are released.
+ *
+ * @param client Pointer to the client
+ */
+void req_client_close(Req_client *client)
+{
+    int i;
+
+    if (!client)
+        return;
+
+    nng_close(client->sock);
+
+    nng_mtx_lock(client->mtx);
+    while (client->outstanding > 0)
+        nng_cv_wait(client->cv);
+    nng_mtx_unlock(client->mtx);
+
+    for (i = 0; i < client->nb_calls; i++)
+    {
+        Req_call *call = client->calls[i];
+
+        nng_aio_free(call->aio);
+        if (call->reply)
+            nng_msg_free(call->reply);
+        free(call);
+    }
+
+    free(client->calls);
+    nng_cv_free(client->cv);
+    nng_mtx_free(client->mtx);
+    free(client);
+}
+
+/**
+ * Submit a request, the callback is called once it completes. Any number of
+ * requests may be outstanding on the client, each has its own context.
+ *
+ * @param client  Pointer to the client
+ * @param request Pointer to the request, sent without copy, it is empty
+ *                afterwards
+ * @param timeout Timeout of the request in ms, NNG_DURATION_DEFAULT for the
+ *                client timeout
+ * @param cb      Completion callback
+ * @param arg     Argument of the callback
+ *
+ * @return True on success, otherwise false and the callback is not called
+ */
+bool req_client_submit(Req_client *client, Databuf *request, nng_duration timeout, Req_client_cb cb, void *arg)
+{
+    if (!cb)
+        return false;
+
+    return call_start(client, request, timeout, cb, arg) != NULL;
+}
+
+/**
+ * Submit a request to be waited for with req_call_wait().
+ *
+ * @param client  Pointer to the client
+ * @param request Pointer to the request, sent without copy, it is empty
+ *                afterwards
+ * @param timeout Timeout of the request in ms, NNG_DURATION_DEFAULT for the
+ *                client timeout
+ *
+ * @return Pointer to the call, NULL on error
+ */
+Req_call *req_client_call(Req_client *client, Databuf *request, nng_duration timeout)
+{
+    return call_start(client, request, timeout, NULL, NULL);
+}
+
+/**
+ * Wait for a call started with req_client_call(), the call is released.
+ *
+ * @param call     Pointer to the call
+ * @param response Pointer to the response, to be freed with databuf_free()
+ *
+ * @return 0 on success, otherwise the nng error
+ */
+int req_call_wait(Req_call *call, Databuf *response)
+{
+    Req_client *client = call->client;
+    nng_msg *msg;
+    int result;
+
+    nng_mtx_lock(client->mtx);
+    while (call->state != REQ_CALL_DONE)
+        nng_cv_wait(client->cv);
+
+    result = call->result;
+    msg = call->reply;
+    call_release(call);
+    nng_mtx_unlock(client->mtx);
+
+    if (result != 0)
+        return result;
+
+    return call_response(msg, response);
+}
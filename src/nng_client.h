@@ -0,0 +1,74 @@
+#ifndef MBIM_NNG_CLIENT_H
+#define MBIM_NNG_CLIENT_H
+
+#include <stdint.h>
+#include "nng/nng.h"
+#include "nng/supplemental/util/platform.h"
+
+#include "databuf.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum
+{
+    REQ_CALL_SEND = 0,
+    REQ_CALL_RECV,
+    REQ_CALL_DONE
+} Req_call_state;
+
+typedef struct req_client Req_client;
+
+/**
+ * Completion of a request submitted with req_client_submit(), called on an
+ * nng thread, it must not block. The response is only valid during the call.
+ *
+ * @param result   0, otherwise the nng error (NNG_ETIMEDOUT, NNG_ECLOSED,
+ *                 NNG_EPROTO for a malformed response)
+ * @param response Pointer to the response, NULL on error
+ * @param arg      Argument given to req_client_submit()
+ */
+typedef void (*Req_client_cb)(int result, Databuf *response, void *arg);
+
+// One outstanding request, each call owns an nng context of the socket
+typedef struct req_call
+{
+    Req_client *client;
+    nng_ctx ctx;
+    nng_aio *aio;
+    Req_call_state state;
+    nng_duration timeout;
+    nng_time expire;         // Deadline of the request, unless the timeout is infinite
+    Req_client_cb cb;        // NULL for a call completed by req_call_wait()
+    void *arg;
+    int result;
+    nng_msg *reply;
+    struct req_call *next;   // Next free call
+} Req_call;
+
+typedef struct req_client
+{
+    nng_socket sock;
+    bool compact;            // Ask for the compact encoding in every request
+    nng_duration timeout;    // Timeout of the requests submitted with NNG_DURATION_DEFAULT
+    nng_mtx *mtx;
+    nng_cv *cv;
+    Req_call **calls;        // Every call, to release them on close
+    int nb_calls;
+    int max_calls;
+    Req_call *free_calls;
+    int outstanding;         // Calls not completed yet
+} Req_client;
+
+Req_client *req_client_open(const char *url, bool compact);
+void req_client_close(Req_client *client);
+bool req_client_submit(Req_client *client, Databuf *request, nng_duration timeout, Req_client_cb cb, void *arg);
+Req_call *req_client_call(Req_client *client, Databuf *request, nng_duration timeout);
+int req_call_wait(Req_call *call, Databuf *response);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // MBIM_NNG_CLIENT_H
@@ -4,12 +4,16 @@
  * @ccmod{MBIM_X_SRV}
  */
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <time.h>
 
 #include "nng_server.h"
 #include "mbim.h"
 #include "mbim_enum.h"
+#include "modem.h"
+#include "cache.h"
 #include "nng/protocol/reqrep0/rep.h"
 
 #define NODE_BIND_RETRIES 3
@@ -61,44 +65,66 @@ static bool server_open(nng_socket *sock, const char *url)
 }
 
 /**
- * Handle incoming requests for the MBIM server.
+ * Parse an incoming request for the MBIM server.
  *
  * @param request Pointer to the Mbim_request structure
+ *
+ * @return True if the request is valid, otherwise false and the error
+ *         response is complete
  */
-static void handle_request(Mbim_request *request)
+static bool parse_request(Mbim_request *request)
 {
+    unsigned int codes;
+    unsigned int field;
+    unsigned char *prev = NULL;
+
     request->type = MBIM_UNKOWN;
     request->proto = MB_PROT_UNKOWN;
-    if (!databuf_is_valid(&request->req))
+    // Checked and indexed at once, the lookups below and those of the
+    // modem backend then no longer scan the request
+    if (!databuf_parse(&request->req))
     {
-        databuf_add_string(&request->resp, MB_ERROR, "Server : Invalid request");
-        databuf_add_uint(&request->resp, MB_RESPONSE, MBIM_ERROR);
-        return;
+        mb_add_error(&request->resp, "Server : Invalid request");
+        mb_add_response(&request->resp, MBIM_ERROR);
+        return false;
     }
 
-    databuf_get_uint(&request->req, MB_REQUEST, &request->type);
+    mb_get_request(&request->req, &request->type);
     if (request->type == MBIM_UNKOWN)
     {
-        databuf_add_string(&request->resp, MB_ERROR, "Server : Unknown request");
-        databuf_add_uint(&request->resp, MB_RESPONSE, MBIM_ERROR);
-        return;
+        mb_add_error(&request->resp, "Server : Unknown request");
+        mb_add_response(&request->resp, MBIM_ERROR);
+        return false;
     }
 
-    databuf_get_uint(&request->req, MB_PROTOCOL, &request->proto);
+    mb_get_protocol(&request->req, &request->proto);
     if (request->proto == MB_PROT_UNKOWN)
     {
-        databuf_add_string(&request->resp, MB_ERROR, "Server : Unknown protocol");
-        databuf_add_uint(&request->resp, MB_RESPONSE, MBIM_ERROR);
-        return;
+        mb_add_error(&request->resp, "Server : Unknown protocol");
+        mb_add_response(&request->resp, MBIM_ERROR);
+        return false;
     }
 
     request->tid = 0;
-    databuf_get_uint(&request->req, MB_SESSION_TID, &request->tid);
+    mb_get_session_tid(&request->req, &request->tid);
 
-    if (request->proto == MB_PROT_MBIM)
-        mbim_perform_request(request);
-    else
-        qmi_perform_request(request);
+    codes = 0;
+    mb_get_codes(&request->req, &codes);
+    request->codes = codes != 0;
+
+    request->projected = false;
+    memset(request->fields, 0, sizeof(request->fields));
+    while ((prev = (unsigned char *) mb_get_next_field(&request->req, &field, prev)) != NULL)
+    {
+        // Out of the set, modem_wants() sends such variables anyway
+        if ((field >> 8) >= MB_FIELD_WORDS * 32)
+            continue;
+
+        request->fields[(field >> 8) / 32] |= 1u << ((field >> 8) % 32);
+        request->projected = true;
+    }
+
+    return true;
 }
 
 /**
@@ -125,43 +151,630 @@ bool rep_server_open(nng_socket *sock, const char *url)
 }
 
 /**
- * Perform a request handling loop for the MBIM server.
+ * Queue the next receive on the worker context.
+ *
+ * @param worker Pointer to the Rep_worker structure
+ */
+static void server_recv(Rep_worker *worker)
+{
+    worker->state = REP_SERVER_RECV;
+    nng_ctx_recv(worker->ctx, worker->aio);
+}
+
+/**
+ * Find a connection that negotiated the compact encoding, the lock must be held.
+ *
+ * @param server Pointer to the Rep_server structure
+ * @param pipe   The connection
+ *
+ * @return Position of the connection in compact_pipes, or -1 if not found
+ */
+static int server_find_pipe(Rep_server *server, nng_pipe pipe)
+{
+    uint32_t id = nng_pipe_id(pipe);
+    int i;
+
+    for (i = 0; i < server->nb_compact_pipes; i++)
+    {
+        if (server->compact_pipes[i] == id)
+            return i;
+    }
+
+    return -1;
+}
+
+/**
+ * Record the encoding of the responses negotiated by a connection.
+ *
+ * @param server   Pointer to the Rep_server structure
+ * @param pipe     The connection
+ * @param encoding Mbim_encoding requested by the client
+ */
+static void server_set_encoding(Rep_server *server, nng_pipe pipe, unsigned int encoding)
+{
+    uint32_t *pipes;
+    int pos;
+
+    nng_mtx_lock(server->mtx);
+    pos = server_find_pipe(server, pipe);
+    if (encoding == MB_ENCODING_COMPACT && pos < 0)
+    {
+        if (server->nb_compact_pipes == server->max_compact_pipes)
+        {
+            pipes = realloc(server->compact_pipes, (server->max_compact_pipes + 8) * sizeof(*pipes));
+            if (!pipes)
+            {
+                nng_mtx_unlock(server->mtx);
+                return;
+            }
+            server->compact_pipes = pipes;
+            server->max_compact_pipes += 8;
+        }
+        server->compact_pipes[server->nb_compact_pipes++] = nng_pipe_id(pipe);
+    }
+    else if (encoding != MB_ENCODING_COMPACT && pos >= 0)
+        server->compact_pipes[pos] = server->compact_pipes[--server->nb_compact_pipes];
+    nng_mtx_unlock(server->mtx);
+}
+
+/**
+ * Check if a connection negotiated the compact encoding.
+ *
+ * @param server Pointer to the Rep_server structure
+ * @param pipe   The connection
+ *
+ * @return True if the responses are sent compact, otherwise false
+ */
+static bool server_pipe_compact(Rep_server *server, nng_pipe pipe)
+{
+    bool compact;
+
+    nng_mtx_lock(server->mtx);
+    compact = server_find_pipe(server, pipe) >= 0;
+    nng_mtx_unlock(server->mtx);
+
+    return compact;
+}
+
+/**
+ * Pipe notification, the encoding of a closed connection is forgotten.
+ *
+ * @param pipe The connection
+ * @param ev   The pipe event
+ * @param arg  Pointer to the Rep_server structure
+ */
+static void server_pipe_removed(nng_pipe pipe, nng_pipe_ev ev, void *arg)
+{
+    (void) ev;
+
+    server_set_encoding(arg, pipe, MB_ENCODING_STANDARD);
+}
+
+/**
+ * Send the reply message of a worker.
+ *
+ * The reply is converted to the compact encoding if the connection
+ * negotiated it, it is sent as is otherwise or if the conversion fails.
+ * A cached reply is already compact, it is not converted again.
+ *
+ * @param worker Pointer to the Rep_worker structure
+ */
+static void server_send(Rep_worker *worker)
+{
+    Databuf reply = {0};
+
+    if (worker->compact)
+    {
+        databuf_set_msg(&reply, worker->msg);
+        databuf_compact(&reply);
+        worker->msg = databuf_take_msg(&reply);
+    }
+
+    worker->state = REP_SERVER_SEND;
+    nng_aio_set_msg(worker->aio, worker->msg);
+    worker->msg = NULL;
+    nng_ctx_send(worker->ctx, worker->aio);
+}
+
+/**
+ * Send a reply to the request handled by a worker.
+ *
+ * The reply is written back into the received message.
+ *
+ * @param worker Pointer to the Rep_worker structure
+ * @param data   Serialized response
+ * @param len    Length of the response in bytes
+ */
+static void server_reply_data(Rep_worker *worker, const void *data, size_t len)
+{
+    Mbim_request *request = &worker->request;
+    int ret;
+
+    databuf_unindex(&request->req);
+    request->req.buf = NULL;
+    request->req.len = 0;
+    request->req.size = 0;
+
+    nng_msg_clear(worker->msg);
+    ret = nng_msg_append(worker->msg, data, len);
+    if (ret != 0)
+    {
+        printf("Server : Unable to build reply [%d] : %s\n", ret, nng_strerror(ret));
+        nng_msg_free(worker->msg);
+        worker->msg = NULL;
+        server_recv(worker);
+        return;
+    }
+
+    server_send(worker);
+}
+
+/**
+ * Send the response of the request handled by a worker.
+ *
+ * The response is built in its own message, it is sent as is and the
+ * received message is released.
+ *
+ * @param worker Pointer to the Rep_worker structure
+ */
+static void server_reply(Rep_worker *worker)
+{
+    Mbim_request *request = &worker->request;
+    nng_msg *msg;
+
+    msg = databuf_take_msg(&request->resp);
+    if (!msg)
+    {
+        server_reply_data(worker, request->resp.buf, request->resp.len);
+        databuf_free(&request->resp);
+        return;
+    }
+
+    databuf_unindex(&request->req);
+    request->req.buf = NULL;
+    request->req.len = 0;
+    request->req.size = 0;
+
+    nng_msg_free(worker->msg);
+    worker->msg = msg;
+    server_send(worker);
+}
+
+/**
+ * Answer a request from the response cache, in the encoding of the connection.
+ *
+ * @param worker Pointer to the Rep_worker structure
+ *
+ * @return True if the cached response is sent, otherwise false
+ */
+static bool server_reply_cached(Rep_worker *worker)
+{
+    Mbim_request *request = &worker->request;
+
+    if (!cache_get(request, worker->msg, worker->compact))
+        return false;
+
+    databuf_unindex(&request->req);
+    request->req.buf = NULL;
+    request->req.len = 0;
+    request->req.size = 0;
+    databuf_free(&request->resp);
+
+    server_send(worker);
+
+    return true;
+}
+
+/**
+ * Send the response of a completed request.
+ *
+ * The workers attached to the request get a copy of its response.
+ *
+ * @param worker Pointer to the Rep_worker structure
+ */
+static void server_complete(Rep_worker *worker)
+{
+    Mbim_request *request = &worker->request;
+    Rep_server *server = worker->server;
+    Rep_worker *waiter;
+
+    nng_mtx_lock(server->mtx);
+    worker->shared = false;
+    while ((waiter = worker->waiters) != NULL)
+    {
+        worker->waiters = waiter->next;
+        waiter->next = NULL;
+        server_reply_data(waiter, request->resp.buf, request->resp.len);
+        databuf_free(&waiter->request.resp);
+        waiter->busy = false;
+    }
+    server_reply(worker);
+    worker->busy = false;
+    nng_cv_wake(server->cv);
+    nng_mtx_unlock(server->mtx);
+}
+
+/**
+ * Completion of a request handled on the modem thread.
+ *
+ * @param request Pointer to the Mbim_request structure
+ */
+static void server_request_done(Mbim_request *request)
+{
+    if (modem_changes_state(request->type))
+        cache_clear();
+    else
+        cache_put(request);
+
+    server_complete(request->priv);
+}
+
+static void server_batch_done(Mbim_request *sub);
+
+/**
+ * Submit the next request of a batch.
+ *
+ * Each request of the batch gets the parameters of the whole message. Once
+ * every request is complete, the batch response is sent.
+ *
+ * @param worker Pointer to the Rep_worker structure
+ */
+static void server_batch_next(Rep_worker *worker)
+{
+    Mbim_request *request = &worker->request;
+    Mbim_request *sub = &worker->sub;
+    unsigned int type;
+
+    while ((worker->batch = (unsigned char *) mb_get_next_request(&request->req, &type, worker->batch)) != NULL)
+    {
+        sub->type = type;
+        sub->proto = request->proto;
+        sub->tid = request->tid;
+        sub->codes = request->codes;
+        sub->projected = request->projected;
+        memcpy(sub->fields, request->fields, sizeof(sub->fields));
+        sub->user_data = request->user_data;
+        sub->req = request->req;
+        sub->done = server_batch_done;
+        sub->priv = worker;
+        databuf_init(&sub->resp);
+
+        if (sub->type < MBIM_UNKOWN)
+        {
+            sub->cache_gen = cache_generation();
+            modem_submit(sub);
+            return;
+        }
+
+        mb_add_error(&sub->resp, "Server : Unknown request");
+        mb_add_response(&sub->resp, MBIM_ERROR);
+        mb_add_request(&sub->resp, type);
+        mb_add_batch_response(&request->resp, &sub->resp);
+        databuf_free(&sub->resp);
+    }
+
+    mb_add_response(&request->resp, MBIM_OK);
+    server_complete(worker);
+}
+
+/**
+ * Completion of a request of a batch, its response is added as a section of
+ * the batch response.
+ *
+ * @param sub Pointer to the Mbim_request structure of the batch request
+ */
+static void server_batch_done(Mbim_request *sub)
+{
+    Rep_worker *worker = sub->priv;
+
+    if (modem_changes_state(sub->type))
+        cache_clear();
+    else
+        cache_put(sub);
+
+    mb_add_request(&sub->resp, sub->type);
+    mb_add_batch_response(&worker->request.resp, &sub->resp);
+    databuf_free(&sub->resp);
+
+    server_batch_next(worker);
+}
+
+/**
+ * Find an in-flight request identical to the one of a worker, the server lock
+ * must be held.
+ *
+ * Requests are identical when their serialized bodies match, so type,
+ * protocol and every parameter are the same.
+ *
+ * @param worker Pointer to the Rep_worker structure
+ *
+ * @return The worker handling the identical request, otherwise NULL
+ */
+static Rep_worker *server_find_shared(Rep_worker *worker)
+{
+    Rep_server *server = worker->server;
+    const Databuf *req = &worker->request.req;
+    int i;
+
+    for (i = 0; i < server->nb_workers; i++)
+    {
+        Rep_worker *other = &server->workers[i];
+
+        if (!other->shared || other->request.type != worker->request.type || other->request.proto != worker->request.proto)
+            continue;
+        if (other->request.req.len == req->len && memcmp(other->request.req.buf, req->buf, req->len) == 0)
+            return other;
+    }
+
+    return NULL;
+}
+
+/**
+ * Handle a received message, the reply is sent once the request completes.
  *
- * @param sock     Pointer to the NNG socket
- * @param request  Pointer to the Mbim_request structure
+ * The request databuf is a read-only view on the message body, the response
+ * databuf is the body of the reply message. A read-only
+ * request identical to one already in flight is not submitted, it waits for
+ * the response of the other one. A message with several MB_REQUEST is a
+ * batch, its requests run one after the other and the response holds one
+ * MB_BATCH_RESPONSE section per request, in order. A request with
+ * MB_ENCODING sets the encoding of the responses for its connection.
+ *
+ * @param worker Pointer to the Rep_worker structure
+ */
+static void server_handle(Rep_worker *worker)
+{
+    Mbim_request *request = &worker->request;
+    Rep_server *server = worker->server;
+    Rep_worker *shared = NULL;
+    Databuf received = {0};
+    unsigned int type;
+    char *first;
+    bool batch;
+
+    worker->msg = nng_aio_get_msg(worker->aio);
+    worker->pipe = nng_msg_get_pipe(worker->msg);
+    worker->compact = server_pipe_compact(server, worker->pipe);
+
+    // A compact request is expanded in a new message, it is rejected by
+    // parse_request() if that fails
+    databuf_set_msg(&received, worker->msg);
+    databuf_expand(&received);
+    worker->msg = databuf_take_msg(&received);
+
+    request->req.buf = nng_msg_body(worker->msg);
+    request->req.len = nng_msg_len(worker->msg);
+    request->req.size = request->req.len;
+    request->req.msg = NULL;
+    request->req.index = NULL;
+    request->done = server_request_done;
+    request->priv = worker;
+    databuf_init_msg(&request->resp);
+
+    if (!parse_request(request))
+    {
+        server_reply(worker);
+        return;
+    }
+
+    if (mb_get_encoding(&request->req, &type))
+    {
+        server_set_encoding(server, worker->pipe, type);
+        worker->compact = type == MB_ENCODING_COMPACT;
+    }
+
+    first = mb_get_request(&request->req, &type);
+    batch = mb_get_next_request(&request->req, &type, (unsigned char *) first) != NULL;
+
+    if (!batch && server_reply_cached(worker))
+        return;
+
+    worker->state = REP_SERVER_WAIT;
+
+    if (batch)
+    {
+        nng_mtx_lock(server->mtx);
+        worker->busy = true;
+        nng_mtx_unlock(server->mtx);
+
+        worker->batch = NULL;
+        server_batch_next(worker);
+        return;
+    }
+
+    nng_mtx_lock(server->mtx);
+    worker->busy = true;
+    if (!modem_changes_state(request->type))
+    {
+        shared = server_find_shared(worker);
+        if (shared)
+        {
+            worker->next = shared->waiters;
+            shared->waiters = worker;
+        }
+        else
+            worker->shared = true;
+    }
+    nng_mtx_unlock(server->mtx);
+
+    if (!shared)
+    {
+        request->cache_gen = cache_generation();
+        modem_submit(request);
+    }
+}
+
+/**
+ * Completion callback of a worker aio, runs as soon as a message is received
+ * or a reply has been sent on its context.
+ *
+ * @param arg Pointer to the Rep_worker structure
+ */
+static void server_cb(void *arg)
+{
+    Rep_worker *worker = arg;
+    int ret;
+
+    ret = nng_aio_result(worker->aio);
+    if (ret == NNG_ECLOSED || ret == NNG_ECANCELED)
+    {
+        if (worker->state == REP_SERVER_SEND)
+            nng_msg_free(nng_aio_get_msg(worker->aio));
+        return;
+    }
+
+    switch (worker->state)
+    {
+    case REP_SERVER_RECV:
+        if (ret != 0)
+        {
+            printf("Server : Receive failed [%d] : %s\n", ret, nng_strerror(ret));
+            server_recv(worker);
+            return;
+        }
+
+        server_handle(worker);
+        break;
+
+    case REP_SERVER_WAIT:
+        break;
+
+    case REP_SERVER_SEND:
+        if (ret != 0)
+        {
+            printf("Failed to reply: %s\n", nng_strerror(ret));
+            nng_msg_free(nng_aio_get_msg(worker->aio));
+        }
+
+        server_recv(worker);
+        break;
+    }
+}
+
+/**
+ * Release the workers and the server locks.
+ *
+ * @param server Pointer to the Rep_server structure
+ */
+static void server_free(Rep_server *server)
+{
+    int i;
+
+    for (i = 0; i < server->nb_workers; i++)
+    {
+        Rep_worker *worker = &server->workers[i];
+
+        if (worker->aio)
+        {
+            nng_aio_stop(worker->aio);
+            nng_aio_free(worker->aio);
+        }
+        nng_ctx_close(worker->ctx);
+    }
+
+    free(server->workers);
+    server->workers = NULL;
+    server->nb_workers = 0;
+
+    free(server->compact_pipes);
+    server->compact_pipes = NULL;
+    server->nb_compact_pipes = 0;
+    server->max_compact_pipes = 0;
+
+    if (server->cv)
+        nng_cv_free(server->cv);
+    if (server->mtx)
+        nng_mtx_free(server->mtx);
+    server->cv = NULL;
+    server->mtx = NULL;
+}
+
+/**
+ * Start handling requests on an opened server socket.
+ *
+ * Each worker owns a context of the socket and keeps one request outstanding,
+ * up to nb_workers requests are handled concurrently and their replies may
+ * complete out of order. Requests are dispatched from the aio completion
+ * callbacks, the caller does not need to poll the socket.
+ *
+ * @param server     Pointer to the Rep_server structure, sock must be opened
+ * @param nb_workers Number of requests handled concurrently
  *
  * @return True on success, otherwise false
  */
-bool rep_server_perform_request(nng_socket *sock, Mbim_request *request)
+bool rep_server_start(Rep_server *server, int nb_workers)
 {
-    unsigned char *buf = NULL;
-    size_t size = 0;
     int ret;
+    int i;
 
-    ret = nng_recv(*sock, &buf, &size, NNG_FLAG_NONBLOCK | NNG_FLAG_ALLOC);
-    if (ret == NNG_EAGAIN)
+    if ((ret = nng_mtx_alloc(&server->mtx)) != 0 || (ret = nng_cv_alloc(&server->cv, server->mtx)) != 0)
     {
-        sleep_us(100 * 1000);
-        return true;
+        printf("Server : Unable to allocate lock [%d] : %s\n", ret, nng_strerror(ret));
+        server_free(server);
+        return false;
     }
 
-    if (ret != 0)
+    server->workers = calloc(nb_workers, sizeof(Rep_worker));
+    if (!server->workers)
     {
-        printf("Server : Receive failed [%d] : %s\n", ret, nng_strerror(ret));
-        nng_close(*sock);
+        server_free(server);
         return false;
     }
 
-    databuf_set_buf(&request->req, buf, size);
-    databuf_init(&request->resp);
+    for (i = 0; i < nb_workers; i++)
+    {
+        Rep_worker *worker = &server->workers[i];
 
-    handle_request(request);
+        worker->server = server;
+        if ((ret = nng_aio_alloc(&worker->aio, server_cb, worker)) != 0 || (ret = nng_ctx_open(&worker->ctx, server->sock)) != 0)
+        {
+            printf("Server : Unable to allocate worker [%d] : %s\n", ret, nng_strerror(ret));
+            server->nb_workers = i + 1;
+            server_free(server);
+            return false;
+        }
+    }
 
-    if ((ret = nng_send(*sock, request->resp.buf, request->resp.len, 0)) != 0)
-        printf("Failed to reply: %s\n", nng_strerror(ret));
+    ret = nng_pipe_notify(server->sock, NNG_PIPE_EV_REM_POST, server_pipe_removed, server);
+    if (ret != 0)
+    {
+        printf("Server : Unable to watch connections [%d] : %s\n", ret, nng_strerror(ret));
+        server->nb_workers = nb_workers;
+        server_free(server);
+        return false;
+    }
 
-    databuf_free(&request->req);
-    databuf_free(&request->resp);
+    server->nb_workers = nb_workers;
+    for (i = 0; i < nb_workers; i++)
+        server_recv(&server->workers[i]);
 
     return true;
 }
+
+/**
+ * Stop handling requests and close the server socket.
+ *
+ * Waits for the requests being handled, if any, to complete. The modem thread
+ * must still be running.
+ *
+ * @param server Pointer to the Rep_server structure
+ */
+void rep_server_stop(Rep_server *server)
+{
+    int i;
+
+    nng_close(server->sock);
+
+    if (!server->workers)
+        return;
+
+    nng_mtx_lock(server->mtx);
+    for (i = 0; i < server->nb_workers; i++)
+    {
+        while (server->workers[i].busy)
+            nng_cv_wait(server->cv);
+    }
+    nng_mtx_unlock(server->mtx);
+
+    server_free(server);
+}
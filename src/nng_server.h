@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include "nng/nng.h"
+#include "nng/supplemental/util/platform.h"
 
 #include "mbim.h"
 
@@ -12,8 +13,49 @@
 extern "C" {
 #endif
 
+typedef enum
+{
+    REP_SERVER_RECV = 0,
+    REP_SERVER_WAIT,
+    REP_SERVER_SEND
+} Rep_server_state;
+
+typedef struct rep_server Rep_server;
+
+// One outstanding request, each worker owns an nng context of the socket
+typedef struct rep_worker
+{
+    Rep_server *server;
+    nng_ctx ctx;
+    nng_aio *aio;
+    nng_msg *msg;
+    Rep_server_state state;
+    nng_pipe pipe;               // Connection the request was received on
+    bool compact;                // Reply in the compact encoding
+    Mbim_request request;
+    Mbim_request sub;            // Current request of a batch
+    unsigned char *batch;        // MB_REQUEST of the current batch request
+    bool busy;                   // Request queued on the modem thread
+    bool shared;                 // In-flight request identical requests may attach to
+    struct rep_worker *waiters;  // Workers attached to this in-flight request
+    struct rep_worker *next;     // Next worker attached to the same request
+} Rep_worker;
+
+typedef struct rep_server
+{
+    nng_socket sock;
+    Rep_worker *workers;
+    int nb_workers;
+    nng_mtx *mtx;
+    nng_cv *cv;
+    uint32_t *compact_pipes;     // Connections that negotiated the compact encoding
+    int nb_compact_pipes;
+    int max_compact_pipes;
+} Rep_server;
+
 bool rep_server_open(nng_socket *sock, const char *url);
-bool rep_server_perform_request(nng_socket *sock, Mbim_request *request);
+bool rep_server_start(Rep_server *server, int nb_workers);
+void rep_server_stop(Rep_server *server);
 
 #ifdef __cplusplus
 }
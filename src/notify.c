@@ -0,0 +1,111 @@
+/**
+ * @file
+ * @brief Modem state change notifications
+ * @ccmod{MBIM_X_SRV}
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "notify.h"
+#include "cache.h"
+#include "trace.h"
+#include "nng/nng.h"
+#include "nng/protocol/pubsub0/pub.h"
+
+static nng_socket g_sock;
+static bool g_opened;
+
+static const char *g_topics[NOTIFY_UNKOWN] = {
+    [NOTIFY_SIGNAL] = MB_TOPIC_SIGNAL,
+    [NOTIFY_REGISTER] = MB_TOPIC_REGISTER,
+    [NOTIFY_CONNECT] = MB_TOPIC_CONNECT,
+    [NOTIFY_SIM] = MB_TOPIC_SIM,
+};
+
+/**
+ * Open and bind the NNG PUB socket of the notifications.
+ *
+ * @param url URL to bind the socket to
+ *
+ * @return True on success, otherwise false
+ */
+bool notify_open(const char *url)
+{
+    int ret;
+
+    ret = nng_pub0_open(&g_sock);
+    if (ret)
+    {
+        printf("Notify : Open PUB socket failed [%d] : %s\n", ret, nng_strerror(ret));
+        return false;
+    }
+
+    ret = nng_listen(g_sock, url, NULL, 0);
+    if (ret)
+    {
+        printf("Notify : Bind PUB socket failed [%d] : %s\n", ret, nng_strerror(ret));
+        nng_close(g_sock);
+        return false;
+    }
+
+    g_opened = true;
+
+    return true;
+}
+
+/**
+ * Close the PUB socket, the modem thread must be stopped.
+ */
+void notify_close(void)
+{
+    if (!g_opened)
+        return;
+
+    g_opened = false;
+    nng_close(g_sock);
+}
+
+/**
+ * Publish a modem state change, runs on the modem thread.
+ *
+ * The message is the topic string with its terminating NUL followed by the
+ * databuf, subscribers filter on the topic string. MB_PROTOCOL, MB_REQUEST
+ * and MB_RESPONSE are added to the databuf so it reads like the response of
+ * the request of that type. The cached response of the request is dropped.
+ *
+ * @param topic Notification topic
+ * @param proto Protocol of the device that raised the change
+ * @param type  Request type whose response changed
+ * @param msg   Pointer to the databuf with the changed values
+ */
+void notify_publish(Notify_topic topic, Mbim_protocol proto, Mbim_req_type type, Databuf *msg)
+{
+    const char *name;
+    nng_msg *nmsg;
+    int ret;
+
+    cache_invalidate(proto, type);
+    trace_notification(topic, proto, type, msg);
+
+    if (!g_opened || topic >= NOTIFY_UNKOWN)
+        return;
+
+    name = g_topics[topic];
+
+    mb_add_protocol(msg, proto);
+    mb_add_request(msg, type);
+    mb_add_response(msg, MBIM_OK);
+
+    if ((ret = nng_msg_alloc(&nmsg, 0)) != 0)
+    {
+        printf("Notify : Unable to allocate message [%d] : %s\n", ret, nng_strerror(ret));
+        return;
+    }
+
+    if ((ret = nng_msg_append(nmsg, name, strlen(name) + 1)) != 0 || (ret = nng_msg_append(nmsg, msg->buf, msg->len)) != 0 ||
+        (ret = nng_sendmsg(g_sock, nmsg, NNG_FLAG_NONBLOCK)) != 0)
+    {
+        printf("Notify : Unable to publish %s [%d] : %s\n", name, ret, nng_strerror(ret));
+        nng_msg_free(nmsg);
+    }
+}
@@ -0,0 +1,30 @@
+#ifndef MBIM_NNG_NOTIFY_H
+#define MBIM_NNG_NOTIFY_H
+
+#include <stdbool.h>
+
+#include "databuf.h"
+#include "mbim_enum.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum
+{
+    NOTIFY_SIGNAL = 0,
+    NOTIFY_REGISTER,
+    NOTIFY_CONNECT,
+    NOTIFY_SIM,
+    NOTIFY_UNKOWN
+} Notify_topic;
+
+bool notify_open(const char *url);
+void notify_close(void);
+void notify_publish(Notify_topic topic, Mbim_protocol proto, Mbim_req_type type, Databuf *msg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // MBIM_NNG_NOTIFY_H
@@ -9,22 +9,44 @@
 #include <glib.h>
 #include <glib/gprintf.h>
 #include <gio/gio.h>
-#include <glib-unix.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
 #include "mbim.h"
-#include "nng_server.h"
+#include "modem.h"
+#include "notify.h"
 
 #include "libqmi-glib/libqmi-glib.h"
 
-static GMainLoop *g_loop;
-static gboolean g_release_cid = TRUE;
-static GCancellable *g_cancellable;
+typedef struct qmi_service_client
+{
+    QmiService service;
+    QmiClient *client;
+    gboolean allocating;
+    GQueue waiting; // Requests waiting for the client allocation
+} Qmi_service_client;
+
 static QmiDevice *g_device;
-static QmiClient *g_client;
-static QmiService g_service;
-static Mbim_request *tmp_req = NULL;
+static gboolean g_device_opening;
+static gboolean g_device_removed;
+static gboolean g_subscribed; // The indications are published, see qmi_subscribe()
+static guint g_pending_release;
+
+// WDS client a network was started with, its CID is kept to keep the network up
+static QmiClient *g_network_client;
+
+// Loop of qmi_shutdown(), quit once the last release closed the device
+static GMainLoop *g_shutdown_loop;
+
+// Requests waiting for the device to be opened
+static GQueue g_waiting = G_QUEUE_INIT;
+
+// Clients allocated once per service and kept until shutdown or error
+static Qmi_service_client g_clients[] = {
+    {.service = QMI_SERVICE_UIM, .waiting = G_QUEUE_INIT},
+    {.service = QMI_SERVICE_NAS, .waiting = G_QUEUE_INIT},
+    {.service = QMI_SERVICE_WDS, .waiting = G_QUEUE_INIT},
+};
 
 /**
  * @brief Count the number of set bits in a 32-bit unsigned integer
@@ -52,8 +74,52 @@ static int count_set_bits(uint32_t n)
  */
 static void set_error(Mbim_request *request, const char *error)
 {
-    databuf_add_string(&request->resp, MB_ERROR, error);
-    databuf_add_uint(&request->resp, MB_RESPONSE, MBIM_ERROR);
+    mb_add_error(&request->resp, error);
+    mb_add_response(&request->resp, MBIM_ERROR);
+}
+
+/**
+ * @brief Get the QmiService used by a request type
+ *
+ * @param type The request type
+ * @return QmiService The service, QMI_SERVICE_UNKNOWN if no client is needed
+ */
+static QmiService request_service(Mbim_req_type type)
+{
+    switch (type)
+    {
+    case MBIM_PIN_STATUS:
+    case MBIM_PIN_ENTER: return QMI_SERVICE_UIM;
+
+    case MBIM_REGISTER:
+    case MBIM_PACKET_SERVICE:
+    case MBIM_SIGNAL: return QMI_SERVICE_NAS;
+
+    case MBIM_CONNECT:
+    case MBIM_IP:
+    case MBIM_STATUS: return QMI_SERVICE_WDS;
+
+    default: return QMI_SERVICE_UNKNOWN;
+    }
+}
+
+/**
+ * @brief Get the cached client of a QmiService
+ *
+ * @param service The QmiService
+ * @return Qmi_service_client* The cached client, NULL if the service is not used
+ */
+static Qmi_service_client *client_slot(QmiService service)
+{
+    guint i;
+
+    for (i = 0; i < G_N_ELEMENTS(g_clients); i++)
+    {
+        if (g_clients[i].service == service)
+            return &g_clients[i];
+    }
+
+    return NULL;
 }
 
 /**
@@ -61,8 +127,9 @@ static void set_error(Mbim_request *request, const char *error)
  *
  * @param dev Pointer to the QmiDevice
  * @param res Pointer to the GAsyncResult
+ * @param loop GMainLoop waiting for the close
  */
-static void close_ready(QmiDevice *dev, GAsyncResult *res)
+static void close_ready(QmiDevice *dev, GAsyncResult *res, GMainLoop *loop)
 {
     GError *error = NULL;
 
@@ -72,47 +139,100 @@ static void close_ready(QmiDevice *dev, GAsyncResult *res)
         g_error_free(error);
     }
 
-    g_main_loop_quit(g_loop);
+    g_main_loop_quit(loop);
 }
 
 /**
- * @brief Handle the result of releasing a QmiDevice client asynchronously
+ * @brief Handle the result of releasing a QmiDevice client asynchronously, the
+ * last release pending during a shutdown closes the device, whoever started it
  *
  * @param dev Pointer to the QmiDevice
  * @param res Pointer to the GAsyncResult
+ * @param user_data Unused
  */
-static void release_client_ready(QmiDevice *dev, GAsyncResult *res)
+static void release_client_ready(QmiDevice *dev, GAsyncResult *res, gpointer user_data)
 {
     GError *error = NULL;
 
+    (void) user_data;
+
     if (!qmi_device_release_client_finish(dev, res, &error))
     {
         printf("error: couldn't release client: %s\n", error->message);
         g_error_free(error);
     }
 
-    qmi_device_close_async(dev, 10, NULL, (GAsyncReadyCallback) close_ready, NULL);
+    if (--g_pending_release > 0 || !g_shutdown_loop)
+        return;
+
+    qmi_device_close_async(dev, 10, NULL, (GAsyncReadyCallback) close_ready, g_shutdown_loop);
 }
 
 /**
- * @brief Perform cleanup operations when shutting down the operation
+ * @brief Release a client, its CID is kept when a network was started with it
+ *
+ * @param client Pointer to the QmiClient, the reference is consumed
  */
-static void operation_shutdown(void)
+static void release_client(QmiClient *client)
 {
     QmiDeviceReleaseClientFlags flags = QMI_DEVICE_RELEASE_CLIENT_FLAGS_NONE;
 
-    g_clear_object(&g_cancellable);
-
-    if (!g_client)
+    if (client == g_network_client)
     {
-        g_main_loop_quit(g_loop);
-        return;
+        printf("[%s] Keeping the CID of the network\n", qmi_device_get_path_display(g_device));
+        g_network_client = NULL;
     }
-
-    if (g_release_cid)
+    else
         flags |= QMI_DEVICE_RELEASE_CLIENT_FLAGS_RELEASE_CID;
 
-    qmi_device_release_client(g_device, g_client, flags, 10, NULL, (GAsyncReadyCallback) release_client_ready, NULL);
+    g_pending_release++;
+    qmi_device_release_client(g_device, client, flags, 10, NULL, (GAsyncReadyCallback) release_client_ready, NULL);
+    g_object_unref(client);
+}
+
+/**
+ * @brief Drop the device and the cached clients without releasing them
+ */
+static void device_drop(void)
+{
+    guint i;
+
+    for (i = 0; i < G_N_ELEMENTS(g_clients); i++)
+        g_clear_object(&g_clients[i].client);
+
+    g_network_client = NULL;
+    g_clear_object(&g_device);
+}
+
+/**
+ * @brief Finish the operation, the device and the client are kept for the next one
+ *
+ * @param request Pointer to the Mbim_request structure
+ */
+static void operation_done(Mbim_request *request)
+{
+    request->done(request);
+}
+
+/**
+ * @brief Finish an operation whose transaction failed, the client is released
+ * and a new one is allocated by the next request
+ *
+ * @param request Pointer to the Mbim_request structure
+ * @param client Pointer to the QmiClient the transaction ran on, kept if
+ * another one replaced it in the meantime
+ */
+static void operation_failed(Mbim_request *request, QmiClient *client)
+{
+    Qmi_service_client *slot = client_slot(request_service(request->type));
+
+    if (slot && slot->client && slot->client == client)
+    {
+        release_client(slot->client);
+        slot->client = NULL;
+    }
+
+    operation_done(request);
 }
 
 /**
@@ -136,7 +256,7 @@ static void get_card_status_ready(QmiClientUim *client, GAsyncResult *res, Mbim_
         printf("error: operation failed: %s\n", error->message);
         set_error(request, error->message);
         g_error_free(error);
-        operation_shutdown();
+        operation_failed(request, QMI_CLIENT(client));
         return;
     }
 
@@ -146,7 +266,7 @@ static void get_card_status_ready(QmiClientUim *client, GAsyncResult *res, Mbim_
         set_error(request, error->message);
         g_error_free(error);
         qmi_message_uim_get_card_status_output_unref(output);
-        operation_shutdown();
+        operation_done(request);
         return;
     }
 
@@ -158,7 +278,7 @@ static void get_card_status_ready(QmiClientUim *client, GAsyncResult *res, Mbim_
         set_error(request, "No card found");
         g_error_free(error);
         qmi_message_uim_get_card_status_output_unref(output);
-        operation_shutdown();
+        operation_done(request);
         return;
     }
 
@@ -169,7 +289,7 @@ static void get_card_status_ready(QmiClientUim *client, GAsyncResult *res, Mbim_
         set_error(request, "No card app");
         g_error_free(error);
         qmi_message_uim_get_card_status_output_unref(output);
-        operation_shutdown();
+        operation_done(request);
         return;
     }
 
@@ -179,10 +299,10 @@ static void get_card_status_ready(QmiClientUim *client, GAsyncResult *res, Mbim_
     {
         printf("PIN is UNLOCKED\n");
 
-        databuf_add_uint(&request->resp, MB_PIN_STATUS, MBIM_PIN_UNLOCK);
-        databuf_add_uint(&request->resp, MB_RESPONSE, MBIM_OK);
+        modem_add_uint(request, MB_PIN_STATUS, MBIM_PIN_UNLOCK);
+        mb_add_response(&request->resp, MBIM_OK);
         qmi_message_uim_get_card_status_output_unref(output);
-        operation_shutdown();
+        operation_done(request);
         return;
     }
 
@@ -191,17 +311,17 @@ static void get_card_status_ready(QmiClientUim *client, GAsyncResult *res, Mbim_
         printf("PIN1 ");
         set_error(request, "Only PIN1 is supported");
         qmi_message_uim_get_card_status_output_unref(output);
-        operation_shutdown();
+        operation_done(request);
         return;
     }
 
     printf("PIN is LOCKED\n");
 
-    databuf_add_uint(&request->resp, MB_PIN_STATUS, MBIM_PIN_LOCK);
-    databuf_add_uint(&request->resp, MB_RESPONSE, MBIM_OK);
+    modem_add_uint(request, MB_PIN_STATUS, MBIM_PIN_LOCK);
+    mb_add_response(&request->resp, MBIM_OK);
 
     qmi_message_uim_get_card_status_output_unref(output);
-    operation_shutdown();
+    operation_done(request);
 }
 
 /**
@@ -222,7 +342,7 @@ static void verify_pin_ready(QmiClientUim *client, GAsyncResult *res, Mbim_reque
         printf("error: operation failed: %s\n", error->message);
         set_error(request, error->message);
         g_error_free(error);
-        operation_shutdown();
+        operation_failed(request, QMI_CLIENT(client));
         return;
     }
 
@@ -233,16 +353,16 @@ static void verify_pin_ready(QmiClientUim *client, GAsyncResult *res, Mbim_reque
         g_error_free(error);
 
         qmi_message_uim_verify_pin_output_unref(output);
-        operation_shutdown();
+        operation_done(request);
         return;
     }
 
     printf("PIN verified successfully\n");
-    databuf_add_uint(&request->resp, MB_PIN_STATUS, MBIM_PIN_UNLOCK);
-    databuf_add_uint(&request->resp, MB_RESPONSE, MBIM_OK);
+    modem_add_uint(request, MB_PIN_STATUS, MBIM_PIN_UNLOCK);
+    mb_add_response(&request->resp, MBIM_OK);
 
     qmi_message_uim_verify_pin_output_unref(output);
-    operation_shutdown();
+    operation_done(request);
 }
 
 /**
@@ -263,7 +383,7 @@ static void get_serving_system_ready(QmiClientNas *client, GAsyncResult *res, Mb
         printf("error: operation failed: %s\n", error->message);
         set_error(request, error->message);
         g_error_free(error);
-        operation_shutdown();
+        operation_failed(request, QMI_CLIENT(client));
         return;
     }
 
@@ -273,7 +393,7 @@ static void get_serving_system_ready(QmiClientNas *client, GAsyncResult *res, Mb
         set_error(request, error->message);
         g_error_free(error);
         qmi_message_nas_get_serving_system_output_unref(output);
-        operation_shutdown();
+        operation_done(request);
         return;
     }
 
@@ -288,13 +408,13 @@ static void get_serving_system_ready(QmiClientNas *client, GAsyncResult *res, Mb
         qmi_message_nas_get_serving_system_output_get_serving_system(output, &registration_state, &cs_attach_state, &ps_attach_state,
                                                                      &selected_network, NULL, NULL);
 
-        databuf_add_uint(&request->resp, MB_REGISTER_STATE, registration_state);
-        databuf_add_string(&request->resp, MB_REGISTER_STATE_STR,
-                           VALIDATE_UNKNOWN(qmi_nas_registration_state_get_string(registration_state)));
-        databuf_add_string(&request->resp, MB_ATTACH_PCK_SERVICE_STATE,
-                           ps_attach_state == QMI_NAS_ATTACH_STATE_ATTACHED ? "attached" : "detached");
+        modem_add_uint(request, MB_REGISTER_STATE, registration_state);
+        modem_add_string(request, MB_REGISTER_STATE_STR,
+                         VALIDATE_UNKNOWN(qmi_nas_registration_state_get_string(registration_state)));
+        modem_add_string(request, MB_ATTACH_PCK_SERVICE_STATE,
+                         ps_attach_state == QMI_NAS_ATTACH_STATE_ATTACHED ? "attached" : "detached");
 
-        databuf_add_uint(&request->resp, MB_RESPONSE, MBIM_OK);
+        mb_add_response(&request->resp, MBIM_OK);
     }
 
     {
@@ -307,13 +427,13 @@ static void get_serving_system_ready(QmiClientNas *client, GAsyncResult *res, Mb
                                                                        &current_plmn_description, NULL))
         {
             snprintf(tmp, sizeof(tmp), "%hu%hu", current_plmn_mcc, current_plmn_mnc);
-            databuf_add_string(&request->resp, MB_REGISTER_PROVIDER_NAME, VALIDATE_UNKNOWN(current_plmn_description));
-            databuf_add_string(&request->resp, MB_REGISTER_PROVIDER_ID, tmp);
+            modem_add_string(request, MB_REGISTER_PROVIDER_NAME, VALIDATE_UNKNOWN(current_plmn_description));
+            modem_add_string(request, MB_REGISTER_PROVIDER_ID, tmp);
         }
     }
 
     qmi_message_nas_get_serving_system_output_unref(output);
-    operation_shutdown();
+    operation_done(request);
 }
 
 /**
@@ -334,7 +454,7 @@ static void start_network_ready(QmiClientWds *client, GAsyncResult *res, Mbim_re
         printf("error: operation failed: %s\n", error->message);
         set_error(request, error->message);
         g_error_free(error);
-        operation_shutdown();
+        operation_failed(request, QMI_CLIENT(client));
         return;
     }
 
@@ -360,13 +480,16 @@ static void start_network_ready(QmiClientWds *client, GAsyncResult *res, Mbim_re
 
         g_error_free(error);
         qmi_message_wds_start_network_output_unref(output);
-        operation_shutdown();
+        operation_done(request);
         return;
     }
 
-    databuf_add_uint(&request->resp, MB_RESPONSE, MBIM_OK);
+    // The CID must outlive the request to keep the network up
+    g_network_client = QMI_CLIENT(client);
+
+    mb_add_response(&request->resp, MBIM_OK);
     qmi_message_wds_start_network_output_unref(output);
-    operation_shutdown();
+    operation_done(request);
 }
 
 /**
@@ -397,7 +520,7 @@ static void get_current_settings_ready(QmiClientWds *client, GAsyncResult *res,
         printf("error: operation failed: %s\n", error->message);
         set_error(request, error->message);
         g_error_free(error);
-        operation_shutdown();
+        operation_failed(request, QMI_CLIENT(client));
         return;
     }
 
@@ -407,11 +530,11 @@ static void get_current_settings_ready(QmiClientWds *client, GAsyncResult *res,
         set_error(request, error->message);
         g_error_free(error);
         qmi_message_wds_get_current_settings_output_unref(output);
-        operation_shutdown();
+        operation_done(request);
         return;
     }
 
-    databuf_add_uint(&request->resp, MB_RESPONSE, MBIM_OK);
+    mb_add_response(&request->resp, MBIM_OK);
 
     if (qmi_message_wds_get_current_settings_output_get_ipv4_gateway_subnet_mask(output, &addr, NULL))
         netmask = count_set_bits(GUINT32_TO_BE(addr));
@@ -422,8 +545,8 @@ static void get_current_settings_ready(QmiClientWds *client, GAsyncResult *res,
         memset(buf4, 0, sizeof(buf4));
         inet_ntop(AF_INET, &in_addr_val, buf4, sizeof(buf4));
         cidr = g_strdup_printf("%s/%u", buf4, netmask);
-        databuf_add_string(&request->resp, MB_IPV4_ADDR, cidr);
-        databuf_add_uint(&request->resp, MB_IPV4_NB, 1);
+        modem_add_string(request, MB_IPV4_ADDR, cidr);
+        modem_add_uint(request, MB_IPV4_NB, 1);
         g_free(cidr);
     }
 
@@ -432,7 +555,7 @@ static void get_current_settings_ready(QmiClientWds *client, GAsyncResult *res,
         in_addr_val.s_addr = GUINT32_TO_BE(addr);
         memset(buf4, 0, sizeof(buf4));
         inet_ntop(AF_INET, &in_addr_val, buf4, sizeof(buf4));
-        databuf_add_string(&request->resp, MB_IPV4_GW, buf4);
+        modem_add_string(request, MB_IPV4_GW, buf4);
     }
 
     if (qmi_message_wds_get_current_settings_output_get_ipv6_address(output, &array, &prefix, NULL))
@@ -443,8 +566,8 @@ static void get_current_settings_ready(QmiClientWds *client, GAsyncResult *res,
         memset(buf6, 0, sizeof(buf6));
         inet_ntop(AF_INET6, &in6_addr_val, buf6, sizeof(buf6));
         cidr = g_strdup_printf("%s/%u", buf6, prefix);
-        databuf_add_string(&request->resp, MB_IPV6_ADDR, cidr);
-        databuf_add_uint(&request->resp, MB_IPV6_NB, 1);
+        modem_add_string(request, MB_IPV6_ADDR, cidr);
+        modem_add_uint(request, MB_IPV6_NB, 1);
         g_free(cidr);
     }
 
@@ -456,11 +579,11 @@ static void get_current_settings_ready(QmiClientWds *client, GAsyncResult *res,
         memset(buf6, 0, sizeof(buf6));
         inet_ntop(AF_INET6, &in6_addr_val, buf6, sizeof(buf6));
         printf("IPv6 GW : %s\n", buf6);
-        databuf_add_string(&request->resp, MB_IPV6_GW, buf6);
+        modem_add_string(request, MB_IPV6_GW, buf6);
     }
 
     qmi_message_wds_get_current_settings_output_unref(output);
-    operation_shutdown();
+    operation_done(request);
 }
 
 /**
@@ -482,6 +605,7 @@ static void get_packet_service_status_ready(QmiClientWds *client, GAsyncResult *
         printf("error: operation failed: %s\n", error->message);
         set_error(request, error->message);
         g_error_free(error);
+        operation_failed(request, QMI_CLIENT(client));
         return;
     }
 
@@ -491,14 +615,16 @@ static void get_packet_service_status_ready(QmiClientWds *client, GAsyncResult *
         set_error(request, error->message);
         g_error_free(error);
         qmi_message_wds_get_packet_service_status_output_unref(output);
+        operation_done(request);
         return;
     }
 
     qmi_message_wds_get_packet_service_status_output_get_connection_status(output, &status, NULL);
-    databuf_add_uint(&request->resp, MB_RESPONSE, MBIM_OK);
-    databuf_add_uint(&request->resp, MB_STATE_ACTIVATION, status);
+    mb_add_response(&request->resp, MBIM_OK);
+    modem_add_uint(request, MB_STATE_ACTIVATION, status);
 
-    operation_shutdown();
+    qmi_message_wds_get_packet_service_status_output_unref(output);
+    operation_done(request);
 }
 
 /**
@@ -523,7 +649,7 @@ static void get_signal_info_ready(QmiClientNas *client, GAsyncResult *res, Mbim_
         printf("error: operation failed: %s\n", error->message);
         set_error(request, error->message);
         g_error_free(error);
-        operation_shutdown();
+        operation_failed(request, QMI_CLIENT(client));
         return;
     }
 
@@ -533,68 +659,60 @@ static void get_signal_info_ready(QmiClientNas *client, GAsyncResult *res, Mbim_
         set_error(request, error->message);
         g_error_free(error);
         qmi_message_nas_get_signal_info_output_unref(output);
-        operation_shutdown();
+        operation_done(request);
         return;
     }
 
     if (qmi_message_nas_get_signal_info_output_get_gsm_signal_strength(output, &rssi, NULL))
     {
-        databuf_add_uint(&request->resp, MB_SIGNAL_RSSI, rssi);
+        modem_add_uint(request, MB_SIGNAL_RSSI, rssi);
+        modem_add_int(request, MB_SIGNAL_RSSI_DBM, rssi);
     }
 
     if (qmi_message_nas_get_signal_info_output_get_lte_signal_strength(output, &rssi, &rsrq, &rsrp, &snr, NULL))
     {
         printf("LTE:\n\tRSSI: '%d dBm'\n\tRSRQ: '%d dB'\n\tRSRP: '%d dBm'\n\tSNR: '%.1lf dB'\n", rssi, rsrq, rsrp,
                (0.1) * ((gdouble) snr));
-        databuf_add_uint(&request->resp, MB_SIGNAL_RSSI, rssi);
-        databuf_add_uint(&request->resp, MB_SIGNAL_RSRQ, rsrq);
-        databuf_add_uint(&request->resp, MB_SIGNAL_RSRP, rsrp);
-        databuf_add_uint(&request->resp, MB_SIGNAL_RSSNR, snr);
+        modem_add_uint(request, MB_SIGNAL_RSSI, rssi);
+        modem_add_uint(request, MB_SIGNAL_RSRQ, rsrq);
+        modem_add_uint(request, MB_SIGNAL_RSRP, rsrp);
+        modem_add_uint(request, MB_SIGNAL_RSSNR, snr);
+        modem_add_int(request, MB_SIGNAL_RSSI_DBM, rssi);
+        modem_add_int(request, MB_SIGNAL_RSRQ_DB, rsrq);
+        modem_add_int(request, MB_SIGNAL_RSRP_DBM, rsrp);
+        modem_add_int(request, MB_SIGNAL_SNR, snr);
     }
 
-    databuf_add_uint(&request->resp, MB_RESPONSE, MBIM_OK);
+    mb_add_response(&request->resp, MBIM_OK);
 
     qmi_message_nas_get_signal_info_output_unref(output);
-    operation_shutdown();
+    operation_done(request);
 }
 
 /**
- * @brief Handle the result of allocating a client for a QmiService asynchronously
+ * @brief Send the QMI request matching the request type with the service client
  *
- * @param dev Pointer to the QmiDevice
- * @param res Pointer to the GAsyncResult
+ * @param client Pointer to the QmiClient of the request service
  * @param request Pointer to the Mbim_request structure
  */
-static void allocate_client_ready(QmiDevice *dev, GAsyncResult *res, Mbim_request *request)
+static void client_command(QmiClient *client, Mbim_request *request)
 {
-    GError *error = NULL;
-    g_release_cid = TRUE;
-
-    g_client = qmi_device_allocate_client_finish(dev, res, &error);
-    if (!g_client)
-    {
-        printf("error: couldn't create client for the '%s' service: %s\n", qmi_service_get_string(g_service), error->message);
-        set_error(request, error->message);
-        g_error_free(error);
-        g_main_loop_quit(g_loop);
-        return;
-    }
-
-    databuf_add_string(&request->resp, MB_DEVICE, qmi_device_get_path_display(dev));
+    GCancellable *cancellable = modem_get_cancellable();
 
     switch (request->type)
     {
     case MBIM_PIN_STATUS:
-        qmi_client_uim_get_card_status(QMI_CLIENT_UIM(g_client), NULL, 10, g_cancellable, (GAsyncReadyCallback) get_card_status_ready,
+        qmi_client_uim_get_card_status(QMI_CLIENT_UIM(client), NULL, 10, cancellable, (GAsyncReadyCallback) get_card_status_ready,
                                        request);
         return;
 
     case MBIM_PIN_ENTER: {
-        char *pin_code = databuf_get_string(&request->req, MB_PIN_CODE);
+        char *pin_code = mb_get_pin_code(&request->req);
         if (!pin_code)
         {
             set_error(request, "You must provide a pin code (MB_PIN_CODE)");
-            break;
+            operation_done(request);
+            return;
         }
 
         GError *error = NULL;
@@ -608,12 +726,12 @@ static void allocate_client_ready(QmiDevice *dev, GAsyncResult *res, Mbim_reques
             g_error_free(error);
             qmi_message_uim_verify_pin_input_unref(input);
             g_array_unref(dummy_aid);
-            operation_shutdown();
+            operation_done(request);
             return;
         }
         g_array_unref(dummy_aid);
 
-        qmi_client_uim_verify_pin(QMI_CLIENT_UIM(g_client), input, 10, g_cancellable, (GAsyncReadyCallback) verify_pin_ready, request);
+        qmi_client_uim_verify_pin(QMI_CLIENT_UIM(client), input, 10, cancellable, (GAsyncReadyCallback) verify_pin_ready, request);
         qmi_message_uim_verify_pin_input_unref(input);
     }
         return;
@@ -621,7 +739,7 @@ static void allocate_client_ready(QmiDevice *dev, GAsyncResult *res, Mbim_reques
     case MBIM_REGISTER:
     case MBIM_PACKET_SERVICE:
         printf("Asynchronously getting serving system...");
-        qmi_client_nas_get_serving_system(QMI_CLIENT_NAS(g_client), NULL, 10, g_cancellable,
+        qmi_client_nas_get_serving_system(QMI_CLIENT_NAS(client), NULL, 10, cancellable,
                                           (GAsyncReadyCallback) get_serving_system_ready, request);
         return;
 
@@ -631,18 +749,19 @@ static void allocate_client_ready(QmiDevice *dev, GAsyncResult *res, Mbim_reques
         char *password;
         int auth = -1;
 
-        g_release_cid = FALSE;
-        apn = databuf_get_string(&request->req, MB_APN);
+        apn = mb_get_apn(&request->req);
         if (!apn)
         {
             set_error(request, "You must provide an APN (MB_APN)");
+            operation_done(request);
             return;
         }
 
-        databuf_get_uint(&request->req, MB_AUTH, &auth);
+        mb_get_auth(&request->req, &auth);
         if (auth == -1)
         {
             set_error(request, "You must provide a auth protocol (MB_AUTH)");
+            operation_done(request);
             return;
         }
 
@@ -663,8 +782,8 @@ static void allocate_client_ready(QmiDevice *dev, GAsyncResult *res, Mbim_reques
         default:
         }
 
-        username = databuf_get_string(&request->req, MB_USERNAME);
-        password = databuf_get_string(&request->req, MB_PASSWORD);
+        username = mb_get_username(&request->req);
+        password = mb_get_password(&request->req);
 
         if (username && username[0])
             qmi_message_wds_start_network_input_set_username(input, username, NULL);
@@ -673,7 +792,7 @@ static void allocate_client_ready(QmiDevice *dev, GAsyncResult *res, Mbim_reques
             qmi_message_wds_start_network_input_set_username(input, password, NULL);
 
 
-        qmi_client_wds_start_network(QMI_CLIENT_WDS(g_client), input, 180, g_cancellable, (GAsyncReadyCallback) start_network_ready,
+        qmi_client_wds_start_network(QMI_CLIENT_WDS(client), input, 180, cancellable, (GAsyncReadyCallback) start_network_ready,
                                      request);
         if (input)
             qmi_message_wds_start_network_input_unref(input);
@@ -692,50 +811,361 @@ static void allocate_client_ready(QmiDevice *dev, GAsyncResult *res, Mbim_reques
              QMI_WDS_GET_CURRENT_SETTINGS_REQUESTED_SETTINGS_IP_FAMILY),
             NULL);
 
-        qmi_client_wds_get_current_settings(QMI_CLIENT_WDS(g_client), input, 10, g_cancellable,
+        qmi_client_wds_get_current_settings(QMI_CLIENT_WDS(client), input, 10, cancellable,
                                             (GAsyncReadyCallback) get_current_settings_ready, request);
         qmi_message_wds_get_current_settings_input_unref(input);
     }
         return;
 
     case MBIM_STATUS:
-        qmi_client_wds_get_packet_service_status(QMI_CLIENT_WDS(g_client), NULL, 10, g_cancellable,
+        qmi_client_wds_get_packet_service_status(QMI_CLIENT_WDS(client), NULL, 10, cancellable,
                                                  (GAsyncReadyCallback) get_packet_service_status_ready, request);
         return;
 
     case MBIM_SIGNAL:
-        qmi_client_nas_get_signal_info(QMI_CLIENT_NAS(g_client), NULL, 10, g_cancellable, (GAsyncReadyCallback) get_signal_info_ready,
-                                       NULL);
+        qmi_client_nas_get_signal_info(QMI_CLIENT_NAS(client), NULL, 10, cancellable, (GAsyncReadyCallback) get_signal_info_ready,
+                                       request);
+        return;
+
+    default: break;
+    }
+
+    operation_done(request);
+}
+
+/**
+ * @brief Run the requests waiting for a service client allocation
+ *
+ * @param slot Pointer to the service client
+ * @param error Allocation error, NULL if the client is allocated
+ */
+static void client_waiting_complete(Qmi_service_client *slot, const GError *error)
+{
+    Mbim_request *request;
+
+    slot->allocating = FALSE;
+
+    while ((request = g_queue_pop_head(&slot->waiting)))
+    {
+        if (error)
+        {
+            set_error(request, error->message);
+            operation_done(request);
+        }
+        else
+            client_command(slot->client, request);
+    }
+}
+
+/**
+ * @brief Publish a serving system indication of the QmiClientNas
+ *
+ * @param client Pointer to the QmiClientNas
+ * @param output Pointer to the indication output
+ * @param unused Unused parameter
+ */
+static void serving_system_indication(QmiClientNas *client, QmiIndicationNasServingSystemOutput *output, gpointer unused)
+{
+    QmiNasRegistrationState registration_state;
+    QmiNasAttachState cs_attach_state;
+    QmiNasAttachState ps_attach_state;
+    QmiNasNetworkType selected_network;
+    Databuf msg = {0};
+
+    (void) unused;
+
+    if (!qmi_indication_nas_serving_system_output_get_serving_system(output, &registration_state, &cs_attach_state, &ps_attach_state,
+                                                                     &selected_network, NULL, NULL) ||
+        !databuf_init(&msg))
+        return;
+
+    mb_add_device(&msg, qmi_device_get_path_display(g_device));
+    mb_add_register_state(&msg, registration_state);
+    mb_add_register_state_str(&msg, VALIDATE_UNKNOWN(qmi_nas_registration_state_get_string(registration_state)));
+    mb_add_attach_pck_service_state(&msg, ps_attach_state == QMI_NAS_ATTACH_STATE_ATTACHED ? "attached" : "detached");
+
+    notify_publish(NOTIFY_REGISTER, MB_PROT_QMI, MBIM_REGISTER, &msg);
+    databuf_free(&msg);
+}
+
+/**
+ * @brief Publish a signal info indication of the QmiClientNas
+ *
+ * @param client Pointer to the QmiClientNas
+ * @param output Pointer to the indication output
+ * @param unused Unused parameter
+ */
+static void signal_info_indication(QmiClientNas *client, QmiIndicationNasSignalInfoOutput *output, gpointer unused)
+{
+    gint8 rssi;
+    gint8 rsrq;
+    gint16 rsrp;
+    gint16 snr;
+    Databuf msg = {0};
+
+    (void) unused;
+
+    if (!databuf_init(&msg))
+        return;
+
+    mb_add_device(&msg, qmi_device_get_path_display(g_device));
+
+    if (qmi_indication_nas_signal_info_output_get_gsm_signal_strength(output, &rssi, NULL))
+    {
+        mb_add_signal_rssi(&msg, rssi);
+        mb_add_signal_rssi_dbm(&msg, rssi);
+    }
+
+    if (qmi_indication_nas_signal_info_output_get_lte_signal_strength(output, &rssi, &rsrq, &rsrp, &snr, NULL))
+    {
+        mb_add_signal_rssi(&msg, rssi);
+        mb_add_signal_rsrq(&msg, rsrq);
+        mb_add_signal_rsrp(&msg, rsrp);
+        mb_add_signal_rssnr(&msg, snr);
+        mb_add_signal_rssi_dbm(&msg, rssi);
+        mb_add_signal_rsrq_db(&msg, rsrq);
+        mb_add_signal_rsrp_dbm(&msg, rsrp);
+        mb_add_signal_snr(&msg, snr);
+    }
+
+    notify_publish(NOTIFY_SIGNAL, MB_PROT_QMI, MBIM_SIGNAL, &msg);
+    databuf_free(&msg);
+}
+
+/**
+ * @brief Publish a packet service status indication of the QmiClientWds
+ *
+ * @param client Pointer to the QmiClientWds
+ * @param output Pointer to the indication output
+ * @param unused Unused parameter
+ */
+static void packet_service_status_indication(QmiClientWds *client, QmiIndicationWdsPacketServiceStatusOutput *output, gpointer unused)
+{
+    QmiWdsConnectionStatus status;
+    Databuf msg = {0};
+
+    (void) unused;
+
+    if (!qmi_indication_wds_packet_service_status_output_get_connection_status(output, &status, NULL, NULL) || !databuf_init(&msg))
+        return;
+
+    mb_add_device(&msg, qmi_device_get_path_display(g_device));
+    mb_add_state_activation(&msg, status);
+
+    notify_publish(NOTIFY_CONNECT, MB_PROT_QMI, MBIM_STATUS, &msg);
+    databuf_free(&msg);
+}
+
+/**
+ * @brief Handle the result of registering the QmiClientNas indications asynchronously
+ *
+ * @param client Pointer to the QmiClientNas
+ * @param res Pointer to the GAsyncResult
+ * @param unused Unused parameter
+ */
+static void register_indications_ready(QmiClientNas *client, GAsyncResult *res, gpointer unused)
+{
+    QmiMessageNasRegisterIndicationsOutput *output;
+    GError *error = NULL;
+
+    (void) unused;
+
+    output = qmi_client_nas_register_indications_finish(client, res, &error);
+    if (output && !qmi_message_nas_register_indications_output_get_result(output, &error))
+        printf("error: couldn't register NAS indications: %s\n", error->message);
+    else if (!output)
+        printf("error: operation failed: %s\n", error->message);
+
+    g_clear_error(&error);
+    if (output)
+        qmi_message_nas_register_indications_output_unref(output);
+}
+
+/**
+ * @brief Watch the indications of a newly allocated service client to publish the state changes
+ *
+ * @param slot Pointer to the service client
+ */
+static void client_watch(Qmi_service_client *slot)
+{
+    QmiMessageNasRegisterIndicationsInput *input;
+
+    if (!g_subscribed)
         return;
 
+    switch (slot->service)
+    {
+    case QMI_SERVICE_NAS:
+        g_signal_connect(slot->client, "serving-system", G_CALLBACK(serving_system_indication), NULL);
+        g_signal_connect(slot->client, "signal-info", G_CALLBACK(signal_info_indication), NULL);
+
+        input = qmi_message_nas_register_indications_input_new();
+        qmi_message_nas_register_indications_input_set_serving_system_events(input, TRUE, NULL);
+        qmi_message_nas_register_indications_input_set_signal_info(input, TRUE, NULL);
+        qmi_client_nas_register_indications(QMI_CLIENT_NAS(slot->client), input, 10, modem_get_cancellable(),
+                                            (GAsyncReadyCallback) register_indications_ready, NULL);
+        qmi_message_nas_register_indications_input_unref(input);
+        break;
+
+    case QMI_SERVICE_WDS:
+        g_signal_connect(slot->client, "packet-service-status", G_CALLBACK(packet_service_status_indication), NULL);
+        break;
+
     default: break;
     }
 }
 
 /**
- * @brief Callback function to set expected data format on a QmiDevice after it has been opened and allocated a client
+ * @brief Handle the result of allocating a client for a QmiService asynchronously
+ *
+ * @param dev Pointer to the QmiDevice
+ * @param res Pointer to the GAsyncResult
+ * @param slot Pointer to the service client
+ */
+static void allocate_client_ready(QmiDevice *dev, GAsyncResult *res, Qmi_service_client *slot)
+{
+    GError *error = NULL;
+
+    slot->client = qmi_device_allocate_client_finish(dev, res, &error);
+    if (!slot->client)
+    {
+        printf("error: couldn't create client for the '%s' service: %s\n", qmi_service_get_string(slot->service), error->message);
+        client_waiting_complete(slot, error);
+        g_error_free(error);
+        return;
+    }
+
+    client_watch(slot);
+    client_waiting_complete(slot, NULL);
+}
+
+/**
+ * @brief Allocate the client of a service, the requests wait for it in the slot
  *
  * @param dev Pointer to the QmiDevice
- * @return FALSE Always return FALSE to remove this source from the event loop
+ * @param slot Pointer to the service client
  */
-static gboolean device_set_expected_data_format_cb(QmiDevice *dev)
+static void client_allocate(QmiDevice *dev, Qmi_service_client *slot)
+{
+    slot->allocating = TRUE;
+    qmi_device_allocate_client(dev, slot->service, QMI_CID_NONE, 10, modem_get_cancellable(),
+                               (GAsyncReadyCallback) allocate_client_ready, slot);
+}
+
+/**
+ * @brief Set the expected data format on the opened QmiDevice
+ *
+ * @param dev Pointer to the QmiDevice
+ * @param request Pointer to the Mbim_request structure
+ */
+static void device_set_expected_data_format(QmiDevice *dev, Mbim_request *request)
 {
     GError *error = NULL;
 
     if (!qmi_device_set_expected_data_format(dev, QMI_DEVICE_EXPECTED_DATA_FORMAT_RAW_IP, &error))
     {
         printf("error: cannot set expected data format: %s\n", error->message);
-        set_error(tmp_req, error->message);
+        set_error(request, error->message);
         g_error_free(error);
     }
     else
-        databuf_add_uint(&tmp_req->resp, MB_RESPONSE, MBIM_OK);
+        mb_add_response(&request->resp, MBIM_OK);
+
+    operation_done(request);
+}
+
+/**
+ * @brief Run the request on the opened device, allocating its client on first use
+ *
+ * @param dev Pointer to the QmiDevice
+ * @param request Pointer to the Mbim_request structure
+ */
+static void device_ready(QmiDevice *dev, Mbim_request *request)
+{
+    Qmi_service_client *slot;
+
+    modem_add_string(request, MB_DEVICE, qmi_device_get_path_display(dev));
 
-    g_clear_object(&g_cancellable);
-    g_main_loop_quit(g_loop);
+    if (request->type == MBIM_ATTACH)
+    {
+        device_set_expected_data_format(dev, request);
+        return;
+    }
+
+    slot = client_slot(request_service(request->type));
+    if (slot->client)
+    {
+        client_command(slot->client, request);
+        return;
+    }
 
-    g_object_unref(dev);
-    return FALSE;
+    g_queue_push_tail(&slot->waiting, request);
+    if (!slot->allocating)
+        client_allocate(dev, slot);
+}
+
+/**
+ * @brief Allocate the clients of the services with indications, once
+ * subscribed, so the state changes are published before their first request
+ *
+ * @param dev Pointer to the opened QmiDevice
+ */
+static void device_watch(QmiDevice *dev)
+{
+    Qmi_service_client *slot;
+    guint i;
+
+    if (!g_subscribed)
+        return;
+
+    for (i = 0; i < G_N_ELEMENTS(g_clients); i++)
+    {
+        slot = &g_clients[i];
+        if (slot->service == QMI_SERVICE_UIM || slot->client || slot->allocating)
+            continue;
+
+        client_allocate(dev, slot);
+    }
+}
+
+/**
+ * @brief Complete the requests waiting for the device to be opened
+ *
+ * @param error Open error, NULL if the device is opened
+ */
+static void device_waiting_complete(const GError *error)
+{
+    Mbim_request *request;
+
+    g_device_opening = FALSE;
+
+    if (!error)
+        device_watch(g_device);
+
+    while ((request = g_queue_pop_head(&g_waiting)))
+    {
+        if (error)
+        {
+            set_error(request, error->message);
+            operation_done(request);
+        }
+        else
+            device_ready(g_device, request);
+    }
+}
+
+/**
+ * @brief Callback function when the device is removed
+ *
+ * @param dev Pointer to the QmiDevice
+ * @param user_data Unused
+ */
+static void device_removed(QmiDevice *dev, gpointer user_data)
+{
+    (void) user_data;
+
+    printf("Qmi : Device %s removed\n", qmi_device_get_path_display(dev));
+    g_device_removed = TRUE;
 }
 
 /**
@@ -743,28 +1173,27 @@ static gboolean device_set_expected_data_format_cb(QmiDevice *dev)
  *
  * @param dev Pointer to the QmiDevice
  * @param res Pointer to the GAsyncResult
- * @param request Pointer to the Mbim_request structure
+ * @param unused Unused parameter
  */
-static void device_open_ready(QmiDevice *dev, GAsyncResult *res, Mbim_request *request)
+static void device_open_ready(QmiDevice *dev, GAsyncResult *res, gpointer unused)
 {
     GError *error = NULL;
-    guint8 cid = QMI_CID_NONE;
+
+    (void) unused;
 
     if (!qmi_device_open_finish(dev, res, &error))
     {
         printf("error: couldn't open the QmiDevice: %s\n", error->message);
+        device_drop();
+        device_waiting_complete(error);
+        g_error_free(error);
         return;
     }
 
-    if (request->type == MBIM_ATTACH)
-    {
-        tmp_req = request;
-        databuf_add_string(&request->resp, MB_DEVICE, MBIM_NNG_DEVICE);
-        g_idle_add((GSourceFunc) device_set_expected_data_format_cb, g_object_ref(dev));
-        return;
-    }
+    g_device_removed = FALSE;
+    g_signal_connect(dev, QMI_DEVICE_SIGNAL_REMOVED, G_CALLBACK(device_removed), NULL);
 
-    qmi_device_allocate_client(dev, g_service, cid, 10, g_cancellable, (GAsyncReadyCallback) allocate_client_ready, request);
+    device_waiting_complete(NULL);
 }
 
 /**
@@ -772,114 +1201,136 @@ static void device_open_ready(QmiDevice *dev, GAsyncResult *res, Mbim_request *r
  *
  * @param unused Unused parameter
  * @param res Pointer to the GAsyncResult
- * @param request Pointer to the Mbim_request structure
+ * @param unused2 Unused parameter
  */
-static void device_new_ready(GObject *unused, GAsyncResult *res, Mbim_request *request)
+static void device_new_ready(GObject *unused, GAsyncResult *res, gpointer unused2)
 {
     GError *error = NULL;
     QmiDeviceOpenFlags open_flags = QMI_DEVICE_OPEN_FLAGS_PROXY | QMI_DEVICE_OPEN_FLAGS_AUTO;
 
+    (void) unused;
+    (void) unused2;
+
     g_device = qmi_device_new_finish(res, &error);
     if (!g_device)
     {
         printf("error: couldn't create QmiDevice: %s\n", error->message);
-        set_error(request, error->message);
+        device_waiting_complete(error);
         g_error_free(error);
-        g_main_loop_quit(g_loop);
         return;
     }
 
-    qmi_device_open(g_device, open_flags, 15, g_cancellable, (GAsyncReadyCallback) device_open_ready, request);
+    qmi_device_open(g_device, open_flags, 15, modem_get_cancellable(), (GAsyncReadyCallback) device_open_ready, NULL);
 }
 
 /**
- * @brief Signal handler for SIGINT, SIGHUP, and SIGTERM signals
- *
- * @return gboolean True if signal handling should continue, otherwise False
+ * @brief Start opening the QmiDevice, the requests wait for it in g_waiting
  */
-static gboolean signals_handler(void)
+static void device_open(void)
 {
-    if (g_cancellable)
-    {
-        if (!g_cancellable_is_cancelled(g_cancellable))
-        {
-            printf("cancelling the operation...\n");
-            g_cancellable_cancel(g_cancellable);
-            return G_SOURCE_CONTINUE;
-        }
-    }
+    GFile *file;
 
-    if (g_loop && g_main_loop_is_running(g_loop))
-    {
-        printf("cancelling the main loop...\n");
-        g_idle_add((GSourceFunc) g_main_loop_quit, g_loop);
-    }
+    g_device_opening = TRUE;
+    device_drop();
 
-    return G_SOURCE_REMOVE;
+    file = g_file_new_for_commandline_arg(MBIM_NNG_DEVICE);
+    qmi_device_new(file, modem_get_cancellable(), (GAsyncReadyCallback) device_new_ready, NULL);
+    g_object_unref(file);
 }
 
 /**
- * @brief Perform a QMI request based on the provided Mbim_request structure
+ * @brief Perform a QMI request based on the provided Mbim_request structure, runs on the modem thread
+ *
+ * The QmiDevice is opened on the first request and one client per service is
+ * allocated on first use, or once the device is opened after qmi_subscribe(). Both are kept for the following requests and only
+ * dropped when the device is removed or a transaction fails. The request is
+ * completed through its done callback.
  *
  * @param request Pointer to the Mbim_request structure containing the request details
  */
 void qmi_perform_request(Mbim_request *request)
 {
-    GFile *file;
-    guint intid;
-    guint hupid;
-    guint termid;
     const char *qmi_device = MBIM_NNG_DEVICE;
 
     if (access(qmi_device, R_OK) != 0)
     {
         printf("No %s file\n", qmi_device);
         set_error(request, "No qmi device file");
+        if (!g_device_opening)
+            device_drop();
+        operation_done(request);
         return;
     }
 
-    switch (request->type)
+    if (request->type != MBIM_ATTACH && request_service(request->type) == QMI_SERVICE_UNKNOWN)
     {
-    case MBIM_PIN_STATUS:
-    case MBIM_PIN_ENTER: g_service = QMI_SERVICE_UIM; break;
-
-    case MBIM_REGISTER:
-    case MBIM_PACKET_SERVICE:
-    case MBIM_SIGNAL: g_service = QMI_SERVICE_NAS; break;
+        set_error(request, "Unsupported request");
+        operation_done(request);
+        return;
+    }
 
-    case MBIM_CONNECT:
-    case MBIM_IP:
-    case MBIM_STATUS: g_service = QMI_SERVICE_WDS; break;
-    case MBIM_ATTACH: break;
-    default: set_error(request, "Unsupported request"); return;
+    if (!g_device_opening && g_device && !g_device_removed && qmi_device_is_open(g_device))
+    {
+        device_ready(g_device, request);
+        return;
     }
 
-    file = g_file_new_for_commandline_arg(qmi_device);
+    g_queue_push_tail(&g_waiting, request);
+    if (!g_device_opening)
+        device_open();
+}
 
-    g_cancellable = g_cancellable_new();
-    g_loop = g_main_loop_new(NULL, FALSE);
+/**
+ * @brief Publish the NAS and WDS indications, runs on the modem thread
+ *
+ * Their clients are allocated and the NAS indications registered as soon as
+ * the device is opened by a request, and again on every reopen.
+ */
+static void qmi_subscribe(void)
+{
+    g_subscribed = TRUE;
+
+    if (!g_device_opening && g_device && !g_device_removed && qmi_device_is_open(g_device))
+        device_watch(g_device);
+}
+
+/**
+ * @brief Release the cached clients and close the QmiDevice, if opened, runs on the modem thread
+ */
+void qmi_shutdown(void)
+{
+    GMainLoop *loop;
+    guint i;
 
-    intid = g_unix_signal_add(SIGINT, (GSourceFunc) signals_handler, GUINT_TO_POINTER(SIGINT));
-    hupid = g_unix_signal_add(SIGHUP, (GSourceFunc) signals_handler, GUINT_TO_POINTER(SIGHUP));
-    termid = g_unix_signal_add(SIGTERM, (GSourceFunc) signals_handler, GUINT_TO_POINTER(SIGTERM));
+    if (!g_device)
+        return;
 
+    loop = g_main_loop_new(g_main_context_get_thread_default(), FALSE);
+    g_shutdown_loop = loop;
 
-    qmi_device_new(file, g_cancellable, (GAsyncReadyCallback) device_new_ready, request);
-    g_main_loop_run(g_loop);
+    for (i = 0; i < G_N_ELEMENTS(g_clients); i++)
+    {
+        if (!g_clients[i].client)
+            continue;
 
-    g_source_remove(intid);
-    g_source_remove(hupid);
-    g_source_remove(termid);
+        release_client(g_clients[i].client);
+        g_clients[i].client = NULL;
+    }
 
-    if (g_cancellable)
-        g_object_unref(g_cancellable);
-    if (g_device)
-        g_object_unref(g_device);
+    // Releases started by failed operations count too, the last one closes
+    if (g_pending_release == 0)
+        qmi_device_close_async(g_device, 10, NULL, (GAsyncReadyCallback) close_ready, loop);
 
-    g_main_loop_unref(g_loop);
-    g_object_unref(file);
+    g_main_loop_run(loop);
 
-    g_device = NULL;
-    g_loop = NULL;
-    g_cancellable = NULL;
+    g_shutdown_loop = NULL;
+    g_main_loop_unref(loop);
+    g_clear_object(&g_device);
 }
+
+const Modem_backend qmi_backend = {
+    .name = "qmi",
+    .execute = qmi_perform_request,
+    .subscribe = qmi_subscribe,
+    .close = qmi_shutdown,
+};
@@ -0,0 +1,763 @@
+/**
+ * @file
+ * @brief Simulated modem backend, answers the requests of both protocols
+ *        from a simulated state with configurable latencies, failures and
+ *        scripted state changes, without any device
+ * @ccmod{MBIM_X_MMG}
+ */
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include "sim.h"
+#include "cache.h"
+#include "modem.h"
+#include "notify.h"
+
+#define SIM_DEVICE "sim"
+
+typedef enum
+{
+    SIM_FIXED = 0,   // a ms
+    SIM_UNIFORM,     // Between a and b ms
+    SIM_NORMAL,      // Mean a ms, standard deviation b ms
+    SIM_EXPONENTIAL, // Mean a ms
+    SIM_DIST_UNKNOWN
+} Sim_distribution;
+
+typedef struct sim_latency
+{
+    Sim_distribution dist;
+    double a;
+    double b;
+} Sim_latency;
+
+typedef enum
+{
+    SIM_SIGNAL = 0,
+    SIM_REGISTER,
+    SIM_ATTACH,
+    SIM_CONNECT,
+    SIM_PIN,
+    SIM_CHANGE_UNKNOWN
+} Sim_change;
+
+typedef struct sim_event
+{
+    unsigned int at_ms; // From the start of the script
+    Sim_change change;
+    unsigned int value;
+} Sim_event;
+
+// Values of the libmbim enumerations and bitmasks sent with MB_CODES
+enum
+{
+    SIM_SUB_NOT_INITIALIZED = 0,
+    SIM_SUB_INITIALIZED = 1,
+    SIM_REGISTER_MODE_AUTOMATIC = 1,
+    SIM_DATA_CLASS_LTE = 0x20,
+    SIM_CELLULAR_CLASS_GSM = 0x01,
+    SIM_PACKET_SERVICE_ATTACHED = 2,
+    SIM_PACKET_SERVICE_DETACHED = 4,
+    SIM_IP_TYPE_IPV4 = 1,
+    SIM_DEVICE_TYPE_REMOTE = 3
+};
+
+typedef struct sim_state
+{
+    unsigned int rssi;
+    Mbim_register_state register_state;
+    bool attached;
+    Mbim_activation_state activation;
+    Mbim_pin_status pin;
+} Sim_state;
+
+static const char *g_type_names[MBIM_UNKOWN] = {
+    [MBIM_PIN_STATUS] = "pin_status",
+    [MBIM_PIN_ENTER] = "pin_enter",
+    [MBIM_SUBSCRIBER] = "subscriber",
+    [MBIM_REGISTER] = "register",
+    [MBIM_ATTACH] = "attach",
+    [MBIM_CONNECT] = "connect",
+    [MBIM_IP] = "ip",
+    [MBIM_STATUS] = "status",
+    [MBIM_DEVICE_CAPS] = "device_caps",
+    [MBIM_PACKET_SERVICE] = "packet_service",
+    [MBIM_SIGNAL] = "signal",
+    [MBIM_FULL_STATUS] = "full_status",
+};
+
+static const char *g_dist_names[SIM_DIST_UNKNOWN] = {"fixed", "uniform", "normal", "exponential"};
+static const char *g_change_names[SIM_CHANGE_UNKNOWN] = {"signal", "register", "attach", "connect", "pin"};
+
+// Values of the changes, by name, indexed by the MBIM value
+static const char *g_register_names[] = {"unknown", "deregistered", "searching", "home", "roaming", "partner", "denied"};
+static const char *g_attach_names[] = {"detached", "attached"};
+static const char *g_activation_names[] = {"unknown", "activated", "activating", "deactivated", "deactivating"};
+static const char *g_pin_names[] = {"unlocked", "locked"};
+
+// Configuration
+static Sim_latency g_latency[MBIM_UNKOWN];
+static double g_failure[MBIM_UNKOWN];
+static Sim_event g_events[SIM_MAX_EVENTS];
+static int g_nb_events;
+static unsigned int g_repeat_ms;
+static uint64_t g_seed = 88172645463325252ULL;
+
+// State, on the modem thread
+static Sim_state g_state;
+static uint64_t g_random;
+static GSource *g_script;
+static gint64 g_script_start;
+static int g_next_event;
+
+/**
+ * Find a name in a table.
+ *
+ * @return Index of the name, -1 if not found
+ */
+static int sim_lookup(const char *name, const char **names, int nb_names)
+{
+    int i;
+
+    for (i = 0; i < nb_names; i++)
+    {
+        if (names[i] && strcmp(name, names[i]) == 0)
+            return i;
+    }
+
+    return -1;
+}
+
+/**
+ * Parse the value of a change, its name or a number.
+ *
+ * @return True on success, otherwise false
+ */
+static bool sim_parse_value(Sim_change change, const char *name, unsigned int *value)
+{
+    char *end;
+    int index = -1;
+
+    switch (change)
+    {
+    case SIM_REGISTER: index = sim_lookup(name, g_register_names, G_N_ELEMENTS(g_register_names)); break;
+    case SIM_ATTACH: index = sim_lookup(name, g_attach_names, G_N_ELEMENTS(g_attach_names)); break;
+    case SIM_CONNECT: index = sim_lookup(name, g_activation_names, G_N_ELEMENTS(g_activation_names)); break;
+    case SIM_PIN: index = sim_lookup(name, g_pin_names, G_N_ELEMENTS(g_pin_names)); break;
+    default: break;
+    }
+
+    if (index >= 0)
+    {
+        *value = index;
+        return true;
+    }
+
+    *value = strtoul(name, &end, 0);
+
+    return end != name && *end == '\0';
+}
+
+/**
+ * Parse the request type of a latency or failure line, "default" sets all of them.
+ *
+ * @return First type to set, MBIM_UNKOWN if unknown, *last is the last one
+ */
+static int sim_parse_type(const char *name, int *last)
+{
+    int type;
+
+    if (strcmp(name, "default") == 0)
+    {
+        *last = MBIM_UNKOWN - 1;
+        return 0;
+    }
+
+    type = sim_lookup(name, g_type_names, MBIM_UNKOWN);
+    if (type < 0)
+        return MBIM_UNKOWN;
+
+    *last = type;
+
+    return type;
+}
+
+/**
+ * Apply one line of the simulator configuration, before modem_start():
+ *
+ *   latency <type|default> fixed <ms>
+ *   latency <type|default> uniform <min ms> <max ms>
+ *   latency <type|default> normal <mean ms> <deviation ms>
+ *   latency <type|default> exponential <mean ms>
+ *   fail <type|default> <probability>
+ *   at <ms> <signal|register|attach|connect|pin> <value>
+ *   repeat <ms>
+ *   seed <number>
+ *
+ * The types are the request names in lower case without MBIM_, for example
+ * full_status. A value is a number or a name, home or roaming for register,
+ * attached, activated or deactivated for connect, locked or unlocked for pin.
+ * The events of at run once from the start, or every repeat ms. Empty lines
+ * and lines starting with # are ignored.
+ *
+ * @param line Configuration line
+ *
+ * @return True on success, otherwise false
+ */
+bool sim_configure_line(const char *line)
+{
+    char key[16];
+    char name[32];
+    char arg[32];
+    unsigned long long seed;
+    unsigned int at;
+    double a;
+    double b = 0;
+    int first;
+    int last;
+    int dist;
+    int change;
+    int nb;
+
+    while (isspace((unsigned char) *line))
+        line++;
+
+    if (*line == '\0' || *line == '#' || sscanf(line, "%15s", key) != 1)
+        return true;
+
+    if (strcmp(key, "latency") == 0)
+    {
+        nb = sscanf(line, "%*s %31s %31s %lf %lf", name, arg, &a, &b);
+        first = nb >= 3 ? sim_parse_type(name, &last) : MBIM_UNKOWN;
+        dist = nb >= 3 ? sim_lookup(arg, g_dist_names, SIM_DIST_UNKNOWN) : -1;
+        if (first != MBIM_UNKOWN && dist >= 0 && a >= 0 && (nb == 4 || dist == SIM_FIXED || dist == SIM_EXPONENTIAL))
+        {
+            for (; first <= last; first++)
+                g_latency[first] = (Sim_latency) {dist, a, b};
+            return true;
+        }
+    }
+    else if (strcmp(key, "fail") == 0)
+    {
+        first = sscanf(line, "%*s %31s %lf", name, &a) == 2 ? sim_parse_type(name, &last) : MBIM_UNKOWN;
+        if (first != MBIM_UNKOWN && a >= 0 && a <= 1)
+        {
+            for (; first <= last; first++)
+                g_failure[first] = a;
+            return true;
+        }
+    }
+    else if (strcmp(key, "at") == 0)
+    {
+        change = -1;
+        if (sscanf(line, "%*s %u %31s %31s", &at, name, arg) == 3)
+            change = sim_lookup(name, g_change_names, SIM_CHANGE_UNKNOWN);
+
+        if (change >= 0 && g_nb_events < SIM_MAX_EVENTS && sim_parse_value(change, arg, &g_events[g_nb_events].value))
+        {
+            g_events[g_nb_events].at_ms = at;
+            g_events[g_nb_events].change = change;
+            g_nb_events++;
+            return true;
+        }
+    }
+    else if (strcmp(key, "repeat") == 0)
+    {
+        if (sscanf(line, "%*s %u", &g_repeat_ms) == 1)
+            return true;
+    }
+    else if (strcmp(key, "seed") == 0)
+    {
+        if (sscanf(line, "%*s %llu", &seed) == 1)
+        {
+            g_seed = seed ? seed : 1;
+            return true;
+        }
+    }
+
+    printf("Sim : Invalid configuration line: %.*s\n", (int) strcspn(line, "\r\n"), line);
+
+    return false;
+}
+
+/**
+ * Read the simulator configuration from a file, one sim_configure_line() per line.
+ *
+ * @param path Path of the configuration file
+ *
+ * @return True on success, otherwise false
+ */
+bool sim_configure(const char *path)
+{
+    char line[256];
+    bool ok = true;
+    FILE *file;
+
+    file = fopen(path, "r");
+    if (!file)
+    {
+        printf("Sim : Unable to open %s\n", path);
+        return false;
+    }
+
+    while (fgets(line, sizeof(line), file))
+    {
+        if (!sim_configure_line(line))
+            ok = false;
+    }
+
+    fclose(file);
+
+    return ok;
+}
+
+/**
+ * Uniform random number, xorshift64*.
+ *
+ * @return Number in ]0, 1[
+ */
+static double sim_random(void)
+{
+    g_random ^= g_random >> 12;
+    g_random ^= g_random << 25;
+    g_random ^= g_random >> 27;
+
+    return (((g_random * 2685821657736338717ULL) >> 11) + 0.5) / 9007199254740992.0;
+}
+
+/**
+ * Draw the latency of a request from the distribution of its type.
+ *
+ * @param type Request type
+ *
+ * @return Latency in ms
+ */
+static unsigned int sim_delay(Mbim_req_type type)
+{
+    const Sim_latency *latency = &g_latency[type];
+    double ms = latency->a;
+
+    switch (latency->dist)
+    {
+    case SIM_UNIFORM:
+        ms = latency->a + (latency->b - latency->a) * sim_random();
+        break;
+
+    case SIM_NORMAL:
+        // Box-Muller
+        ms = latency->a + latency->b * sqrt(-2 * log(sim_random())) * cos(2 * G_PI * sim_random());
+        break;
+
+    case SIM_EXPONENTIAL:
+        ms = -latency->a * log(sim_random());
+        break;
+
+    default:
+        break;
+    }
+
+    return ms > 0 ? (unsigned int) (ms + 0.5) : 0;
+}
+
+/**
+ * Publish a state change for both protocols.
+ */
+static void sim_publish(Notify_topic topic, Mbim_req_type type, Databuf *msg)
+{
+    cache_invalidate(MB_PROT_QMI, type);
+    notify_publish(topic, MB_PROT_MBIM, type, msg);
+}
+
+/**
+ * Change the simulated state and publish the change, as the indications
+ * of a device.
+ *
+ * @param change Changed value
+ * @param value  New value
+ */
+static void sim_apply(Sim_change change, unsigned int value)
+{
+    Databuf msg = {0};
+
+    if (!databuf_init(&msg))
+        return;
+
+    mb_add_device(&msg, SIM_DEVICE);
+
+    switch (change)
+    {
+    case SIM_SIGNAL:
+        g_state.rssi = value;
+        mb_add_signal_rssi(&msg, value);
+        mb_add_signal_error_rate(&msg, 0);
+        sim_publish(NOTIFY_SIGNAL, MBIM_SIGNAL, &msg);
+        break;
+
+    case SIM_REGISTER:
+        g_state.register_state = value;
+        mb_add_register_state(&msg, value);
+        if (value < G_N_ELEMENTS(g_register_names))
+            mb_add_register_state_str(&msg, g_register_names[value]);
+        sim_publish(NOTIFY_REGISTER, MBIM_REGISTER, &msg);
+        break;
+
+    case SIM_ATTACH:
+        g_state.attached = value != 0;
+        mb_add_attach_pck_service_state(&msg, g_state.attached ? "attached" : "detached");
+        sim_publish(NOTIFY_CONNECT, MBIM_PACKET_SERVICE, &msg);
+        break;
+
+    case SIM_CONNECT:
+        g_state.activation = value;
+        mb_add_state_activation(&msg, value);
+        if (value < G_N_ELEMENTS(g_activation_names))
+            mb_add_state_activation_str(&msg, g_activation_names[value]);
+        mb_add_state_session_id(&msg, 0);
+        sim_publish(NOTIFY_CONNECT, MBIM_STATUS, &msg);
+        break;
+
+    case SIM_PIN:
+        g_state.pin = value;
+        mb_add_pin_status(&msg, value);
+        sim_publish(NOTIFY_SIM, MBIM_PIN_STATUS, &msg);
+        break;
+
+    default:
+        break;
+    }
+
+    databuf_free(&msg);
+}
+
+static void sim_add_subscriber(Mbim_request *request)
+{
+    bool initialized = g_state.pin != MBIM_PIN_LOCK;
+
+    if (request->codes)
+        modem_add_uint(request, MB_SUB_STATE_CODE, initialized ? SIM_SUB_INITIALIZED : SIM_SUB_NOT_INITIALIZED);
+    else
+        modem_add_string(request, MB_SUB_STATE, initialized ? "initialized" : "not-initialized");
+    modem_add_string(request, MB_SUB_ID, "001010123456789");
+    modem_add_string(request, MB_SUB_SIM_ICCD, "89001012012345678901");
+    modem_add_uint(request, MB_SUB_TEL_NB, 1);
+    modem_add_string(request, MB_SUB_TEL_NUM, "+4900000000");
+}
+
+static void sim_add_register(Mbim_request *request)
+{
+    modem_add_uint(request, MB_REGISTER_STATE, g_state.register_state);
+    if (request->codes)
+    {
+        modem_add_uint(request, MB_REGISTER_MODE_CODE, SIM_REGISTER_MODE_AUTOMATIC);
+        modem_add_uint(request, MB_REGISTER_DATA_CLASS_CODE, SIM_DATA_CLASS_LTE);
+    }
+    else
+    {
+        if (g_state.register_state < G_N_ELEMENTS(g_register_names))
+            modem_add_string(request, MB_REGISTER_STATE_STR, g_register_names[g_state.register_state]);
+        modem_add_string(request, MB_REGISTER_MODE, "automatic");
+        modem_add_string(request, MB_REGISTER_DATA_CLASS, "lte");
+    }
+    modem_add_string(request, MB_REGISTER_PROVIDER_ID, "00101");
+    modem_add_string(request, MB_REGISTER_PROVIDER_NAME, "Simulated network");
+}
+
+static void sim_add_attach(Mbim_request *request)
+{
+    if (request->codes)
+        modem_add_uint(request, MB_ATTACH_PCK_SERVICE_STATE_CODE,
+                       g_state.attached ? SIM_PACKET_SERVICE_ATTACHED : SIM_PACKET_SERVICE_DETACHED);
+    else
+        modem_add_string(request, MB_ATTACH_PCK_SERVICE_STATE, g_state.attached ? "attached" : "detached");
+    modem_add_uint64(request, MB_ATTACH_UP_SPEED64, g_state.attached ? 50000000 : 0);
+    modem_add_uint64(request, MB_ATTACH_DOWN_SPEED64, g_state.attached ? 150000000 : 0);
+}
+
+static void sim_add_state(Mbim_request *request)
+{
+    modem_add_uint(request, MB_STATE_ACTIVATION, g_state.activation);
+    if (!request->codes && g_state.activation < G_N_ELEMENTS(g_activation_names))
+        modem_add_string(request, MB_STATE_ACTIVATION_STR, g_activation_names[g_state.activation]);
+    modem_add_uint(request, MB_STATE_SESSION_ID, 0);
+    if (request->codes)
+        modem_add_uint(request, MB_STATE_IP_TYPE_CODE, SIM_IP_TYPE_IPV4);
+    else
+        modem_add_string(request, MB_STATE_IP_TYPE, "ipv4");
+}
+
+static void sim_add_ip(Mbim_request *request)
+{
+    bool connected = g_state.activation == MBIM_ACTIVATION_ACTIVATED;
+
+    modem_add_uint(request, MB_IPV4_NB, connected ? 1 : 0);
+    if (connected)
+    {
+        modem_add_string(request, MB_IPV4_ADDR, "10.0.0.2/30");
+        modem_add_string(request, MB_IPV4_GW, "10.0.0.1");
+    }
+    modem_add_uint(request, MB_IPV6_NB, 0);
+}
+
+static void sim_add_signal(Mbim_request *request)
+{
+    modem_add_uint(request, MB_SIGNAL_RSSI, g_state.rssi);
+    modem_add_uint(request, MB_SIGNAL_ERROR_RATE, 0);
+}
+
+static void sim_add_caps(Mbim_request *request)
+{
+    if (request->codes)
+    {
+        modem_add_uint(request, MB_DEV_TYPE_CODE, SIM_DEVICE_TYPE_REMOTE);
+        modem_add_uint(request, MB_DEV_CELL_CLASS_CODE, SIM_CELLULAR_CLASS_GSM);
+        modem_add_uint(request, MB_DEV_DATA_CLASS_CODE, SIM_DATA_CLASS_LTE);
+    }
+    else
+    {
+        modem_add_string(request, MB_DEV_TYPE, "remote");
+        modem_add_string(request, MB_DEV_CELL_CLASS, "gsm");
+        modem_add_string(request, MB_DEV_DATA_CLASS, "lte");
+    }
+    modem_add_uint(request, MB_DEV_MAX_SESSION, 8);
+    modem_add_string(request, MB_DEV_ID, "000000000000000");
+    modem_add_string(request, MB_DEV_FMW_INFO, "simulator");
+}
+
+/**
+ * Answer a request from the simulated state, the requests changing the
+ * modem state change it. With MB_CODES the libmbim values are sent as
+ * *_CODE, as the MBIM backend does.
+ *
+ * @param request Pointer to the Mbim_request structure
+ */
+static void sim_response(Mbim_request *request)
+{
+    switch (request->type)
+    {
+    case MBIM_PIN_ENTER:
+        if (g_state.pin != MBIM_PIN_UNLOCK)
+            sim_apply(SIM_PIN, MBIM_PIN_UNLOCK);
+        // fall through
+
+    case MBIM_PIN_STATUS:
+        modem_add_uint(request, MB_PIN_STATUS, g_state.pin);
+        break;
+
+    case MBIM_SUBSCRIBER:
+        sim_add_subscriber(request);
+        break;
+
+    case MBIM_REGISTER:
+        sim_add_register(request);
+        break;
+
+    case MBIM_ATTACH:
+        if (!g_state.attached)
+            sim_apply(SIM_ATTACH, 1);
+        sim_add_attach(request);
+        break;
+
+    case MBIM_PACKET_SERVICE:
+        sim_add_register(request);
+        sim_add_attach(request);
+        break;
+
+    case MBIM_CONNECT:
+        if (g_state.activation != MBIM_ACTIVATION_ACTIVATED)
+            sim_apply(SIM_CONNECT, MBIM_ACTIVATION_ACTIVATED);
+        // fall through
+
+    case MBIM_STATUS:
+        sim_add_state(request);
+        break;
+
+    case MBIM_IP:
+        sim_add_ip(request);
+        break;
+
+    case MBIM_DEVICE_CAPS:
+        sim_add_caps(request);
+        break;
+
+    case MBIM_SIGNAL:
+        sim_add_signal(request);
+        break;
+
+    case MBIM_FULL_STATUS:
+        sim_add_subscriber(request);
+        sim_add_register(request);
+        sim_add_attach(request);
+        sim_add_state(request);
+        sim_add_ip(request);
+        sim_add_signal(request);
+        break;
+
+    default:
+        break;
+    }
+
+    mb_add_response(&request->resp, MBIM_OK);
+}
+
+/**
+ * Complete a request once its latency elapsed, or fail it.
+ *
+ * @param data Pointer to the Mbim_request structure
+ *
+ * @return G_SOURCE_REMOVE
+ */
+static gboolean sim_done(gpointer data)
+{
+    Mbim_request *request = data;
+
+    if (g_failure[request->type] > 0 && sim_random() < g_failure[request->type])
+    {
+        mb_add_error(&request->resp, "Simulated failure");
+        mb_add_response(&request->resp, MBIM_ERROR);
+    }
+    else
+        sim_response(request);
+
+    request->done(request);
+
+    return G_SOURCE_REMOVE;
+}
+
+/**
+ * Run a request, the requests overlap as on a device.
+ *
+ * @param request Pointer to the Mbim_request structure
+ */
+static void sim_execute(Mbim_request *request)
+{
+    unsigned int delay;
+    GSource *source;
+
+    if (request->type >= MBIM_UNKOWN)
+    {
+        mb_add_error(&request->resp, "Unsupported request");
+        mb_add_response(&request->resp, MBIM_ERROR);
+        request->done(request);
+        return;
+    }
+
+    delay = sim_delay(request->type);
+    source = delay ? g_timeout_source_new(delay) : g_idle_source_new();
+    g_source_set_callback(source, sim_done, request, NULL);
+    g_source_attach(source, g_main_context_get_thread_default());
+    g_source_unref(source);
+}
+
+static void sim_schedule(void);
+
+/**
+ * Run the next event of the script.
+ *
+ * @param unused Unused
+ *
+ * @return G_SOURCE_REMOVE
+ */
+static gboolean sim_event(gpointer unused)
+{
+    (void) unused;
+
+    g_script = NULL;
+    sim_apply(g_events[g_next_event].change, g_events[g_next_event].value);
+    g_next_event++;
+    sim_schedule();
+
+    return G_SOURCE_REMOVE;
+}
+
+/**
+ * Schedule the next event of the script, from its start.
+ */
+static void sim_schedule(void)
+{
+    gint64 due;
+    gint64 now;
+
+    if (g_next_event == g_nb_events)
+    {
+        if (!g_repeat_ms || !g_nb_events)
+            return;
+
+        g_script_start += (gint64) g_repeat_ms * 1000;
+        g_next_event = 0;
+    }
+
+    due = g_script_start + (gint64) g_events[g_next_event].at_ms * 1000;
+    now = g_get_monotonic_time();
+
+    g_script = g_timeout_source_new(due > now ? (due - now) / 1000 : 0);
+    g_source_set_callback(g_script, sim_event, NULL, NULL);
+    g_source_attach(g_script, g_main_context_get_thread_default());
+    g_source_unref(g_script);
+}
+
+/**
+ * Start from a registered, attached and disconnected modem with its PIN
+ * unlocked.
+ *
+ * @return True
+ */
+static bool sim_open(void)
+{
+    Sim_event event;
+    int i;
+    int j;
+
+    g_state = (Sim_state) {
+        .rssi = 20,
+        .register_state = MBIM_REGISTER_HOME,
+        .attached = true,
+        .activation = MBIM_ACTIVATION_DEACTIVATED,
+        .pin = MBIM_PIN_UNLOCK,
+    };
+    g_random = g_seed;
+
+    // Sorted by time, the events of the same time run in configuration order
+    for (i = 1; i < g_nb_events; i++)
+    {
+        for (j = i; j > 0 && g_events[j - 1].at_ms > g_events[j].at_ms; j--)
+        {
+            event = g_events[j];
+            g_events[j] = g_events[j - 1];
+            g_events[j - 1] = event;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Start the script of state changes.
+ */
+static void sim_subscribe(void)
+{
+    g_script_start = g_get_monotonic_time();
+    g_next_event = 0;
+    sim_schedule();
+}
+
+/**
+ * Stop the script of state changes.
+ */
+static void sim_close(void)
+{
+    if (g_script)
+        g_source_destroy(g_script);
+    g_script = NULL;
+}
+
+const Modem_backend sim_backend = {
+    .name = "sim",
+    .open = sim_open,
+    .execute = sim_execute,
+    .subscribe = sim_subscribe,
+    .close = sim_close,
+};
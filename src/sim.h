@@ -0,0 +1,25 @@
+#ifndef MBIM_NNG_SIM_H
+#define MBIM_NNG_SIM_H
+
+#include <stdbool.h>
+
+#include "mbim.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Events of the script of state changes, see sim_configure()
+#define SIM_MAX_EVENTS 64
+
+bool sim_configure(const char *path);
+bool sim_configure_line(const char *line);
+
+// Simulated modem, answers both protocols without any device
+extern const Modem_backend sim_backend;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // MBIM_NNG_SIM_H
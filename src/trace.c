@@ -0,0 +1,574 @@
+/**
+ * @file
+ * @brief Trace of the modem backends, records the requests and the
+ *        notifications with their timing in a binary file and replays them
+ *        as a backend, with the original or a scaled timing
+ * @ccmod{MBIM_X_MMG}
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include "trace.h"
+#include "modem.h"
+
+// Larger data buffers are a corrupted trace
+#define TRACE_MAX_DATA (1 << 20)
+
+typedef enum
+{
+    TRACE_REQUEST = 0,
+    TRACE_NOTIFICATION,
+    TRACE_KIND_UNKNOWN
+} Trace_kind;
+
+// Record of the trace file, in host byte order, followed by its data
+// buffer in the compact encoding
+typedef struct trace_header
+{
+    uint64_t time_us;    // From the start of the recording
+    uint32_t latency_us; // Of the request on the backend, 0 for a notification
+    uint32_t len;        // Of the data buffer
+    uint8_t kind;        // Trace_kind
+    uint8_t proto;       // Mbim_protocol
+    uint8_t type;        // Mbim_req_type
+    uint8_t topic;       // Notify_topic of a notification
+    uint8_t reserved[4];
+} Trace_header;
+
+typedef struct trace_entry
+{
+    Trace_header header;
+    Databuf data; // Compact until replay_open() expands it
+} Trace_entry;
+
+// Request waiting for the latency of its entry
+typedef struct replay_call
+{
+    Mbim_request *request;
+    const Trace_entry *entry;
+} Replay_call;
+
+// Recording
+static FILE *g_file;
+static gint64 g_start;
+
+// Replay
+static Trace_entry *g_entries;
+static size_t g_nb_entries;
+static double g_scale = 1;
+static gint64 g_period_us; // Length of the trace, the notifications repeat with it
+static size_t *g_requests[MB_PROT_UNKOWN][MBIM_UNKOWN];
+static size_t g_nb_requests[MB_PROT_UNKOWN][MBIM_UNKOWN];
+static size_t g_next_request[MB_PROT_UNKOWN][MBIM_UNKOWN];
+static size_t *g_notifications;
+static size_t g_nb_notifications;
+static size_t g_next_notification;
+static GSource *g_script;
+static gint64 g_script_start;
+
+/**
+ * Write a record to the trace, the recording stops on error.
+ *
+ * @param header Pointer to the record, its length is set
+ * @param data   Pointer to the data buffer of the record
+ */
+static void trace_write(Trace_header *header, const Databuf *data)
+{
+    Databuf copy = {0};
+
+    if (!databuf_init(&copy))
+        return;
+
+    databuf_merge(&copy, data, NULL, 0);
+    if (databuf_compact(&copy))
+    {
+        header->len = copy.len;
+        if (fwrite(header, sizeof(*header), 1, g_file) != 1 || fwrite(copy.buf, copy.len, 1, g_file) != 1)
+        {
+            printf("Trace : Unable to write the trace, recording stopped\n");
+            fclose(g_file);
+            g_file = NULL;
+        }
+    }
+
+    databuf_free(&copy);
+}
+
+/**
+ * Record a completed request, then complete it.
+ *
+ * @param request Pointer to the Mbim_request structure
+ */
+static void trace_request_done(Mbim_request *request)
+{
+    Trace_header header = {0};
+    gint64 now = g_get_monotonic_time();
+
+    request->done = request->trace_done;
+
+    if (g_file)
+    {
+        header.time_us = request->trace_start - g_start;
+        header.latency_us = now - request->trace_start > UINT32_MAX ? UINT32_MAX : now - request->trace_start;
+        header.kind = TRACE_REQUEST;
+        header.proto = request->proto;
+        header.type = request->type;
+        trace_write(&header, &request->resp);
+    }
+
+    request->done(request);
+}
+
+/**
+ * Record the requests and notifications of the backends to a file, before
+ * modem_start().
+ *
+ * @param path Path of the trace file, truncated
+ *
+ * @return True on success, otherwise false
+ */
+bool trace_record(const char *path)
+{
+    uint32_t file_header[2] = {TRACE_MAGIC, TRACE_VERSION};
+
+    g_file = fopen(path, "wb");
+    if (!g_file)
+    {
+        printf("Trace : Unable to create %s\n", path);
+        return false;
+    }
+
+    if (fwrite(file_header, sizeof(file_header), 1, g_file) != 1)
+    {
+        printf("Trace : Unable to write %s\n", path);
+        fclose(g_file);
+        g_file = NULL;
+        return false;
+    }
+
+    g_start = g_get_monotonic_time();
+
+    return true;
+}
+
+/**
+ * Record a request run on a backend, its completion is intercepted. Does
+ * nothing unless recording, runs on the modem thread.
+ *
+ * @param request Pointer to the Mbim_request structure
+ */
+void trace_request(Mbim_request *request)
+{
+    if (!g_file)
+        return;
+
+    request->trace_start = g_get_monotonic_time();
+    request->trace_done = request->done;
+    request->done = trace_request_done;
+}
+
+/**
+ * Record a notification of a backend, before its header variables are
+ * added. Does nothing unless recording, runs on the modem thread.
+ *
+ * @param topic Notification topic
+ * @param proto Protocol of the backend
+ * @param type  Request type whose result changed
+ * @param msg   Pointer to the variables of the notification
+ */
+void trace_notification(Notify_topic topic, Mbim_protocol proto, Mbim_req_type type, const Databuf *msg)
+{
+    Trace_header header = {0};
+
+    if (!g_file)
+        return;
+
+    header.time_us = g_get_monotonic_time() - g_start;
+    header.kind = TRACE_NOTIFICATION;
+    header.proto = proto;
+    header.type = type;
+    header.topic = topic;
+    trace_write(&header, msg);
+}
+
+/**
+ * Add an entry index to a list, its capacity doubles.
+ *
+ * @return True on success, otherwise false
+ */
+static bool trace_list_add(size_t **list, size_t *nb, size_t index)
+{
+    size_t *grown;
+
+    // Full when nb is a power of two
+    if ((*nb & (*nb - 1)) == 0)
+    {
+        grown = realloc(*list, (*nb ? *nb * 2 : 1) * sizeof(**list));
+        if (!grown)
+            return false;
+        *list = grown;
+    }
+
+    (*list)[(*nb)++] = index;
+
+    return true;
+}
+
+/**
+ * Check a record read from a trace file.
+ *
+ * @return True if the record is valid, otherwise false
+ */
+static bool trace_check(const Trace_header *header)
+{
+    if (header->kind >= TRACE_KIND_UNKNOWN || header->proto >= MB_PROT_UNKOWN || header->type >= MBIM_UNKOWN ||
+        header->len < 4 || header->len > TRACE_MAX_DATA)
+        return false;
+
+    return header->kind != TRACE_NOTIFICATION || header->topic < NOTIFY_UNKOWN;
+}
+
+/**
+ * Read a trace file to be served by replay_backend, before modem_start().
+ *
+ * @param path  Path of the trace file
+ * @param scale Factor of the recorded timing, 1 for the original one, 0 to
+ *              answer at once
+ *
+ * @return True on success, otherwise false
+ */
+bool trace_replay(const char *path, double scale)
+{
+    uint32_t file_header[2];
+    Trace_header header;
+    Trace_entry *entries;
+    Trace_entry *entry;
+    unsigned char *data;
+    size_t max_entries = 0;
+    bool ok = true;
+    FILE *file;
+    gint64 end;
+
+    if (scale < 0)
+    {
+        printf("Trace : Invalid scale %g\n", scale);
+        return false;
+    }
+
+    file = fopen(path, "rb");
+    if (!file)
+    {
+        printf("Trace : Unable to open %s\n", path);
+        return false;
+    }
+
+    if (fread(file_header, sizeof(file_header), 1, file) != 1 || file_header[0] != TRACE_MAGIC ||
+        file_header[1] != TRACE_VERSION)
+    {
+        printf("Trace : %s is not a trace of version %d\n", path, TRACE_VERSION);
+        fclose(file);
+        return false;
+    }
+
+    while (ok && fread(&header, sizeof(header), 1, file) == 1)
+    {
+        if (!trace_check(&header))
+        {
+            printf("Trace : Invalid record %zu in %s\n", g_nb_entries, path);
+            ok = false;
+            break;
+        }
+
+        if (g_nb_entries == max_entries)
+        {
+            entries = realloc(g_entries, (max_entries * 2 + 256) * sizeof(*g_entries));
+            if (!entries)
+            {
+                ok = false;
+                break;
+            }
+
+            g_entries = entries;
+            max_entries = max_entries * 2 + 256;
+        }
+
+        data = malloc(header.len);
+        if (!data)
+        {
+            ok = false;
+            break;
+        }
+
+        if (fread(data, header.len, 1, file) != 1)
+        {
+            printf("Trace : Truncated record %zu in %s\n", g_nb_entries, path);
+            free(data);
+            ok = false;
+            break;
+        }
+
+        entry = &g_entries[g_nb_entries];
+        memset(entry, 0, sizeof(*entry));
+        entry->header = header;
+        databuf_set_buf(&entry->data, data, header.len);
+
+        if (header.kind == TRACE_REQUEST)
+            ok = trace_list_add(&g_requests[header.proto][header.type], &g_nb_requests[header.proto][header.type],
+                                g_nb_entries);
+        else
+            ok = trace_list_add(&g_notifications, &g_nb_notifications, g_nb_entries);
+
+        end = header.time_us + header.latency_us;
+        if (end > g_period_us)
+            g_period_us = end;
+
+        g_nb_entries++;
+    }
+
+    fclose(file);
+
+    if (!ok)
+    {
+        trace_stop();
+        return false;
+    }
+
+    g_scale = scale;
+    printf("Trace : %zu records of %.3f s from %s\n", g_nb_entries, g_period_us / 1e6, path);
+
+    return true;
+}
+
+/**
+ * Stop the recording and free the replayed trace, after modem_stop().
+ */
+void trace_stop(void)
+{
+    size_t i;
+    int proto;
+    int type;
+
+    if (g_file)
+        fclose(g_file);
+    g_file = NULL;
+
+    for (i = 0; i < g_nb_entries; i++)
+        databuf_free(&g_entries[i].data);
+    free(g_entries);
+    g_entries = NULL;
+    g_nb_entries = 0;
+
+    for (proto = 0; proto < MB_PROT_UNKOWN; proto++)
+    {
+        for (type = 0; type < MBIM_UNKOWN; type++)
+        {
+            free(g_requests[proto][type]);
+            g_requests[proto][type] = NULL;
+            g_nb_requests[proto][type] = 0;
+        }
+    }
+
+    free(g_notifications);
+    g_notifications = NULL;
+    g_nb_notifications = 0;
+    g_period_us = 0;
+}
+
+/**
+ * Next recorded response of a request, those of the other protocol if its
+ * own protocol has none. The responses of a type are served in trace order,
+ * from the start again once all are served.
+ *
+ * @return Pointer to the entry, NULL if the trace has none
+ */
+static const Trace_entry *replay_next(const Mbim_request *request)
+{
+    Mbim_req_type type = request->type;
+    size_t index;
+    int proto = request->proto;
+
+    if (type >= MBIM_UNKOWN)
+        return NULL;
+
+    if (proto >= MB_PROT_UNKOWN || !g_nb_requests[proto][type])
+    {
+        for (proto = 0; proto < MB_PROT_UNKOWN && !g_nb_requests[proto][type]; proto++)
+            ;
+
+        if (proto == MB_PROT_UNKOWN)
+            return NULL;
+    }
+
+    index = g_next_request[proto][type]++ % g_nb_requests[proto][type];
+
+    return &g_entries[g_requests[proto][type][index]];
+}
+
+/**
+ * Complete a request with its recorded response once its latency elapsed,
+ * the variables the request does not want are left out.
+ *
+ * @param data Pointer to the Replay_call structure
+ *
+ * @return G_SOURCE_REMOVE
+ */
+static gboolean replay_done(gpointer data)
+{
+    Replay_call *call = data;
+    Mbim_request *request = call->request;
+    Databuf_iter iter;
+
+    databuf_iter_init(&iter, &call->entry->data);
+    while (databuf_iter_next(&iter))
+    {
+        if (iter.var == MB_RESPONSE || iter.var == MB_ERROR || modem_wants(request, iter.var))
+            databuf_put(&request->resp, iter.var, iter.value, iter.len);
+    }
+
+    request->done(request);
+
+    return G_SOURCE_REMOVE;
+}
+
+/**
+ * Run a request, the requests overlap as on the recorded device.
+ *
+ * @param request Pointer to the Mbim_request structure
+ */
+static void replay_execute(Mbim_request *request)
+{
+    const Trace_entry *entry = replay_next(request);
+    unsigned int delay;
+    Replay_call *call;
+    GSource *source;
+
+    if (!entry)
+    {
+        mb_add_error(&request->resp, "Not in the trace");
+        mb_add_response(&request->resp, MBIM_ERROR);
+        request->done(request);
+        return;
+    }
+
+    call = g_new(Replay_call, 1);
+    call->request = request;
+    call->entry = entry;
+
+    delay = (unsigned int) (entry->header.latency_us * g_scale / 1000 + 0.5);
+    source = delay ? g_timeout_source_new(delay) : g_idle_source_new();
+    g_source_set_callback(source, replay_done, call, g_free);
+    g_source_attach(source, g_main_context_get_thread_default());
+    g_source_unref(source);
+}
+
+static void replay_schedule(void);
+
+/**
+ * Publish the next notification of the trace.
+ *
+ * @param unused Unused
+ *
+ * @return G_SOURCE_REMOVE
+ */
+static gboolean replay_notify(gpointer unused)
+{
+    const Trace_entry *entry = &g_entries[g_notifications[g_next_notification]];
+    Databuf msg = {0};
+
+    (void) unused;
+
+    g_script = NULL;
+    g_next_notification++;
+
+    if (databuf_init(&msg))
+    {
+        databuf_merge(&msg, &entry->data, NULL, 0);
+        notify_publish(entry->header.topic, entry->header.proto, entry->header.type, &msg);
+        databuf_free(&msg);
+    }
+
+    replay_schedule();
+
+    return G_SOURCE_REMOVE;
+}
+
+/**
+ * Schedule the next notification of the trace, from the start of the replay.
+ */
+static void replay_schedule(void)
+{
+    gint64 period = g_period_us * g_scale;
+    gint64 due;
+    gint64 now;
+
+    if (g_next_notification == g_nb_notifications)
+    {
+        // A trace replayed without timing would repeat at once
+        if (!g_nb_notifications || period < 1000)
+            return;
+
+        g_script_start += period;
+        g_next_notification = 0;
+    }
+
+    due = g_script_start + (gint64) (g_entries[g_notifications[g_next_notification]].header.time_us * g_scale);
+    now = g_get_monotonic_time();
+
+    g_script = g_timeout_source_new(due > now ? (due - now) / 1000 : 0);
+    g_source_set_callback(g_script, replay_notify, NULL, NULL);
+    g_source_attach(g_script, g_main_context_get_thread_default());
+    g_source_unref(g_script);
+}
+
+/**
+ * Expand the recorded data buffers, the lookups need the normal encoding.
+ *
+ * @return True on success, otherwise false
+ */
+static bool replay_open(void)
+{
+    size_t i;
+
+    for (i = 0; i < g_nb_entries; i++)
+    {
+        if (!databuf_expand(&g_entries[i].data) || !databuf_is_valid(&g_entries[i].data))
+        {
+            printf("Trace : Invalid data buffer of record %zu\n", i);
+            return false;
+        }
+    }
+
+    memset(g_next_request, 0, sizeof(g_next_request));
+
+    return g_nb_entries > 0;
+}
+
+/**
+ * Start the notifications of the trace.
+ */
+static void replay_subscribe(void)
+{
+    g_script_start = g_get_monotonic_time();
+    g_next_notification = 0;
+    replay_schedule();
+}
+
+/**
+ * Stop the notifications of the trace.
+ */
+static void replay_close(void)
+{
+    if (g_script)
+        g_source_destroy(g_script);
+    g_script = NULL;
+}
+
+const Modem_backend replay_backend = {
+    .name = "replay",
+    .open = replay_open,
+    .execute = replay_execute,
+    .subscribe = replay_subscribe,
+    .close = replay_close,
+};
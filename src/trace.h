@@ -0,0 +1,30 @@
+#ifndef MBIM_NNG_TRACE_H
+#define MBIM_NNG_TRACE_H
+
+#include <stdbool.h>
+
+#include "mbim.h"
+#include "notify.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Header of a trace file, "MBTR" then the version
+#define TRACE_MAGIC 0x5254424d
+#define TRACE_VERSION 1
+
+bool trace_record(const char *path);
+void trace_stop(void);
+void trace_request(Mbim_request *request);
+void trace_notification(Notify_topic topic, Mbim_protocol proto, Mbim_req_type type, const Databuf *msg);
+bool trace_replay(const char *path, double scale);
+
+// Serves the responses and notifications of a trace, see trace_replay()
+extern const Modem_backend replay_backend;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // MBIM_NNG_TRACE_H